@@ -1,14 +1,14 @@
 #!/bin/sh
 
-for i in `ls *.vgm`; do
-    echo "Converting $i"
-    ./vgm2wav $i `basename $i .vgm`.wav 0
-done
-
-for i in `ls *.nsf`; do
-    echo "Converting $i"
-    for j in 0 1 2 3 4 5 6 7 8 9; do
-        echo "-- track $j"
-        ./vgm2wav $i `basename $i .nsf`-$j.wav $j
-    done
+# Converts all vgm, vgz and nsf files (all tracks) in current directory
+# using all cpu cores
+# Patterns without matches are passed by sh as is, so they are skipped
+set --
+for file in *.vgm *.vgz *.nsf; do
+    [ -f "$file" ] && set -- "$@" "$file"
 done
+if [ $# -eq 0 ]; then
+    echo "No vgm, vgz or nsf files in current directory"
+    exit 0
+fi
+./vgm2wav --batch . "$@"
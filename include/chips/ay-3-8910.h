@@ -26,6 +26,7 @@ SOFTWARE.
 
 #include <stdint.h>
 #include <stdlib.h>
+#include "vgm_config.h"
 
 enum
 {
@@ -44,6 +45,53 @@ enum
     CHIP_TYPE_YM2610B = 0x23,
 };
 
+/**
+ * State of tone channels A, B, C stored as structure of arrays, so it can be
+ * processed by SIMD kernels. Lane 3 is not used by the chip and keeps zero period.
+ */
+typedef struct
+{
+    /** Channel A/B/C frequency counter */
+    uint32_t counter[4];
+    /** period value for sound channels: A, B, C. */
+    uint32_t period[4];
+    /** Channel A/B/C output: 0x00000000 or 0xFFFFFFFF */
+    uint32_t output[4];
+    /** Volume value for sound channel. */
+    uint32_t amplitude[4];
+    /** 0xFFFFFFFF if channel is in envelope mode, 0x00000000 if in period mode */
+    uint32_t useEnvelope[4];
+    /** 0xFFFFFFFF if tone is enabled for the channel by mixer register */
+    uint32_t toneEnable[4];
+    /** 0xFFFFFFFF if noise is enabled for the channel by mixer register */
+    uint32_t noiseEnable[4];
+} AY38910Channels;
+
+/** Dynamic state of the chip, see AY38910::saveState() */
+typedef struct
+{
+    AY38910Channels tone;
+    uint32_t rng;
+    uint32_t periodNoise;
+    uint32_t periodE;
+    uint32_t counterNoise;
+    uint32_t counterEnv;
+    uint8_t mixer;
+    uint8_t ampR[3];
+    uint8_t envelopeReg;
+    uint8_t envVolume;
+    bool holding;
+    bool hold;
+    bool attack;
+    bool continueFlag;
+    bool alternate;
+    bool noiseRecalc;
+    bool noiseHigh;
+} AY38910Snapshot;
+
+/** Number of chips, which AY38910Lanes kernel advances together */
+#define AY38910_LANES 8
+
 class AY38910
 {
 public:
@@ -76,6 +124,36 @@ public:
     /** Returns left (16 bits) and right (16 bits) channels if next sound sample */
     uint32_t getSample();
 
+    /**
+     * Renders specified number of samples to outBuffer.
+     * Each sample has the same format as returned by getSample().
+     * Only samples, where tone, noise or envelope counters change the output, are
+     * emulated. Constant spans between them are filled at once, the result is
+     * exactly the same as getSample() output.
+     */
+    void renderBlock(uint32_t *outBuffer, int samples);
+
+    /**
+     * Advances chip state by specified number of samples without mixing output.
+     * Chip state is exactly the same as after rendering the samples.
+     */
+    void skip(uint32_t samples) { skipSamples( samples ); }
+
+    /**
+     * Returns true if output level can't change until the registers are written:
+     * each channel is either muted by mixer, or has zero volume, fixed or held by envelope.
+     */
+    bool isSilent() const;
+
+    /**
+     * Saves dynamic chip state (registers, counters, generators). Chip configuration
+     * (type, frequencies, volume) is not saved, and must be the same for loadState().
+     */
+    void saveState(AY38910Snapshot &state) const;
+
+    /** Restores chip state, saved by saveState() */
+    void loadState(const AY38910Snapshot &state);
+
     /** Set chip clock external frequency */
     void setFrequency( uint32_t frequency );
 
@@ -94,10 +172,18 @@ public:
     /** Changes volume level. Default level is 100! */
     void setVolume(uint16_t volume);
 
+    /**
+     * Allows to use SIMD kernels (SSE2, NEON) if they are supported by cpu.
+     * Scalar kernel is used if SIMD is disabled or not available. Enabled by default.
+     */
+    static void enableSimd(bool enable);
+
     /** TODO: */
     //void setStereoMode(uint8_t mode);
 
 private:
+    friend class AY38910Lanes;
+
     /** Chip Type. */
     uint8_t m_chipType = 0;
 
@@ -118,18 +204,12 @@ private:
 
     uint32_t m_envFrequencyScale = 0;
 
-    /** period value for sound channels: A, B, C. */
-    uint32_t m_period[3]{};
-
     /** Period value for noise. */
     uint32_t m_periodNoise = 0;
 
     /** Mixer register. */
     uint8_t m_mixer = 0x00;
 
-    /** Volume value for sound channel. */
-    uint8_t m_amplitude[3]{};
-
     uint8_t m_ampR[3]{};
 
     /** Period value for envelope. */
@@ -152,14 +232,8 @@ private:
 
     uint8_t m_envStepMask = 0x0F;
 
-    /** Indicates whether a particular channel is in envelope or period mode. */
-    bool m_useEnvelope[3]{};
-
-    /** Channel A/B/C frequency counter */
-    uint32_t m_counter[3]{};
-
-    /** Turn channel A/B/C on/off */
-    bool m_channelOutput[3]{};
+    /** Tone channels A/B/C state */
+    alignas(16) AY38910Channels m_tone{};
 
     /** Noise frequency counter */
     uint32_t m_counterNoise = 0;
@@ -173,14 +247,138 @@ private:
     /** Envelope tick counter */
     uint8_t m_envVolume = 0;
 
-    /** volume level table for the chip */
-    uint16_t m_levelTable[32];
+    /** Constant volume level table for the chip type */
+    const uint16_t *m_levelTable = nullptr;
 
     /** user volume level */
     uint16_t m_userVolume = 100;
 
-    /** Recalculates volume tables */
+    /** Gain for user volume level, 16.16 fixed point */
+    uint32_t m_gain = 65536;
+
+    /** Selects volume table for chip type, and calculates gain for user volume */
     void calcVolumeTables();
+
+    /** Recalculates counter increments for current chip and sample frequencies */
+    void calcFrequencyScales();
+
+    /** Kernel used to render samples, when output changes on every sample */
+    static void (AY38910::*s_denseKernel)(uint32_t *outBuffer, int samples);
+
+    void stepNoise();
+    void stepEnvelope();
+    void updateNoiseAndEnvelope();
+    uint32_t mixLevels(const uint32_t *index);
+    uint32_t mixChannels();
+
+    void renderDenseScalar(uint32_t *outBuffer, int samples);
+    void renderDenseSse2(uint32_t *outBuffer, int samples);
+    void renderDenseNeon(uint32_t *outBuffer, int samples);
+
+    /** Returns number of next samples, which have the same output level */
+    uint32_t constantSpan(uint32_t maxSamples);
+
+    /** Advances chip state by specified number of samples without mixing */
+    void skipSamples(uint32_t samples);
+};
+
+/**
+ * Renders several independent chips at once, for example chips of different streams
+ * of VgmStreamEngine. Each chip skips constant spans on its own, as renderBlock() does.
+ * While output of the chips changes on every sample, their tone, noise and envelope
+ * counters are kept as structure of arrays across AY38910_LANES chips, and are advanced
+ * together by SIMD kernel. Output of every chip is exactly the same as renderBlock() one.
+ *
+ * Each chip is rendered by own lane: setLane() gives the lane output buffer, and render()
+ * runs all lanes until some of them fill their buffers. Such lanes can get the next buffer,
+ * while others keep their state in the kernel.
+ */
+class AY38910Lanes
+{
+public:
+    /**
+     * Renders samples[i] samples of chips[i] to outBuffers[i] for count chips.
+     * Each sample has the same format as returned by AY38910::getSample().
+     */
+    static void render(AY38910 *const *chips, uint32_t *const *outBuffers, const uint32_t *samples, int count);
+
+    /**
+     * Sets chip of the lane, which renders specified number of samples to outBuffer.
+     * The lane must be idle: it is not set yet, or render() has reported it.
+     * The chip must not be changed, until render() reports the lane.
+     */
+    void setLane(int lane, AY38910 *chip, uint32_t *outBuffer, uint32_t samples);
+
+    /**
+     * Renders all lanes until some of them fill their output buffers, and returns bit
+     * mask of such lanes, which become idle. Returns 0 if all lanes are idle.
+     */
+    uint32_t render();
+
+private:
+    friend class AY38910;
+
+    AY38910 *m_chips[AY38910_LANES]{};
+    uint32_t *m_outBuffers[AY38910_LANES]{};
+    /** Samples, which the lane must render yet */
+    uint32_t m_left[AY38910_LANES]{};
+    /** Samples, which the lane renders by the kernel before searching for the next constant span */
+    uint32_t m_dense[AY38910_LANES]{};
+    /** Number of lanes up to the last one, which has been set */
+    int m_count = 0;
+    /** Samples, rendered by the kernel, dense runs of all lanes end at the same ticks */
+    uint32_t m_tick = 0;
+    /** Slot of the kernel, which renders the lane in a dense run */
+    int m_slots[AY38910_LANES]{};
+    AY38910 *m_slotChips[AY38910_LANES]{};
+
+    /**
+     * Channel A/B/C rows of AY38910Channels fields, one column per slot. Each slot keeps
+     * state of the chip of some lane in a dense run.
+     */
+    alignas(16) uint32_t m_counter[3][AY38910_LANES]{};
+    alignas(16) uint32_t m_period[3][AY38910_LANES]{};
+    alignas(16) uint32_t m_output[3][AY38910_LANES]{};
+    /** Levels of channel amplitudes, looked up in level table of the chip */
+    alignas(16) uint32_t m_ampLevel[3][AY38910_LANES]{};
+    alignas(16) uint32_t m_useEnvelope[3][AY38910_LANES]{};
+    alignas(16) uint32_t m_toneEnable[3][AY38910_LANES]{};
+    alignas(16) uint32_t m_noiseEnable[3][AY38910_LANES]{};
+    alignas(16) uint32_t m_toneIncrement[AY38910_LANES]{};
+    alignas(16) uint32_t m_counterNoise[AY38910_LANES]{};
+    alignas(16) uint32_t m_periodNoise[AY38910_LANES]{};
+    alignas(16) uint32_t m_rng[AY38910_LANES]{};
+    /** 0xFFFFFFFF if m_noiseRecalc of the chip is set */
+    alignas(16) uint32_t m_noiseRecalc[AY38910_LANES]{};
+    /** 0xFFFFFFFF if noise output is high */
+    alignas(16) uint32_t m_noise[AY38910_LANES]{};
+    alignas(16) uint32_t m_counterEnv[AY38910_LANES]{};
+    alignas(16) uint32_t m_periodE[AY38910_LANES]{};
+    /** Envelope counter increment, 0 if envelope is held */
+    alignas(16) uint32_t m_envIncrement[AY38910_LANES]{};
+    alignas(16) uint32_t m_envVolume[AY38910_LANES]{};
+    alignas(16) uint32_t m_envLevel[AY38910_LANES]{};
+    /** 1 if envelope attacks, 0xFFFFFFFF if it decays */
+    alignas(16) uint32_t m_envDirection[AY38910_LANES]{};
+    alignas(16) uint32_t m_envStepMask[AY38910_LANES]{};
+    alignas(16) uint32_t m_gain[AY38910_LANES]{};
+    const uint16_t *m_levelTable[AY38910_LANES]{};
+    /** 0xFFFFFFFF for slots, emulated sample by sample by the kernel */
+    alignas(16) uint32_t m_active[AY38910_LANES]{};
+    /** 0xFFFFFFFF for active slots with running envelope */
+    alignas(16) uint32_t m_envActive[AY38910_LANES]{};
+
+    /** Kernel used to render samples of active chips */
+    static void (AY38910Lanes::*s_kernel)(AY38910 *const *chips, uint32_t *const *outBuffers,
+                                          int count, uint32_t samples);
+
+    static void enableSimd(bool enable);
+
+    void load(int slot, const AY38910 &chip);
+    void store(int slot, AY38910 &chip);
+
+    template <class Ops>
+    void renderDense(AY38910 *const *chips, uint32_t *const *outBuffers, int count, uint32_t samples);
 };
 
 
@@ -31,34 +31,45 @@ SOFTWARE.
 
 #define APU_MAX_REG   (0x20)
 
+/** Channel state, fields are ordered by size to avoid padding */
 typedef struct
 {
-    uint16_t lenCounter;
-    uint16_t linearCounter;
-    bool linearReloadFlag;
-
     uint32_t period;
     uint32_t counter;
+    uint32_t output;
+    uint32_t dmcAddr;
+    uint32_t dmcLen;
+
+    uint16_t lenCounter;
+    uint16_t linearCounter;
 
     uint8_t decayCounter;
     uint8_t divider;
-    bool updateEnvelope;
     uint8_t envVolume;
-
     uint8_t sequencer;
-
     uint8_t volume;
-    uint32_t output;
-
     uint8_t sweepCounter;
+    uint8_t dmcBuffer;
 
+    bool linearReloadFlag;
+    bool updateEnvelope;
     bool dmcActive;
-    uint32_t dmcAddr;
-    uint32_t dmcLen;
-    uint8_t dmcBuffer;
-    bool    dmcIrqFlag;
+    bool dmcIrqFlag;
 } ChannelInfo;
 
+/** Dynamic state of NES APU, see NesApu::saveState() */
+typedef struct
+{
+    ChannelInfo chan[5];
+    uint8_t regs[APU_MAX_REG];
+    uint32_t lastFrameCounter;
+    uint16_t shiftNoise;
+    uint8_t apuFrames;
+    bool quaterSignal;
+    bool halfSignal;
+    bool fullSignal;
+} NesApuSnapshot;
+
 class NesCpu;
 
 class NesApu
@@ -75,14 +86,59 @@ public:
     uint8_t read(uint16_t reg);
 
     /**
-     * Returns next sample at 44100 frequency rate. Each call to getSample()
-     * simulates ~ 40.5 nes cpu ticks (1789773 Hz / 44100 Hz).
+     * Returns next sample at specified sample frequency (44100 Hz by default).
+     * Each call to getSample() simulates ~ 40.5 nes cpu ticks (1789773 Hz / 44100 Hz).
      */
     uint32_t getSample();
 
+    /**
+     * Renders specified number of samples to outBuffer.
+     * Each sample has the same format as returned by getSample().
+     * Samples between frame counter ticks are rendered by spans: each channel is advanced
+     * separately, and disabled or silent channels are not emulated per sample. The result
+     * is exactly the same as getSample() output.
+     */
+    void renderBlock(uint32_t *outBuffer, int samples);
+
+    /** Advances APU state by specified number of samples without mixing output */
+    void skip(uint32_t samples);
+
+    /**
+     * Returns true if no channel can change output level until the registers are written,
+     * i.e. APU produces silence (constant level).
+     */
+    bool isSilent() const;
+
     /** Sets volume, default volume is 100 */
     void setVolume(uint16_t volume);
 
+    /** Sets sample frequency, default frequency is 44100 Hz */
+    void setSampleFrequency(uint32_t frequency);
+
+    /** Returns currently set sample frequency */
+    uint32_t getSampleFrequency() const { return m_sampleFrequency; }
+
+    /**
+     * Saves dynamic APU state (registers, channels, frame counter). APU configuration
+     * (sample frequency, volume) is not saved, and must be the same for loadState().
+     */
+    void saveState(NesApuSnapshot &state) const;
+
+    /** Restores APU state, saved by saveState() */
+    void loadState(const NesApuSnapshot &state);
+
+    /** Returns number of register writes since resetWriteStats() */
+    uint32_t getWriteCount() const { return m_writeCount; }
+
+    /** Returns bit mask of registers (0x00 - 0x3F), written since resetWriteStats() */
+    uint64_t getWrittenRegisters() const { return m_writtenRegisters; }
+
+    /** Clears register write counters */
+    void resetWriteStats() { m_writeCount = 0; m_writtenRegisters = 0; }
+
+    /** Adds APU registers to the hash, see nesStateHash() */
+    uint64_t getStateHash(uint64_t hash) const { return nesStateHash( hash, m_regs, APU_MAX_REG ); }
+
     /** Resets nes apu state */
     void reset();
 
@@ -93,11 +149,10 @@ private:
     NesCpu *m_cpu = nullptr;
 
     uint8_t m_regs[APU_MAX_REG]{};
-    uint32_t m_rectVolTable[16]{};
-    uint32_t m_triVolTable[16]{};
-    uint32_t m_noiseVolTable[16]{};
-    uint32_t m_dmcVolTable[16]{};
 
+    uint32_t m_sampleFrequency = 44100;
+    /** Nes cpu ticks (fixed point) in one audio sample */
+    uint32_t m_counterScaler = 0;
     uint32_t m_lastFrameCounter = 0;
     uint8_t m_apuFrames = 0;
     uint16_t m_shiftNoise;
@@ -105,12 +160,33 @@ private:
     bool m_halfSignal = false;
     bool m_fullSignal = false;
     uint16_t m_volume = 100;
+    /** Gain for user volume level, 16.16 fixed point */
+    uint32_t m_gain = 65536;
     ChannelInfo m_chan[5]{};
+    uint32_t m_writeCount = 0;
+    uint64_t m_writtenRegisters = 0;
 
     // APU Processing
+    void updateChannels();
     void updateRectChannel(int i);
     void updateTriangleChannel(ChannelInfo &info);
     void updateNoiseChannel(ChannelInfo &chan);
     void updateDmcChannel(ChannelInfo &info);
+    bool fetchDmcByte(ChannelInfo &info);
     void updateFrameCounter();
+    void stepNoise();
+
+    /** Returns number of next samples (up to maxSamples), which have no frame counter tick */
+    int getFrameCounterSpan(int maxSamples) const;
+
+    /**
+     * Advances channels by samples without frame counter ticks, and mixes output if
+     * outBuffer is not nullptr. Span functions add channel output to mix buffer and return 0,
+     * or return channel level, if it is constant during the span (or mix is nullptr).
+     */
+    void renderSpan(uint32_t *outBuffer, int samples);
+    uint32_t spanRectChannel(int i, uint32_t *mix, int samples);
+    uint32_t spanTriangleChannel(ChannelInfo &chan, uint32_t *mix, int samples);
+    uint32_t spanNoiseChannel(ChannelInfo &chan, uint32_t *mix, int samples);
+    uint32_t spanDmcChannel(ChannelInfo &chan, uint32_t *mix, int samples);
 };
@@ -1,6 +1,27 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
+
+/** Initial value for nesStateHash() */
+#define NES_STATE_HASH_SEED 0xCBF29CE484222325ULL
+
+/**
+ * Adds data to 64-bit FNV-1a hash, calculated over 8-byte words. It is used to compare
+ * emulator states, so it should be fast rather than strong.
+ */
+static inline uint64_t nesStateHash(uint64_t hash, const void *data, uint32_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>( data );
+    for ( ; size >= 8; size -= 8, bytes += 8 )
+    {
+        uint64_t word;
+        memcpy( &word, bytes, 8 );
+        hash = ( hash ^ word ) * 0x100000001B3ULL;
+    }
+    while ( size-- ) hash = ( hash ^ *bytes++ ) * 0x100000001B3ULL;
+    return hash;
+}
 
 typedef struct
 {
@@ -22,4 +43,41 @@ public:
     virtual void reset() = 0;
 
     virtual void power() = 0;
+
+    /** Returns size of cartridge state in bytes, 0 if cartridge has no state */
+    virtual uint32_t getStateSize() const { return 0; }
+
+    /** Saves cartridge state to buffer of getStateSize() bytes */
+    virtual void saveState(uint8_t *state) const {}
+
+    /** Restores cartridge state, saved by saveState() */
+    virtual void loadState(const uint8_t *state) {}
+
+    /**
+     * Adds the part of cartridge state, which affects code execution (banks, RAM),
+     * to the hash, see nesStateHash().
+     */
+    virtual uint64_t getStateHash(uint64_t hash) const { return hash; }
+
+    /**
+     * Returns pointer to 256-byte memory page at address (aligned to page), which can be
+     * read directly, or nullptr if the page must be accessed via read().
+     */
+    virtual const uint8_t *getReadPage(uint16_t address) { return nullptr; }
+
+    /**
+     * Returns pointer to 256-byte memory page at address (aligned to page), which can be
+     * written directly, or nullptr if the page must be accessed via write().
+     */
+    virtual uint8_t *getWritePage(uint16_t address) { return nullptr; }
+
+    /** Returns number, which changes each time pages, returned by getReadPage()/getWritePage(), change */
+    uint32_t getMapRevision() const { return m_mapRevision; }
+
+protected:
+    /** Must be called by cartridge, when memory mapping is changed */
+    void mapChanged() { m_mapRevision++; }
+
+private:
+    uint32_t m_mapRevision = 0;
 };
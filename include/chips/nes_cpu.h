@@ -26,6 +26,7 @@ SOFTWARE.
 
 #include "nes_cartridge.h"
 #include "nes_apu.h"
+#include "vgm_config.h"
 
 #include <stdint.h>
 #include <string>
@@ -38,12 +39,23 @@ typedef struct
     uint8_t y;
     uint8_t flags;
     uint8_t sp;
-
-    uint16_t absAddr;
-    uint16_t relAddr;
-    bool implied;
 } NesCpuState;
 
+#define NES_CPU_RAM_SIZE 2048
+
+/** Size of memory page in cpu memory map */
+#define NES_CPU_PAGE_SIZE 256
+
+/** Fixed part of NES CPU state, cartridge state follows it, see NesCpu::saveState() */
+typedef struct
+{
+    NesCpuState cpu;
+    NesApuSnapshot apu;
+    uint8_t stopSp;
+    bool ramValid;
+    uint8_t ram[NES_CPU_RAM_SIZE];
+} NesCpuSnapshot;
+
 class NesCpu
 {
 public:
@@ -90,9 +102,9 @@ public:
 
     /**
      * Associates Nes CPU with cartridge.
-     * cartridge object will be deleted by NesApu.
+     * cartridge object will be deleted by NesCpu, if owned is true.
      */
-    void insertCartridge( NesCartridge *cartridge );
+    void insertCartridge( NesCartridge *cartridge, bool owned = true );
 
     /**
      * Returns pointer to currently associated cartridge
@@ -106,22 +118,51 @@ public:
 
     NesCpuState &cpuState();
 
-private:
-    struct Instruction
-    {
-        Instruction(void (NesCpu::* &&a)(void), void (NesCpu::* &&b)(void)): opcode(a), addrmode(b) {}
-        void (NesCpu::*opcode)  (void) = nullptr;
-        void (NesCpu::*addrmode)(void) = nullptr;
-    };
+    /** Returns size of full state of cpu, apu and inserted cartridge in bytes */
+    uint32_t getStateSize() const;
+
+    /** Saves cpu, apu and cartridge state to buffer of getStateSize() bytes */
+    void saveState(uint8_t *state) const;
+
+    /** Restores state, saved by saveState(). The same cartridge must be inserted */
+    void loadState(const uint8_t *state);
 
+    /**
+     * Returns hash of cpu registers, RAM, APU registers and cartridge state. If hashes
+     * after two subroutine calls are equal, the code continues exactly the same way.
+     * Program counter is not included, since it is the same after each completed call.
+     */
+    uint64_t getStateHash() const;
+
+private:
     NesApu m_apu;
     NesCpuState m_cpu{};
     uint8_t m_stopSp;
     // Nes cpu RAM
     uint8_t *m_ram = nullptr;
+#if VGM_DECODER_SINGLE_CHIP
+    /** RAM is part of the object in single chip build, m_ram points to it once RAM is used */
+    uint8_t m_ramStorage[NES_CPU_RAM_SIZE];
+#endif
     NesCartridge *m_cartridge = nullptr;
+    bool m_ownCartridge = true;
 
-    static const NesCpu::Instruction commands[256];
+    bool allocRam();
+
+#if !VGM_DECODER_COMPACT
+    /**
+     * Memory map of 256-byte pages, which can be accessed directly. nullptr pages (APU,
+     * cartridge registers, not allocated memory) are accessed via readTrap()/writeTrap().
+     */
+    const uint8_t *m_readPages[0x10000 / NES_CPU_PAGE_SIZE]{};
+    uint8_t *m_writePages[0x10000 / NES_CPU_PAGE_SIZE]{};
+#endif
+    /** Cartridge map revision, the memory map was built for */
+    uint32_t m_mapRevision = 0;
+
+    void mapPages();
+    uint8_t readTrap(uint16_t address);
+    bool writeTrap(uint16_t address, uint8_t data);
 
     // APU Processing
     void updateRectChannel(int i);
@@ -130,71 +171,74 @@ private:
     void updateDmcChannel(ChannelInfo &info);
     void updateFrameCounter();
 
-    // RAM/ROM Access
-    void IMD();
-    void ZP();
-    void ZPX();
-    void ZPY();
-    void REL();
-    void ABS();
-    void ABX();
-    void ABY();
-    void IND();
-    void IDX();
-    void IDY();
-    void UND() { m_cpu.implied = true; };
+    // RAM/ROM Access, each addressing mode returns operand address
+    uint16_t IMD();
+    uint16_t ZP();
+    uint16_t ZPX();
+    uint16_t ZPY();
+    uint16_t REL();
+    uint16_t ABS();
+    uint16_t ABX();
+    uint16_t ABY();
+    uint16_t IND();
+    uint16_t IDX();
+    uint16_t IDY();
     uint8_t fetch() { return read( m_cpu.pc++ ); }
     uint8_t readInternal(uint16_t address);
 
     // CPU Core
     // opcodes
-    void BPL();
-    void ADC();
-    void SBC();
+    void branch(bool condition);
+    void ADC(uint16_t addr);
+    void SBC(uint16_t addr);
     void TAX();
     void TAY();
     void TXA();
     void TYA();
     void INY();
-    void LDA();
+    void LDA(uint16_t addr);
     void ASL();
+    void ASL(uint16_t addr);
     void CLC();
-    void BIT();
-    void JMP();
-    void JSR();
-    void STA();
-    void STX();
-    void STY();
-    void LDX();
-    void LDY();
-    void BEQ();
-    void BNE();
-    void BMI();
-    void BCC();
-    void BCS();
-    void CMP();
-    void CPY();
-    void CPX();
+    void BIT(uint16_t addr);
+    void JMP(uint16_t addr);
+    void JSR(uint16_t addr);
+    void STA(uint16_t addr);
+    void STX(uint16_t addr);
+    void STY(uint16_t addr);
+    void LDX(uint16_t addr);
+    void LDY(uint16_t addr);
+    void CMP(uint16_t addr);
+    void CPY(uint16_t addr);
+    void CPX(uint16_t addr);
     void RTS();
-    void DEC();
-    void INC();
+    void DEC(uint16_t addr);
+    void INC(uint16_t addr);
     void DEX();
     void DEY();
     void INX();
-    void AND();
-    void ORA();
-    void EOR();
+    void AND(uint16_t addr);
+    void ORA(uint16_t addr);
+    void EOR(uint16_t addr);
     void NOP();
     void LSR();
+    void LSR(uint16_t addr);
     void ROR();
+    void ROR(uint16_t addr);
     void ROL();
+    void ROL(uint16_t addr);
     void PHA();
     void PLA();
     void SEC();
     void BRK();
 
-    std::string getOpCode(const Instruction & instruction, uint16_t data);
+    uint8_t shiftLeft(uint8_t data);
+    uint8_t shiftRight(uint8_t data);
+    uint8_t rotateLeft(uint8_t data);
+    uint8_t rotateRight(uint8_t data);
+
+    std::string getOpCode(uint8_t code, uint16_t data);
     void modifyFlags(uint8_t data);
-    void printCpuState( const Instruction & instruction, uint16_t pc );
+    void printCpuState( uint16_t pc );
 
 };
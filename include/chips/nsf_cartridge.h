@@ -27,6 +27,21 @@ SOFTWARE.
 #include "nes_cartridge.h"
 
 #define APU_MAX_MEMORY_BLOCKS (4)
+#define BBRAM_SIZE 0x2000
+
+/**
+ * State of NSF cartridge. Memory blocks refer to the data, registered with
+ * setDataBlock(), so the state is valid only while that data exists.
+ */
+typedef struct
+{
+    NesMemoryBlock mem[APU_MAX_MEMORY_BLOCKS];
+    uint8_t bank[8];
+    bool bankingEnabled;
+    bool bbRamValid;
+    uint16_t mapper031BaseAddress;
+    uint8_t bbRam[BBRAM_SIZE];
+} NsfCartridgeSnapshot;
 
 class NsfCartridge: public NesCartridge
 {
@@ -42,6 +57,18 @@ public:
 
     void power() override;
 
+    uint32_t getStateSize() const override { return sizeof(NsfCartridgeSnapshot); }
+
+    void saveState(uint8_t *state) const override;
+
+    void loadState(const uint8_t *state) override;
+
+    uint64_t getStateHash(uint64_t hash) const override;
+
+    const uint8_t *getReadPage(uint16_t address) override;
+
+    uint8_t *getWritePage(uint16_t address) override;
+
     /**
      * Registers new data memory blockю
      * @param data pointer to VGM data block (first 2 bytes is length).
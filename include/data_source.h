@@ -0,0 +1,147 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Source of NSF/VGM data for decoders. Data can be either resident in memory,
+ * or read on demand, so decoding can start right after the header is read.
+ */
+class DataSource
+{
+public:
+    DataSource() = default;
+    virtual ~DataSource() = default;
+
+    DataSource(const DataSource &) = delete;
+    DataSource &operator=(const DataSource &) = delete;
+
+    /** Returns size of data in bytes */
+    virtual uint32_t getSize() const = 0;
+
+    /**
+     * Returns pointer to the whole data if it is resident in memory, or nullptr.
+     * Decoders use the data directly instead of copying it, if it is available.
+     */
+    virtual const uint8_t *getData() { return nullptr; }
+
+    /**
+     * Returns pointer to size bytes at specified offset. If less than size bytes left,
+     * returns pointer to the rest of data. Returns nullptr if offset is out of data.
+     * The pointer remains valid until the next call to fetch() or read().
+     */
+    virtual const uint8_t *fetch(uint32_t offset, uint32_t size) = 0;
+
+    /** Copies size bytes at offset to buffer and returns number of copied bytes */
+    virtual uint32_t read(uint32_t offset, void *buffer, uint32_t size) = 0;
+
+    /**
+     * Hints the source, that data at offset will be accessed again after reading
+     * data beyond it (for example, loop point of the melody). Sources, which cannot
+     * seek back cheaply, can save their state at this offset.
+     */
+    virtual void addCheckpoint(uint32_t offset) {}
+};
+
+/** Data, which is already resident in memory. Data is not copied and not freed */
+class MemoryDataSource: public DataSource
+{
+public:
+    MemoryDataSource() = default;
+    MemoryDataSource(const uint8_t *data, uint32_t size): m_data( data ), m_size( size ) {}
+
+    /** Sets new memory data */
+    void setData(const uint8_t *data, uint32_t size) { m_data = data; m_size = size; }
+
+    uint32_t getSize() const override { return m_size; }
+
+    const uint8_t *getData() override { return m_data; }
+
+    const uint8_t *fetch(uint32_t offset, uint32_t size) override;
+
+    uint32_t read(uint32_t offset, void *buffer, uint32_t size) override;
+
+private:
+    const uint8_t *m_data = nullptr;
+    uint32_t m_size = 0;
+};
+
+/**
+ * File, mapped to memory. Uses mmap() on platforms supporting it, and reads the whole
+ * file to memory on other platforms.
+ */
+class MappedFileDataSource: public MemoryDataSource
+{
+public:
+    MappedFileDataSource() = default;
+    ~MappedFileDataSource();
+
+    /** Opens file, returns false if file cannot be opened or mapped */
+    bool open(const char *name);
+
+    /** Unmaps the file */
+    void close();
+
+private:
+    uint8_t *m_mapped = nullptr;
+    uint32_t m_mappedSize = 0;
+};
+
+/**
+ * File, read on demand through small read-ahead window. Memory use is bounded by
+ * the window size, so it is suitable for files on SD card or SPI flash. Random
+ * access out of the window causes reading of new window from the file.
+ */
+class FileDataSource: public DataSource
+{
+public:
+    /** Creates source with specified window size. Window can not be less than 256 bytes */
+    explicit FileDataSource(uint32_t windowSize = 4096);
+    ~FileDataSource();
+
+    /** Opens file, returns false if file cannot be opened */
+    bool open(const char *name);
+
+    /** Closes the file */
+    void close();
+
+    uint32_t getSize() const override { return m_size; }
+
+    const uint8_t *fetch(uint32_t offset, uint32_t size) override;
+
+    uint32_t read(uint32_t offset, void *buffer, uint32_t size) override;
+
+private:
+    FILE *m_file = nullptr;
+    uint32_t m_size = 0;
+    uint8_t *m_window = nullptr;
+    uint32_t m_windowSize = 0;
+    /** File offset of the first byte in the window */
+    uint32_t m_windowOffset = 0;
+    /** Number of valid bytes in the window */
+    uint32_t m_windowLength = 0;
+};
@@ -0,0 +1,186 @@
+/*
+MIT License
+
+Copyright (c) 2020 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "music_decoder.h"
+#include "data_source.h"
+#include "formats/nsf_format.h"
+#include "chips/nes_cpu.h"
+#include "chips/nsf_cartridge.h"
+
+class NsfMusicDecoder final: public BaseMusicDecoder
+{
+public:
+    NsfMusicDecoder();
+    ~NsfMusicDecoder();
+
+    /** Allows to open NSF data blocks */
+    bool open(const uint8_t *data, int size) override;
+
+    /**
+     * Opens NSF data from the source. NSF code is accessed randomly, so if the
+     * source data is not resident in memory, it is copied to memory on open.
+     */
+    bool open(DataSource *source) override;
+
+    /**
+     * Tries to open NSF data. If storage is not null, decoder is constructed there
+     * instead of heap, and must be destroyed without delete.
+     */
+    static NsfMusicDecoder *tryOpen(const uint8_t *data, int size, void *storage = nullptr);
+
+    static NsfMusicDecoder *tryOpen(DataSource *source, void *storage = nullptr);
+
+    /** Closes NSF data */
+    void close();
+
+    uint32_t getSample() override;
+
+    void renderBlock(uint32_t *outBuffer, int samples) override;
+
+    void skipBlock(int samples) override;
+
+    uint32_t getStateSize() override;
+
+    bool saveState(uint8_t *state) override;
+
+    bool loadState(const uint8_t *state) override;
+
+    /** Sets sampling frequency. Must be called before decodeBlock */
+    bool setSampleFrequency( uint32_t frequency ) override;
+
+    /** Sets volume, default level is 64 */
+    void setVolume(uint16_t volume) override;
+
+    /** Returns number of tracks in opened file */
+    int getTrackCount() override;
+
+    /**
+     * Sets track to play. Machine state after open() is restored at once, and only
+     * init routine of the track is executed, see setTrackPrefetch().
+     */
+    bool setTrack(int track) override;
+
+    /**
+     * Enables preparing previous and next tracks in background thread after each track
+     * change. Switching to prepared track restores machine state after its init routine,
+     * so it doesn't execute any code. Disabled by default.
+     */
+    void setTrackPrefetch(bool enable) override;
+
+    /**
+     * Enables hashing of cpu, RAM and APU registers state after each play call. If the
+     * state repeats, the track loops. Track stops after 3 seconds of APU silence.
+     */
+    void setLoopDetection(bool enable) override;
+
+    uint32_t getLoopLength() override { return m_loopLength; }
+
+    /**
+     * Runs play routine and advances APU without mixing samples, until the loop or
+     * silence is detected, see setLoopDetection(). Register writes of init routine
+     * are not counted.
+     */
+    bool analyze(int track, uint32_t maxSamples, VgmTrackInfo &info) override;
+
+    /**
+     * Decodes data block and returns number of samples to read from decoder.
+     * If it returns -1, then error occured, 0 means - nothing left.
+     */
+    int decodeBlock() override;
+
+    /** Limits number of cpu instructions, executed by single decodeBlock() call */
+    void setBlockBudget(uint32_t budget) override { m_blockBudget = budget; }
+
+private:
+    NesCpu m_nesChip{};
+#if VGM_DECODER_SINGLE_CHIP
+    /** Storage for the cartridge of m_nesChip, constructed by open() */
+    alignas(NsfCartridge) uint8_t m_cartridgeStorage[sizeof(NsfCartridge)];
+#endif
+    uint32_t m_waitSamples;
+    uint32_t m_sampleFrequency = 44100;
+
+    MemoryDataSource m_memorySource;
+    /** Copy of NSF code, if source data is not resident in memory */
+    uint8_t * m_romCopy = nullptr;
+    const uint8_t *m_rom = nullptr;
+    uint32_t m_romSize = 0;
+
+    /** Machine state after power up and memory setup, before init routine of any track */
+    std::vector<uint8_t> m_cleanImage;
+
+    typedef struct
+    {
+        int track;
+        /** Machine state after init routine of the track */
+        std::vector<uint8_t> state;
+    } TrackImage;
+
+    /** Images of current, previous and next tracks, if prefetch is enabled */
+    TrackImage m_trackImages[3];
+    bool m_prefetch = false;
+    std::thread m_prefetchThread;
+    std::atomic<bool> m_prefetchStop{ false };
+
+    NsfHeader m_headerData{};
+    const NsfHeader *m_nsfHeader = nullptr;
+
+    /** Maximum number of instructions per decodeBlock() call, 0 if not limited */
+    uint32_t m_blockBudget = 0;
+    /** Instructions left for play routine, which is not completed yet, or 0 */
+    uint32_t m_playRemaining = 0;
+
+    bool m_loopDetection = false;
+    /** Play call index for each state hash */
+    std::unordered_map<uint64_t, uint32_t> m_frameHashes;
+    /** Number of play calls since the track start */
+    uint32_t m_frame = 0;
+    uint32_t m_silentFrames = 0;
+    /** Detected loop length in samples */
+    uint32_t m_loopLength = 0;
+
+    void resetLoopDetection();
+    bool detectLoop();
+
+    /** Resets the chip and fills memory and registers, as required before init routine */
+    void setupMachine(NesCpu &chip);
+    /** Prepares the chip for the track and executes init routine */
+    bool initTrack(NesCpu &chip, int track);
+    TrackImage *findImage(int track);
+    /** Saves chip state to the image, not used by current, previous and next tracks */
+    void saveImage(NesCpu &chip, int track, int current);
+    void prefetchTracks(int track);
+    void stopPrefetch();
+    void clearImages();
+};
+
+
+
@@ -0,0 +1,118 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+enum
+{
+    VGM_EVENT_NONE = 0x00,
+    VGM_EVENT_AY8910 = 0x01,
+    VGM_EVENT_NES_APU = 0x02,
+    VGM_EVENT_END = 0xFF,
+};
+
+/** Compiled vgm command: chip register write followed by the wait */
+typedef struct
+{
+    /** Number of samples (44100 Hz) to wait after register write */
+    uint32_t wait;
+    /** Chip to write register to, one of VGM_EVENT_* */
+    uint8_t chip;
+    uint8_t reg;
+    uint8_t value;
+} VgmEvent;
+
+/** Location of vgm data block in source vgm data */
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+} VgmDataBlockInfo;
+
+/**
+ * Vgm command stream, compiled to the array of register writes for supported chips.
+ * Commands for unsupported chips are removed, sequential waits are merged, and loop
+ * point is converted to event index. Compiled stream is never changed after compilation,
+ * so single stream can be shared between several players of the same vgm data.
+ */
+class VgmCommandStream
+{
+public:
+    /**
+     * Compiles vgm data. Vgm data must remain valid while the stream is used.
+     * Returns nullptr if data is not valid vgm data. Returned object must be
+     * deleted by the caller.
+     */
+    static VgmCommandStream *compile(const uint8_t *data, int size);
+
+    /** Returns pointer to source vgm data */
+    const uint8_t *getData() const { return m_data; }
+
+    /** Returns size of source vgm data */
+    int getSize() const { return m_size; }
+
+    /** Returns compiled events, the last event is always VGM_EVENT_END */
+    const VgmEvent *getEvents() const { return m_events.data(); }
+
+    /** Returns number of compiled events */
+    uint32_t getEventCount() const { return m_events.size(); }
+
+    /** Returns true if the stream has loop point */
+    bool hasLoop() const { return m_loopIndex != UINT32_MAX; }
+
+    /** Returns index of the event to continue from at the end of stream */
+    uint32_t getLoopIndex() const { return m_loopIndex; }
+
+    /** Returns NES APU data blocks found in vgm data */
+    const std::vector<VgmDataBlockInfo> &getDataBlocks() const { return m_dataBlocks; }
+
+    /** Adds register write event */
+    void addWrite(uint8_t chip, uint8_t reg, uint8_t value);
+
+    /** Adds wait samples to the last event */
+    void addWait(uint32_t samples);
+
+    /** Marks the next event as loop start */
+    void markLoop();
+
+    /** Adds NES APU data block */
+    void addDataBlock(uint32_t offset, uint32_t size);
+
+    /** Completes the stream with VGM_EVENT_END */
+    void end();
+
+private:
+    friend class VgmMusicDecoder;
+
+    VgmCommandStream(const uint8_t *data, int size);
+
+    const uint8_t *m_data = nullptr;
+    int m_size = 0;
+    uint32_t m_loopIndex = UINT32_MAX;
+    std::vector<VgmEvent> m_events;
+    std::vector<VgmDataBlockInfo> m_dataBlocks;
+};
@@ -0,0 +1,100 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+class DataSource;
+
+/** Data block (0x67 command), found in vgm data */
+typedef struct
+{
+    /** Offset of block data in source vgm data */
+    uint32_t offset;
+    uint32_t size;
+    /** Offset of the block in its bank: all blocks of the same type, following each other */
+    uint32_t bankOffset;
+    /** Data block type, see vgm specification */
+    uint8_t type;
+    /** Block data in memory, or nullptr until the block is loaded */
+    const uint8_t *data;
+    /** True if the data is copy of the block, made by the registry */
+    bool owned;
+} VgmDataBlock;
+
+/**
+ * Index of vgm data blocks by type and position in the bank. Blocks of resident data
+ * point to the source data directly, and are indexed once, when data is opened. Data,
+ * read on demand, is indexed as blocks are parsed, and only blocks, which are actually
+ * used, are copied to memory.
+ */
+class VgmDataBanks
+{
+public:
+    VgmDataBanks() = default;
+    ~VgmDataBanks();
+
+    VgmDataBanks(const VgmDataBanks &) = delete;
+    VgmDataBanks &operator=(const VgmDataBanks &) = delete;
+
+    /** Removes all blocks and frees copied data */
+    void clear();
+
+    /**
+     * Indexes all data blocks of resident vgm data, starting with vgm command at offset.
+     * Does nothing if source data is not resident in memory.
+     */
+    void scan(DataSource *source, uint32_t offset);
+
+    /** Adds data block, located at offset of the source, if it is not indexed yet */
+    void add(DataSource *source, uint8_t type, uint32_t offset, uint32_t size);
+
+    /**
+     * Returns data of the block at offset of the source, copying it to memory if the
+     * source is not resident. Returns nullptr if the block is not indexed, or cannot be read.
+     */
+    const uint8_t *getData(DataSource *source, uint32_t offset);
+
+    /** Loads all blocks of the bank to memory, returns false if some block cannot be read */
+    bool loadBank(DataSource *source, uint8_t type);
+
+    /** Returns total size of the blocks of given type */
+    uint32_t getBankSize(uint8_t type) const;
+
+    /** Returns block with specified index in the bank, or nullptr */
+    const VgmDataBlock *getBlock(uint8_t type, uint32_t index) const;
+
+    /** Returns block, containing specified position of the bank, or nullptr */
+    const VgmDataBlock *findBlock(uint8_t type, uint32_t position) const;
+
+    /** Returns number of indexed blocks */
+    uint32_t getBlockCount() const { return m_blocks.size(); }
+
+private:
+    std::vector<VgmDataBlock> m_blocks;
+
+    bool load(DataSource *source, VgmDataBlock &block);
+};
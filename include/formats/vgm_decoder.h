@@ -0,0 +1,251 @@
+/*
+MIT License
+
+Copyright (c) 2020 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "music_decoder.h"
+#include "data_source.h"
+#include "formats/vgm_command_stream.h"
+#include "formats/vgm_data_banks.h"
+#include "formats/vgm_format.h"
+#include "chips/ay-3-8910.h"
+#include "chips/nes_cpu.h"
+#include "chips/nsf_cartridge.h"
+
+/** Vgm file are always based on 44.1kHz rate */
+#define VGM_SAMPLE_RATE 44100
+
+/** AY-3-8910 emulator is member of the decoder, when it is the only chip in the build */
+#define VGM_DECODER_EMBEDDED_AY38910 ( VGM_DECODER_AY38910 && !VGM_DECODER_NES )
+
+/** NES cpu and its cartridge are members of the decoder, when NES is the only chip in the build */
+#define VGM_DECODER_EMBEDDED_NES ( VGM_DECODER_NES && !VGM_DECODER_AY38910 )
+
+/** Maximum number of DAC streams (0x90-0x95 commands), controlled at once */
+#define VGM_DAC_STREAM_COUNT ( VGM_DECODER_COMPACT ? 2 : 8 )
+
+/** State of DAC stream, which writes data bank bytes to chip register at stream frequency */
+typedef struct
+{
+    /** Stream id, 0xFF if the slot is free */
+    uint8_t id;
+    /** Chip to write to, one of VGM_EVENT_*, VGM_EVENT_NONE for not supported chips */
+    uint8_t chip;
+    uint8_t reg;
+    /** Data bank, the same as data block type */
+    uint8_t bank;
+    /** Bank bytes to pass after each write */
+    uint8_t stepSize;
+    /** Offset, added to the start position of the stream */
+    uint8_t stepBase;
+    bool loop;
+    bool reverse;
+    bool playing;
+    /** Stream frequency, writes per second */
+    uint32_t frequency;
+    /** Bank position of the first write */
+    uint32_t start;
+    /** Number of writes done since the start, and total number of writes */
+    uint32_t writeIndex;
+    uint32_t writeCount;
+    /** Samples till the next write, and samples between writes, 16.16 fixed point */
+    uint32_t phase;
+    uint32_t period;
+} VgmDacStream;
+
+class VgmMusicDecoder final: public BaseMusicDecoder
+{
+public:
+    VgmMusicDecoder();
+    ~VgmMusicDecoder();
+
+    /** Allows to open NSF and VGM data blocks */
+    bool open(const uint8_t *data, int size) override;
+
+    /**
+     * Opens vgm data from the source. Only the header is read on open, and
+     * commands are read from the source while decoding.
+     */
+    bool open(DataSource *source) override;
+
+    /**
+     * Opens vgm data, using command stream compiled earlier. The stream can be shared
+     * between several decoders and must remain valid until the decoder is closed.
+     */
+    bool open(const VgmCommandStream *stream);
+
+    /**
+     * Tries to open vgm data. If precompile is true, vgm commands are compiled
+     * to VgmCommandStream once, and decoder plays the compiled events.
+     * If storage is not null, decoder is constructed there instead of heap, storage
+     * must fit VgmMusicDecoder, and the decoder must be destroyed without delete.
+     */
+    static VgmMusicDecoder *tryOpen(const uint8_t *data, int size, bool precompile = false,
+                                    void *storage = nullptr);
+
+    /**
+     * Tries to open vgm data from the source. Precompiling is possible only
+     * if the source data is resident in memory. See above for storage.
+     */
+    static VgmMusicDecoder *tryOpen(DataSource *source, bool precompile = false, void *storage = nullptr);
+
+    /** Compiles vgm data to command stream, returns nullptr if data is not valid */
+    static VgmCommandStream *compile(const uint8_t *data, int size);
+
+    /** Closes either VGM or NSF data */
+    void close();
+
+    uint32_t getSample() override;
+
+    void renderBlock(uint32_t *outBuffer, int samples) override;
+
+    void skipBlock(int samples) override;
+
+    AY38910 *renderLaneBlock(int samples) override;
+
+    uint32_t getStateSize() override;
+
+    bool saveState(uint8_t *state) override;
+
+    bool loadState(const uint8_t *state) override;
+
+    /** Sets volume, default level is 64 */
+    void setVolume(uint16_t volume) override;
+
+    /** Sets sampling frequency. Must be called before decodeBlock */
+    bool setSampleFrequency( uint32_t frequency ) override;
+
+    /**
+     * Enables trimming of trailing silence: if chips are silent, and only wait commands
+     * are left till the end of data, decodeBlock() returns 0 instead of the waits.
+     * Vgm data have loop information, so loops are not detected.
+     */
+    void setLoopDetection(bool enable) override { m_trimSilence = enable; }
+
+    /**
+     * Decodes data block and returns number of samples to read from decoder.
+     * If it returns -1, then error occured, 0 means - nothing left.
+     * DAC streams are not part of the block: they write chip registers, while
+     * the block samples are rendered.
+     */
+    int decodeBlock() override;
+
+    /** Limits number of commands, parsed by single decodeBlock() call */
+    void setBlockBudget(uint32_t budget) override { m_blockBudget = budget; }
+
+    /**
+     * Parses vgm commands till the end of data or maxSamples, without writing them
+     * to the chips. Separate parser is used, so decoder keeps its position.
+     */
+    bool analyze(int track, uint32_t maxSamples, VgmTrackInfo &info) override;
+
+private:
+#if VGM_DECODER_AY38910
+    AY38910 *m_msxChip = nullptr;
+#endif
+#if VGM_DECODER_NES
+    NesCpu  *m_nesChip = nullptr;
+#endif
+#if VGM_DECODER_EMBEDDED_AY38910
+    AY38910 m_msxStorage;
+#endif
+#if VGM_DECODER_EMBEDDED_NES
+    /** Storage for m_nesChip and its cartridge, objects are constructed only for NES vgm files */
+    alignas(NesCpu) uint8_t m_nesStorage[sizeof(NesCpu)];
+    alignas(NsfCartridge) uint8_t m_nesCartridgeStorage[sizeof(NsfCartridge)];
+#endif
+
+    DataSource *m_source = nullptr;
+    MemoryDataSource m_memorySource;
+    uint32_t m_size = 0;
+    int m_headerSize = 0;
+
+    /** Offset of the next vgm command */
+    uint32_t m_dataOffset = 0;
+
+    VgmHeader m_headerData{};
+    const VgmHeader *m_header = nullptr;
+
+    /** Data blocks of vgm data, used by NES APU and DAC streams */
+    VgmDataBanks m_banks;
+
+    VgmDacStream m_dacStreams[VGM_DAC_STREAM_COUNT]{};
+    /** True if at least one DAC stream writes to the chip */
+    bool m_dacPlaying = false;
+    /** Data of the bank block, which is being played by each DAC stream */
+    const VgmDataBlock *m_dacBlocks[VGM_DAC_STREAM_COUNT]{};
+    /** DAC streams are used, so vgm data cannot be compiled to events */
+    bool m_dacUsed = false;
+    /** Position in YM2612 PCM bank, set by 0xE0 and advanced by 0x8n commands */
+    uint32_t m_pcmPosition = 0;
+    /** Bank block, containing m_pcmPosition, or nullptr until it is looked up */
+    const VgmDataBlock *m_pcmBlock = nullptr;
+
+    uint32_t m_rate;
+    uint32_t m_vgmDataOffset;
+    uint32_t m_loopOffset;
+    uint8_t  m_loops;
+    uint32_t m_waitSamples = 0;
+    uint32_t m_samplesPlayed = 0;
+    uint32_t m_sampleFrequency = VGM_SAMPLE_RATE;
+    /** Fractional part of wait samples, when sample frequency differs from 44100 Hz */
+    uint32_t m_waitRemainder = 0;
+
+    uint8_t m_state = 0;
+    bool m_trimSilence = false;
+    /** Data range, which is known to contain wait commands, followed by other command */
+    uint32_t m_waitScanStart = 0;
+    uint32_t m_waitScanEnd = 0;
+
+    /** Compiled command stream being played, or nullptr to parse raw vgm data */
+    const VgmCommandStream *m_stream = nullptr;
+    /** Compiled command stream, owned by the decoder */
+    VgmCommandStream *m_ownStream = nullptr;
+    /** Index of the next compiled event to play */
+    uint32_t m_eventIndex = 0;
+    /** Stream to record chips writes to, while compiling vgm data */
+    VgmCommandStream *m_recorder = nullptr;
+    /** Track information to count chips writes in, while analyzing vgm data */
+    VgmTrackInfo *m_info = nullptr;
+    /** Maximum number of commands per decodeBlock() call, 0 if not limited */
+    uint32_t m_blockBudget = 0;
+
+    bool nextCommand();
+    bool nextEvent();
+    bool isSilent() const;
+    bool isTrailingWait();
+    void writeRegister(uint8_t chip, uint8_t reg, uint8_t value);
+    void setDataBlock(uint32_t offset, uint32_t size);
+    void controlDacStream(const uint8_t *data);
+    void startDacStream(VgmDacStream &stream, uint32_t start, uint32_t count);
+    void writeDacStream(int index);
+    void updateDacStreams();
+    void resetDacStreams();
+    void playDacStreams(uint32_t *outBuffer, int samples);
+    void renderChips(uint32_t *outBuffer, int samples);
+    void skipChips(int samples);
+    void deleteChips();
+};
@@ -0,0 +1,90 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "data_source.h"
+
+/*
+    Gzip support requires zlib and is compiled in only if VGM_DECODER_ZLIB
+    is defined to 1.
+*/
+#ifndef VGM_DECODER_ZLIB
+#define VGM_DECODER_ZLIB 0
+#endif
+
+#if VGM_DECODER_ZLIB
+
+typedef struct GzipDataSourceState GzipDataSourceState;
+
+/**
+ * Gzip compressed data (for example, vgz files), inflated on demand to small sliding
+ * window. Only forward access is cheap: seeking back restarts inflating either from
+ * the nearest checkpoint (see addCheckpoint()), or from the beginning of data.
+ */
+class GzipDataSource: public DataSource
+{
+public:
+    /** Creates source with specified window size. Window can not be less than 256 bytes */
+    explicit GzipDataSource(uint32_t windowSize = 4096);
+    ~GzipDataSource();
+
+    /** Returns true if data starts with gzip signature */
+    static bool isGzip(DataSource *source);
+
+    /**
+     * Opens compressed data. Compressed source must remain valid until
+     * GzipDataSource is closed. Returns false if data is not gzip data.
+     */
+    bool open(DataSource *compressed);
+
+    /** Closes the source */
+    void close();
+
+    /** Returns size of inflated data, stored in gzip trailer */
+    uint32_t getSize() const override { return m_size; }
+
+    const uint8_t *fetch(uint32_t offset, uint32_t size) override;
+
+    uint32_t read(uint32_t offset, void *buffer, uint32_t size) override;
+
+    /** Saves inflate state, when inflated data reaches the offset. Only one checkpoint is kept */
+    void addCheckpoint(uint32_t offset) override;
+
+private:
+    DataSource *m_compressed = nullptr;
+    GzipDataSourceState *m_state = nullptr;
+    uint32_t m_size = 0;
+    uint8_t *m_window = nullptr;
+    uint32_t m_windowSize = 0;
+    /** Inflated data offset of the first byte in the window */
+    uint32_t m_windowOffset = 0;
+    /** Number of valid bytes in the window */
+    uint32_t m_windowLength = 0;
+
+    bool rewind(uint32_t offset);
+    bool inflateTo(uint8_t *buffer, uint32_t size);
+};
+
+#endif
@@ -26,6 +26,39 @@ SOFTWARE.
 
 #include <stdint.h>
 
+class DataSource;
+class AY38910;
+
+/** decodeBlock() result, if the block is not completed within the budget, see setBlockBudget() */
+#define VGM_BLOCK_PENDING (-2)
+
+/** Chips, reported by track analysis, see VgmTrackInfo */
+enum
+{
+    VGM_CHIP_AY8910 = 0,
+    VGM_CHIP_NES_APU = 1,
+    VGM_CHIP_COUNT = 2,
+};
+
+/** Track information, collected without rendering samples, see BaseMusicDecoder::analyze() */
+typedef struct
+{
+    /** Duration at 44100 Hz, if the track loops, it includes the first pass of the loop */
+    uint32_t totalSamples;
+    /** Loop length at 44100 Hz, 0 if the track doesn't loop */
+    uint32_t loopSamples;
+    /** Number of register writes during totalSamples */
+    uint32_t registerWrites;
+    /** Maximum number of register writes per second, measured over 1/60 second intervals */
+    uint32_t peakWriteRate;
+    /** Bit mask of chips with register writes, bit number is VGM_CHIP_* */
+    uint32_t chips;
+    /** Bit masks of written registers for each chip, bit number is register number (up to 63) */
+    uint64_t registers[VGM_CHIP_COUNT];
+    /** False if the end of the track is not found within maximum duration */
+    bool complete;
+} VgmTrackInfo;
+
 class BaseMusicDecoder
 {
 public:
@@ -35,16 +68,92 @@ public:
     /** Allows to open NSF and VGM data blocks */
     virtual bool open(const uint8_t *data, int size) = 0;
 
+    /** Opens NSF and VGM data from the source. The source must remain valid until closed */
+    virtual bool open(DataSource *source) = 0;
+
     virtual uint32_t getSample() = 0;
 
+    /**
+     * Renders specified number of samples to outBuffer. Each sample has the same
+     * format as returned by getSample(). Use it instead of getSample() to render
+     * the whole block returned by decodeBlock() at once.
+     */
+    virtual void renderBlock(uint32_t *outBuffer, int samples)
+    {
+        while ( samples-- > 0 ) *outBuffer++ = getSample();
+    }
+
+    /**
+     * Advances decoder by specified number of samples without producing output.
+     * Decoder state is the same as after renderBlock() for the same samples.
+     */
+    virtual void skipBlock(int samples)
+    {
+        uint32_t buffer[256];
+        while ( samples > 0 )
+        {
+            int count = samples < 256 ? samples : 256;
+            renderBlock( buffer, count );
+            samples -= count;
+        }
+    }
+
+    /**
+     * Returns AY-3-8910 chip, if the next samples of the block are produced by the chip
+     * alone, and counts them as rendered. Then the caller must render exactly the same
+     * samples by the chip, for example by AY38910Lanes together with chips of other
+     * decoders. Returns nullptr, if the block must be rendered by renderBlock().
+     */
+    virtual AY38910 *renderLaneBlock(int samples) { return nullptr; }
+
+    /**
+     * Returns size of decoder state in bytes, see saveState().
+     * Returns 0 if decoder doesn't support state snapshots.
+     */
+    virtual uint32_t getStateSize() { return 0; }
+
+    /**
+     * Saves full decoder and chips state to buffer of getStateSize() bytes.
+     * State refers to the opened data, so it can be restored only by decoder,
+     * which has the same data opened, with the same sample frequency and volume.
+     */
+    virtual bool saveState(uint8_t *state) { return false; }
+
+    /** Restores decoder state, saved by saveState() */
+    virtual bool loadState(const uint8_t *state) { return false; }
+
+    /**
+     * Enables detection of loops and silence, if decoder supports it for data without
+     * loop information. When the data becomes silent, decodeBlock() returns 0.
+     */
+    virtual void setLoopDetection(bool enable) {}
+
+    /**
+     * Returns loop length in samples, when decoder detects, that the last getLoopLength()
+     * samples are repeated from now on. Returns 0 if loop is not detected yet.
+     */
+    virtual uint32_t getLoopLength() { return 0; }
+
     /**
      * Decodes data block and returns number of samples to read from decoder.
      * If it returns -1, then error occured, 0 means - nothing left.
+     * VGM_BLOCK_PENDING means, that the budget is spent, and the next call continues the block.
      */
     virtual int decodeBlock() = 0;
 
-    /** Sets sampling frequency. ,Must be called before decodePcm */
-//    void setSampleFrequency( uint32_t frequency ) virtual;
+    /**
+     * Limits work of single decodeBlock() call: number of cpu instructions for NSF, or
+     * number of commands for VGM. 0 means no limit (default). Decoders, which don't
+     * support the budget, always complete the block.
+     */
+    virtual void setBlockBudget(uint32_t budget) {}
+
+    /**
+     * Sets sampling frequency. Must be called before decodeBlock.
+     * After that decodeBlock() returns number of samples at specified rate.
+     * Returns false if decoder can produce samples at 44100 Hz only.
+     */
+    virtual bool setSampleFrequency( uint32_t frequency ) { return false; }
 
     /** Sets volume, default level is 100 */
     virtual void setVolume(uint16_t volume) {}
@@ -54,4 +163,15 @@ public:
 
     /** Sets track to play */
     virtual bool setTrack(int track) { return true; };
+
+    /** Enables preparing of neighbouring tracks in background, for formats with several tracks */
+    virtual void setTrackPrefetch(bool enable) {}
+
+    /**
+     * Passes the track without synthesizing samples, and fills info. Passing stops at
+     * maxSamples (44100 Hz), if the end of the track is not found. Decoder position is
+     * not defined after analysis, so setTrack() must be called to play the track.
+     * Returns false, if decoder doesn't support analysis.
+     */
+    virtual bool analyze(int track, uint32_t maxSamples, VgmTrackInfo &info) { return false; }
 };
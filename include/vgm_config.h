@@ -0,0 +1,66 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+/*
+    Compact build for embedded systems, which run several decoders at once, is enabled,
+    if VGM_DECODER_COMPACT is defined to 1. It reduces memory used by each decoder instance:
+     - NES cpu accesses memory without page table (2 pointers per 256-byte page),
+       so NSF decoding is slower
+     - VgmFile doesn't save seek checkpoints by default, see VgmFile::setSeekInterval()
+    See VgmFile::getMemoryUsage() for memory used by each object.
+*/
+#ifndef VGM_DECODER_COMPACT
+#define VGM_DECODER_COMPACT 0
+#endif
+
+/*
+    Chips, supported by the library, are selected at compile time. Firmware, which plays
+    only AY-3-8910 or only NES music, can define VGM_DECODER_NES or VGM_DECODER_AY38910
+    to 0, so the code of disabled chip and its decoders is not compiled:
+     - VGM_DECODER_AY38910=0 removes AY-3-8910 / YM2149 emulator, vgm data for it is
+       rejected on open
+     - VGM_DECODER_NES=0 removes NES APU, 6502 cpu and NSF decoder
+    In single chip build VgmMusicDecoder doesn't check chip type on every block. Decoder
+    is constructed inside VgmFile, and chips (AY-3-8910, or NES cpu with its RAM and
+    cartridge) are parts of decoder object, so opening and playing vgm data doesn't
+    allocate heap. Heap is still used by: vgm data blocks index, gzip data, precompiled
+    command streams, seek checkpoints, copies of data, which is not resident in memory,
+    and in NSF decoder - battery backed RAM, machine images, loop detection and prefetch.
+*/
+#ifndef VGM_DECODER_AY38910
+#define VGM_DECODER_AY38910 1
+#endif
+
+#ifndef VGM_DECODER_NES
+#define VGM_DECODER_NES 1
+#endif
+
+#if !VGM_DECODER_AY38910 && !VGM_DECODER_NES
+#error "At least one chip must be enabled: VGM_DECODER_AY38910 or VGM_DECODER_NES"
+#endif
+
+/** Single chip build, see above */
+#define VGM_DECODER_SINGLE_CHIP ( !VGM_DECODER_AY38910 || !VGM_DECODER_NES )
@@ -25,7 +25,31 @@ SOFTWARE.
 #pragma once
 
 #include <stdint.h>
+#include <vector>
 #include "music_decoder.h"
+#include "vgm_config.h"
+#include "vgm_resampler.h"
+#include "vgm_sample_format.h"
+#include "vgm_stats.h"
+#if VGM_DECODER_SINGLE_CHIP
+#include "formats/vgm_decoder.h"
+#include "formats/nsf_decoder.h"
+#endif
+
+class VgmCommandStream;
+class DataSource;
+class VgmPcmSink;
+class VgmTraceBuffer;
+
+/** Memory budget of library object, see VgmFile::getMemoryUsage() */
+typedef struct
+{
+    const char *name;
+    /** Size of the object itself in bytes */
+    uint32_t size;
+    /** Maximum heap memory in bytes, which the object allocates while playing */
+    uint32_t heap;
+} VgmMemoryUsage;
 
 class VgmFile
 {
@@ -33,22 +57,159 @@ public:
     VgmFile();
     ~VgmFile();
 
-    /** Allows to open NSF and VGM data blocks */
+    /**
+     * Allows to open NSF and VGM data blocks. Gzip compressed VGM data (vgz) is
+     * inflated on the fly, if the library is built with VGM_DECODER_ZLIB=1.
+     */
     bool open(const uint8_t *data, int size);
 
+    /**
+     * Opens NSF and VGM data from the source, see data_source.h.
+     * The source must remain valid until VgmFile is closed.
+     */
+    bool open(DataSource *source);
+
+    /**
+     * Opens vgm data using command stream, compiled by VgmCommandStream::compile().
+     * The same stream can be used by several VgmFile objects at once, and
+     * must remain valid until VgmFile is closed.
+     */
+    bool open(const VgmCommandStream *stream);
+
+    /**
+     * Enables compiling of vgm commands to the compact event stream on open().
+     * Decoding compiled stream is faster, but it requires additional memory
+     * (8 bytes per register write). Disabled by default. NSF data is not affected.
+     */
+    void setPrecompile(bool enable) { m_precompile = enable; }
+
     /** Closes either VGM or NSF data */
     void close();
 
     /**
      * Decodes next block and fill pcm buffer.
      * If there is not more data to play returns size less than maxSize.
-     * outBuffer is filled up with 16-bit unsigned PCM for 2 channels (stereo).
+     * outBuffer is filled up with samples in output format, see setOutputFormat(),
+     * 16-bit unsigned PCM for 2 channels (stereo) by default.
      */
     int decodePcm(uint8_t *outBuffer, int maxSize);
 
+    /**
+     * Decodes up to maxSize bytes directly to memory, provided by the sink, see vgm_pcm_sink.h.
+     * Span of the sink may end in the middle of decoded block, the rest of the block is
+     * written to the next span. Returns number of bytes committed to the sink, which is
+     * less than maxSize, if there is no more data to play, or the sink is full.
+     */
+    int decodePcm(VgmPcmSink &sink, int maxSize);
+
+    /**
+     * Decodes pcm data the same way as decodePcm(), but returns when the time, given in
+     * microseconds, runs out. Blocks, heavy to decode, are split into small slices, and
+     * interrupted block is continued by the next call, so the output is exactly the same
+     * as without the deadline. Returns number of bytes decoded, which can be less than
+     * maxSize or even 0 before the end of the track, use isEnded() to check the end.
+     */
+    int decodePcm(uint8_t *outBuffer, int maxSize, uint32_t microseconds);
+
+    /** The same as decodePcm(uint8_t *, int, uint32_t), but writes to the sink */
+    int decodePcm(VgmPcmSink &sink, int maxSize, uint32_t microseconds);
+
+    /**
+     * Starts lane block, which is rendered by AY-3-8910 chip directly, so chips of several
+     * files can be rendered at once by AY38910Lanes, see VgmStreamEngine. Processes vgm
+     * commands till the next wait, limits samples to the wait, and returns the chip, which
+     * must render the samples before commitLaneBlock(). Returns nullptr, if samples can't be
+     * rendered by the chip alone (other chip, DAC streams, sample rate conversion, deadline),
+     * the wait is shorter than minSamples and than samples, or the end of the track is
+     * reached (see isEnded()), then decodePcm() must be used.
+     */
+    AY38910 *beginLaneBlock(uint32_t &samples, uint32_t minSamples);
+
+    /**
+     * Applies fading to samples, rendered by the chip of beginLaneBlock(), converts them to
+     * output format and writes to the sink. The sink must have space for all samples.
+     * Returns number of written bytes.
+     */
+    int commitLaneBlock(uint32_t *block, uint32_t samples, VgmPcmSink &sink);
+
+    /** Returns true if the last decodePcm() call returned less data due to the end of track */
+    bool isEnded() const { return m_ended; }
+
+    /**
+     * Skips the same pcm data as decodePcm() would produce, but without mixing samples,
+     * when chips support that. Returns number of bytes skipped.
+     */
+    int skipPcm(int maxSize);
+
+    /**
+     * Sets sample format and number of channels for decodePcm() output. Default
+     * format is VGM_SAMPLE_U16 stereo, which is native for decoders and doesn't
+     * require conversion. Returns false if format is not supported.
+     */
+    bool setOutputFormat(const VgmOutputFormat &format);
+
+    /** Returns current output format */
+    const VgmOutputFormat &getOutputFormat() const { return m_format; }
+
+    /** Returns size of one output frame in bytes, decodePcm() output is always aligned to it */
+    uint32_t getFrameSize() const { return vgmGetFrameSize( m_format ); }
+
+    /**
+     * Returns number of output samples at full scale level from the start of the track,
+     * which are likely clipped. Decrease volume, if it is not 0. Default U16 stereo output
+     * is not converted, so its samples are counted only if setClipDetection() enables it.
+     */
+    uint32_t getClippedSamples() const { return m_clippedSamples; }
+
+    /** Enables counting of clipped samples for U16 stereo output, disabled by default */
+    void setClipDetection(bool enable) { m_clipDetection = enable; }
+
+    /**
+     * Moves playback position to specified time from the start of the track.
+     * Player state is saved to checkpoint index every seek interval while decoding,
+     * so seek restores the nearest checkpoint and passes the rest without mixing.
+     * Returns false if position is beyond the end of the track, or if position is
+     * behind the current one, and the data doesn't support state snapshots.
+     */
+    bool seek(uint32_t milliseconds);
+
+    /**
+     * Sets interval between checkpoints in milliseconds, 5 seconds by default (0 in
+     * compact build, see vgm_config.h). Each checkpoint takes getStateSize() bytes.
+     * 0 disables checkpoints.
+     */
+    void setSeekInterval(uint32_t milliseconds) { m_seekInterval = milliseconds; }
+
+    /** Returns number of samples at output sample frequency from the start of the track */
+    uint32_t getPosition() { return m_position; }
+
+    /** Returns size of state in bytes, or 0 if opened data doesn't support state snapshots */
+    uint32_t getStateSize();
+
+    /**
+     * Saves playback state to buffer of getStateSize() bytes. State can be restored by
+     * any VgmFile, which has the same data opened with the same settings (sample frequency,
+     * volume, duration, fading), so playback continues from the same sample.
+     * The state refers to opened data, which must remain valid while the state is used.
+     */
+    bool saveState(uint8_t *state);
+
+    /** Restores playback state, saved by saveState() */
+    bool loadState(const uint8_t *state);
+
     /** Sets sampling frequency. ,Must be called before decodePcm */
     void setSampleFrequency( uint32_t frequency );
 
+    /**
+     * Enables polyphase FIR resampler, see vgm_resampler.h. Chips render samples at
+     * chipFrequency (44100 Hz if 0), and resampler converts them to sample frequency,
+     * set by setSampleFrequency(), both up and down. It allows to run chips at the
+     * cheapest rate, still producing any output rate without aliasing. By default
+     * (VGM_RESAMPLER_OFF) chips render samples at output sample frequency directly.
+     * Resets playback position like setSampleFrequency().
+     */
+    void setResampler(uint8_t quality, uint32_t chipFrequency = 0);
+
     /** Sets volume, default level is 100 */
     void setVolume(uint16_t volume);
 
@@ -58,6 +219,21 @@ public:
     /** Sets track to play */
     bool setTrack(int track);
 
+    /**
+     * Enables preparing previous and next tracks of NSF file in background thread after
+     * each track change, so switching to them is instant. Disabled by default.
+     */
+    void setTrackPrefetch(bool enable);
+
+    /**
+     * Collects track information (duration, loop, register writes) without synthesizing
+     * samples, which is much faster than decoding. Analysis is limited by max duration,
+     * or by 10 minutes, if max duration is not set. Sample frequency settings are not used,
+     * all durations are at 44100 Hz. The track is set to play from the start after analysis.
+     * Returns false, if analysis is not supported by the decoder.
+     */
+    bool analyze(int track, VgmTrackInfo &info);
+
     /**
      * Sets maximum decoding duration in milliseconds.
      * Useful for looped music
@@ -65,7 +241,17 @@ public:
     void setMaxDuration( uint32_t milliseconds );
 
     /**
-     * Returns number of total samples in track.
+     * Enables loop and silence detection for data without loop information (NSF).
+     * When the loop is detected, playback stops after specified number of loops,
+     * including the first pass. Playback also stops, if the track becomes silent.
+     * For VGM data trailing silence is trimmed: playback stops, when the chips are
+     * silent, and only wait commands are left till the end of data.
+     * Max duration still limits playback. Disabled by default.
+     */
+    void setLoopDetection(bool enable, uint8_t loops = 2);
+
+    /**
+     * Returns number of total samples in track (at decoder sample frequency).
      * Be careful, some formats do not allow to calculate samples before
      * decoding all data. Vgm decoder decodes in realtime, thus it may return
      * 0 total samples. If you want to limit play duration, please use
@@ -85,26 +271,119 @@ public:
      */
     void setFading(bool enable);
 
+    /**
+     * Attaches binary trace buffer to the object. Decoder events are written to the
+     * buffer while decodePcm() and setTrack() are executed, if the library is built
+     * with VGM_DECODER_TRACE=1. The buffer can be read by another thread.
+     * Pass nullptr to detach the buffer.
+     */
+    void setTrace(VgmTraceBuffer *buffer) { m_trace = buffer; }
+
+    /**
+     * Copies runtime statistics, collected since the file is opened or resetStats()
+     * is called. Statistics don't depend on track changes and seeking. Returns false
+     * and zero statistics, if the library is built without VGM_DECODER_STATS=1.
+     */
+    bool getStats(VgmStats &stats) const;
+
+    /** Clears runtime statistics */
+    void resetStats();
+
+    /**
+     * Fills table with sizes and heap usage of the player, decoders and chips for current
+     * build configuration, and returns number of entries. Heap of decoder includes the chips,
+     * it creates, but doesn't include data blocks and copies of not resident input data.
+     */
+    static int getMemoryUsage(VgmMemoryUsage *table, int maxEntries);
+
 private:
+    typedef struct
+    {
+        /** Output samples from the start of the track */
+        uint32_t position;
+        std::vector<uint8_t> state;
+    } Checkpoint;
+
     BaseMusicDecoder * m_decoder = nullptr;
+#if VGM_DECODER_SINGLE_CHIP
+    /** Decoder is constructed here in single chip build, so opening the file doesn't use heap */
+#if VGM_DECODER_NES
+    alignas(VgmMusicDecoder) alignas(NsfMusicDecoder)
+    uint8_t m_decoderStorage[sizeof(VgmMusicDecoder) > sizeof(NsfMusicDecoder) ?
+                             sizeof(VgmMusicDecoder) : sizeof(NsfMusicDecoder)];
+#else
+    alignas(VgmMusicDecoder) uint8_t m_decoderStorage[sizeof(VgmMusicDecoder)];
+#endif
+#endif
+    /** Sources, owned by the object, when gzip data are opened */
+    DataSource * m_memorySource = nullptr;
+    DataSource * m_gzipSource = nullptr;
+    VgmTraceBuffer * m_trace = nullptr;
+#if VGM_DECODER_STATS
+    VgmStats m_stats{};
+#endif
 
     /** Duration in samples */
     uint32_t m_duration = 0;
+    /** Duration in milliseconds */
+    uint32_t m_maxDuration = 0;
+    /** End of the last loop in samples, if loop is detected, 0 otherwise */
+    uint32_t m_loopEnd = 0;
+    uint8_t m_loopCount = 2;
+    bool m_loopDetection = false;
+    bool m_trackPrefetch = false;
 
     uint32_t m_samplesPlayed;
     uint32_t m_waitSamples;
+    /** Samples at output frequency from the start of the track */
+    uint32_t m_position = 0;
+    /** Output samples at full scale from the start of the track */
+    uint32_t m_clippedSamples = 0;
+    bool m_clipDetection = false;
+    VgmOutputFormat m_format{ VGM_SAMPLE_U16, 2 };
+    VgmResampler m_resampler;
+    uint8_t m_resamplerQuality = VGM_RESAMPLER_OFF;
+    /** Sample frequency of chips, when resampler is used */
+    uint32_t m_chipFrequency = 0;
+
+    /** Checkpoints index, sorted by position */
+    std::vector<Checkpoint> m_checkpoints;
+    /** Interval between checkpoints in milliseconds */
+    uint32_t m_seekInterval = VGM_DECODER_COMPACT ? 0 : 5000;
 
     uint32_t m_readCounter;
-    uint32_t m_writeCounter;
+    uint32_t m_writeCounter = 0;
+    /** Sample frequency of the decoder */
     uint32_t m_readScaler;
+    /** Output sample frequency */
     uint32_t m_writeScaler;
 
     uint32_t m_sampleSum;
     bool m_sampleSumValid = false;
     bool m_fadeEffect = false;
+    bool m_precompile = false;
+    bool m_ended = false;
+    /** Time, when decoding must be stopped, in microseconds, 0 if not limited */
+    uint64_t m_deadline = 0;
     uint16_t m_shifter = 0;
     uint16_t m_volume = 100;
 
-    void interpolateSample();
+    void applyFading(uint32_t *samples, int count);
+    int resampleBlock(const uint32_t *samples, int count, uint8_t *outBuffer);
+    int decode(uint8_t *outBuffer, int maxSize);
+    void setDeadline(uint32_t microseconds);
+    void addCheckpoint();
+    void updateCheckpoints();
+    uint32_t getEndSample() const;
+    /**
+     * Limits samples to the end of the track and to the fade step at current sample,
+     * and sets m_shifter for the step
+     */
+    uint32_t limitSamples(uint32_t samples);
+    bool nextBlock(bool &decodeStarted);
+    void resetPosition();
     void deleteDecoder();
+    void *getDecoderStorage();
+    bool initDecoder();
+    bool openSource(DataSource *source);
 };
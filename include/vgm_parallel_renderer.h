@@ -0,0 +1,93 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+#include "vgm_file.h"
+
+/**
+ * Renders single track using several threads. The track is passed once without
+ * mixing samples to save player state at the start of every segment, then segments
+ * are rendered in parallel, each one by own VgmFile object restored from the state.
+ * The output is exactly the same as sequential VgmFile::decodePcm() output.
+ */
+class VgmParallelRenderer
+{
+public:
+    VgmParallelRenderer() = default;
+    ~VgmParallelRenderer() = default;
+
+    /**
+     * Opens NSF and VGM data for rendering. Data is shared by all threads and
+     * must remain valid until rendering is complete.
+     */
+    bool open(const uint8_t *data, int size);
+
+    /** Returns number of tracks in opened file */
+    int getTrackCount() { return m_file.getTrackCount(); }
+
+    /** Sets track to render */
+    bool setTrack(int track);
+
+    /** Sets sampling frequency. Must be called before render(). */
+    void setSampleFrequency(uint32_t frequency);
+
+    /** Sets volume, default level is 100 */
+    void setVolume(uint16_t volume);
+
+    /** Sets maximum duration of the track in milliseconds */
+    void setMaxDuration(uint32_t milliseconds);
+
+    /** Enables fade effect at the end of the track */
+    void setFading(bool enable);
+
+    /** Sets number of rendering threads, 0 means number of cpu cores (default) */
+    void setThreadCount(int count) { m_threadCount = count; }
+
+    /** Sets duration of single segment in milliseconds, 10 seconds by default */
+    void setSegmentDuration(uint32_t milliseconds) { m_segmentDuration = milliseconds; }
+
+    /**
+     * Renders the rest of the track to outBuffer in the same format as VgmFile::decodePcm().
+     * Returns number of bytes rendered. If opened data doesn't support state snapshots,
+     * the track is rendered by single thread.
+     */
+    int render(uint8_t *outBuffer, int maxSize);
+
+private:
+    VgmFile m_file;
+    const uint8_t *m_data = nullptr;
+    int m_size = 0;
+    int m_track = 0;
+    int m_threadCount = 0;
+    uint32_t m_segmentDuration = 10000;
+    uint32_t m_sampleFrequency = 44100;
+    uint16_t m_volume = 100;
+    uint32_t m_maxDuration = 3 * 60 * 1000;
+    bool m_fadeEffect = false;
+
+    bool setup(VgmFile &file);
+};
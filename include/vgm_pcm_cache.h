@@ -0,0 +1,142 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "data_source.h"
+#include "vgm_sample_format.h"
+
+/**
+ * Version of rendered data, it is a part of every cache key. Increase it, when changes
+ * of decoders or chips change the output, so old cache entries are not used.
+ */
+#define VGM_PCM_CACHE_VERSION 1
+
+/** Rendering parameters, which are a part of cache key, see VgmPcmCache::makeKey() */
+typedef struct
+{
+    int track;
+    uint32_t sampleFrequency;
+    uint16_t volume;
+    bool fading;
+    bool loopDetection;
+    /** Number of loops to play, see VgmFile::setLoopDetection() */
+    uint8_t loopCount;
+    /** Max duration in milliseconds, see VgmFile::setMaxDuration() */
+    uint32_t maxDuration;
+    VgmOutputFormat format;
+    /** Resampler quality and chips frequency, see VgmFile::setResampler() */
+    uint8_t resamplerQuality;
+    uint32_t chipFrequency;
+} VgmPcmCacheParams;
+
+/**
+ * Size-bounded cache of rendered pcm data in a directory. Every entry is raw pcm of one
+ * track, stored in file named by its key, so any range of it can be read without
+ * decoding. Entries are evicted in least recently used order, when total size exceeds
+ * the limit. The index of entries is saved to the directory, when an entry is added
+ * or the cache is closed. All methods can be called from several threads at once.
+ */
+class VgmPcmCache
+{
+public:
+    VgmPcmCache() = default;
+    ~VgmPcmCache() { close(); }
+
+    VgmPcmCache(const VgmPcmCache &) = delete;
+    VgmPcmCache &operator=(const VgmPcmCache &) = delete;
+
+    /**
+     * Opens cache in existing directory and loads its index. Entries over maxSize
+     * bytes in total are evicted. Returns false if the directory is not writable.
+     */
+    bool open(const char *directory, uint64_t maxSize);
+
+    /** Saves the index and closes the cache */
+    void close();
+
+    /** Calculates cache key from input file data and rendering parameters */
+    static uint64_t makeKey(const uint8_t *data, uint32_t size, const VgmPcmCacheParams &params);
+
+    /**
+     * Opens cached pcm data of the key as file source, and marks the entry as the most
+     * recently used. Returns false if there is no such entry. The source remains valid
+     * even if the entry is evicted later.
+     */
+    bool read(uint64_t key, FileDataSource &source);
+
+    /**
+     * Creates temporary file for pcm data of the key. Data are written by caller, and
+     * the file is passed to commit() or discard(). Returns nullptr on error.
+     */
+    FILE *create(uint64_t key);
+
+    /**
+     * Closes file, created by create(), and adds it to the cache as entry of the key.
+     * Least recently used entries are evicted to keep cache size. Returns false on error.
+     */
+    bool commit(uint64_t key, FILE *file);
+
+    /** Closes file, created by create(), and removes it */
+    void discard(FILE *file);
+
+    /** Returns total size of cached entries in bytes */
+    uint64_t getSize();
+
+    /** Returns number of cached entries */
+    uint32_t getCount();
+
+private:
+    typedef struct
+    {
+        uint32_t size;
+        /** Position in least recently used order */
+        std::list<uint64_t>::iterator use;
+    } Entry;
+
+    std::mutex m_mutex;
+    std::string m_directory;
+    uint64_t m_maxSize = 0;
+    uint64_t m_size = 0;
+    /** Keys from least to most recently used */
+    std::list<uint64_t> m_uses;
+    std::unordered_map<uint64_t, Entry> m_entries;
+    /** Temporary files, created by create(), by their file pointers */
+    std::unordered_map<FILE *, std::string> m_temporary;
+    uint32_t m_temporaryCounter = 0;
+    bool m_modified = false;
+
+    std::string getEntryName(uint64_t key) const;
+    void addEntry(uint64_t key, uint32_t size);
+    void removeEntry(uint64_t key);
+    void evict();
+    bool saveIndex();
+    static bool replaceFile(const std::string &source, const std::string &target);
+};
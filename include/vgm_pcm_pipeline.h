@@ -0,0 +1,146 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "vgm_file.h"
+#include "vgm_pcm_sink.h"
+
+/**
+ * Lock-free single producer / single consumer ring buffer of pcm data.
+ * One thread writes data, while another one reads them. Data can be written
+ * and read in place via acquire / commit pairs, so decoder renders samples
+ * directly to the buffer, and consumer passes them to output without copying.
+ * The buffer is the sink of producer side for VgmFile::decodePcm().
+ */
+class VgmPcmRingBuffer: public VgmPcmSink
+{
+public:
+    /** Creates buffer of specified size in bytes, rounded up to power of 2 */
+    explicit VgmPcmRingBuffer(uint32_t size = 65536);
+    ~VgmPcmRingBuffer();
+
+    VgmPcmRingBuffer(const VgmPcmRingBuffer &) = delete;
+    VgmPcmRingBuffer &operator=(const VgmPcmRingBuffer &) = delete;
+
+    /** Returns buffer size in bytes */
+    uint32_t getCapacity() const { return m_capacityMask + 1; }
+
+    /** Returns number of bytes available for reading */
+    uint32_t getAvailable() const
+    {
+        return m_head.load( std::memory_order_acquire ) - m_tail.load( std::memory_order_acquire );
+    }
+
+    /**
+     * Returns pointer to contiguous free space and sets size to its length in bytes.
+     * Called by producer only. The space is aligned to any write size, which is power of 2.
+     */
+    uint8_t *acquireWrite(uint32_t &size);
+
+    /** Makes size bytes of acquired space available for reading. Called by producer only */
+    void commitWrite(uint32_t size) { m_head.store( m_head.load( std::memory_order_relaxed ) + size,
+                                                    std::memory_order_release ); }
+
+    /** Sink interface for producer, the same as acquireWrite() */
+    uint8_t *acquire(uint32_t &size) override { return acquireWrite( size ); }
+
+    /** Sink interface for producer, the same as commitWrite() */
+    void commit(uint32_t size) override { commitWrite( size ); }
+
+    /** Returns pointer to contiguous data and sets size to its length. Called by consumer only */
+    const uint8_t *acquireRead(uint32_t &size);
+
+    /** Releases size bytes of acquired data. Called by consumer only */
+    void commitRead(uint32_t size) { m_tail.store( m_tail.load( std::memory_order_relaxed ) + size,
+                                                   std::memory_order_release ); }
+
+    /** Copies up to size bytes to outBuffer, and returns number of copied bytes. Called by consumer only */
+    uint32_t read(uint8_t *outBuffer, uint32_t size);
+
+    /** Discards all data. Must not be called while producer or consumer use the buffer */
+    void clear();
+
+private:
+    uint8_t *m_data = nullptr;
+    uint32_t m_capacityMask = 0;
+    alignas(64) std::atomic<uint32_t> m_head{0};
+    alignas(64) std::atomic<uint32_t> m_tail{0};
+};
+
+/**
+ * Decodes VgmFile to ring buffer in separate thread, so output latency is defined
+ * by buffer depth rather than by decoding time of single block. The file must be
+ * fully configured (track, format, duration) before start(), and must not be used
+ * by other threads until stop().
+ */
+class VgmPcmProducer
+{
+public:
+    /** Creates producer with ring buffer of specified size in bytes */
+    explicit VgmPcmProducer(uint32_t bufferSize = 65536): m_buffer( bufferSize ) {}
+    ~VgmPcmProducer() { stop(); }
+
+    /**
+     * Starts decoding thread and waits until prefill bytes are decoded, or the
+     * track is over. prefill is limited to buffer size.
+     */
+    void start(VgmFile *file, uint32_t prefill);
+
+    /** Stops decoding thread, unread data are discarded */
+    void stop();
+
+    /**
+     * Copies up to size bytes of decoded data to outBuffer without waiting, and returns
+     * number of copied bytes. Called by single consumer thread, for example audio callback.
+     */
+    uint32_t read(uint8_t *outBuffer, uint32_t size) { return m_buffer.read( outBuffer, size ); }
+
+    /**
+     * Waits until size bytes are decoded, or the track is over. Returns number
+     * of bytes available for reading.
+     */
+    uint32_t wait(uint32_t size);
+
+    /** Returns ring buffer to read data in place */
+    VgmPcmRingBuffer &getBuffer() { return m_buffer; }
+
+    /** Returns true if decoding thread has reached the end of the track */
+    bool isFinished() const { return m_finished.load( std::memory_order_acquire ); }
+
+    /** Returns true if the track is over and all decoded data are read */
+    bool isEmpty() const { return isFinished() && !m_buffer.getAvailable(); }
+
+private:
+    VgmPcmRingBuffer m_buffer;
+    VgmFile *m_file = nullptr;
+    std::thread m_thread;
+    std::atomic<bool> m_finished{ true };
+    std::atomic<bool> m_stop{ false };
+
+    void decode();
+};
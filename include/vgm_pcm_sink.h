@@ -0,0 +1,49 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Output, which provides memory for pcm data itself, like DMA buffers of I2S driver,
+ * audio stream of the player or memory mapped output file. VgmFile::decodePcm() renders
+ * samples directly to acquired memory, so they are not copied once more by the caller.
+ */
+class VgmPcmSink
+{
+public:
+    virtual ~VgmPcmSink() = default;
+
+    /**
+     * Returns pointer to contiguous free space and sets size to its length in bytes.
+     * On entry size holds number of bytes, the caller is going to write. Returned space
+     * may be either smaller or larger, the caller uses whole frames of it only.
+     * Returning less than one frame means, that the sink is full.
+     */
+    virtual uint8_t *acquire(uint32_t &size) = 0;
+
+    /** Passes size bytes, written to acquired space, to the output */
+    virtual void commit(uint32_t size) = 0;
+};
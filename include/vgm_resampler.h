@@ -0,0 +1,132 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/** Quality of polyphase resampler, see VgmFile::setResampler() */
+enum
+{
+    /** Resampler is not used, chips render samples at output frequency */
+    VGM_RESAMPLER_OFF = 0,
+    /** 8 taps per phase */
+    VGM_RESAMPLER_FAST = 1,
+    /** 16 taps per phase */
+    VGM_RESAMPLER_MEDIUM = 2,
+    /** 32 taps per phase */
+    VGM_RESAMPLER_BEST = 3,
+};
+
+/** Maximum number of filter phases between two input samples */
+#define VGM_RESAMPLER_MAX_PHASES 256
+
+/** Maximum number of filter taps, taps are increased for downsampling */
+#define VGM_RESAMPLER_MAX_TAPS 64
+
+/**
+ * Fixed-point polyphase FIR resampler of stereo samples in internal format (see
+ * BaseMusicDecoder::getSample()). Converts samples between any frequencies up and down
+ * with low-pass windowed sinc filter, which cuts frequencies above Nyquist limit of
+ * lower frequency. Filter coefficients are calculated by init() for each phase between
+ * input samples. Phases are exact, if ratio of frequencies has small denominator, like
+ * 147/160 for 44100 -> 48000, otherwise the nearest of VGM_RESAMPLER_MAX_PHASES is used.
+ * Filter delay is compensated, so output is aligned to input. SSE2 or NEON instructions
+ * are used, if cpu supports them, the results are the same as for scalar code.
+ */
+class VgmResampler
+{
+public:
+    /**
+     * Calculates filter for specified frequencies and quality and resets state.
+     * Returns false, if quality is VGM_RESAMPLER_OFF or parameters are not valid.
+     */
+    bool init(uint32_t inputFrequency, uint32_t outputFrequency, uint8_t quality);
+
+    /** Disables resampler and frees filter tables */
+    void close();
+
+    /** Returns true, if resampler is initialized */
+    bool isEnabled() const { return m_taps != 0; }
+
+    /** Returns number of filter taps per phase */
+    uint32_t getTaps() const { return m_taps; }
+
+    /** Clears filter history with silence, next output sample is aligned to next input sample */
+    void reset();
+
+    /**
+     * Returns number of input samples, required to produce specified number of output
+     * samples. process() consumes all of them then.
+     */
+    uint32_t getInputSamples(uint32_t outputSamples) const;
+
+    /**
+     * Consumes count input samples and writes up to maxSamples output samples to outBuffer.
+     * count must not exceed getInputSamples( maxSamples ). outBuffer can be nullptr,
+     * then the filter state is updated, but output is not calculated. Returns number of
+     * output samples.
+     */
+    int process(const uint32_t *samples, int count, uint32_t *outBuffer, int maxSamples);
+
+    /** Returns size of state in bytes, see saveState() */
+    uint32_t getStateSize() const;
+
+    /** Saves filter history and phase, the same filter parameters are required for loadState() */
+    void saveState(uint8_t *state) const;
+
+    /** Restores state, saved by saveState() */
+    void loadState(const uint8_t *state);
+
+    /** Returns maximum heap size in bytes, used by resampler for any frequencies and quality */
+    static uint32_t getMaxHeapSize();
+
+    /** Allows to use SIMD kernels (SSE2, NEON). Enabled by default */
+    static void enableSimd(bool enable);
+
+private:
+    /** Polyphase filter coefficients, taps for each phase, Q15 */
+    std::vector<int16_t> m_coefficients;
+    /**
+     * Signed history of left and right channels, 2 * taps samples for each. Each sample
+     * is stored twice, so last taps samples are always contiguous.
+     */
+    std::vector<int16_t> m_history;
+    uint32_t m_taps = 0;
+    uint32_t m_phases = 0;
+    /** Output sample period is m_step / m_denominator of input sample period */
+    uint32_t m_step = 0;
+    uint32_t m_denominator = 0;
+    /** Position of next output sample after last input sample, in 1 / m_denominator units */
+    uint32_t m_position = 0;
+    /** Next write index in history */
+    uint32_t m_index = 0;
+
+    void push(uint32_t sample);
+
+    /** Kernel, which calculates output sample for history window and phase coefficients */
+    static uint32_t (*s_kernel)(const int16_t *left, const int16_t *right, const int16_t *coefficients,
+                                uint32_t taps);
+};
@@ -0,0 +1,62 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/** Sample encodings of decodePcm() output */
+enum
+{
+    /** Unsigned 16-bit, silence is 0. It is internal format of decoders */
+    VGM_SAMPLE_U16 = 0,
+    /** Signed 16-bit, native byte order */
+    VGM_SAMPLE_S16 = 1,
+    /** 32-bit float in range -1.0 ... 1.0 */
+    VGM_SAMPLE_F32 = 2,
+};
+
+/** Output format descriptor, see VgmFile::setOutputFormat() */
+typedef struct
+{
+    /** Sample encoding: VGM_SAMPLE_U16, VGM_SAMPLE_S16 or VGM_SAMPLE_F32 */
+    uint8_t sampleFormat;
+    /** 2 for interleaved stereo (left, right), 1 for mono (average of both channels) */
+    uint8_t channels;
+} VgmOutputFormat;
+
+/** Returns true if the format is supported */
+bool vgmIsValidFormat(const VgmOutputFormat &format);
+
+/** Returns size of one output frame (all channels) in bytes */
+uint32_t vgmGetFrameSize(const VgmOutputFormat &format);
+
+/**
+ * Converts stereo samples in internal format (see BaseMusicDecoder::getSample()) to
+ * output format. Output buffer may be unaligned, and for 16-bit stereo formats it may
+ * be the same as input buffer. SSE2 or NEON instructions are used, if cpu supports them.
+ * Returns number of output samples at full scale level, i.e. possibly clipped.
+ */
+uint32_t vgmConvertSamples(const uint32_t *samples, int count, uint8_t *outBuffer,
+                           const VgmOutputFormat &format);
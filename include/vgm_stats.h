@@ -0,0 +1,113 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+    Runtime statistics are compiled in only if VGM_DECODER_STATS is defined to 1.
+    Counters and timers are updated by decoders and chips, while VgmFile methods
+    are executed, and can be read by VgmFile::getStats(). Otherwise all counting
+    is compiled out, and VgmFile::getStats() returns false.
+*/
+#ifndef VGM_DECODER_STATS
+#define VGM_DECODER_STATS 0
+#endif
+
+/** Classes of vgm commands, counted by VgmStats::commands */
+enum
+{
+    /** 0x61 - 0x63 and 0x70 - 0x7F */
+    VGM_STATS_COMMAND_WAIT = 0,
+    /** Register and memory writes of all chips, including 0x80 - 0x8F */
+    VGM_STATS_COMMAND_WRITE = 1,
+    /** 0x67 data blocks and 0x68 PCM RAM writes */
+    VGM_STATS_COMMAND_DATA = 2,
+    /** 0x90 - 0x95 DAC stream control */
+    VGM_STATS_COMMAND_STREAM = 3,
+    /** End of data, configuration and unknown commands */
+    VGM_STATS_COMMAND_OTHER = 4,
+    VGM_STATS_COMMAND_CLASSES,
+};
+
+/** Runtime statistics of single VgmFile, see VgmFile::getStats(). Times are in nanoseconds */
+typedef struct
+{
+    /** Vgm commands, decoded by VGM_STATS_COMMAND_* class */
+    uint64_t commands[VGM_STATS_COMMAND_CLASSES];
+    /** NES cpu instructions, executed by init and play routines */
+    uint64_t cpuInstructions;
+    /** Samples synthesized by chips at decoder sample frequency */
+    uint64_t samplesRendered;
+    /** Samples passed by chips without mixing, see VgmFile::skipPcm() and VgmFile::seek() */
+    uint64_t samplesSkipped;
+    /** Frames returned by VgmFile::decodePcm() at output sample frequency */
+    uint64_t samplesEmitted;
+    /** Number of BaseMusicDecoder::decodeBlock() calls */
+    uint64_t decodeBlockCalls;
+    /** Time in BaseMusicDecoder::decodeBlock(): command parsing and play routines */
+    uint64_t decodeTime;
+    /** Longest single BaseMusicDecoder::decodeBlock() call */
+    uint64_t maxDecodeTime;
+    /** Time of chips synthesis */
+    uint64_t renderTime;
+    /** Time of fading, resampling and output format conversion */
+    uint64_t outputTime;
+} VgmStats;
+
+/** Returns classification of vgm command for VgmStats::commands */
+static inline int vgmStatsCommandClass(uint8_t cmd)
+{
+    if ( ( cmd >= 0x61 && cmd <= 0x63 ) || ( cmd & 0xF0 ) == 0x70 ) return VGM_STATS_COMMAND_WAIT;
+    if ( cmd == 0x67 || cmd == 0x68 ) return VGM_STATS_COMMAND_DATA;
+    if ( cmd >= 0x90 && cmd <= 0x95 ) return VGM_STATS_COMMAND_STREAM;
+    if ( cmd == 0x4F || cmd == 0x50 || ( cmd >= 0x51 && cmd <= 0x5F ) || ( cmd & 0xF0 ) == 0x80 ||
+         cmd >= 0xA0 ) return VGM_STATS_COMMAND_WRITE;
+    return VGM_STATS_COMMAND_OTHER;
+}
+
+#if VGM_DECODER_STATS
+
+/** Returns statistics, which decoder in current thread updates, or nullptr */
+VgmStats *vgmStatsCurrent();
+
+/** Sets statistics to update in current thread, returns previous one */
+VgmStats *vgmStatsSetCurrent(VgmStats *stats);
+
+/** Returns monotonic time in nanoseconds */
+uint64_t vgmStatsTime();
+
+/** Attaches statistics to current thread for the life time of the object */
+class VgmStatsScope
+{
+public:
+    explicit VgmStatsScope(VgmStats *stats): m_prev( vgmStatsSetCurrent( stats ) ) {}
+    ~VgmStatsScope() { vgmStatsSetCurrent( m_prev ); }
+
+private:
+    VgmStats *m_prev;
+};
+
+#endif
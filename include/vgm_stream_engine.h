@@ -0,0 +1,156 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "vgm_file.h"
+#include "vgm_pcm_pipeline.h"
+#include "chips/ay-3-8910.h"
+
+/** Maximum number of streams, rendered by one thread at once, see VgmStreamEngine */
+#define VGM_STREAM_LANES AY38910_LANES
+
+/**
+ * Maximum number of samples of one stream, given to AY38910Lanes at once. Long blocks
+ * span many vgm waits, so lanes of the group are refilled rarely and stay in step.
+ */
+#define VGM_STREAM_LANE_BLOCK 1024
+
+/**
+ * Minimum number of samples between vgm commands, rendered by AY38910Lanes. Streams with
+ * shorter waits render the rest of the quantum by VgmFile::decodePcm().
+ */
+#define VGM_STREAM_LANE_MIN_WAIT 64
+
+/**
+ * Decodes many streams at once by fixed pool of threads. Every stream is VgmFile with
+ * own ring buffer, owned by the engine. Threads render streams by fixed quanta directly
+ * to the ring buffers, and each quantum is given to the playing stream with the least
+ * buffered data, so all streams are served evenly. Streams with full buffers are not
+ * rendered until consumer reads the data. Only one thread renders the stream at a time,
+ * and the same stream may be rendered by different threads.
+ *
+ * Each thread takes group of up to VGM_STREAM_LANES neediest streams and renders their
+ * quanta together: while AY-3-8910 chips of the streams play waits between vgm commands,
+ * the chips are rendered at once by AY38910Lanes, which advances counters of all chips of
+ * the group by the same SIMD instructions. Each chip still skips own constant spans.
+ * Other streams, and blocks, which need the decoder (NES APU, DAC streams, resampling),
+ * are rendered by VgmFile::decodePcm(). Output is the same in both cases.
+ */
+class VgmStreamEngine
+{
+public:
+    /**
+     * Creates engine with specified number of stream slots. Each stream has ring
+     * buffer of bufferSize bytes, and is rendered by quanta of quantum frames.
+     */
+    explicit VgmStreamEngine(int streams, uint32_t bufferSize = 65536, uint32_t quantum = 1024);
+    ~VgmStreamEngine() { stop(); }
+
+    VgmStreamEngine(const VgmStreamEngine &) = delete;
+    VgmStreamEngine &operator=(const VgmStreamEngine &) = delete;
+
+    /** Starts rendering threads, 0 means number of cpu cores */
+    void start(int threads = 0);
+
+    /** Stops rendering threads, streams keep their state and buffered data */
+    void stop();
+
+    /**
+     * Enables rendering of AY-3-8910 chips of several streams at once, enabled by default.
+     * Disabled lanes render every stream by VgmFile::decodePcm(). Must be called, while
+     * the engine is stopped.
+     */
+    void enableLanes(bool enable) { m_lanes = enable; }
+
+    /** Returns number of stream slots */
+    int getStreamCount() const { return m_streams.size(); }
+
+    /**
+     * Returns file of the stream. The file can be opened and configured only, while the
+     * stream is not playing, see play() and pause().
+     */
+    VgmFile &getFile(int stream) { return m_streams[stream]->file; }
+
+    /** Starts rendering of the stream, already buffered data are discarded */
+    void play(int stream);
+
+    /**
+     * Stops rendering of the stream and waits until the thread, rendering it, finishes
+     * current quantum. Unread data remain in the buffer.
+     */
+    void pause(int stream);
+
+    /** Returns true if the stream is playing and has not reached the end of the track */
+    bool isPlaying(int stream) const;
+
+    /** Returns true if the stream has reached the end of the track */
+    bool isFinished(int stream) const;
+
+    /**
+     * Copies up to size bytes of rendered data of the stream to outBuffer without waiting,
+     * and returns number of copied bytes. Only one consumer thread can read the stream.
+     */
+    uint32_t read(int stream, uint8_t *outBuffer, uint32_t size)
+    {
+        return m_streams[stream]->buffer.read( outBuffer, size );
+    }
+
+    /** Returns ring buffer of the stream to read data in place by single consumer */
+    VgmPcmRingBuffer &getBuffer(int stream) { return m_streams[stream]->buffer; }
+
+    /** Returns number of rendered quanta since the engine is created */
+    uint64_t getQuantumCount() const { return m_quanta.load( std::memory_order_relaxed ); }
+
+private:
+    typedef struct Stream
+    {
+        explicit Stream(uint32_t bufferSize): buffer( bufferSize ) {}
+
+        VgmFile file;
+        VgmPcmRingBuffer buffer;
+        /** State of the stream: VGM_STREAM_* */
+        std::atomic<uint8_t> state{ 0 };
+    } Stream;
+
+    std::vector<std::unique_ptr<Stream>> m_streams;
+    std::vector<std::thread> m_threads;
+    uint32_t m_quantum;
+    /** Number of streams, taken by thread at once */
+    int m_groupSize = 1;
+    bool m_lanes = true;
+    std::atomic<bool> m_stop{ false };
+    std::atomic<uint64_t> m_quanta{ 0 };
+    /** Start of the next search for a stream, so streams with equal data are taken in turn */
+    std::atomic<uint32_t> m_cursor{ 0 };
+
+    void work();
+    int takeStream();
+    void renderGroup(Stream *const *group, int count);
+};
@@ -0,0 +1,187 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+    Binary trace is compiled in only if VGM_DECODER_TRACE is defined to 1.
+    Trace records are written to the buffer, attached to VgmFile object via
+    VgmFile::setTrace(), and can be read by another thread while decoding.
+*/
+#ifndef VGM_DECODER_TRACE
+#define VGM_DECODER_TRACE 0
+#endif
+
+/** Trace event categories, each can be enabled separately */
+enum
+{
+    VGM_TRACE_CATEGORY_FILE = 0,
+    VGM_TRACE_CATEGORY_COMMAND = 1,
+    VGM_TRACE_CATEGORY_CPU = 2,
+    VGM_TRACE_CATEGORY_MEMORY = 3,
+};
+
+#define VGM_TRACE_EVENT(category, index) ( ((category) << 8) | (index) )
+
+/** Trace events, high byte of the event id is category */
+enum
+{
+    /** arg1 - block samples, arg2 - samples played */
+    VGM_TRACE_PCM_BLOCK    = VGM_TRACE_EVENT( VGM_TRACE_CATEGORY_FILE, 0 ),
+    /** arg1 - samples played */
+    VGM_TRACE_STOP         = VGM_TRACE_EVENT( VGM_TRACE_CATEGORY_FILE, 1 ),
+    /** arg0 - command, arg1 - command offset in vgm data */
+    VGM_TRACE_VGM_COMMAND  = VGM_TRACE_EVENT( VGM_TRACE_CATEGORY_COMMAND, 0 ),
+    /** arg1 - wait samples */
+    VGM_TRACE_VGM_WAIT     = VGM_TRACE_EVENT( VGM_TRACE_CATEGORY_COMMAND, 1 ),
+    /** arg0 - register, arg1 - value */
+    VGM_TRACE_AY_WRITE     = VGM_TRACE_EVENT( VGM_TRACE_CATEGORY_COMMAND, 2 ),
+    /** arg0 - register address, arg1 - value */
+    VGM_TRACE_APU_WRITE    = VGM_TRACE_EVENT( VGM_TRACE_CATEGORY_COMMAND, 3 ),
+    /** arg0 - opcode | flags << 8, arg1 - pc, arg2 - sp << 24 | a << 16 | x << 8 | y */
+    VGM_TRACE_CPU_STEP     = VGM_TRACE_EVENT( VGM_TRACE_CATEGORY_CPU, 0 ),
+    /** arg0 - address, arg1 - value */
+    VGM_TRACE_MEMORY_READ  = VGM_TRACE_EVENT( VGM_TRACE_CATEGORY_MEMORY, 0 ),
+    /** arg0 - address, arg1 - value */
+    VGM_TRACE_MEMORY_WRITE = VGM_TRACE_EVENT( VGM_TRACE_CATEGORY_MEMORY, 1 ),
+};
+
+/** Single trace record, 16 bytes */
+typedef struct
+{
+    /** Time in microseconds since the trace buffer is created */
+    uint32_t timestamp;
+    /** One of VGM_TRACE_* events */
+    uint16_t event;
+    uint16_t arg0;
+    uint32_t arg1;
+    uint32_t arg2;
+} VgmTraceRecord;
+
+/** Header of binary trace file, followed by VgmTraceRecord records */
+typedef struct
+{
+    /** "VGMT" */
+    uint32_t ident;
+    uint16_t version;
+    uint16_t recordSize;
+} VgmTraceFileHeader;
+
+#define VGM_TRACE_FILE_IDENT 0x544D4756
+
+/**
+ * Lock-free single producer / single consumer ring buffer of trace records.
+ * Decoder thread writes records, while any other thread can read them.
+ * If the buffer is full, new records are dropped and counted.
+ */
+class VgmTraceBuffer
+{
+public:
+    /** Creates buffer for specified number of records, rounded up to power of 2 */
+    explicit VgmTraceBuffer(uint32_t records = 4096);
+    ~VgmTraceBuffer();
+
+    VgmTraceBuffer(const VgmTraceBuffer &) = delete;
+    VgmTraceBuffer &operator=(const VgmTraceBuffer &) = delete;
+
+    /** Enables categories by bit mask (1 << VGM_TRACE_CATEGORY_*). All are enabled by default */
+    void setMask(uint32_t mask) { m_mask = mask; }
+
+    /** Writes record to the buffer. Called by decoder thread only */
+    void push(uint16_t event, uint16_t arg0, uint32_t arg1, uint32_t arg2)
+    {
+        if ( !(m_mask & (1 << (event >> 8))) )
+        {
+            return;
+        }
+        uint32_t head = m_head.load( std::memory_order_relaxed );
+        if ( head - m_tail.load( std::memory_order_acquire ) > m_capacityMask )
+        {
+            m_dropped.fetch_add( 1, std::memory_order_relaxed );
+            return;
+        }
+        VgmTraceRecord &record = m_records[ head & m_capacityMask ];
+        record.timestamp = getTimestamp();
+        record.event = event;
+        record.arg0 = arg0;
+        record.arg1 = arg1;
+        record.arg2 = arg2;
+        m_head.store( head + 1, std::memory_order_release );
+    }
+
+    /** Reads up to count records from the buffer and returns number of read records */
+    int pop(VgmTraceRecord *records, int count);
+
+    /** Returns number of records dropped due to buffer overflow */
+    uint32_t getDropped() const { return m_dropped.load( std::memory_order_relaxed ); }
+
+    /** Returns buffer, which decoder in current thread writes to, or nullptr */
+    static VgmTraceBuffer *current() { return s_current; }
+
+    /** Sets buffer to write records in current thread to, returns previous one */
+    static VgmTraceBuffer *setCurrent(VgmTraceBuffer *buffer);
+
+    /**
+     * Formats record as text line to specified buffer.
+     * Returns number of characters written, same as snprintf().
+     */
+    static int format(const VgmTraceRecord &record, char *text, int size);
+
+    /** Formats record event and arguments only, without timestamp */
+    static int formatEvent(const VgmTraceRecord &record, char *text, int size);
+
+private:
+    VgmTraceRecord *m_records = nullptr;
+    uint32_t m_capacityMask = 0;
+    uint32_t m_mask = 0xFFFFFFFF;
+    uint64_t m_startTime = 0;
+    alignas(64) std::atomic<uint32_t> m_head{0};
+    alignas(64) std::atomic<uint32_t> m_tail{0};
+    std::atomic<uint32_t> m_dropped{0};
+
+    static thread_local VgmTraceBuffer *s_current;
+
+    uint32_t getTimestamp();
+};
+
+/** Writes trace record to the buffer of current thread if any */
+static inline void vgmTrace(uint16_t event, uint16_t arg0, uint32_t arg1 = 0, uint32_t arg2 = 0)
+{
+    VgmTraceBuffer *buffer = VgmTraceBuffer::current();
+    if ( buffer ) buffer->push( event, arg0, arg1, arg2 );
+}
+
+/** Attaches trace buffer to current thread for the life time of the object */
+class VgmTraceScope
+{
+public:
+    explicit VgmTraceScope(VgmTraceBuffer *buffer): m_prev( VgmTraceBuffer::setCurrent( buffer ) ) {}
+    ~VgmTraceScope() { VgmTraceBuffer::setCurrent( m_prev ); }
+
+private:
+    VgmTraceBuffer *m_prev;
+};
@@ -23,16 +23,42 @@ SOFTWARE.
 */
 
 #include "vgm_file.h"
+#include "vgm_pcm_cache.h"
+#include "vgm_pcm_pipeline.h"
+#include "vgm_trace.h"
+#include "data_source.h"
 #include "formats/wav_format.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
 #ifndef AUDIO_PLAYER
 #define AUDIO_PLAYER 0
 #endif
 
+/** Ring buffer size of wav writer, and size of single write to output file */
+#define WAV_BUFFER_SIZE (256 * 1024)
+#define WAV_WRITE_SIZE (64 * 1024)
+
+/** Default size limit of rendered pcm cache in megabytes */
+#define PCM_CACHE_SIZE 1024
+
+/** Ring buffer size and prefill of audio player, about 1 second and 200 milliseconds */
+#define PLAYER_BUFFER_SIZE (44100 * 4)
+#define PLAYER_PREFILL (44100 * 4 / 5)
+
 #if AUDIO_PLAYER
 #ifdef _WIN32
 #include <SDL.h>
@@ -41,29 +67,81 @@ SOFTWARE.
 #endif
 #endif
 
-int readFile(const char *name, uint8_t **buffer )
+static VgmTraceBuffer *s_trace = nullptr;
+static FILE *s_traceFile = nullptr;
+static VgmPcmCache *s_cache = nullptr;
+
+static void flushTrace()
 {
-    FILE *fileptr;
-    int filelen;
+    VgmTraceRecord records[256];
+    int count;
+    while ( s_traceFile && (count = s_trace->pop( records, 256 )) > 0 )
+    {
+        fwrite( records, sizeof(VgmTraceRecord), count, s_traceFile );
+    }
+}
 
-    fileptr = fopen(name, "rb");
-    if ( fileptr == nullptr )
+static bool openTrace(const char *name, VgmFile *vgm)
+{
+    s_traceFile = fopen(name, "wb");
+    if ( s_traceFile == nullptr )
     {
-        return -1;
+        fprintf( stderr, "Failed to open file %s \n", name );
+        return false;
     }
-    fseek(fileptr, 0, SEEK_END);
-    filelen = ftell(fileptr);
-    rewind(fileptr);
-    *buffer = (uint8_t *)malloc(filelen);
-    fread(*buffer, filelen, 1, fileptr);
-    fclose(fileptr);
-    return filelen;
+    VgmTraceFileHeader header = { VGM_TRACE_FILE_IDENT, 1, sizeof(VgmTraceRecord) };
+    fwrite( &header, sizeof(header), 1, s_traceFile );
+    s_trace = new VgmTraceBuffer( 65536 );
+    vgm->setTrace( s_trace );
+    return true;
 }
 
-int writeFile(const char *name, VgmFile *vgm, int trackIndex)
+static void closeTrace(VgmFile *vgm)
+{
+    if ( s_traceFile == nullptr )
+    {
+        return;
+    }
+    vgm->setTrace( nullptr );
+    flushTrace();
+    if ( s_trace->getDropped() )
+    {
+        fprintf( stderr, "Warning. %u trace records are dropped\n", s_trace->getDropped() );
+    }
+    fclose( s_traceFile );
+    s_traceFile = nullptr;
+    delete s_trace;
+    s_trace = nullptr;
+}
+
+/** Copies cached pcm data to output file, returns false if the track is not cached */
+static bool copyCachedPcm(uint64_t key, FILE *fileptr)
+{
+    FileDataSource source( WAV_WRITE_SIZE );
+    if ( !s_cache->read( key, source ) )
+    {
+        return false;
+    }
+    std::vector<uint8_t> buffer( WAV_WRITE_SIZE );
+    for ( uint32_t offset = 0; offset < source.getSize(); )
+    {
+        uint32_t size = source.read( offset, buffer.data(), buffer.size() );
+        if ( !size )
+        {
+            break;
+        }
+        fwrite( buffer.data(), size, 1, fileptr );
+        offset += size;
+    }
+    return true;
+}
+
+/**
+ * Converts the track to wav file. If input data are resident in memory and pcm cache is
+ * opened, rendered pcm data are taken from the cache or added to it.
+ */
+int writeFile(const char *name, VgmFile *vgm, int trackIndex, DataSource *input = nullptr, bool *cached = nullptr)
 {
-    bool warningDisplayed = false;
-    uint8_t buffer[1024];
     FILE *fileptr;
 
     if ( trackIndex >= vgm->getTrackCount() )
@@ -85,33 +163,48 @@ int writeFile(const char *name, VgmFile *vgm, int trackIndex)
         0x61746164, 0
     };
     fwrite( &header, sizeof(header), 1, fileptr );
-    vgm->setMaxDuration( 90000 );
-    vgm->setFading( true );
-    vgm->setSampleFrequency( 44100 );
-    vgm->setTrack( trackIndex );
-    vgm->setVolume( 100 );
-    for(;;)
+    VgmPcmCacheParams params = { trackIndex, 44100, 100, true, true, 2, 90000, { VGM_SAMPLE_S16, 2 },
+                                 VGM_RESAMPLER_OFF, 0 };
+    bool useCache = s_cache && input && input->getData();
+    uint64_t key = useCache ? VgmPcmCache::makeKey( input->getData(), input->getSize(), params ) : 0;
+    bool hit = useCache && copyCachedPcm( key, fileptr );
+    if ( cached ) *cached = hit;
+    if ( !hit )
     {
-        int size = vgm->decodePcm(buffer, sizeof(buffer));
-        if ( size < 0 )
-        {
-            break;
-        }
-        for (int i = 0; i<sizeof(buffer); i+=2)
+        vgm->setMaxDuration( params.maxDuration );
+        vgm->setFading( params.fading );
+        vgm->setLoopDetection( params.loopDetection, params.loopCount );
+        vgm->setResampler( params.resamplerQuality, params.chipFrequency );
+        vgm->setSampleFrequency( params.sampleFrequency );
+        vgm->setTrack( trackIndex );
+        vgm->setVolume( params.volume );
+        vgm->setOutputFormat( params.format );
+        FILE *cacheFile = useCache ? s_cache->create( key ) : nullptr;
+        // Decoding thread fills the buffer, while this one writes data by large blocks
+        VgmPcmProducer producer( WAV_BUFFER_SIZE );
+        producer.start( vgm, 0 );
+        VgmPcmRingBuffer &ring = producer.getBuffer();
+        for(;;)
         {
-            // Convert unsigned PCM16 to signed PCM16
-            if ( *reinterpret_cast<uint16_t *>(buffer+i) == 65535 && !warningDisplayed )
+            producer.wait( WAV_WRITE_SIZE );
+            uint32_t size;
+            const uint8_t *data = ring.acquireRead( size );
+            if ( !size )
             {
-                warningDisplayed = true;
-                fprintf( stderr, "Warning. Melody is too loud, possible peak cuts\n" );
+                break;
             }
-            *reinterpret_cast<int16_t *>(buffer+i) = *reinterpret_cast<uint16_t *>(buffer+i) - 32768;
-        }
-        fwrite( buffer, size, 1, fileptr );
-        if ( size < 1024 )
-        {
-            break;
+            if ( size > WAV_WRITE_SIZE ) size = WAV_WRITE_SIZE;
+            fwrite( data, size, 1, fileptr );
+            if ( cacheFile ) fwrite( data, size, 1, cacheFile );
+            ring.commitRead( size );
+            flushTrace();
         }
+        producer.stop();
+        if ( cacheFile ) s_cache->commit( key, cacheFile );
+    }
+    if ( vgm->getClippedSamples() )
+    {
+        fprintf( stderr, "Warning. Melody is too loud, possible peak cuts\n" );
     }
     int totalSize = ftell( fileptr );
     header.subchunk2Size = totalSize - sizeof(header);
@@ -119,19 +212,339 @@ int writeFile(const char *name, VgmFile *vgm, int trackIndex)
     fseek(fileptr, 0, SEEK_SET);
     fwrite( &header, sizeof(header), 1, fileptr );
     fclose(fileptr);
+    return header.subchunk2Size;
+}
+
+typedef struct
+{
+    std::string input;
+    /** Output file name without extension */
+    std::string output;
+    /** Shared read-only input data, nullptr until the file is opened by the first job */
+    std::shared_ptr<MappedFileDataSource> source;
+    int track;
+    int trackCount;
+} BatchJob;
+
+/**
+ * Thread pool with work stealing: each worker takes jobs from the back of own queue,
+ * and steals jobs from the front of other queues, when own queue is empty.
+ */
+class BatchPool
+{
+public:
+    explicit BatchPool(int workers): m_queues( workers ) {}
+
+    void push(int worker, BatchJob &&job)
+    {
+        m_pending++;
+        std::lock_guard<std::mutex> lock( m_queues[worker].mutex );
+        m_queues[worker].jobs.push_back( std::move( job ) );
+    }
+
+    bool pop(int worker, BatchJob &job)
+    {
+        for ( size_t i = 0; i < m_queues.size(); i++ )
+        {
+            Queue &queue = m_queues[ (worker + i) % m_queues.size() ];
+            std::lock_guard<std::mutex> lock( queue.mutex );
+            if ( queue.jobs.empty() )
+            {
+                continue;
+            }
+            if ( i == 0 )
+            {
+                job = std::move( queue.jobs.back() );
+                queue.jobs.pop_back();
+            }
+            else
+            {
+                job = std::move( queue.jobs.front() );
+                queue.jobs.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /** Marks popped job as completed */
+    void done() { m_pending--; }
+
+    /** Returns true if all pushed jobs are completed */
+    bool finished() const { return m_pending == 0; }
+
+    int getWorkerCount() const { return m_queues.size(); }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<BatchJob> jobs;
+    };
+    std::vector<Queue> m_queues;
+    std::atomic<int> m_pending{0};
+};
+
+static std::mutex s_printMutex;
+static std::atomic<int> s_failedJobs{0};
+static std::atomic<uint64_t> s_batchBytes{0};
+
+static void runBatchJob(BatchPool &pool, int worker, VgmFile &file, BatchJob &job)
+{
+    auto start = std::chrono::steady_clock::now();
+    if ( !job.source )
+    {
+        // The first job for the file maps it, and adds jobs for the rest tracks
+        job.source = std::make_shared<MappedFileDataSource>();
+        if ( !job.source->open( job.input.c_str() ) || !file.open( job.source.get() ) )
+        {
+            std::lock_guard<std::mutex> lock( s_printMutex );
+            fprintf( stderr, "[FAIL] %s: failed to open or parse file\n", job.input.c_str() );
+            s_failedJobs++;
+            return;
+        }
+        job.trackCount = file.getTrackCount();
+        for ( int track = job.trackCount - 1; track > 0; track-- )
+        {
+            pool.push( worker, BatchJob{ job.input, job.output, job.source, track, job.trackCount } );
+        }
+    }
+    else if ( !file.open( job.source.get() ) )
+    {
+        std::lock_guard<std::mutex> lock( s_printMutex );
+        fprintf( stderr, "[FAIL] %s track %d: failed to open file\n", job.input.c_str(), job.track );
+        s_failedJobs++;
+        return;
+    }
+    std::string name = job.output;
+    if ( job.trackCount > 1 )
+    {
+        name += "-" + std::to_string( job.track );
+    }
+    name += ".wav";
+    bool cached = false;
+    int bytes = writeFile( name.c_str(), &file, job.track, job.source.get(), &cached );
+    file.close();
+    double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    std::lock_guard<std::mutex> lock( s_printMutex );
+    if ( bytes < 0 )
+    {
+        fprintf( stderr, "[FAIL] %s track %d\n", job.input.c_str(), job.track );
+        s_failedJobs++;
+        return;
+    }
+    s_batchBytes += bytes;
+    double duration = bytes / (44100.0 * 4);
+    fprintf( stderr, "[ OK ] %s track %d/%d -> %s: %.1fs audio in %.3fs (x%.0f), worker %d%s\n",
+             job.input.c_str(), job.track, job.trackCount, name.c_str(), duration, elapsed,
+             elapsed > 0 ? duration / elapsed : 0.0, worker, cached ? ", cached" : "" );
+}
+
+static void batchWorker(BatchPool &pool, int worker)
+{
+    VgmFile file;
+    BatchJob job;
+    while ( !pool.finished() )
+    {
+        if ( !pool.pop( worker, job ) )
+        {
+            // Other workers still run jobs, which can add new ones
+            std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+            continue;
+        }
+        runBatchJob( pool, worker, file, job );
+        job = BatchJob{};
+        pool.done();
+    }
+}
+
+static bool isSoundFile(const std::filesystem::path &path)
+{
+    std::string ext = path.extension().string();
+    return ext == ".vgm" || ext == ".vgz" || ext == ".nsf";
+}
+
+typedef struct
+{
+    std::string input;
+    /** Output path relative to output directory, without extension */
+    std::filesystem::path output;
+} BatchInput;
+
+static void addBatchInput(std::vector<BatchInput> &inputs, const char *arg)
+{
+    if ( arg[0] == '@' )
+    {
+        // List file with an input file name per line
+        FILE *list = fopen( arg + 1, "r" );
+        if ( list == nullptr )
+        {
+            fprintf( stderr, "Failed to open file %s \n", arg + 1 );
+            return;
+        }
+        char line[1024];
+        while ( fgets( line, sizeof(line), list ) )
+        {
+            line[ strcspn( line, "\r\n" ) ] = '\0';
+            if ( line[0] ) inputs.push_back( BatchInput{ line, std::filesystem::path( line ).stem() } );
+        }
+        fclose( list );
+        return;
+    }
+    std::error_code error;
+    if ( std::filesystem::is_directory( arg, error ) )
+    {
+        for ( const auto &entry: std::filesystem::recursive_directory_iterator( arg, error ) )
+        {
+            if ( entry.is_regular_file() && isSoundFile( entry.path() ) )
+            {
+                // Keep directory structure of the input directory
+                std::filesystem::path output = std::filesystem::relative( entry.path(), arg, error );
+                inputs.push_back( BatchInput{ entry.path().string(), output.replace_extension() } );
+            }
+        }
+        return;
+    }
+    inputs.push_back( BatchInput{ arg, std::filesystem::path( arg ).stem() } );
+}
+
+static int batchConvert(int argc, char *argv[])
+{
+    const char *outputDir = argv[0];
+    int workers = std::thread::hardware_concurrency();
+    std::vector<BatchInput> inputs;
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( !strcmp( argv[i], "--jobs" ) && i + 1 < argc )
+        {
+            workers = strtoul( argv[++i], nullptr, 10 );
+            continue;
+        }
+        addBatchInput( inputs, argv[i] );
+    }
+    if ( workers < 1 )
+    {
+        workers = 1;
+    }
+    std::error_code error;
+    std::filesystem::create_directories( outputDir, error );
+
+    auto start = std::chrono::steady_clock::now();
+    BatchPool pool( workers );
+    std::set<std::filesystem::path> outputs;
+    for ( size_t i = 0; i < inputs.size(); i++ )
+    {
+        std::filesystem::path output = std::filesystem::path( outputDir ) / inputs[i].output;
+        if ( !outputs.insert( output ).second )
+        {
+            // song.vgm and song.vgz are converted to song.wav and song.vgz.wav
+            output += std::filesystem::path( inputs[i].input ).extension();
+            outputs.insert( output );
+        }
+        std::filesystem::create_directories( output.parent_path(), error );
+        pool.push( i % workers, BatchJob{ inputs[i].input, output.string(), nullptr, 0, 1 } );
+    }
+    std::vector<std::thread> threads;
+    for ( int i = 0; i < workers; i++ )
+    {
+        threads.emplace_back( batchWorker, std::ref( pool ), i );
+    }
+    for ( auto &thread: threads )
+    {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    fprintf( stderr, "%zu files, %.1fs audio in %.3fs using %d workers, %d failed\n",
+             inputs.size(), s_batchBytes / (44100.0 * 4), elapsed, workers, s_failedJobs.load() );
+    return s_failedJobs ? -1 : 0;
+}
+
+static void printStats(const VgmFile &vgm)
+{
+    VgmStats stats;
+    if ( !vgm.getStats( stats ) )
+    {
+        return;
+    }
+    static const char *classes[VGM_STATS_COMMAND_CLASSES] = { "wait", "write", "data", "stream", "other" };
+    fprintf( stderr, "Commands:" );
+    for ( int i = 0; i < VGM_STATS_COMMAND_CLASSES; i++ )
+    {
+        fprintf( stderr, " %s %llu", classes[i], static_cast<unsigned long long>( stats.commands[i] ) );
+    }
+    fprintf( stderr, "\nCpu instructions: %llu\n", static_cast<unsigned long long>( stats.cpuInstructions ) );
+    fprintf( stderr, "Samples: rendered %llu, skipped %llu, emitted %llu\n",
+             static_cast<unsigned long long>( stats.samplesRendered ),
+             static_cast<unsigned long long>( stats.samplesSkipped ),
+             static_cast<unsigned long long>( stats.samplesEmitted ) );
+    fprintf( stderr, "Time, ms: decode %.3f (%llu blocks, max %.3f), render %.3f, output %.3f\n",
+             stats.decodeTime / 1e6, static_cast<unsigned long long>( stats.decodeBlockCalls ),
+             stats.maxDecodeTime / 1e6, stats.renderTime / 1e6, stats.outputTime / 1e6 );
+}
+
+static int printMemoryUsage()
+{
+    VgmMemoryUsage usage[16];
+    int count = VgmFile::getMemoryUsage( usage, 16 );
+    fprintf( stderr, "%-32s %8s %8s\n", "Object", "sizeof", "heap" );
+    for ( int i = 0; i < count; i++ )
+    {
+        fprintf( stderr, "%-32s %8u %8u\n", usage[i].name, usage[i].size, usage[i].heap );
+    }
+    fprintf( stderr, "Compact build: %s\n", VGM_DECODER_COMPACT ? "yes" : "no" );
+    return 0;
+}
+
+static int printTrackInfo(const char *name)
+{
+    MappedFileDataSource source;
+    VgmFile file;
+    if ( !source.open( name ) || !file.open( &source ) )
+    {
+        fprintf( stderr, "Failed to open or parse file %s \n", name );
+        return -1;
+    }
+    file.setLoopDetection( true );
+    static const char *chips[VGM_CHIP_COUNT] = { "AY-3-8910", "NES APU" };
+    for ( int track = 0; track < file.getTrackCount(); track++ )
+    {
+        VgmTrackInfo info;
+        if ( !file.analyze( track, info ) )
+        {
+            fprintf( stderr, "Track %d: analysis is not supported\n", track );
+            return -1;
+        }
+        fprintf( stderr, "Track %d: %.1fs%s, loop %.1fs, %u writes, peak %u writes/s\n", track,
+                 info.totalSamples / 44100.0, info.complete ? "" : "+", info.loopSamples / 44100.0,
+                 info.registerWrites, info.peakWriteRate );
+        for ( int i = 0; i < VGM_CHIP_COUNT; i++ )
+        {
+            if ( info.chips & (1 << i) )
+            {
+                fprintf( stderr, "    %s registers: %016llX\n", chips[i],
+                         static_cast<unsigned long long>( info.registers[i] ) );
+            }
+        }
+    }
     return 0;
 }
 
 #if AUDIO_PLAYER
 
-static bool s_stopped = false;
+static std::atomic<bool> s_stopped{ false };
+static std::atomic<uint32_t> s_underruns{ 0 };
 
 void getAudioCallback(void *udata, uint8_t *stream, int len)
 {
-    VgmFile *vgm = (VgmFile *)udata;
-    memset(stream, 0, len);
-    int size = vgm->decodePcm(stream, len);
-    s_stopped = size == 0;
+    VgmPcmProducer *producer = (VgmPcmProducer *)udata;
+    // Only copy decoded data here, missing samples are replaced with silence
+    uint32_t size = producer->read( stream, len );
+    memset( stream + size, 0, len - size );
+    if ( size < static_cast<uint32_t>(len) && !producer->isFinished() )
+    {
+        s_underruns++;
+    }
+    s_stopped = producer->isEmpty();
 }
 
 int playTrack(VgmFile *vgm, int trackIndex)
@@ -143,27 +556,37 @@ int playTrack(VgmFile *vgm, int trackIndex)
     spec.format = AUDIO_U16SYS;
     spec.samples = 1024;
     spec.callback = getAudioCallback;
-    spec.userdata = vgm;
+    VgmPcmProducer producer( PLAYER_BUFFER_SIZE );
+    spec.userdata = &producer;
 
     vgm->setMaxDuration( 90000 );
     vgm->setFading( true );
+    vgm->setLoopDetection( true );
     vgm->setSampleFrequency( 44100 );
     vgm->setTrack( trackIndex );
     vgm->setVolume( 100 );
     s_stopped = false;
+    s_underruns = 0;
 
     if ( SDL_OpenAudio(&spec, NULL) < 0 )
     {
         fprintf(stderr, "Couldn't open audio: %s\n", SDL_GetError());
         return -1;
     }
+    producer.start( vgm, PLAYER_PREFILL );
     SDL_PauseAudio(0);
     while ( !s_stopped )
     {
         SDL_Delay(100);
+        flushTrace();
     }
     SDL_CloseAudio();
+    producer.stop();
     SDL_Quit();
+    if ( s_underruns )
+    {
+        fprintf( stderr, "Warning. %u audio buffer underruns\n", s_underruns.load() );
+    }
     return 0;
 }
 #endif
@@ -171,12 +594,58 @@ int playTrack(VgmFile *vgm, int trackIndex)
 int main(int argc, char *argv[])
 {
     int trackIndex = 0;
+    const char *traceName = nullptr;
+    if ( argc > 1 && !strcmp( argv[1], "--memory" ) )
+    {
+        return printMemoryUsage();
+    }
+    if ( argc > 2 && !strcmp( argv[1], "--info" ) )
+    {
+        return printTrackInfo( argv[2] );
+    }
+    const char *cacheName = nullptr;
+    uint32_t cacheSize = PCM_CACHE_SIZE;
+    while ( argc > 2 && ( !strcmp( argv[1], "--cache" ) || !strcmp( argv[1], "--cache-size" ) ) )
+    {
+        if ( !strcmp( argv[1], "--cache" ) ) cacheName = argv[2];
+        else cacheSize = strtoul( argv[2], nullptr, 10 );
+        argc -= 2;
+        argv += 2;
+    }
+    VgmPcmCache cache;
+    if ( cacheName )
+    {
+        std::error_code error;
+        std::filesystem::create_directories( cacheName, error );
+        if ( !cache.open( cacheName, static_cast<uint64_t>( cacheSize ) << 20 ) )
+        {
+            fprintf( stderr, "Failed to open pcm cache %s \n", cacheName );
+            return -1;
+        }
+        s_cache = &cache;
+    }
+    if ( argc > 2 && !strcmp( argv[1], "--batch" ) )
+    {
+        return batchConvert( argc - 2, argv + 2 );
+    }
+    if ( argc > 2 && !strcmp( argv[1], "--trace" ) )
+    {
+        traceName = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
     if (argc < 3)
     {
         fprintf(stderr, "Converts NSF or VGM files to wav data\n");
-        fprintf(stderr, "Usage: vgm2pcm input output [track_index]\n");
+        fprintf(stderr, "Usage: vgm2pcm [--cache cache_dir [--cache-size MB]] [--trace trace_file] input output [track_index]\n");
         #if AUDIO_PLAYER
-        fprintf(stderr, "Usage: vgm2pcm input play [track_index]\n");
+        fprintf(stderr, "Usage: vgm2pcm [--trace trace_file] input play [track_index]\n");
+        #endif
+        fprintf(stderr, "Usage: vgm2pcm [--cache cache_dir [--cache-size MB]] --batch output_dir [--jobs N] input|directory|@list ...\n");
+        fprintf(stderr, "Usage: vgm2pcm --info input\n");
+        fprintf(stderr, "Usage: vgm2pcm --memory\n");
+        #if !VGM_DECODER_TRACE
+        fprintf(stderr, "Note: trace records are written only if built with VGM_DECODER_TRACE=1\n");
         #endif
         return -1;
     }
@@ -184,19 +653,22 @@ int main(int argc, char *argv[])
     {
         trackIndex = strtoul(argv[3], nullptr, 10);
     }
-    uint8_t *data;
-    int size = readFile( argv[1], &data );
-    if ( size < 0 )
+    MappedFileDataSource source;
+    if ( !source.open( argv[1] ) )
     {
         fprintf( stderr, "Failed to open file %s \n", argv[1] );
         return -1;
     }
     VgmFile file;
-    if (!file.open(data, size))
+    if (!file.open(&source))
     {
         fprintf( stderr, "Failed to parse vgm data %s \n", argv[1] );
         return -1;
     }
+    if ( traceName && !openTrace( traceName, &file ) )
+    {
+        return -1;
+    }
     #if AUDIO_PLAYER
     if ( !strcmp( argv[2], "play" ) )
     {
@@ -204,10 +676,13 @@ int main(int argc, char *argv[])
     }
     else
     #endif
-    if ( writeFile( argv[2], &file, trackIndex ) < 0 )
+    if ( writeFile( argv[2], &file, trackIndex, &source ) < 0 )
     {
+        closeTrace( &file );
         return -1;
     }
+    closeTrace( &file );
+    printStats( file );
     fprintf(stderr, "DONE\n");
     return 0;
 }
@@ -24,9 +24,19 @@ SOFTWARE.
 
 #include "chips/ay-3-8910.h"
 
+#if VGM_DECODER_AY38910
+
 #include <stdint.h>
 #include <stdlib.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AY38910_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define AY38910_NEON 1
+#include <arm_neon.h>
+#endif
+
 #define AY38910_DEBUG 1
 
 #if AY38910_DEBUG && !defined(VGM_DECODER_LOGGER)
@@ -37,6 +47,15 @@ SOFTWARE.
 
 #define YM2149_PIN26_LOW   (0x10)
 
+/** Number of samples to emulate one by one, when output changes on every sample */
+#define AY38910_DENSE_RUN  (16)
+
+/**
+ * The same for AY38910Lanes: chips of the group enter and leave the kernel at different
+ * samples, so longer run keeps more chips in every kernel call
+ */
+#define AY38910_LANES_RUN  (64)
+
 /*
 
 Normalized voltage
@@ -60,14 +79,14 @@ Normalized voltage
 
  */
 
-static uint16_t ay8910LevelTable[16] =
+static constexpr uint16_t ay8910Voltage[16] =
 {
 0,	183,	408,	683,	1020,	1433,	1939,	2558,	3317,	4246,	5385,	6779,	8487,	10579,	13142,	16281,
 /*    2345,  3017,  3945,  4820,  5985,  7190,  8590,  10600,
     11370, 12890, 13620, 14275, 14760, 15090, 15350, 15950,*/
 };
 
-static uint16_t ym2149LevelTable[32] =
+static constexpr uint16_t ym2149Voltage[32] =
 {
 0,	81,	171,	270,	380,	501,	635,	783,
 947,	1128,	1327,	1548,	1793,	2062,	2361,	2690,
@@ -75,6 +94,29 @@ static uint16_t ym2149LevelTable[32] =
 7746,	8642,	9632,	10726,	11936,	13272,	14749,	16382,
 };
 
+template <int N>
+struct AY38910LevelTable
+{
+    uint16_t level[N];
+};
+
+/** Scales normalized voltages to output levels of single channel */
+template <int N>
+static constexpr AY38910LevelTable<N> makeLevelTable(const uint16_t (&voltage)[N])
+{
+    AY38910LevelTable<N> table{};
+    for (int i = 0; i < N; i++)
+    {
+        uint32_t vol = static_cast<uint32_t>( voltage[i] ) * 60 / 32;
+        table.level[i] = vol > 65535 ? 65535 : vol;
+    }
+    return table;
+}
+
+// Level tables are constant, so they can be placed to flash memory on embedded systems
+static constexpr AY38910LevelTable<16> ay8910LevelTable = makeLevelTable( ay8910Voltage );
+static constexpr AY38910LevelTable<32> ym2149LevelTable = makeLevelTable( ym2149Voltage );
+
 enum
 {
 /*
@@ -138,6 +180,8 @@ void AY38910::setType( uint8_t chipType, uint8_t flags )
 {
     m_chipType = chipType;
     m_flags = flags;
+    // Level table depends on chip type, so it must be ready even if volume is never set
+    calcVolumeTables();
     reset();
 }
 
@@ -150,7 +194,8 @@ void AY38910::setFrequency( uint32_t frequency )
 void AY38910::setSampleFrequency( uint32_t sampleFrequency )
 {
     m_sampleFrequency = sampleFrequency;
-    reset();
+    // Registers are kept, so sample frequency can be changed after the chip is programmed
+    calcFrequencyScales();
 }
 
 void AY38910::setVolume(uint16_t volume)
@@ -161,29 +206,13 @@ void AY38910::setVolume(uint16_t volume)
 
 void AY38910::calcVolumeTables()
 {
-    if ( m_chipType & 0xF0 )
-    {
-        for (int i = 0; i < 32; i++)
-        {
-            uint32_t vol = static_cast<uint32_t>( ym2149LevelTable[i] ) * m_userVolume * 60 / (100 * 32);
-            if ( vol > 65535 ) vol = 65535;
-            m_levelTable[i] = vol;
-        }
-    }
-    else
-    {
-        for (int i = 0; i < 16; i++)
-        {
-            uint32_t vol = static_cast<uint32_t>( ay8910LevelTable[i] ) * m_userVolume * 60 / (100 * 32);
-            if ( vol > 65535 ) vol = 65535;
-            m_levelTable[i] = vol;
-        }
-    }
+    m_levelTable = ( m_chipType & 0xF0 ) ? ym2149LevelTable.level : ay8910LevelTable.level;
+    // User volume is applied to mixed level, 100 means 1.0 gain
+    m_gain = static_cast<uint32_t>( m_userVolume ) * 65536 / 100;
 }
 
-void AY38910::reset()
+void AY38910::calcFrequencyScales()
 {
-    m_envStepMask = ( m_chipType & 0xF0 ) ? 0x1F: 0x0F;
     m_toneFrequencyScale = (m_frequency / m_sampleFrequency); // * 16
     m_envFrequencyScale = (m_frequency / m_sampleFrequency);  // * 256
     if ( !( m_chipType & 0xF0 ) )
@@ -195,7 +224,12 @@ void AY38910::reset()
     {
         m_envFrequencyScale /= 2;
     }
+}
 
+void AY38910::reset()
+{
+    m_envStepMask = ( m_chipType & 0xF0 ) ? 0x1F: 0x0F;
+    calcFrequencyScales();
     for (int i=0; i<=R_ENVELOPE; i++) write(i, 0);
 }
 
@@ -204,17 +238,17 @@ uint16_t AY38910::read(uint8_t reg)
     switch (reg)
     {
     case FTR_A:
-        return (m_period[CHANNEL_A] >> 4) & 0xFF;
+        return (m_tone.period[CHANNEL_A] >> 4) & 0xFF;
     case CTR_A:
-        return (m_period[CHANNEL_A] >> 12) & 0x0F;
+        return (m_tone.period[CHANNEL_A] >> 12) & 0x0F;
     case FTR_B:
-        return (m_period[CHANNEL_B] >> 4) & 0xFF;
+        return (m_tone.period[CHANNEL_B] >> 4) & 0xFF;
     case CTR_B:
-        return (m_period[CHANNEL_B] >> 12) & 0x0F;
+        return (m_tone.period[CHANNEL_B] >> 12) & 0x0F;
     case FTR_C:
-        return (m_period[CHANNEL_C] >> 4) & 0xFF;
+        return (m_tone.period[CHANNEL_C] >> 4) & 0xFF;
     case CTR_C:
-        return (m_period[CHANNEL_C] >> 12) & 0x0F;
+        return (m_tone.period[CHANNEL_C] >> 12) & 0x0F;
     case NPR:
         return (m_periodNoise >> 4);
     case R_MIXER:
@@ -241,32 +275,37 @@ uint16_t AY38910::read(uint8_t reg)
 
 void AY38910::write(uint8_t reg, uint16_t value)
 {
-    LOGI( ">> reg: %d = 0x%02X\n", reg, value);
+    TRACE( VGM_TRACE_AY_WRITE, reg, value );
     switch (reg)
     {
     case FTR_A:
-        m_period[CHANNEL_A] = ((m_period[CHANNEL_A] & 0xf000) | (value << 4));
+        m_tone.period[CHANNEL_A] = ((m_tone.period[CHANNEL_A] & 0xf000) | (value << 4));
         break;
     case CTR_A:
-        m_period[CHANNEL_A] = (((value & 0x0f) << 12) | (m_period[CHANNEL_A] & 0xff0));
+        m_tone.period[CHANNEL_A] = (((value & 0x0f) << 12) | (m_tone.period[CHANNEL_A] & 0xff0));
         break;
     case FTR_B:
-        m_period[CHANNEL_B] = ((m_period[CHANNEL_B] & 0xf000) | (value << 4));
+        m_tone.period[CHANNEL_B] = ((m_tone.period[CHANNEL_B] & 0xf000) | (value << 4));
         break;
     case CTR_B:
-        m_period[CHANNEL_B] = (((value & 0x0f) << 12) | (m_period[CHANNEL_B] & 0xff0));
+        m_tone.period[CHANNEL_B] = (((value & 0x0f) << 12) | (m_tone.period[CHANNEL_B] & 0xff0));
         break;
     case FTR_C:
-        m_period[CHANNEL_C] = ((m_period[CHANNEL_C] & 0xf000) | (value << 4));
+        m_tone.period[CHANNEL_C] = ((m_tone.period[CHANNEL_C] & 0xf000) | (value << 4));
         break;
     case CTR_C:
-        m_period[CHANNEL_C] = (((value & 0x0f) << 12) | (m_period[CHANNEL_C] & 0xff0));
+        m_tone.period[CHANNEL_C] = (((value & 0x0f) << 12) | (m_tone.period[CHANNEL_C] & 0xff0));
         break;
     case NPR:
         m_periodNoise = (value & 0x1f) << 4;
         break;
     case R_MIXER:
         m_mixer = value;
+        for (int i=0; i<3; i++)
+        {
+            m_tone.toneEnable[i] = ((value >> i) & 1) ? 0x00000000 : 0xFFFFFFFF;
+            m_tone.noiseEnable[i] = ((value >> (3 + i)) & 1) ? 0x00000000 : 0xFFFFFFFF;
+        }
         break;
 
     case R_AMP_A:
@@ -275,10 +314,10 @@ void AY38910::write(uint8_t reg, uint16_t value)
     {
         uint8_t channel = reg - R_AMP_A;
         m_ampR[channel] = value;
-        m_amplitude[channel] = (value & 0x0f);
+        m_tone.amplitude[channel] = (value & 0x0f);
         // For YM2149 type chips there 32 levels instead of 16
-        if ( m_chipType & 0xF0 ) m_amplitude[channel] <<= 1;
-        m_useEnvelope[channel] = ((value & 0x10) != 0);
+        if ( m_chipType & 0xF0 ) m_tone.amplitude[channel] <<= 1;
+        m_tone.useEnvelope[channel] = (value & 0x10) ? 0xFFFFFFFF : 0x00000000;
         break;
     }
     case R_FPC_E:
@@ -309,32 +348,116 @@ void AY38910::write(uint8_t reg, uint16_t value)
     }
 }
 
-uint32_t AY38910::getSample()
+/**
+ * Returns number of samples till next counter overflow, including the sample,
+ * where overflow happens. Returns UINT32_MAX if counter never overflows.
+ */
+static inline uint32_t edgeDistance(uint32_t counter, uint32_t period, uint32_t scale)
 {
-    for (int i=0; i<3; i++)
+    if ( counter + scale >= period )
     {
-        m_counter[i] += m_toneFrequencyScale;
-        if (m_counter[i] >= m_period[i])
-        {
-            m_channelOutput[i] = !m_channelOutput[i];
-            m_counter[i] = 0;
-        }
+        return 1;
+    }
+    if ( !scale )
+    {
+        return UINT32_MAX;
+    }
+    return (period - counter + scale - 1) / scale;
+}
+
+/**
+ * Advances counter by specified number of samples and returns number of
+ * counter overflows happened.
+ */
+static inline uint32_t advanceCounter(uint32_t &counter, uint32_t period, uint32_t scale, uint32_t samples)
+{
+    uint32_t first = edgeDistance( counter, period, scale );
+    if ( samples < first )
+    {
+        counter += samples * scale;
+        return 0;
     }
+    samples -= first;
+    counter = 0;
+    uint32_t cycle = edgeDistance( 0, period, scale );
+    if ( cycle == UINT32_MAX )
+    {
+        return 1;
+    }
+    counter = (samples % cycle) * scale;
+    return 1 + samples / cycle;
+}
+
+void AY38910::stepNoise()
+{
+    m_counterNoise = 0;
+    m_noiseRecalc = !m_noiseRecalc;
+    if ( m_noiseRecalc )
+    {
+        // The Random Number Generator of the 8910 is a 17-bit shift
+        // register. The input to the shift register is bit0 XOR bit3
+        // (bit0 is the output).
+        m_rng ^= (((m_rng & 1) ^ ((m_rng >> 3) & 1)) << 17);
+        m_rng >>= 1;
+        m_noiseHigh = !!(m_rng & 1);
+    }
+}
+
+void AY38910::stepEnvelope()
+{
+    m_counterEnv = 0;
+    m_envVolume += m_attack ? 1: -1;
+    if ( m_envVolume > m_envStepMask ) // if overflow happened, we reached the boundary: low or high
+    {
+        m_holding = m_hold;
+        // step back
+        m_envVolume -= m_attack ? 1: -1;
+        if ( !m_continue ) m_envVolume = 0;
+        else if ( m_alternate && m_hold ) m_envVolume ^= m_envStepMask;
+        else if ( !m_hold && !m_alternate ) m_envVolume ^= m_envStepMask;
+        else if ( !m_hold && m_alternate ) m_attack = !m_attack;
+    }
+}
+
+/** Applies user volume gain to sum of channel levels, and returns stereo sample */
+static inline uint32_t packLevel(uint32_t level, uint32_t gain)
+{
+    if ( gain != 65536 ) level = ( static_cast<uint64_t>( level ) * gain ) >> 16;
+    // Left and right channels have the same level until stereo mode is supported
+    if ( level > 65535 ) level = 65535;
+    return (level<<16) | level;
+}
+
+uint32_t AY38910::mixLevels(const uint32_t *index)
+{
+    uint32_t level = static_cast<uint32_t>(m_levelTable[index[CHANNEL_A]]) +
+                     m_levelTable[index[CHANNEL_B]] +
+                     m_levelTable[index[CHANNEL_C]];
+    return packLevel( level, m_gain );
+}
 
+uint32_t AY38910::mixChannels()
+{
+    uint32_t index[3];
+    uint32_t noise = m_noiseHigh ? 0xFFFFFFFF : 0x00000000;
+    for(int chan=0; chan<3; chan++)
+    {
+        // Channel is enabled if tone is enabled and high, or noise is enabled and high
+        uint32_t enabled = ( m_tone.toneEnable[chan] & m_tone.output[chan] ) |
+                           ( m_tone.noiseEnable[chan] & noise );
+        // TODO: Evelope must have it's own table
+        uint32_t volume = m_tone.useEnvelope[chan] ? m_envVolume : m_tone.amplitude[chan];
+        index[chan] = enabled & volume;
+    }
+    return mixLevels( index );
+}
+
+void AY38910::updateNoiseAndEnvelope()
+{
     m_counterNoise += m_toneFrequencyScale;
     if (m_counterNoise >= m_periodNoise)
     {
-        m_counterNoise = 0;
-        m_noiseRecalc = !m_noiseRecalc;
-        if ( m_noiseRecalc )
-        {
-            // The Random Number Generator of the 8910 is a 17-bit shift
-            // register. The input to the shift register is bit0 XOR bit3
-            // (bit0 is the output).
-            m_rng ^= (((m_rng & 1) ^ ((m_rng >> 3) & 1)) << 17);
-            m_rng >>= 1;
-            m_noiseHigh = !!(m_rng & 1);
-        }
+        stepNoise();
     }
 
     if ( !m_holding )
@@ -346,45 +469,1062 @@ uint32_t AY38910::getSample()
             // tone counter, so double the envelope period
             if (m_counterEnv >= m_periodE)
             {
-                m_counterEnv = 0;
-                m_envVolume += m_attack ? 1: -1;
-                if ( m_envVolume > m_envStepMask ) // if overflow happened, we reached the boundary: low or high
+                stepEnvelope();
+            }
+        }
+    }
+}
+
+uint32_t AY38910::getSample()
+{
+    for (int i=0; i<3; i++)
+    {
+        m_tone.counter[i] += m_toneFrequencyScale;
+        if (m_tone.counter[i] >= m_tone.period[i])
+        {
+            m_tone.output[i] = ~m_tone.output[i];
+            m_tone.counter[i] = 0;
+        }
+    }
+    updateNoiseAndEnvelope();
+    return mixChannels();
+}
+
+void AY38910::renderDenseScalar(uint32_t *outBuffer, int samples)
+{
+    while ( samples-- > 0 )
+    {
+        *outBuffer++ = getSample();
+    }
+}
+
+#if AY38910_SSE2
+void AY38910::renderDenseSse2(uint32_t *outBuffer, int samples)
+{
+    // Lane 3 is not used, it is kept unchanged, so the state is the same as after scalar kernel
+    const __m128i used = _mm_set_epi32( 0, -1, -1, -1 );
+    const __m128i scale = _mm_set_epi32( 0, m_toneFrequencyScale, m_toneFrequencyScale, m_toneFrequencyScale );
+    // Periods and counters never exceed 0x7FFFFFFF, so signed comparison can be used
+    const __m128i period = _mm_load_si128( reinterpret_cast<const __m128i *>(m_tone.period) );
+    const __m128i amplitude = _mm_load_si128( reinterpret_cast<const __m128i *>(m_tone.amplitude) );
+    const __m128i useEnvelope = _mm_load_si128( reinterpret_cast<const __m128i *>(m_tone.useEnvelope) );
+    const __m128i toneEnable = _mm_load_si128( reinterpret_cast<const __m128i *>(m_tone.toneEnable) );
+    const __m128i noiseEnable = _mm_load_si128( reinterpret_cast<const __m128i *>(m_tone.noiseEnable) );
+    __m128i counter = _mm_load_si128( reinterpret_cast<const __m128i *>(m_tone.counter) );
+    __m128i output = _mm_load_si128( reinterpret_cast<const __m128i *>(m_tone.output) );
+    alignas(16) uint32_t index[4];
+    while ( samples-- > 0 )
+    {
+        counter = _mm_add_epi32( counter, scale );
+        __m128i overflow = _mm_andnot_si128( _mm_cmpgt_epi32( period, counter ), used );
+        output = _mm_xor_si128( output, overflow );
+        counter = _mm_andnot_si128( overflow, counter );
+
+        updateNoiseAndEnvelope();
+
+        __m128i noise = _mm_set1_epi32( m_noiseHigh ? -1 : 0 );
+        __m128i enabled = _mm_or_si128( _mm_and_si128( toneEnable, output ),
+                                        _mm_and_si128( noiseEnable, noise ) );
+        __m128i volume = _mm_or_si128( _mm_and_si128( useEnvelope, _mm_set1_epi32( m_envVolume ) ),
+                                       _mm_andnot_si128( useEnvelope, amplitude ) );
+        _mm_store_si128( reinterpret_cast<__m128i *>(index), _mm_and_si128( enabled, volume ) );
+        *outBuffer++ = mixLevels( index );
+    }
+    _mm_store_si128( reinterpret_cast<__m128i *>(m_tone.counter), counter );
+    _mm_store_si128( reinterpret_cast<__m128i *>(m_tone.output), output );
+}
+#endif
+
+#if AY38910_NEON
+void AY38910::renderDenseNeon(uint32_t *outBuffer, int samples)
+{
+    // Lane 3 is not used, it is kept unchanged, so the state is the same as after scalar kernel
+    const uint32_t usedLanes[4] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0 };
+    const uint32x4_t used = vld1q_u32( usedLanes );
+    const uint32x4_t scale = vandq_u32( vdupq_n_u32( m_toneFrequencyScale ), used );
+    const uint32x4_t period = vld1q_u32( m_tone.period );
+    const uint32x4_t amplitude = vld1q_u32( m_tone.amplitude );
+    const uint32x4_t useEnvelope = vld1q_u32( m_tone.useEnvelope );
+    const uint32x4_t toneEnable = vld1q_u32( m_tone.toneEnable );
+    const uint32x4_t noiseEnable = vld1q_u32( m_tone.noiseEnable );
+    uint32x4_t counter = vld1q_u32( m_tone.counter );
+    uint32x4_t output = vld1q_u32( m_tone.output );
+    alignas(16) uint32_t index[4];
+    while ( samples-- > 0 )
+    {
+        counter = vaddq_u32( counter, scale );
+        uint32x4_t overflow = vandq_u32( vcgeq_u32( counter, period ), used );
+        output = veorq_u32( output, overflow );
+        counter = vbicq_u32( counter, overflow );
+
+        updateNoiseAndEnvelope();
+
+        uint32x4_t noise = vdupq_n_u32( m_noiseHigh ? 0xFFFFFFFF : 0x00000000 );
+        uint32x4_t enabled = vorrq_u32( vandq_u32( toneEnable, output ),
+                                        vandq_u32( noiseEnable, noise ) );
+        uint32x4_t volume = vbslq_u32( useEnvelope, vdupq_n_u32( m_envVolume ), amplitude );
+        vst1q_u32( index, vandq_u32( enabled, volume ) );
+        *outBuffer++ = mixLevels( index );
+    }
+    vst1q_u32( m_tone.counter, counter );
+    vst1q_u32( m_tone.output, output );
+}
+#endif
+
+static bool isSimdSupported()
+{
+#if AY38910_SSE2 || AY38910_NEON
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if AY38910_SSE2
+#define AY38910_SIMD_KERNEL (&AY38910::renderDenseSse2)
+#elif AY38910_NEON
+#define AY38910_SIMD_KERNEL (&AY38910::renderDenseNeon)
+#else
+#define AY38910_SIMD_KERNEL (&AY38910::renderDenseScalar)
+#endif
+
+void (AY38910::*AY38910::s_denseKernel)(uint32_t *outBuffer, int samples) =
+    isSimdSupported() ? AY38910_SIMD_KERNEL : &AY38910::renderDenseScalar;
+
+void AY38910::enableSimd(bool enable)
+{
+    s_denseKernel = ( enable && isSimdSupported() ) ? AY38910_SIMD_KERNEL : &AY38910::renderDenseScalar;
+    AY38910Lanes::enableSimd( enable );
+}
+
+uint32_t AY38910::constantSpan(uint32_t maxSamples)
+{
+    uint32_t span = maxSamples;
+    bool noiseAudible = false;
+    bool envelopeAudible = false;
+    for (int i=0; i<3; i++)
+    {
+        // Channel with zero fixed amplitude produces zero level regardless of tone and noise state
+        if ( !m_tone.useEnvelope[i] && !m_tone.amplitude[i] )
+        {
+            continue;
+        }
+        envelopeAudible = envelopeAudible || m_tone.useEnvelope[i];
+        noiseAudible = noiseAudible || m_tone.noiseEnable[i];
+        if ( m_tone.toneEnable[i] )
+        {
+            uint32_t distance = edgeDistance( m_tone.counter[i], m_tone.period[i], m_toneFrequencyScale ) - 1;
+            if ( distance < span ) span = distance;
+        }
+    }
+    if ( noiseAudible )
+    {
+        uint32_t distance = edgeDistance( m_counterNoise, m_periodNoise, m_toneFrequencyScale ) - 1;
+        if ( distance < span ) span = distance;
+    }
+    if ( envelopeAudible && !m_holding && m_periodE > 0 )
+    {
+        uint32_t distance = edgeDistance( m_counterEnv, m_periodE, m_envFrequencyScale ) - 1;
+        if ( distance < span ) span = distance;
+    }
+    return span;
+}
+
+bool AY38910::isSilent() const
+{
+    for (int i=0; i<3; i++)
+    {
+        if ( !m_tone.toneEnable[i] && !m_tone.noiseEnable[i] )
+        {
+            continue;
+        }
+        if ( m_tone.useEnvelope[i] ? !m_holding || m_envVolume : m_tone.amplitude[i] != 0 )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AY38910::skipSamples(uint32_t samples)
+{
+    for (int i=0; i<3; i++)
+    {
+        if ( advanceCounter( m_tone.counter[i], m_tone.period[i], m_toneFrequencyScale, samples ) & 1 )
+        {
+            m_tone.output[i] = ~m_tone.output[i];
+        }
+    }
+
+    uint32_t noiseSteps = advanceCounter( m_counterNoise, m_periodNoise, m_toneFrequencyScale, samples );
+    uint32_t counterNoise = m_counterNoise;
+    while ( noiseSteps-- )
+    {
+        stepNoise();
+    }
+    m_counterNoise = counterNoise;
+
+    // Envelope may stop at any step, so process envelope steps one by one
+    while ( samples && !m_holding && m_periodE > 0 )
+    {
+        uint32_t distance = edgeDistance( m_counterEnv, m_periodE, m_envFrequencyScale );
+        if ( samples < distance )
+        {
+            m_counterEnv += samples * m_envFrequencyScale;
+            break;
+        }
+        samples -= distance;
+        stepEnvelope();
+    }
+}
+
+void AY38910::saveState(AY38910Snapshot &state) const
+{
+    state.tone = m_tone;
+    state.rng = m_rng;
+    state.periodNoise = m_periodNoise;
+    state.periodE = m_periodE;
+    state.counterNoise = m_counterNoise;
+    state.counterEnv = m_counterEnv;
+    state.mixer = m_mixer;
+    for (int i=0; i<3; i++) state.ampR[i] = m_ampR[i];
+    state.envelopeReg = m_envelopeReg;
+    state.envVolume = m_envVolume;
+    state.holding = m_holding;
+    state.hold = m_hold;
+    state.attack = m_attack;
+    state.continueFlag = m_continue;
+    state.alternate = m_alternate;
+    state.noiseRecalc = m_noiseRecalc;
+    state.noiseHigh = m_noiseHigh;
+}
+
+void AY38910::loadState(const AY38910Snapshot &state)
+{
+    m_tone = state.tone;
+    m_rng = state.rng;
+    m_periodNoise = state.periodNoise;
+    m_periodE = state.periodE;
+    m_counterNoise = state.counterNoise;
+    m_counterEnv = state.counterEnv;
+    m_mixer = state.mixer;
+    for (int i=0; i<3; i++) m_ampR[i] = state.ampR[i];
+    m_envelopeReg = state.envelopeReg;
+    m_envVolume = state.envVolume;
+    m_holding = state.holding;
+    m_hold = state.hold;
+    m_attack = state.attack;
+    m_continue = state.continueFlag;
+    m_alternate = state.alternate;
+    m_noiseRecalc = state.noiseRecalc;
+    m_noiseHigh = state.noiseHigh;
+}
+
+void AY38910::renderBlock(uint32_t *outBuffer, int samples)
+{
+    while ( samples > 0 )
+    {
+        // The output changes only when some audible counter overflows, so fill
+        // constant level till that moment and emulate edge sample only.
+        uint32_t span = constantSpan( samples );
+        if ( span )
+        {
+            uint32_t sample = mixChannels();
+            for (uint32_t i = 0; i < span; i++)
+            {
+                *outBuffer++ = sample;
+            }
+            skipSamples( span );
+            samples -= span;
+        }
+        else
+        {
+            // Counters overflow on every sample, so skip searching for the edges for a while
+            int count = samples < AY38910_DENSE_RUN ? samples : AY38910_DENSE_RUN;
+            (this->*s_denseKernel)( outBuffer, count );
+            outBuffer += count;
+            samples -= count;
+            continue;
+        }
+        if ( samples > 0 )
+        {
+            *outBuffer++ = getSample();
+            samples--;
+        }
+    }
+}
+
+/** Row pointers of one AY38910Lanes channel for 4 chips, processed by the kernel */
+struct AY38910LaneChannel
+{
+    uint32_t *counter;
+    uint32_t *output;
+    const uint32_t *period;
+    const uint32_t *increment;
+    const uint32_t *mask;
+    const uint32_t *toneEnable;
+    const uint32_t *noiseEnable;
+    const uint32_t *useEnvelope;
+    const uint32_t *ampLevel;
+};
+
+/** Row pointers of AY38910Lanes noise and envelope generators for 4 chips */
+struct AY38910LaneGenerators
+{
+    uint32_t *counterNoise;
+    uint32_t *rng;
+    uint32_t *noiseRecalc;
+    uint32_t *noise;
+    uint32_t *counterEnv;
+    uint32_t *envVolume;
+    uint32_t *envLevel;
+    const uint32_t *periodNoise;
+    const uint32_t *increment;
+    const uint32_t *mask;
+    const uint32_t *periodE;
+    const uint32_t *envIncrement;
+    const uint32_t *envActive;
+    const uint32_t *envDirection;
+    const uint32_t *envStepMask;
+    const uint16_t *const *levelTable;
+};
+
+/**
+ * Operations of AY38910Lanes kernel on 4 chips at once. Mask selects chips, which
+ * counters are advanced, counters of other chips may change, but don't overflow.
+ * Per sample data are passed as rows of AY38910_LANES values for every sample.
+ */
+struct AY38910ScalarOps
+{
+    static inline void copy(uint32_t *dst, const uint32_t *src)
+    {
+        for (int i = 0; i < 4; i++) dst[i] = src[i];
+    }
+
+    /**
+     * Advances noise and envelope generators from the sample till the specified number of
+     * samples, the same way as AY38910::updateNoiseAndEnvelope(), and stores noise output
+     * and level of envelope volume of every sample. Stops at the sample, where envelope of
+     * some chip reaches the boundary: boundary gets mask of such chips, their volume is left
+     * unchanged, and envelope row of the sample is not stored. Returns the sample, the
+     * generators stopped at.
+     */
+    static inline uint32_t generators(const AY38910LaneGenerators &g, uint32_t *noise, uint32_t *envLevel,
+                                      uint32_t sample, uint32_t samples, uint32_t *boundary)
+    {
+        for (; sample < samples; sample++)
+        {
+            uint32_t any = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                uint32_t counter = g.counterNoise[i] + g.increment[i];
+                if ( counter >= g.periodNoise[i] && g.mask[i] )
                 {
-                    m_holding = m_hold;
-                    // step back
-                    m_envVolume -= m_attack ? 1: -1;
-                    if ( !m_continue ) m_envVolume = 0;
-                    else if ( m_alternate && m_hold ) m_envVolume ^= m_envStepMask;
-                    else if ( !m_hold && !m_alternate ) m_envVolume ^= m_envStepMask;
-                    else if ( !m_hold && m_alternate ) m_attack = !m_attack;
+                    counter = 0;
+                    // The same as AY38910::stepNoise()
+                    g.noiseRecalc[i] ^= 0xFFFFFFFF;
+                    if ( g.noiseRecalc[i] )
+                    {
+                        g.rng[i] ^= (((g.rng[i] & 1) ^ ((g.rng[i] >> 3) & 1)) << 17);
+                        g.rng[i] >>= 1;
+                        g.noise[i] = ( g.rng[i] & 1 ) ? 0xFFFFFFFF : 0x00000000;
+                    }
                 }
+                g.counterNoise[i] = counter;
+                noise[sample * AY38910_LANES + i] = g.noise[i];
+                boundary[i] = 0;
+                counter = g.counterEnv[i] + g.envIncrement[i];
+                if ( counter >= g.periodE[i] && g.envActive[i] )
+                {
+                    counter = 0;
+                    uint32_t volume = g.envVolume[i] + g.envDirection[i];
+                    if ( volume & ~g.envStepMask[i] )
+                    {
+                        boundary[i] = 0xFFFFFFFF;
+                    }
+                    else
+                    {
+                        g.envVolume[i] = volume;
+                        g.envLevel[i] = g.levelTable[i][volume];
+                    }
+                }
+                g.counterEnv[i] = counter;
+                any |= boundary[i];
             }
+            if ( any ) break;
+            copy( envLevel + sample * AY38910_LANES, g.envLevel );
         }
+        return sample;
     }
 
-    uint32_t left = 0;
-    uint32_t right = 0;
+    /**
+     * Advances tone counters of 3 channels for the specified number of samples, mixes
+     * levels of the channels the same way as AY38910::mixChannels() on every sample, and
+     * stores the samples as rows. Level of disabled channel is 0 for both level tables.
+     */
+    static inline void channels(const AY38910LaneChannel *channel, const uint32_t *noise,
+                                const uint32_t *envLevel, const uint32_t *gain, uint32_t *packed,
+                                uint32_t samples)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            uint32_t counter[3];
+            uint32_t output[3];
+            for (int ch = 0; ch < 3; ch++)
+            {
+                counter[ch] = channel[ch].counter[i];
+                output[ch] = channel[ch].output[i];
+            }
+            for (uint32_t sample = 0; sample < samples; sample++)
+            {
+                uint32_t level = 0;
+                for (int ch = 0; ch < 3; ch++)
+                {
+                    counter[ch] += channel[ch].increment[i];
+                    if ( counter[ch] >= channel[ch].period[i] && channel[ch].mask[i] )
+                    {
+                        counter[ch] = 0;
+                        output[ch] ^= 0xFFFFFFFF;
+                    }
+                    uint32_t enabled = ( channel[ch].toneEnable[i] & output[ch] ) |
+                                       ( channel[ch].noiseEnable[i] & noise[sample * AY38910_LANES + i] );
+                    uint32_t volume = channel[ch].useEnvelope[i] ? envLevel[sample * AY38910_LANES + i]
+                                                                 : channel[ch].ampLevel[i];
+                    level += enabled & volume;
+                }
+                packed[sample * AY38910_LANES + i] = packLevel( level, gain[i] );
+            }
+            for (int ch = 0; ch < 3; ch++)
+            {
+                channel[ch].counter[i] = counter[ch];
+                channel[ch].output[i] = output[ch];
+            }
+        }
+    }
 
-    for(int chan=0; chan<3; chan++)
+    /** Copies sample rows to output buffers of active chips */
+    static inline void scatter(const uint32_t *packed, uint32_t *const *outBuffers, const uint32_t *mask,
+                               uint32_t samples)
     {
-// Two variant for calculating enable field. Both work
-//        bool enabled = ( ((m_mixer >> chan) & 1)  || m_channelOutput[chan] ) &&
-//                       ( ((m_mixer >> (3 + chan)) & 1) || m_noiseHigh );
-        bool enabled = ( ((m_mixer >> chan) & 1) == 0 && m_channelOutput[chan] ) ||
-                       ( ((m_mixer >> (3 + chan)) & 1) == 0 && m_noiseHigh );
-        if (m_useEnvelope[chan])
+        for (int i = 0; i < 4; i++)
         {
-            // TODO: Evelope must have it's own table
-            left += m_levelTable[enabled ? m_envVolume: 0];
-            right += m_levelTable[enabled ? m_envVolume: 0];
+            if ( !mask[i] ) continue;
+            for (uint32_t sample = 0; sample < samples; sample++)
+            {
+                outBuffers[i][sample] = packed[sample * AY38910_LANES + i];
+            }
         }
-        else
+    }
+};
+
+#if AY38910_SSE2
+struct AY38910Sse2Ops
+{
+    static inline __m128i load(const uint32_t *data) { return _mm_load_si128( reinterpret_cast<const __m128i *>(data) ); }
+
+    static inline void store(uint32_t *data, __m128i value) { _mm_store_si128( reinterpret_cast<__m128i *>(data), value ); }
+
+    static inline void copy(uint32_t *dst, const uint32_t *src) { store( dst, load( src ) ); }
+
+    static inline uint32_t generators(const AY38910LaneGenerators &g, uint32_t *noise, uint32_t *envLevel,
+                                      uint32_t sample, uint32_t samples, uint32_t *boundary)
+    {
+        const __m128i one = _mm_set1_epi32( 1 );
+        const __m128i zero = _mm_setzero_si128();
+        __m128i counterNoise = load( g.counterNoise );
+        __m128i rng = load( g.rng );
+        __m128i recalc = load( g.noiseRecalc );
+        __m128i noiseHigh = load( g.noise );
+        __m128i counterEnv = load( g.counterEnv );
+        __m128i volume = load( g.envVolume );
+        __m128i level = load( g.envLevel );
+        const __m128i periodNoise = load( g.periodNoise );
+        const __m128i increment = load( g.increment );
+        const __m128i mask = load( g.mask );
+        const __m128i periodE = load( g.periodE );
+        const __m128i envIncrement = load( g.envIncrement );
+        const __m128i envActive = load( g.envActive );
+        const __m128i direction = load( g.envDirection );
+        const __m128i outside = _mm_xor_si128( load( g.envStepMask ), _mm_set1_epi32( -1 ) );
+        for (; sample < samples; sample++)
+        {
+            // Periods and counters never exceed 0x7FFFFFFF, so signed comparison can be used
+            __m128i value = _mm_add_epi32( counterNoise, increment );
+            __m128i edge = _mm_andnot_si128( _mm_cmpgt_epi32( periodNoise, value ), mask );
+            counterNoise = _mm_andnot_si128( edge, value );
+            recalc = _mm_xor_si128( recalc, edge );
+            __m128i shift = _mm_and_si128( edge, recalc );
+            __m128i bit = _mm_and_si128( _mm_xor_si128( rng, _mm_srli_epi32( rng, 3 ) ), one );
+            __m128i next = _mm_srli_epi32( _mm_xor_si128( rng, _mm_slli_epi32( bit, 17 ) ), 1 );
+            rng = _mm_or_si128( _mm_and_si128( shift, next ), _mm_andnot_si128( shift, rng ) );
+            __m128i high = _mm_cmpeq_epi32( _mm_and_si128( next, one ), one );
+            noiseHigh = _mm_or_si128( _mm_and_si128( shift, high ), _mm_andnot_si128( shift, noiseHigh ) );
+            store( noise + sample * AY38910_LANES, noiseHigh );
+
+            value = _mm_add_epi32( counterEnv, envIncrement );
+            edge = _mm_andnot_si128( _mm_cmpgt_epi32( periodE, value ), envActive );
+            if ( _mm_movemask_epi8( edge ) )
+            {
+                counterEnv = _mm_andnot_si128( edge, value );
+                __m128i stepped = _mm_add_epi32( volume, _mm_and_si128( edge, direction ) );
+                __m128i over = _mm_andnot_si128( _mm_cmpeq_epi32( _mm_and_si128( stepped, outside ), zero ), edge );
+                volume = _mm_or_si128( _mm_and_si128( over, volume ), _mm_andnot_si128( over, stepped ) );
+                // There is no gather in SSE2, levels of the stepped chips are looked up one by one
+                alignas(16) uint32_t stepVolume[4];
+                alignas(16) uint32_t stepLevel[4];
+                store( stepVolume, volume );
+                store( stepLevel, level );
+                int edges = _mm_movemask_ps( _mm_castsi128_ps( edge ) );
+                for (int i = 0; i < 4; i++)
+                {
+                    if ( edges & (1 << i) ) stepLevel[i] = g.levelTable[i][stepVolume[i]];
+                }
+                level = load( stepLevel );
+                if ( _mm_movemask_epi8( over ) )
+                {
+                    store( boundary, over );
+                    break;
+                }
+            }
+            else
+            {
+                counterEnv = value;
+            }
+            store( envLevel + sample * AY38910_LANES, level );
+        }
+        store( g.counterNoise, counterNoise );
+        store( g.rng, rng );
+        store( g.noiseRecalc, recalc );
+        store( g.noise, noiseHigh );
+        store( g.counterEnv, counterEnv );
+        store( g.envVolume, volume );
+        store( g.envLevel, level );
+        return sample;
+    }
+
+    /** Registers of one channel, kept by channels() */
+    struct Channel
+    {
+        __m128i counter;
+        __m128i output;
+        __m128i period;
+        __m128i toneEnable;
+        __m128i noiseEnable;
+        __m128i envelope;
+        __m128i ampLevel;
+    };
+
+    static inline Channel loadChannel(const AY38910LaneChannel &channel)
+    {
+        Channel ch;
+        ch.counter = load( channel.counter );
+        ch.output = load( channel.output );
+        ch.period = load( channel.period );
+        ch.toneEnable = load( channel.toneEnable );
+        ch.noiseEnable = load( channel.noiseEnable );
+        ch.envelope = load( channel.useEnvelope );
+        ch.ampLevel = _mm_andnot_si128( ch.envelope, load( channel.ampLevel ) );
+        return ch;
+    }
+
+    static inline __m128i stepChannel(Channel &ch, __m128i increment, __m128i mask, __m128i noise, __m128i envLevel)
+    {
+        __m128i value = _mm_add_epi32( ch.counter, increment );
+        __m128i edge = _mm_andnot_si128( _mm_cmpgt_epi32( ch.period, value ), mask );
+        ch.counter = _mm_andnot_si128( edge, value );
+        ch.output = _mm_xor_si128( ch.output, edge );
+        __m128i enabled = _mm_or_si128( _mm_and_si128( ch.toneEnable, ch.output ),
+                                        _mm_and_si128( ch.noiseEnable, noise ) );
+        __m128i volume = _mm_or_si128( _mm_and_si128( ch.envelope, envLevel ), ch.ampLevel );
+        return _mm_and_si128( enabled, volume );
+    }
+
+    static inline void channels(const AY38910LaneChannel *channel, const uint32_t *noise,
+                                const uint32_t *envLevel, const uint32_t *gain, uint32_t *packed,
+                                uint32_t samples)
+    {
+        // Channels are separate variables, so all of them stay in registers
+        Channel a = loadChannel( channel[CHANNEL_A] );
+        Channel b = loadChannel( channel[CHANNEL_B] );
+        Channel c = loadChannel( channel[CHANNEL_C] );
+        const __m128i increment = load( channel[0].increment );
+        const __m128i mask = load( channel[0].mask );
+        const __m128i gainEven = load( gain );
+        const __m128i gainOdd = _mm_srli_epi64( gainEven, 32 );
+        const __m128i max = _mm_set1_epi32( 65535 );
+        // Gain of 65536 gives the same level, so it is applied, if any active chip has other volume
+        const bool scaled = _mm_movemask_epi8( _mm_andnot_si128( _mm_cmpeq_epi32( gainEven, _mm_set1_epi32( 65536 ) ),
+                                                                 mask ) ) != 0;
+        for (uint32_t sample = 0; sample < samples; sample++)
+        {
+            const __m128i noiseHigh = load( noise + sample * AY38910_LANES );
+            const __m128i envVolume = load( envLevel + sample * AY38910_LANES );
+            __m128i level = _mm_add_epi32( stepChannel( a, increment, mask, noiseHigh, envVolume ),
+                                           stepChannel( b, increment, mask, noiseHigh, envVolume ) );
+            level = _mm_add_epi32( level, stepChannel( c, increment, mask, noiseHigh, envVolume ) );
+            if ( scaled )
+            {
+                __m128i even = _mm_srli_epi64( _mm_mul_epu32( level, gainEven ), 16 );
+                __m128i odd = _mm_srli_epi64( _mm_mul_epu32( _mm_srli_epi64( level, 32 ), gainOdd ), 16 );
+                level = _mm_or_si128( even, _mm_slli_epi64( odd, 32 ) );
+            }
+            __m128i over = _mm_cmpgt_epi32( level, max );
+            level = _mm_or_si128( _mm_and_si128( over, max ), _mm_andnot_si128( over, level ) );
+            store( packed + sample * AY38910_LANES, _mm_or_si128( _mm_slli_epi32( level, 16 ), level ) );
+        }
+        store( channel[CHANNEL_A].counter, a.counter );
+        store( channel[CHANNEL_A].output, a.output );
+        store( channel[CHANNEL_B].counter, b.counter );
+        store( channel[CHANNEL_B].output, b.output );
+        store( channel[CHANNEL_C].counter, c.counter );
+        store( channel[CHANNEL_C].output, c.output );
+    }
+
+    static inline void scatter(const uint32_t *packed, uint32_t *const *outBuffers, const uint32_t *mask,
+                               uint32_t samples)
+    {
+        uint32_t sample = 0;
+        // 4 samples of 4 chips are transposed to be stored to output of every chip
+        for (; sample + 4 <= samples; sample += 4)
+        {
+            const uint32_t *row = packed + sample * AY38910_LANES;
+            __m128i t0 = _mm_unpacklo_epi32( load( row ), load( row + AY38910_LANES ) );
+            __m128i t1 = _mm_unpacklo_epi32( load( row + AY38910_LANES * 2 ), load( row + AY38910_LANES * 3 ) );
+            __m128i t2 = _mm_unpackhi_epi32( load( row ), load( row + AY38910_LANES ) );
+            __m128i t3 = _mm_unpackhi_epi32( load( row + AY38910_LANES * 2 ), load( row + AY38910_LANES * 3 ) );
+            const __m128i chip[4] = { _mm_unpacklo_epi64( t0, t1 ), _mm_unpackhi_epi64( t0, t1 ),
+                                      _mm_unpacklo_epi64( t2, t3 ), _mm_unpackhi_epi64( t2, t3 ) };
+            for (int i = 0; i < 4; i++)
+            {
+                if ( mask[i] ) _mm_storeu_si128( reinterpret_cast<__m128i *>( outBuffers[i] + sample ), chip[i] );
+            }
+        }
+        for (; sample < samples; sample++)
         {
-            left += m_levelTable[enabled ? m_amplitude[chan]: 0];
-            right += m_levelTable[enabled ? m_amplitude[chan]: 0];
+            for (int i = 0; i < 4; i++)
+            {
+                if ( mask[i] ) outBuffers[i][sample] = packed[sample * AY38910_LANES + i];
+            }
         }
     }
-/*    left /= 3;*/ if ( left > 65535 ) left = 65535;
-/*    right /= 3;*/ if ( right > 65535 ) right = 65535;
-    return (left<<16) | right;
+};
+#endif
+
+#if AY38910_NEON
+struct AY38910NeonOps
+{
+    static inline void copy(uint32_t *dst, const uint32_t *src) { vst1q_u32( dst, vld1q_u32( src ) ); }
+
+    static inline bool any(uint32x4_t mask)
+    {
+        uint32x2_t half = vorr_u32( vget_low_u32( mask ), vget_high_u32( mask ) );
+        return ( vget_lane_u32( half, 0 ) | vget_lane_u32( half, 1 ) ) != 0;
+    }
+
+    static inline uint32_t generators(const AY38910LaneGenerators &g, uint32_t *noise, uint32_t *envLevel,
+                                      uint32_t sample, uint32_t samples, uint32_t *boundary)
+    {
+        const uint32x4_t one = vdupq_n_u32( 1 );
+        uint32x4_t counterNoise = vld1q_u32( g.counterNoise );
+        uint32x4_t rng = vld1q_u32( g.rng );
+        uint32x4_t recalc = vld1q_u32( g.noiseRecalc );
+        uint32x4_t noiseHigh = vld1q_u32( g.noise );
+        uint32x4_t counterEnv = vld1q_u32( g.counterEnv );
+        uint32x4_t volume = vld1q_u32( g.envVolume );
+        uint32x4_t level = vld1q_u32( g.envLevel );
+        const uint32x4_t periodNoise = vld1q_u32( g.periodNoise );
+        const uint32x4_t increment = vld1q_u32( g.increment );
+        const uint32x4_t mask = vld1q_u32( g.mask );
+        const uint32x4_t periodE = vld1q_u32( g.periodE );
+        const uint32x4_t envIncrement = vld1q_u32( g.envIncrement );
+        const uint32x4_t envActive = vld1q_u32( g.envActive );
+        const uint32x4_t direction = vld1q_u32( g.envDirection );
+        const uint32x4_t outside = vmvnq_u32( vld1q_u32( g.envStepMask ) );
+        for (; sample < samples; sample++)
+        {
+            uint32x4_t value = vaddq_u32( counterNoise, increment );
+            uint32x4_t edge = vandq_u32( vcgeq_u32( value, periodNoise ), mask );
+            counterNoise = vbicq_u32( value, edge );
+            recalc = veorq_u32( recalc, edge );
+            uint32x4_t shift = vandq_u32( edge, recalc );
+            uint32x4_t bit = vandq_u32( veorq_u32( rng, vshrq_n_u32( rng, 3 ) ), one );
+            uint32x4_t next = vshrq_n_u32( veorq_u32( rng, vshlq_n_u32( bit, 17 ) ), 1 );
+            rng = vbslq_u32( shift, next, rng );
+            noiseHigh = vbslq_u32( shift, vtstq_u32( next, one ), noiseHigh );
+            vst1q_u32( noise + sample * AY38910_LANES, noiseHigh );
+
+            value = vaddq_u32( counterEnv, envIncrement );
+            edge = vandq_u32( vcgeq_u32( value, periodE ), envActive );
+            counterEnv = vbicq_u32( value, edge );
+            if ( any( edge ) )
+            {
+                uint32x4_t stepped = vaddq_u32( volume, vandq_u32( edge, direction ) );
+                uint32x4_t over = vandq_u32( vtstq_u32( stepped, outside ), edge );
+                volume = vbslq_u32( over, volume, stepped );
+                uint32_t stepVolume[4];
+                uint32_t stepLevel[4];
+                uint32_t stepEdge[4];
+                vst1q_u32( stepVolume, volume );
+                vst1q_u32( stepLevel, level );
+                vst1q_u32( stepEdge, edge );
+                for (int i = 0; i < 4; i++)
+                {
+                    if ( stepEdge[i] ) stepLevel[i] = g.levelTable[i][stepVolume[i]];
+                }
+                level = vld1q_u32( stepLevel );
+                if ( any( over ) )
+                {
+                    vst1q_u32( boundary, over );
+                    break;
+                }
+            }
+            vst1q_u32( envLevel + sample * AY38910_LANES, level );
+        }
+        vst1q_u32( g.counterNoise, counterNoise );
+        vst1q_u32( g.rng, rng );
+        vst1q_u32( g.noiseRecalc, recalc );
+        vst1q_u32( g.noise, noiseHigh );
+        vst1q_u32( g.counterEnv, counterEnv );
+        vst1q_u32( g.envVolume, volume );
+        vst1q_u32( g.envLevel, level );
+        return sample;
+    }
+
+    /** Registers of one channel, kept by channels() */
+    struct Channel
+    {
+        uint32x4_t counter;
+        uint32x4_t output;
+        uint32x4_t period;
+        uint32x4_t toneEnable;
+        uint32x4_t noiseEnable;
+        uint32x4_t envelope;
+        uint32x4_t ampLevel;
+    };
+
+    static inline Channel loadChannel(const AY38910LaneChannel &channel)
+    {
+        Channel ch;
+        ch.counter = vld1q_u32( channel.counter );
+        ch.output = vld1q_u32( channel.output );
+        ch.period = vld1q_u32( channel.period );
+        ch.toneEnable = vld1q_u32( channel.toneEnable );
+        ch.noiseEnable = vld1q_u32( channel.noiseEnable );
+        ch.envelope = vld1q_u32( channel.useEnvelope );
+        ch.ampLevel = vld1q_u32( channel.ampLevel );
+        return ch;
+    }
+
+    static inline uint32x4_t stepChannel(Channel &ch, uint32x4_t increment, uint32x4_t mask, uint32x4_t noise,
+                                         uint32x4_t envLevel)
+    {
+        uint32x4_t value = vaddq_u32( ch.counter, increment );
+        uint32x4_t edge = vandq_u32( vcgeq_u32( value, ch.period ), mask );
+        ch.counter = vbicq_u32( value, edge );
+        ch.output = veorq_u32( ch.output, edge );
+        uint32x4_t enabled = vorrq_u32( vandq_u32( ch.toneEnable, ch.output ), vandq_u32( ch.noiseEnable, noise ) );
+        return vandq_u32( enabled, vbslq_u32( ch.envelope, envLevel, ch.ampLevel ) );
+    }
+
+    static inline void channels(const AY38910LaneChannel *channel, const uint32_t *noise,
+                                const uint32_t *envLevel, const uint32_t *gain, uint32_t *packed,
+                                uint32_t samples)
+    {
+        // Channels are separate variables, so all of them stay in registers
+        Channel a = loadChannel( channel[CHANNEL_A] );
+        Channel b = loadChannel( channel[CHANNEL_B] );
+        Channel c = loadChannel( channel[CHANNEL_C] );
+        const uint32x4_t increment = vld1q_u32( channel[0].increment );
+        const uint32x4_t mask = vld1q_u32( channel[0].mask );
+        const uint32x4_t gains = vld1q_u32( gain );
+        // Gain of 65536 gives the same level, so it is applied, if any active chip has other volume
+        bool scaled = false;
+        for (int i = 0; i < 4; i++)
+        {
+            if ( channel[0].mask[i] && gain[i] != 65536 ) scaled = true;
+        }
+        for (uint32_t sample = 0; sample < samples; sample++)
+        {
+            const uint32x4_t noiseHigh = vld1q_u32( noise + sample * AY38910_LANES );
+            const uint32x4_t envVolume = vld1q_u32( envLevel + sample * AY38910_LANES );
+            uint32x4_t level = vaddq_u32( stepChannel( a, increment, mask, noiseHigh, envVolume ),
+                                          stepChannel( b, increment, mask, noiseHigh, envVolume ) );
+            level = vaddq_u32( level, stepChannel( c, increment, mask, noiseHigh, envVolume ) );
+            if ( scaled )
+            {
+                uint64x2_t low = vmull_u32( vget_low_u32( level ), vget_low_u32( gains ) );
+                uint64x2_t high = vmull_u32( vget_high_u32( level ), vget_high_u32( gains ) );
+                level = vcombine_u32( vshrn_n_u64( low, 16 ), vshrn_n_u64( high, 16 ) );
+            }
+            level = vminq_u32( level, vdupq_n_u32( 65535 ) );
+            vst1q_u32( packed + sample * AY38910_LANES, vorrq_u32( vshlq_n_u32( level, 16 ), level ) );
+        }
+        vst1q_u32( channel[CHANNEL_A].counter, a.counter );
+        vst1q_u32( channel[CHANNEL_A].output, a.output );
+        vst1q_u32( channel[CHANNEL_B].counter, b.counter );
+        vst1q_u32( channel[CHANNEL_B].output, b.output );
+        vst1q_u32( channel[CHANNEL_C].counter, c.counter );
+        vst1q_u32( channel[CHANNEL_C].output, c.output );
+    }
+
+    static inline void scatter(const uint32_t *packed, uint32_t *const *outBuffers, const uint32_t *mask,
+                               uint32_t samples)
+    {
+        uint32_t sample = 0;
+        // 4 samples of 4 chips are transposed to be stored to output of every chip
+        for (; sample + 4 <= samples; sample += 4)
+        {
+            const uint32_t *row = packed + sample * AY38910_LANES;
+            uint32x4x2_t t0 = vtrnq_u32( vld1q_u32( row ), vld1q_u32( row + AY38910_LANES ) );
+            uint32x4x2_t t1 = vtrnq_u32( vld1q_u32( row + AY38910_LANES * 2 ), vld1q_u32( row + AY38910_LANES * 3 ) );
+            const uint32x4_t chip[4] = {
+                vcombine_u32( vget_low_u32( t0.val[0] ), vget_low_u32( t1.val[0] ) ),
+                vcombine_u32( vget_low_u32( t0.val[1] ), vget_low_u32( t1.val[1] ) ),
+                vcombine_u32( vget_high_u32( t0.val[0] ), vget_high_u32( t1.val[0] ) ),
+                vcombine_u32( vget_high_u32( t0.val[1] ), vget_high_u32( t1.val[1] ) ),
+            };
+            for (int i = 0; i < 4; i++)
+            {
+                if ( mask[i] ) vst1q_u32( outBuffers[i] + sample, chip[i] );
+            }
+        }
+        for (; sample < samples; sample++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                if ( mask[i] ) outBuffers[i][sample] = packed[sample * AY38910_LANES + i];
+            }
+        }
+    }
+};
+#endif
+
+#if AY38910_SSE2
+#define AY38910_LANES_KERNEL (&AY38910Lanes::renderDense<AY38910Sse2Ops>)
+#elif AY38910_NEON
+#define AY38910_LANES_KERNEL (&AY38910Lanes::renderDense<AY38910NeonOps>)
+#else
+#define AY38910_LANES_KERNEL (&AY38910Lanes::renderDense<AY38910ScalarOps>)
+#endif
+
+void (AY38910Lanes::*AY38910Lanes::s_kernel)(AY38910 *const *chips, uint32_t *const *outBuffers,
+                                             int count, uint32_t samples) =
+    isSimdSupported() ? AY38910_LANES_KERNEL : &AY38910Lanes::renderDense<AY38910ScalarOps>;
+
+void AY38910Lanes::enableSimd(bool enable)
+{
+    s_kernel = ( enable && isSimdSupported() ) ? AY38910_LANES_KERNEL : &AY38910Lanes::renderDense<AY38910ScalarOps>;
+}
+
+void AY38910Lanes::load(int slot, const AY38910 &chip)
+{
+    for (int i=0; i<3; i++)
+    {
+        m_counter[i][slot] = chip.m_tone.counter[i];
+        m_period[i][slot] = chip.m_tone.period[i];
+        m_output[i][slot] = chip.m_tone.output[i];
+        m_ampLevel[i][slot] = chip.m_levelTable[chip.m_tone.amplitude[i]];
+        m_useEnvelope[i][slot] = chip.m_tone.useEnvelope[i];
+        m_toneEnable[i][slot] = chip.m_tone.toneEnable[i];
+        m_noiseEnable[i][slot] = chip.m_tone.noiseEnable[i];
+    }
+    m_toneIncrement[slot] = chip.m_toneFrequencyScale;
+    m_counterNoise[slot] = chip.m_counterNoise;
+    m_periodNoise[slot] = chip.m_periodNoise;
+    m_rng[slot] = chip.m_rng;
+    m_noiseRecalc[slot] = chip.m_noiseRecalc ? 0xFFFFFFFF : 0x00000000;
+    m_noise[slot] = chip.m_noiseHigh ? 0xFFFFFFFF : 0x00000000;
+    m_counterEnv[slot] = chip.m_counterEnv;
+    m_periodE[slot] = chip.m_periodE;
+    m_envVolume[slot] = chip.m_envVolume;
+    m_envLevel[slot] = chip.m_levelTable[chip.m_envVolume];
+    m_envDirection[slot] = chip.m_attack ? 1 : 0xFFFFFFFF;
+    m_envStepMask[slot] = chip.m_envStepMask;
+    m_levelTable[slot] = chip.m_levelTable;
+    m_gain[slot] = chip.m_gain;
+    m_active[slot] = 0xFFFFFFFF;
+    // Envelope counter doesn't run, while the envelope is held or has zero period
+    bool envelope = !chip.m_holding && chip.m_periodE > 0;
+    m_envActive[slot] = envelope ? 0xFFFFFFFF : 0x00000000;
+    m_envIncrement[slot] = envelope ? chip.m_envFrequencyScale : 0;
 }
+
+void AY38910Lanes::store(int slot, AY38910 &chip)
+{
+    for (int i=0; i<3; i++)
+    {
+        chip.m_tone.counter[i] = m_counter[i][slot];
+        chip.m_tone.output[i] = m_output[i][slot];
+    }
+    chip.m_counterNoise = m_counterNoise[slot];
+    chip.m_rng = m_rng[slot];
+    chip.m_noiseRecalc = m_noiseRecalc[slot] != 0;
+    chip.m_noiseHigh = m_noise[slot] != 0;
+    chip.m_counterEnv = m_counterEnv[slot];
+    chip.m_envVolume = m_envVolume[slot];
+    m_active[slot] = 0;
+    m_envActive[slot] = 0;
+}
+
+template <class Ops>
+void AY38910Lanes::renderDense(AY38910 *const *chips, uint32_t *const *outBuffers, int count, uint32_t samples)
+{
+    alignas(16) uint32_t boundary[4];
+    // Per sample rows of noise output, envelope level and output samples of all chips
+    alignas(16) uint32_t noise[AY38910_LANES_RUN][AY38910_LANES];
+    alignas(16) uint32_t envLevel[AY38910_LANES_RUN][AY38910_LANES];
+    alignas(16) uint32_t packed[AY38910_LANES_RUN][AY38910_LANES];
+    for (int first = 0; first < count; first += 4)
+    {
+        if ( !( m_active[first] | m_active[first + 1] | m_active[first + 2] | m_active[first + 3] ) )
+        {
+            continue;
+        }
+        // Noise and envelope generators go first, since every channel depends on them
+        const AY38910LaneGenerators generators = {
+            m_counterNoise + first, m_rng + first, m_noiseRecalc + first, m_noise + first,
+            m_counterEnv + first, m_envVolume + first, m_envLevel + first, m_periodNoise + first,
+            m_toneIncrement + first, m_active + first, m_periodE + first, m_envIncrement + first,
+            m_envActive + first, m_envDirection + first, m_envStepMask + first, m_levelTable + first,
+        };
+        for (uint32_t sample = 0; ; sample++)
+        {
+            sample = Ops::generators( generators, noise[0] + first, envLevel[0] + first, sample, samples, boundary );
+            if ( sample == samples ) break;
+            // Envelope shape logic at the boundary is left to the chip itself
+            for (int lane = first; lane < first + 4; lane++)
+            {
+                if ( !boundary[lane - first] ) continue;
+                AY38910 &chip = *chips[lane];
+                chip.m_envVolume = m_envVolume[lane];
+                chip.stepEnvelope();
+                m_envVolume[lane] = chip.m_envVolume;
+                m_envLevel[lane] = chip.m_levelTable[chip.m_envVolume];
+                m_envDirection[lane] = chip.m_attack ? 1 : 0xFFFFFFFF;
+                if ( chip.m_holding )
+                {
+                    m_envActive[lane] = 0;
+                    m_envIncrement[lane] = 0;
+                }
+            }
+            Ops::copy( envLevel[sample] + first, m_envLevel + first );
+        }
+        // Then all channels run through the samples with their state kept in registers
+        AY38910LaneChannel channels[3];
+        for (int ch = 0; ch < 3; ch++)
+        {
+            channels[ch] = {
+                m_counter[ch] + first, m_output[ch] + first, m_period[ch] + first, m_toneIncrement + first,
+                m_active + first, m_toneEnable[ch] + first, m_noiseEnable[ch] + first,
+                m_useEnvelope[ch] + first, m_ampLevel[ch] + first,
+            };
+        }
+        Ops::channels( channels, noise[0] + first, envLevel[0] + first, m_gain + first, packed[0] + first, samples );
+        Ops::scatter( packed[0] + first, outBuffers + first, m_active + first, samples );
+    }
+}
+
+void AY38910Lanes::setLane(int lane, AY38910 *chip, uint32_t *outBuffer, uint32_t samples)
+{
+    m_chips[lane] = chip;
+    m_outBuffers[lane] = outBuffer;
+    m_left[lane] = samples;
+    m_dense[lane] = 0;
+    if ( lane >= m_count ) m_count = lane + 1;
+}
+
+uint32_t AY38910Lanes::render()
+{
+    for (;;)
+    {
+        uint32_t done = 0;
+        uint32_t run = UINT32_MAX;
+        for (int lane = 0; lane < m_count; lane++)
+        {
+            if ( !m_chips[lane] ) continue;
+            AY38910 &chip = *m_chips[lane];
+            // The same as AY38910::renderBlock(): fill constant level till the edge sample, and
+            // emulate the edge, till the output changes on every sample
+            while ( !m_dense[lane] && m_left[lane] )
+            {
+                uint32_t span = chip.constantSpan( m_left[lane] );
+                if ( !span )
+                {
+                    uint32_t dense = AY38910_LANES_RUN - m_tick % AY38910_LANES_RUN;
+                    m_dense[lane] = m_left[lane] < dense ? m_left[lane] : dense;
+                    // Lowest free slot keeps dense chips in as few groups of the kernel as possible
+                    int slot = 0;
+                    while ( m_active[slot] ) slot++;
+                    m_slots[lane] = slot;
+                    m_slotChips[slot] = &chip;
+                    load( slot, chip );
+                    break;
+                }
+                uint32_t sample = chip.mixChannels();
+                uint32_t *out = m_outBuffers[lane];
+                for (uint32_t i = 0; i < span; i++)
+                {
+                    *out++ = sample;
+                }
+                chip.skipSamples( span );
+                m_left[lane] -= span;
+                if ( m_left[lane] )
+                {
+                    *out++ = chip.getSample();
+                    m_left[lane]--;
+                }
+                m_outBuffers[lane] = out;
+            }
+            if ( !m_left[lane] )
+            {
+                m_chips[lane] = nullptr;
+                done |= 1u << lane;
+            }
+            else if ( m_dense[lane] < run )
+            {
+                run = m_dense[lane];
+            }
+        }
+        if ( done || run == UINT32_MAX )
+        {
+            return done;
+        }
+        uint32_t *outBuffers[AY38910_LANES];
+        int width = 0;
+        for (int lane = 0; lane < m_count; lane++)
+        {
+            if ( !m_dense[lane] ) continue;
+            outBuffers[m_slots[lane]] = m_outBuffers[lane];
+            if ( m_slots[lane] >= width ) width = m_slots[lane] + 1;
+        }
+        // Kernel processes chips by 4, so unused slots of the last group stay inactive
+        (this->*s_kernel)( m_slotChips, outBuffers, ( width + 3 ) & ~3, run );
+        m_tick += run;
+        for (int lane = 0; lane < m_count; lane++)
+        {
+            if ( !m_dense[lane] ) continue;
+            m_outBuffers[lane] += run;
+            m_left[lane] -= run;
+            m_dense[lane] -= run;
+            if ( !m_dense[lane] ) store( m_slots[lane], *m_chips[lane] );
+        }
+    }
+}
+
+void AY38910Lanes::render(AY38910 *const *chips, uint32_t *const *outBuffers, const uint32_t *samples, int count)
+{
+    for (int first = 0; first < count; first += AY38910_LANES)
+    {
+        AY38910Lanes lanes;
+        int group = count - first < AY38910_LANES ? count - first : AY38910_LANES;
+        for (int lane = 0; lane < group; lane++)
+        {
+            lanes.setLane( lane, chips[first + lane], outBuffers[first + lane], samples[first + lane] );
+        }
+        while ( lanes.render() )
+        {
+        }
+    }
+}
+
+#endif
@@ -25,7 +25,10 @@ SOFTWARE.
 #include "chips/nes_apu.h"
 #include "chips/nes_cpu.h"
 
+#if VGM_DECODER_NES
+
 #include <stdio.h>
+#include <string.h>
 
 #define NES_APU_DEBUG 1
 //#define DEBUG_NES_CPU
@@ -36,10 +39,8 @@ SOFTWARE.
 #include "../vgm_logger.h"
 
 #define NES_CPU_FREQUENCY (1789773)
-#define SAMPLING_RATE  (44100)
 #define CONST_SHIFT_BITS (4)
 
-static constexpr uint32_t counterScaler = ((NES_CPU_FREQUENCY << CONST_SHIFT_BITS) / SAMPLING_RATE);
 static constexpr uint32_t frameCounterPeriod = ((NES_CPU_FREQUENCY << CONST_SHIFT_BITS) / 240 );
 
 static constexpr uint8_t lengthLut[] =
@@ -67,11 +68,55 @@ static constexpr uint16_t dmcLut[] =
     0x06A, 0x054, 0x048, 0x036,
 };
 
+static constexpr uint8_t sequencerTable[] =
+{
+    0b01000000,
+    0b01100000,
+    0b01111000,
+    0b10011111,
+};
+
+static constexpr uint8_t triangleTable[] =
+{
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+};
+
+/** Maximum number of samples, mixed at once by span renderer */
+#define NES_APU_SPAN_SIZE 256
+
 static constexpr uint16_t nesApuLevelTable[16] =
 {
 0,	1092,	2184,	3276,	4369,	5461,	6553,	7645,	8738,	9830,	10922,	12014,	13107,	14199,	15291,	16384,
 };
 
+typedef struct
+{
+    uint16_t level[16];
+} NesApuLevelTable;
+
+/**
+ * Calculates volume level table for the channel. Each channel has specific compensation.
+ * That compenation is implemented in NES hardware, but since current implementation is
+ * software, we need to add some coef. For example, noise has coef = 15/32
+ */
+static constexpr NesApuLevelTable makeLevelTable(uint32_t coef)
+{
+    NesApuLevelTable table{};
+    for (int i=0; i<16; i++)
+    {
+        uint32_t vol = static_cast<uint32_t>(nesApuLevelTable[i]) * coef / 32;
+        table.level[i] = vol > 65535 ? 65535 : vol;
+    }
+    return table;
+}
+
+// Level tables are constant, so they can be placed to flash memory on embedded systems
+static constexpr NesApuLevelTable rectVolTable = makeLevelTable( 33 );
+static constexpr NesApuLevelTable triVolTable = makeLevelTable( 15 );
+static constexpr NesApuLevelTable noiseVolTable = makeLevelTable( 15 );
+static constexpr NesApuLevelTable dmcVolTable = makeLevelTable( 68 );
+
 enum
 {
     APU_RECT_VOL1  = 0x00,  // 4000
@@ -152,6 +197,7 @@ NesApu::NesApu(NesCpu *cpu)
    : m_cpu( cpu )
 {
     m_volume = 100;
+    setSampleFrequency( m_sampleFrequency );
     reset();
 }
 
@@ -178,8 +224,10 @@ void NesApu::write(uint16_t reg, uint8_t val)
 {
     uint16_t originReg = reg;
     uint8_t oldVal = val;
-    LOGI( "Write 0x%02X to [%04X] reg\n", val, getRegAddress( reg ) );
+    TRACE( VGM_TRACE_APU_WRITE, getRegAddress( reg ), val );
     reg = getRegIndex(reg);
+    m_writeCount++;
+    m_writtenRegisters |= 1ULL << ( reg & 0x3F );
     if ( reg < APU_MAX_REG )
     {
         oldVal = m_regs[reg];
@@ -294,28 +342,17 @@ void NesApu::write(uint16_t reg, uint8_t val)
     }
 }
 
+void NesApu::setSampleFrequency(uint32_t frequency)
+{
+    m_sampleFrequency = frequency;
+    m_counterScaler = (NES_CPU_FREQUENCY << CONST_SHIFT_BITS) / frequency;
+}
+
 void NesApu::setVolume(uint16_t volume)
 {
     m_volume = volume;
-    for(int i=0; i<16; i++)
-    {
-        uint32_t vol;
-        /**
-         * Calculate volume level tables for each channel. User volume is defined in
-         * parts of 100 (volume / 100).
-         * Also, each channel has specific compensation. That compenation is implemented in NES
-         * hardware, but since current implementation is software, we need to add some coef.
-         * For example, noise has coef = 10/32
-         */
-        vol = static_cast<uint32_t>(nesApuLevelTable[i]) * volume * 33 / ( 100 * 32 );
-        m_rectVolTable[i] = vol > 65535 ? 65535 : vol;
-        vol = static_cast<uint32_t>(nesApuLevelTable[i]) * volume * 15 / ( 100 * 32 );
-        m_triVolTable[i] = vol > 65535 ? 65535 : vol;
-        vol = static_cast<uint32_t>(nesApuLevelTable[i]) * volume * 15 / ( 100 * 32 );
-        m_noiseVolTable[i] = vol > 65535 ? 65535 : vol;
-        vol = static_cast<uint32_t>(nesApuLevelTable[i]) * volume * 68 / ( 100 * 32 );
-        m_dmcVolTable[i] = vol > 65535 ? 65535 : vol;
-    }
+    // User volume is defined in parts of 100 (volume / 100), and applied to mixed samples
+    m_gain = static_cast<uint32_t>( volume ) * 65536 / 100;
 }
 
 uint8_t NesApu::read(uint16_t reg)
@@ -323,7 +360,7 @@ uint8_t NesApu::read(uint16_t reg)
     return 0;
 }
 
-uint32_t NesApu::getSample()
+void NesApu::updateChannels()
 {
 //    m_apuIncrement = counterScaler; /* 40.5 cpu ticks */
     updateFrameCounter();
@@ -333,6 +370,11 @@ uint32_t NesApu::getSample()
     updateTriangleChannel(m_chan[2]);
     updateNoiseChannel(m_chan[3]);
     updateDmcChannel(m_chan[4]);
+}
+
+uint32_t NesApu::getSample()
+{
+    updateChannels();
 
     uint32_t sample = 0;
     sample += m_chan[0].output; // chan 1
@@ -341,10 +383,254 @@ uint32_t NesApu::getSample()
     sample += m_chan[3].output; // noise
     sample += m_chan[4].output; // dmc
 
+    if ( m_gain != 65536 ) sample = ( static_cast<uint64_t>( sample ) * m_gain ) >> 16;
     if ( sample > 65535 ) sample = 65535;
     return sample | (sample << 16);
 }
 
+void NesApu::renderBlock(uint32_t *outBuffer, int samples)
+{
+    while ( samples > 0 )
+    {
+        int span = getFrameCounterSpan( samples );
+        if ( !span )
+        {
+            // Envelopes, length counters and sweeps are updated at frame counter ticks only
+            *outBuffer++ = getSample();
+            samples--;
+            continue;
+        }
+        renderSpan( outBuffer, span );
+        outBuffer += span;
+        samples -= span;
+    }
+}
+
+int NesApu::getFrameCounterSpan(int maxSamples) const
+{
+    if ( m_lastFrameCounter + m_counterScaler >= frameCounterPeriod )
+    {
+        return 0;
+    }
+    uint32_t span = ( frameCounterPeriod - 1 - m_lastFrameCounter ) / m_counterScaler;
+    if ( span > NES_APU_SPAN_SIZE ) span = NES_APU_SPAN_SIZE;
+    return static_cast<int>( span ) < maxSamples ? span : maxSamples;
+}
+
+static inline void addLevel(uint32_t *mix, int samples, uint32_t level)
+{
+    while ( samples-- > 0 ) *mix++ += level;
+}
+
+void NesApu::renderSpan(uint32_t *outBuffer, int samples)
+{
+    uint32_t mix[NES_APU_SPAN_SIZE];
+    // Silent channels return constant level without mixing, so the whole span is
+    // filled with single sample, while the channels are advanced at once
+    bool silent = isSilent();
+    uint32_t *channelMix = outBuffer && !silent ? mix : nullptr;
+    if ( channelMix ) memset( mix, 0, samples * sizeof(uint32_t) );
+    m_lastFrameCounter += samples * m_counterScaler;
+    m_quaterSignal = false;
+    m_halfSignal = false;
+    m_fullSignal = false;
+    // Each channel depends on own state only, so channels are advanced one after another.
+    // Channels with constant output are not mixed, their level is added to all samples at once.
+    uint32_t level = spanRectChannel( 0, channelMix, samples );
+    level += spanRectChannel( 1, channelMix, samples );
+    level += spanTriangleChannel( m_chan[2], channelMix, samples );
+    level += spanNoiseChannel( m_chan[3], channelMix, samples );
+    level += spanDmcChannel( m_chan[4], channelMix, samples );
+    if ( !outBuffer )
+    {
+        return;
+    }
+    if ( silent )
+    {
+        if ( m_gain != 65536 ) level = ( static_cast<uint64_t>( level ) * m_gain ) >> 16;
+        if ( level > 65535 ) level = 65535;
+        uint32_t sample = level | (level << 16);
+        for (int i = 0; i < samples; i++)
+        {
+            outBuffer[i] = sample;
+        }
+        return;
+    }
+    for (int i = 0; i < samples; i++)
+    {
+        uint32_t sample = mix[i] + level;
+        if ( m_gain != 65536 ) sample = ( static_cast<uint64_t>( sample ) * m_gain ) >> 16;
+        if ( sample > 65535 ) sample = 65535;
+        outBuffer[i] = sample | (sample << 16);
+    }
+}
+
+uint32_t NesApu::spanRectChannel(int i, uint32_t *mix, int samples)
+{
+    ChannelInfo &chan = m_chan[i];
+    uint8_t volumeReg = m_regs[APU_RECT_VOL1 + i*4];
+    if ( !(m_regs[APU_STATUS] & (1<<i)) || !chan.lenCounter ||
+         chan.period < (8 << (CONST_SHIFT_BITS + 4)) ||
+         chan.period > (0x7FF << (CONST_SHIFT_BITS + 4)) )
+    {
+        chan.volume = 0;
+        chan.output = rectVolTable.level[ chan.volume ];
+        return chan.output;
+    }
+    uint8_t level = ( volumeReg & FIXED_VOL_MASK ) ? ( volumeReg & VALUE_VOL_MASK ) : chan.decayCounter;
+    uint8_t duty = sequencerTable[ (volumeReg & DUTY_CYCLE_MASK) >> 6 ];
+    uint32_t period = chan.period + (1 << (CONST_SHIFT_BITS + 4));
+    uint32_t step = m_counterScaler << 3;
+    if ( !mix || !level )
+    {
+        // Output doesn't matter, so advance the sequencer at once
+        uint64_t counter = chan.counter + static_cast<uint64_t>( step ) * samples;
+        chan.sequencer = ( chan.sequencer + counter / period ) & 0x07;
+        chan.counter = counter % period;
+    }
+    else
+    {
+        for (int n = 0; n < samples; )
+        {
+            // Number of samples, during which sequencer keeps its position
+            int span = chan.counter < period ? ( period - 1 - chan.counter ) / step : 0;
+            if ( span > samples - n ) span = samples - n;
+            addLevel( mix + n, span, rectVolTable.level[ (duty & (1<<chan.sequencer)) ? level : 0 ] );
+            chan.counter += span * step;
+            n += span;
+            if ( n == samples ) break;
+            chan.counter += step;
+            while ( chan.counter >= period )
+            {
+                chan.sequencer++;
+                chan.sequencer &= 0x07;
+                chan.counter -= period;
+            }
+            mix[n++] += rectVolTable.level[ (duty & (1<<chan.sequencer)) ? level : 0 ];
+        }
+    }
+    chan.volume = (duty & (1<<chan.sequencer)) ? level : 0;
+    chan.output = rectVolTable.level[ chan.volume ];
+    return mix && level ? 0 : chan.output;
+}
+
+uint32_t NesApu::spanTriangleChannel(ChannelInfo &chan, uint32_t *mix, int samples)
+{
+    if ( !(m_regs[APU_STATUS] & TRI_ENABLE_MASK) || !chan.lenCounter || !chan.linearCounter )
+    {
+        chan.output = triVolTable.level[ chan.volume ];
+        return chan.output;
+    }
+    uint32_t period = chan.period + (1 << (CONST_SHIFT_BITS + 4));
+    uint32_t step = m_counterScaler << 4;
+    if ( !mix )
+    {
+        uint64_t counter = chan.counter + static_cast<uint64_t>( step ) * samples;
+        if ( counter >= period )
+        {
+            chan.sequencer = ( chan.sequencer + counter / period ) & 0x1F;
+            chan.volume = triangleTable[ chan.sequencer ];
+        }
+        chan.counter = counter % period;
+        chan.output = triVolTable.level[ chan.volume ];
+        return chan.output;
+    }
+    for (int n = 0; n < samples; )
+    {
+        int span = chan.counter < period ? ( period - 1 - chan.counter ) / step : 0;
+        if ( span > samples - n ) span = samples - n;
+        addLevel( mix + n, span, triVolTable.level[ chan.volume ] );
+        chan.counter += span * step;
+        n += span;
+        if ( n == samples ) break;
+        chan.counter += step;
+        while ( chan.counter >= period )
+        {
+            chan.sequencer++;
+            chan.sequencer &= 0x1F;
+            chan.counter -= period;
+        }
+        chan.volume = triangleTable[ chan.sequencer ];
+        mix[n++] += triVolTable.level[ chan.volume ];
+    }
+    chan.output = triVolTable.level[ chan.volume ];
+    return 0;
+}
+
+inline void NesApu::stepNoise()
+{
+    uint8_t temp;
+    if ( m_regs[APU_NOISE_FREQ] & NOISE_MODE_MASK )
+    {
+        // 93-bits
+        temp = ((m_shiftNoise >> 6)^m_shiftNoise) & 1;
+    }
+    else
+    {
+        // 32768-bits
+        temp = ((m_shiftNoise >> 1)^m_shiftNoise) & 1;
+    }
+    m_shiftNoise >>= 1;
+    m_shiftNoise |= (temp << 14);
+}
+
+uint32_t NesApu::spanNoiseChannel(ChannelInfo &chan, uint32_t *mix, int samples)
+{
+    if ( !(m_regs[APU_STATUS] & (1<<3)) || !chan.lenCounter )
+    {
+        chan.volume = 0;
+        chan.output = noiseVolTable.level[ chan.volume ];
+        return chan.output;
+    }
+    uint8_t volumeReg = m_regs[APU_NOISE_VOL];
+    uint8_t level = ( volumeReg & FIXED_VOL_MASK ) ? ( volumeReg & VALUE_VOL_MASK ) : chan.decayCounter;
+    uint32_t period = chan.period + (1 << (CONST_SHIFT_BITS + 4));
+    uint32_t step = m_counterScaler << 3;
+    if ( !mix || !level )
+    {
+        uint64_t counter = chan.counter + static_cast<uint64_t>( step ) * samples;
+        for ( uint64_t steps = counter / period; steps; steps-- ) stepNoise();
+        chan.counter = counter % period;
+    }
+    else
+    {
+        for (int n = 0; n < samples; )
+        {
+            int span = chan.counter < period ? ( period - 1 - chan.counter ) / step : 0;
+            if ( span > samples - n ) span = samples - n;
+            addLevel( mix + n, span, noiseVolTable.level[ (m_shiftNoise & 0x01) ? 0 : level ] );
+            chan.counter += span * step;
+            n += span;
+            if ( n == samples ) break;
+            chan.counter += step;
+            while ( chan.counter >= period )
+            {
+                stepNoise();
+                chan.counter -= period;
+            }
+            mix[n++] += noiseVolTable.level[ (m_shiftNoise & 0x01) ? 0 : level ];
+        }
+    }
+    chan.volume = (m_shiftNoise & 0x01) ? 0 : level;
+    chan.output = noiseVolTable.level[ chan.volume ];
+    return mix && level ? 0 : chan.output;
+}
+
+uint32_t NesApu::spanDmcChannel(ChannelInfo &chan, uint32_t *mix, int samples)
+{
+    if ( !chan.dmcActive && !chan.sequencer )
+    {
+        chan.output = (static_cast<uint32_t>(dmcVolTable.level[15]) * chan.volume) >> 7;
+        return chan.output;
+    }
+    for (int n = 0; n < samples; n++)
+    {
+        updateDmcChannel( chan );
+        if ( mix ) mix[n] += chan.output;
+    }
+    return 0;
+}
+
 //--------------
 //Square Channel
 //--------------
@@ -366,18 +652,11 @@ uint32_t NesApu::getSample()
 void NesApu::updateRectChannel(int i)
 {
     ChannelInfo &chan = m_chan[i];
-    static constexpr uint8_t sequencerTable[] =
-    {
-        0b01000000,
-        0b01100000,
-        0b01111000,
-        0b10011111,
-    };
 
     if (!(m_regs[APU_STATUS] & (1<<i)))
     {
         chan.volume = 0;
-        chan.output = m_rectVolTable[ chan.volume ];
+        chan.output = rectVolTable.level[ chan.volume ];
         return;
     }
 
@@ -431,7 +710,7 @@ void NesApu::updateRectChannel(int i)
     if (!chan.lenCounter)
     {
         chan.volume = 0;
-        chan.output = m_rectVolTable[ chan.volume ];
+        chan.output = rectVolTable.level[ chan.volume ];
         return;
     }
     // Sweep works
@@ -464,11 +743,11 @@ void NesApu::updateRectChannel(int i)
          chan.period > (0x7FF << (CONST_SHIFT_BITS + 4)) )
     {
         chan.volume = 0;
-        chan.output = m_rectVolTable[ chan.volume ];
+        chan.output = rectVolTable.level[ chan.volume ];
         return;
     }
 
-    chan.counter += counterScaler << 3;
+    chan.counter += m_counterScaler << 3;
     while ( chan.counter >= chan.period + (1 <<  (CONST_SHIFT_BITS + 4)) )
     {
         chan.sequencer++;
@@ -479,7 +758,7 @@ void NesApu::updateRectChannel(int i)
     {
         chan.volume = 0;
     }
-    chan.output = m_rectVolTable[ chan.volume ];
+    chan.output = rectVolTable.level[ chan.volume ];
 }
 
 
@@ -498,16 +777,11 @@ void NesApu::updateRectChannel(int i)
 
 void NesApu::updateTriangleChannel(ChannelInfo &chan)
 {
-    static constexpr uint8_t triangleTable[] =
-    {
-        0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
-        15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
-    };
     bool disabled = !(m_regs[APU_STATUS] & TRI_ENABLE_MASK);
 
     if (disabled)
     {
-        chan.output = m_triVolTable[ chan.volume ];
+        chan.output = triVolTable.level[ chan.volume ];
         return;
     }
     // Linear counter control
@@ -531,11 +805,11 @@ void NesApu::updateTriangleChannel(ChannelInfo &chan)
 
     if ((!chan.lenCounter || !chan.linearCounter))
     {
-        chan.output = m_triVolTable[ chan.volume ];
+        chan.output = triVolTable.level[ chan.volume ];
         return;
     }
 
-    chan.counter += counterScaler << 4;
+    chan.counter += m_counterScaler << 4;
     while ( chan.counter >= ( chan.period + (1 <<  (CONST_SHIFT_BITS + 4))) )
     {
         chan.sequencer++;
@@ -543,7 +817,7 @@ void NesApu::updateTriangleChannel(ChannelInfo &chan)
         chan.counter -= ( chan.period + (1 <<  (CONST_SHIFT_BITS + 4)) );
         chan.volume = triangleTable[ chan.sequencer ];
     }
-    chan.output = m_triVolTable[ chan.volume ];
+    chan.output = triVolTable.level[ chan.volume ];
 }
 
 //-------------
@@ -564,7 +838,7 @@ void NesApu::updateNoiseChannel(ChannelInfo &chan)
     if (!(m_regs[APU_STATUS] & (1<<3)))
     {
         chan.volume = 0;
-        chan.output = m_noiseVolTable[ chan.volume ];
+        chan.output = noiseVolTable.level[ chan.volume ];
         return;
     }
 
@@ -618,33 +892,21 @@ void NesApu::updateNoiseChannel(ChannelInfo &chan)
     if (!chan.lenCounter)
     {
         chan.volume = 0;
-        chan.output = m_noiseVolTable[ chan.volume ];
+        chan.output = noiseVolTable.level[ chan.volume ];
         return;
     }
 
-    chan.counter += counterScaler << 3;
+    chan.counter += m_counterScaler << 3;
     while ( chan.counter >= chan.period + (1 <<  (CONST_SHIFT_BITS + 4)) )
     {
-        uint8_t temp;
-        if ( m_regs[APU_NOISE_FREQ] & NOISE_MODE_MASK )
-        {
-            // 93-bits
-            temp = ((m_shiftNoise >> 6)^m_shiftNoise) & 1;
-        }
-        else
-        {
-            // 32768-bits
-            temp = ((m_shiftNoise >> 1)^m_shiftNoise) & 1;
-        }
-        m_shiftNoise >>= 1;
-        m_shiftNoise |= (temp << 14);
+        stepNoise();
         chan.counter -= (chan.period + (1 <<  (CONST_SHIFT_BITS + 4)));
     }
     if ( m_shiftNoise & 0x01 )
     {
         chan.volume = 0;
     }
-    chan.output = m_noiseVolTable[ chan.volume ];
+    chan.output = noiseVolTable.level[ chan.volume ];
 }
 
 //------------------------------
@@ -660,37 +922,51 @@ void NesApu::updateNoiseChannel(ChannelInfo &chan)
 //    |  Buffer  |----| Output  |---->| Counter |---->|   DAC   |
 //    +----------+    +---------+     +---------+     +---------+
 
+bool NesApu::fetchDmcByte(ChannelInfo &info)
+{
+    if ( info.dmcLen == 0 )
+    {
+        if ( m_regs[APU_DMC_DMA_FREQ] & DMC_LOOP_MASK )
+        {
+            info.dmcAddr = m_regs[APU_DMC_ADDR] * 0x40 + 0xC000;
+            info.dmcLen = m_regs[APU_DMC_LEN] * 16 + 1;
+        }
+        else
+        {
+            info.dmcIrqFlag = !!(m_regs[APU_DMC_DMA_FREQ] & DMC_IRQ_ENABLE_MASK);
+            info.dmcActive = false;
+            return false;
+        }
+    }
+    info.dmcBuffer = m_cpu->read( info.dmcAddr );
+    info.sequencer = 8;
+    info.dmcAddr++;
+    info.dmcLen--;
+    if ( info.dmcAddr == 0x0000 ) info.dmcAddr = 0x8000;
+    return true;
+}
+
 void NesApu::updateDmcChannel(ChannelInfo &info)
 {
     if ( info.dmcActive && !info.sequencer )
     {
-        if ( info.dmcLen == 0 )
+        if ( !fetchDmcByte( info ) )
         {
-            if ( m_regs[APU_DMC_DMA_FREQ] & DMC_LOOP_MASK )
-            {
-                info.dmcAddr = m_regs[APU_DMC_ADDR] * 0x40 + 0xC000;
-                info.dmcLen = m_regs[APU_DMC_LEN] * 16 + 1;
-            }
-            else
-            {
-                info.dmcIrqFlag = !!(m_regs[APU_DMC_DMA_FREQ] & DMC_IRQ_ENABLE_MASK);
-                info.dmcActive = false;
-                info.output = (static_cast<uint32_t>(m_dmcVolTable[15]) * info.volume) >> 7;
-                return;
-            }
+            info.output = (static_cast<uint32_t>(dmcVolTable.level[15]) * info.volume) >> 7;
+            return;
         }
-        info.dmcBuffer = m_cpu->read( info.dmcAddr );
-        info.sequencer = 8;
-        info.dmcAddr++;
-        info.dmcLen--;
-        if ( info.dmcAddr == 0x0000 ) info.dmcAddr = 0x8000;
     }
 
     if ( info.sequencer )
     {
-        info.counter += counterScaler;
+        info.counter += m_counterScaler;
         while ( info.counter >= info.period )
         {
+            // At low sample frequencies several bytes can be played during single sample
+            if ( !info.sequencer && !( info.dmcActive && fetchDmcByte( info ) ) )
+            {
+                break;
+            }
             if ( info.dmcBuffer & 1 )
             {
                 if ( info.volume <= 125 ) info.volume += 2;
@@ -704,7 +980,7 @@ void NesApu::updateDmcChannel(ChannelInfo &info)
             info.counter -= info.period;
         }
     }
-    info.output = (static_cast<uint32_t>(m_dmcVolTable[15]) * info.volume) >> 7;
+    info.output = (static_cast<uint32_t>(dmcVolTable.level[15]) * info.volume) >> 7;
     return;
 }
 
@@ -714,7 +990,7 @@ void NesApu::updateFrameCounter()
     m_quaterSignal = false;
     m_halfSignal = false;
     m_fullSignal = false;
-    m_lastFrameCounter += counterScaler;
+    m_lastFrameCounter += m_counterScaler;
     if ( m_lastFrameCounter >= frameCounterPeriod )
     {
         m_lastFrameCounter -= frameCounterPeriod;
@@ -731,3 +1007,81 @@ void NesApu::updateFrameCounter()
         }
     }
 }
+
+void NesApu::skip(uint32_t samples)
+{
+    while ( samples > 0 )
+    {
+        int span = getFrameCounterSpan( samples < NES_APU_SPAN_SIZE ? samples : NES_APU_SPAN_SIZE );
+        if ( !span )
+        {
+            // Frame counter tick
+            updateChannels();
+            samples--;
+            continue;
+        }
+        renderSpan( nullptr, span );
+        samples -= span;
+    }
+}
+
+bool NesApu::isSilent() const
+{
+    for (int i=0; i<4; i++)
+    {
+        // Triangle channel is checked separately, it has no envelope
+        if ( i == 2 ) continue;
+        const ChannelInfo &chan = m_chan[i];
+        uint8_t volumeReg = m_regs[ i == 3 ? APU_NOISE_VOL : APU_RECT_VOL1 + i*4 ];
+        if ( !(m_regs[APU_STATUS] & (1<<i)) || !chan.lenCounter )
+        {
+            continue;
+        }
+        if ( i < 2 && ( chan.period < (8 << (CONST_SHIFT_BITS + 4)) ||
+                        chan.period > (0x7FF << (CONST_SHIFT_BITS + 4)) ) )
+        {
+            continue;
+        }
+        // Decay counter stays at zero, until the channel is restarted, or the envelope loops
+        bool audible = ( volumeReg & FIXED_VOL_MASK ) ? ( volumeReg & VALUE_VOL_MASK ) != 0 :
+                       chan.decayCounter || chan.updateEnvelope || ( volumeReg & ENABLE_LOOP_MASK );
+        if ( audible )
+        {
+            return false;
+        }
+    }
+    // Stopped triangle sequencer and DMC keep constant output level
+    const ChannelInfo &tri = m_chan[2];
+    if ( (m_regs[APU_STATUS] & TRI_ENABLE_MASK) && tri.lenCounter &&
+         ( tri.linearCounter || ( tri.linearReloadFlag && (m_regs[APU_TRIANGLE] & 0x7F) ) ) )
+    {
+        return false;
+    }
+    return !m_chan[4].dmcActive && !m_chan[4].sequencer;
+}
+
+void NesApu::saveState(NesApuSnapshot &state) const
+{
+    for (int i=0; i<5; i++) state.chan[i] = m_chan[i];
+    for (int i=0; i<APU_MAX_REG; i++) state.regs[i] = m_regs[i];
+    state.lastFrameCounter = m_lastFrameCounter;
+    state.shiftNoise = m_shiftNoise;
+    state.apuFrames = m_apuFrames;
+    state.quaterSignal = m_quaterSignal;
+    state.halfSignal = m_halfSignal;
+    state.fullSignal = m_fullSignal;
+}
+
+void NesApu::loadState(const NesApuSnapshot &state)
+{
+    for (int i=0; i<5; i++) m_chan[i] = state.chan[i];
+    for (int i=0; i<APU_MAX_REG; i++) m_regs[i] = state.regs[i];
+    m_lastFrameCounter = state.lastFrameCounter;
+    m_shiftNoise = state.shiftNoise;
+    m_apuFrames = state.apuFrames;
+    m_quaterSignal = state.quaterSignal;
+    m_halfSignal = state.halfSignal;
+    m_fullSignal = state.fullSignal;
+}
+
+#endif
@@ -25,8 +25,11 @@ SOFTWARE.
 #include "chips/nes_apu.h"
 #include "chips/nes_cpu.h"
 
+#if VGM_DECODER_NES
+
 #include <malloc.h>
 #include <stdio.h>
+#include <string.h>
 
 #define NES_CPU_DEBUG 1
 //#define DEBUG_NES_CPU
@@ -46,27 +49,68 @@ NesCpu::NesCpu()
 
 NesCpu::~NesCpu()
 {
+#if !VGM_DECODER_SINGLE_CHIP
     if ( m_ram )
     {
         free( m_ram );
-        m_ram = nullptr;
     }
-    if ( m_cartridge )
+#endif
+    m_ram = nullptr;
+    if ( m_cartridge && m_ownCartridge )
     {
         delete m_cartridge;
-        m_cartridge = nullptr;
     }
+    m_cartridge = nullptr;
 }
 
 
-void NesCpu::insertCartridge( NesCartridge * cartridge )
+void NesCpu::insertCartridge( NesCartridge * cartridge, bool owned )
 {
-    if ( m_cartridge )
+    if ( m_cartridge && m_ownCartridge )
     {
         delete m_cartridge;
-        m_cartridge = nullptr;
     }
     m_cartridge = cartridge;
+    m_ownCartridge = owned;
+    mapPages();
+}
+
+bool NesCpu::allocRam()
+{
+    if ( m_ram == nullptr )
+    {
+#if VGM_DECODER_SINGLE_CHIP
+        m_ram = m_ramStorage;
+#else
+        m_ram = static_cast<uint8_t *>(malloc(NES_CPU_RAM_SIZE));
+#endif
+    }
+    return m_ram != nullptr;
+}
+
+void NesCpu::mapPages()
+{
+#if !VGM_DECODER_COMPACT
+    for (int page = 0; page < 0x10000 / NES_CPU_PAGE_SIZE; page++)
+    {
+        uint16_t address = page * NES_CPU_PAGE_SIZE;
+        m_readPages[page] = nullptr;
+        m_writePages[page] = nullptr;
+        if ( address < 0x2000 )
+        {
+            // RAM is mirrored 4 times
+            m_writePages[page] = m_ram ? m_ram + ( address & 0x07FF ) : nullptr;
+            m_readPages[page] = m_writePages[page];
+        }
+        // Page 0x4000 contains APU registers, so cartridge pages start from the next one
+        else if ( address > 0x4000 && m_cartridge )
+        {
+            m_readPages[page] = m_cartridge->getReadPage( address );
+            m_writePages[page] = m_cartridge->getWritePage( address );
+        }
+    }
+#endif
+    m_mapRevision = m_cartridge ? m_cartridge->getMapRevision() : 0;
 }
 
 NesCartridge *NesCpu::getCartridge()
@@ -86,12 +130,72 @@ void NesCpu::power()
     if ( m_cartridge ) m_cartridge->power();
 }
 
+uint32_t NesCpu::getStateSize() const
+{
+    return sizeof(NesCpuSnapshot) + ( m_cartridge ? m_cartridge->getStateSize() : 0 );
+}
+
+void NesCpu::saveState(uint8_t *state) const
+{
+    // State buffer is not aligned, so prepare snapshot and copy it to the buffer
+    NesCpuSnapshot snapshot{};
+    snapshot.cpu = m_cpu;
+    m_apu.saveState( snapshot.apu );
+    snapshot.stopSp = m_stopSp;
+    snapshot.ramValid = m_ram != nullptr;
+    if ( m_ram ) memcpy( snapshot.ram, m_ram, NES_CPU_RAM_SIZE );
+    memcpy( state, &snapshot, sizeof(snapshot) );
+    if ( m_cartridge ) m_cartridge->saveState( state + sizeof(NesCpuSnapshot) );
+}
+
+void NesCpu::loadState(const uint8_t *state)
+{
+    NesCpuSnapshot snapshot{};
+    memcpy( &snapshot, state, sizeof(snapshot) );
+    m_cpu = snapshot.cpu;
+    m_apu.loadState( snapshot.apu );
+    m_stopSp = snapshot.stopSp;
+    if ( snapshot.ramValid )
+    {
+        allocRam();
+        memcpy( m_ram, snapshot.ram, NES_CPU_RAM_SIZE );
+    }
+    if ( m_cartridge ) m_cartridge->loadState( state + sizeof(NesCpuSnapshot) );
+    mapPages();
+}
+
+uint64_t NesCpu::getStateHash() const
+{
+    const uint8_t registers[] = { m_cpu.a, m_cpu.x, m_cpu.y, m_cpu.flags, m_cpu.sp };
+    uint64_t hash = nesStateHash( NES_STATE_HASH_SEED, registers, sizeof(registers) );
+    if ( m_ram ) hash = nesStateHash( hash, m_ram, NES_CPU_RAM_SIZE );
+    hash = m_apu.getStateHash( hash );
+    return m_cartridge ? m_cartridge->getStateHash( hash ) : hash;
+}
+
 uint8_t NesCpu::read(uint16_t address)
+{
+#if !VGM_DECODER_COMPACT
+    const uint8_t *page = m_readPages[ address / NES_CPU_PAGE_SIZE ];
+    if ( page )
+    {
+        TRACEM( VGM_TRACE_MEMORY_READ, address, page[ address % NES_CPU_PAGE_SIZE ] );
+        return page[ address % NES_CPU_PAGE_SIZE ];
+    }
+#endif
+    return readTrap( address );
+}
+
+uint8_t NesCpu::readTrap(uint16_t address)
 {
     if ( address < 0x2000 )
     {
-        if ( m_ram == nullptr ) m_ram = static_cast<uint8_t *>(malloc(2048));
-        LOGM("[%04X] ==> %02X\n", address, m_ram[address & 0x07FF]);
+        if ( m_ram == nullptr )
+        {
+            allocRam();
+            mapPages();
+        }
+        TRACEM( VGM_TRACE_MEMORY_READ, address, m_ram[address & 0x07FF] );
         return m_ram[address & 0x07FF];
     }
     if ( address >= 0x4000 && address < 0x4020 )
@@ -100,7 +204,9 @@ uint8_t NesCpu::read(uint16_t address)
     }
     if ( address >= 0x4020 && m_cartridge )
     {
-        return m_cartridge->read( address );
+        uint8_t data = m_cartridge->read( address );
+        if ( m_cartridge->getMapRevision() != m_mapRevision ) mapPages();
+        return data;
     }
     LOGE("Memory data fetch error 0x%04X\n", address);
     return 0xFF;
@@ -112,12 +218,30 @@ uint8_t NesCpu::readInternal(uint16_t address)
 }
 
 bool NesCpu::write(uint16_t address, uint8_t data)
+{
+#if !VGM_DECODER_COMPACT
+    uint8_t *page = m_writePages[ address / NES_CPU_PAGE_SIZE ];
+    if ( page )
+    {
+        page[ address % NES_CPU_PAGE_SIZE ] = data;
+        TRACEM( VGM_TRACE_MEMORY_WRITE, address, data );
+        return true;
+    }
+#endif
+    return writeTrap( address, data );
+}
+
+bool NesCpu::writeTrap(uint16_t address, uint8_t data)
 {
     if ( address < 0x2000 )
     {
-        if ( m_ram == nullptr ) m_ram = static_cast<uint8_t *>(malloc(2048));
+        if ( m_ram == nullptr )
+        {
+            allocRam();
+            mapPages();
+        }
         m_ram[address & 0x07FF] = data;
-        LOGM("[%04X] <== %02X\n", address, data);
+        TRACEM( VGM_TRACE_MEMORY_WRITE, address, data );
         return true;
     }
     if ( address >= 0x4000 && address < 0x4020 )
@@ -127,7 +251,9 @@ bool NesCpu::write(uint16_t address, uint8_t data)
     }
     if ( address >= 0x4020 && m_cartridge )
     {
-        return m_cartridge->write( address, data );
+        bool result = m_cartridge->write( address, data );
+        if ( m_cartridge->getMapRevision() != m_mapRevision ) mapPages();
+        return result;
     }
     LOGE("Memory data write error (ROM) 0x%04X\n", address);
     return false;
@@ -138,74 +264,70 @@ NesCpuState &NesCpu::cpuState()
     return m_cpu;
 }
 
-void NesCpu::IMD()
+uint16_t NesCpu::IMD()
 {
-    m_cpu.absAddr = m_cpu.pc;
-    m_cpu.pc++;
+    return m_cpu.pc++;
 }
 
-void NesCpu::ZP()
+uint16_t NesCpu::ZP()
 {
-    m_cpu.absAddr = fetch();
+    return fetch();
 }
 
-void NesCpu::ZPX()
+uint16_t NesCpu::ZPX()
 {
-    m_cpu.absAddr = (fetch() + m_cpu.x) & 0x00FF;
+    return (fetch() + m_cpu.x) & 0x00FF;
 }
 
-void NesCpu::ZPY()
+uint16_t NesCpu::ZPY()
 {
-    m_cpu.absAddr = (fetch() + m_cpu.y) & 0x00FF;
+    return (fetch() + m_cpu.y) & 0x00FF;
 }
 
-void NesCpu::REL()
+uint16_t NesCpu::REL()
 {
-    m_cpu.relAddr = fetch();
-    if ( m_cpu.relAddr & 0x80)
-        m_cpu.relAddr |= 0xFF00;
+    uint16_t relAddr = fetch();
+    if ( relAddr & 0x80)
+        relAddr |= 0xFF00;
+    return relAddr;
 }
 
-void NesCpu::ABS()
+uint16_t NesCpu::ABS()
 {
-    m_cpu.absAddr = fetch();
-    m_cpu.absAddr |= static_cast<uint16_t>(fetch()) << 8;
+    uint16_t absAddr = fetch();
+    absAddr |= static_cast<uint16_t>(fetch()) << 8;
+    return absAddr;
 }
 
-void NesCpu::ABX()
+uint16_t NesCpu::ABX()
 {
-    m_cpu.absAddr = static_cast<uint16_t>(fetch());
-    m_cpu.absAddr |= (static_cast<uint16_t>(fetch()) << 8);
-    m_cpu.absAddr += m_cpu.x;
+    return ABS() + m_cpu.x;
 }
 
-void NesCpu::ABY()
+uint16_t NesCpu::ABY()
 {
-    m_cpu.absAddr = fetch();
-    m_cpu.absAddr |= (static_cast<uint16_t>(fetch()) << 8);
-    m_cpu.absAddr += m_cpu.y;
+    return ABS() + m_cpu.y;
 }
 
-void NesCpu::IND()
+uint16_t NesCpu::IND()
 {
-    m_cpu.absAddr = fetch();
-    m_cpu.absAddr |= (static_cast<uint16_t>(fetch()) << 8);
+    uint16_t absAddr = ABS();
     // no page boundary hardware bug
-    m_cpu.absAddr = (read(m_cpu.absAddr)) | (read( m_cpu.absAddr + 1 ) << 8);
+    return (read(absAddr)) | (read( absAddr + 1 ) << 8);
 }
 
-void NesCpu::IDX()
+uint16_t NesCpu::IDX()
 {
-    m_cpu.absAddr = (fetch() + m_cpu.x) & 0x00FF;
-    m_cpu.absAddr = (read(m_cpu.absAddr)) | (read( (m_cpu.absAddr + 1) & 0xFF ) << 8);
+    uint16_t absAddr = (fetch() + m_cpu.x) & 0x00FF;
+    return (read(absAddr)) | (read( (absAddr + 1) & 0xFF ) << 8);
 }
 
-void NesCpu::IDY()
+uint16_t NesCpu::IDY()
 {
-    m_cpu.absAddr = fetch();
-    m_cpu.absAddr = static_cast<uint16_t>(read( m_cpu.absAddr )) |
-                    (static_cast<uint16_t>(read( (m_cpu.absAddr + 1) & 0xFF )) << 8);
-    m_cpu.absAddr += m_cpu.y;
+    uint16_t absAddr = fetch();
+    absAddr = static_cast<uint16_t>(read( absAddr )) |
+              (static_cast<uint16_t>(read( (absAddr + 1) & 0xFF )) << 8);
+    return absAddr + m_cpu.y;
 }
 
 enum
@@ -227,16 +349,18 @@ void NesCpu::modifyFlags(uint8_t baseData)
     m_cpu.flags |= (baseData & 0x80) ? N_FLAG : 0;
 }
 
-void NesCpu::printCpuState(const Instruction & instruction, uint16_t pc)
+void NesCpu::printCpuState(uint16_t pc)
 {
+#if VGM_DECODER_TRACE
+    TRACE( VGM_TRACE_CPU_STEP, readInternal( pc ) | (m_cpu.flags << 8), pc,
+           (m_cpu.sp << 24) | (m_cpu.a << 16) | (m_cpu.x << 8) | m_cpu.y );
+#else
     LOGI("SP:%02X A:%02X X:%02X Y:%02X F:%02X [%04X] (0x%02X) %s\n",
          m_cpu.sp, m_cpu.a, m_cpu.x, m_cpu.y, m_cpu.flags, pc, readInternal( pc ),
-         getOpCode( instruction, readInternal(pc + 1) | (static_cast<uint16_t>(readInternal(pc + 2)) << 8)).c_str() );
+         getOpCode( readInternal( pc ), readInternal(pc + 1) | (static_cast<uint16_t>(readInternal(pc + 2)) << 8)).c_str() );
+#endif
 }
 
-#define GEN_OPCODE(x) if ( instruction.opcode == &NesCpu::x ) opcode = # x
-#define GEN_ADDRMODE(x, y) if ( instruction.addrmode == &NesCpu::x ) opcode += y
-
 static std::string hexToString( uint16_t hex )
 {
     char str[6]{};
@@ -251,171 +375,262 @@ static std::string hexToString( uint8_t hex )
     return str;
 }
 
-using c = NesCpu;
-const NesCpu::Instruction NesCpu::commands[256] =
-{
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 0X */{ &c::BRK, &c::UND }, { &c::ORA, &c::IDX }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::ORA, &c::ZP  }, { &c::ASL, &c::ZP  }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 0X */{ &c::UND, &c::UND }, { &c::ORA, &c::IMD }, { &c::ASL, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::ORA, &c::ABS }, { &c::ASL, &c::ABS }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 1X */{ &c::BPL, &c::REL }, { &c::ORA, &c::IDY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::ORA, &c::ZPX }, { &c::ASL, &c::ZPX }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 1X */{ &c::CLC, &c::UND }, { &c::ORA, &c::ABY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::ORA, &c::ABX }, { &c::ASL, &c::ABX }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 2X */{ &c::JSR, &c::ABS }, { &c::AND, &c::IDX }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::BIT, &c::ZP  }, { &c::AND, &c::ZP  }, { &c::ROL, &c::ZP  }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 2X */{ &c::UND, &c::UND }, { &c::AND, &c::IMD }, { &c::ROL, &c::UND }, { &c::UND, &c::UND }, { &c::BIT, &c::ABS }, { &c::AND, &c::ABS }, { &c::ROL, &c::ABS }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 3X */{ &c::BMI, &c::REL }, { &c::AND, &c::IDY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::AND, &c::ZPX }, { &c::ROL, &c::ZPX }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 3X */{ &c::SEC, &c::UND }, { &c::AND, &c::ABY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::AND, &c::ABX }, { &c::ROL, &c::ABX }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 4X */{ &c::UND, &c::UND }, { &c::EOR, &c::IDX }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::EOR, &c::ZP  }, { &c::LSR, &c::ZP  }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 4X */{ &c::PHA, &c::UND }, { &c::EOR, &c::IMD }, { &c::LSR, &c::UND }, { &c::UND, &c::UND }, { &c::JMP, &c::ABS }, { &c::EOR, &c::ABS }, { &c::LSR, &c::ABS }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 5X */{ &c::UND, &c::UND }, { &c::EOR, &c::IDY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::EOR, &c::ZPX }, { &c::LSR, &c::ZPX }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 5X */{ &c::UND, &c::UND }, { &c::EOR, &c::ABY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::EOR, &c::ABX }, { &c::LSR, &c::ABX }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 6X */{ &c::RTS, &c::UND }, { &c::ADC, &c::IDX }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::ADC, &c::ZP  }, { &c::ROR, &c::ZP  }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 6X */{ &c::PLA, &c::UND }, { &c::ADC, &c::IMD }, { &c::ROR, &c::UND }, { &c::UND, &c::UND }, { &c::JMP, &c::IND }, { &c::ADC, &c::ABS }, { &c::ROR, &c::ABS }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 7X */{ &c::UND, &c::UND }, { &c::ADC, &c::IDY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::ADC, &c::ZPX }, { &c::ROR, &c::ZPX }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 7X */{ &c::UND, &c::UND }, { &c::ADC, &c::ABY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::ADC, &c::ABX }, { &c::ROR, &c::ABX }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 8X */{ &c::UND, &c::UND }, { &c::STA, &c::IDX }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::STY, &c::ZP  }, { &c::STA, &c::ZP  }, { &c::STX, &c::ZP  }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 8X */{ &c::DEY, &c::UND }, { &c::UND, &c::UND }, { &c::TXA, &c::UND }, { &c::UND, &c::UND }, { &c::STY, &c::ABS }, { &c::STA, &c::ABS }, { &c::STX, &c::ABS }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* 9X */{ &c::BCC, &c::REL }, { &c::STA, &c::IDY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::STY, &c::ZPX }, { &c::STA, &c::ZPX }, { &c::STX, &c::ZPY }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* 9X */{ &c::TYA, &c::UND }, { &c::STA, &c::ABY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::STA, &c::ABX }, { &c::UND, &c::UND }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* AX */{ &c::LDY, &c::IMD }, { &c::LDA, &c::IDX }, { &c::LDX, &c::IMD }, { &c::UND, &c::UND }, { &c::LDY, &c::ZP  }, { &c::LDA, &c::ZP  }, { &c::LDX, &c::ZP  }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* AX */{ &c::TAY, &c::UND }, { &c::LDA, &c::IMD }, { &c::TAX, &c::UND }, { &c::UND, &c::UND }, { &c::LDY, &c::ABS }, { &c::LDA, &c::ABS }, { &c::LDX, &c::ABS }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* BX */{ &c::BCS, &c::REL }, { &c::LDA, &c::IDY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::LDY, &c::ZPX }, { &c::LDA, &c::ZPX }, { &c::LDX, &c::ZPY }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* BX */{ &c::UND, &c::UND }, { &c::LDA, &c::ABY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::LDY, &c::ABX }, { &c::LDA, &c::ABX }, { &c::LDX, &c::ABY }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* CX */{ &c::CPY, &c::IMD }, { &c::CMP, &c::IDX }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::CPY, &c::ZP  }, { &c::CMP, &c::ZP  }, { &c::DEC, &c::ZP  }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* CX */{ &c::INY, &c::UND }, { &c::CMP, &c::IMD }, { &c::DEX, &c::UND }, { &c::UND, &c::UND }, { &c::CPY, &c::ABS }, { &c::CMP, &c::ABS }, { &c::DEC, &c::ABS }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* DX */{ &c::BNE, &c::REL }, { &c::CMP, &c::IDY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::CMP, &c::ZPX }, { &c::DEC, &c::ZPX }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* DX */{ &c::UND, &c::UND }, { &c::CMP, &c::ABY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::CMP, &c::ABX }, { &c::DEC, &c::ABX }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* EX */{ &c::CPX, &c::IMD }, { &c::SBC, &c::IDX }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::CPX, &c::ZP  }, { &c::SBC, &c::ZP  }, { &c::INC, &c::ZP  }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* EX */{ &c::INX, &c::UND }, { &c::SBC, &c::IMD }, { &c::NOP, &c::UND }, { &c::UND, &c::UND }, { &c::CPX, &c::ABS }, { &c::SBC, &c::ABS }, { &c::INC, &c::ABS }, { &c::UND, &c::UND },
-/*      X0                    X1                    X2                    X3                    X4                    X5                    X6                    X7                 */
-/* FX */{ &c::BEQ, &c::REL }, { &c::SBC, &c::IDY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::SBC, &c::ZPX }, { &c::INC, &c::ZPX }, { &c::UND, &c::UND },
-/*      X8                    X9                    XA                    XB                    XC                    XD                    XE                    XF                 */
-/* FX */{ &c::UND, &c::UND }, { &c::SBC, &c::ABY }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::UND, &c::UND }, { &c::SBC, &c::ABX }, { &c::INC, &c::ABX }, { &c::UND, &c::UND },
+/** Addressing modes of instructions, used to print disassembled code */
+enum
+{
+    MODE_IMP,
+    MODE_IMD,
+    MODE_ZP,
+    MODE_ZPX,
+    MODE_ZPY,
+    MODE_ABS,
+    MODE_ABX,
+    MODE_ABY,
+    MODE_REL,
+    MODE_IND,
+    MODE_IDX,
+    MODE_IDY,
+};
+
+typedef struct
+{
+    const char *name;
+    uint8_t mode;
+} NesCpuOpcodeInfo;
+
+static const NesCpuOpcodeInfo opcodes[256] =
+{
+/* 0X */ { "BRK", MODE_IMP }, { "ORA", MODE_IDX }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "ORA", MODE_ZP }, { "ASL", MODE_ZP }, { "???", MODE_IMP },
+         { "???", MODE_IMP }, { "ORA", MODE_IMD }, { "ASL", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "ORA", MODE_ABS }, { "ASL", MODE_ABS }, { "???", MODE_IMP },
+/* 1X */ { "BPL", MODE_REL }, { "ORA", MODE_IDY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "ORA", MODE_ZPX }, { "ASL", MODE_ZPX }, { "???", MODE_IMP },
+         { "CLC", MODE_IMP }, { "ORA", MODE_ABY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "ORA", MODE_ABX }, { "ASL", MODE_ABX }, { "???", MODE_IMP },
+/* 2X */ { "JSR", MODE_ABS }, { "AND", MODE_IDX }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "BIT", MODE_ZP }, { "AND", MODE_ZP }, { "ROL", MODE_ZP }, { "???", MODE_IMP },
+         { "???", MODE_IMP }, { "AND", MODE_IMD }, { "ROL", MODE_IMP }, { "???", MODE_IMP }, { "BIT", MODE_ABS }, { "AND", MODE_ABS }, { "ROL", MODE_ABS }, { "???", MODE_IMP },
+/* 3X */ { "BMI", MODE_REL }, { "AND", MODE_IDY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "AND", MODE_ZPX }, { "ROL", MODE_ZPX }, { "???", MODE_IMP },
+         { "SEC", MODE_IMP }, { "AND", MODE_ABY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "AND", MODE_ABX }, { "ROL", MODE_ABX }, { "???", MODE_IMP },
+/* 4X */ { "???", MODE_IMP }, { "EOR", MODE_IDX }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "EOR", MODE_ZP }, { "LSR", MODE_ZP }, { "???", MODE_IMP },
+         { "PHA", MODE_IMP }, { "EOR", MODE_IMD }, { "LSR", MODE_IMP }, { "???", MODE_IMP }, { "JMP", MODE_ABS }, { "EOR", MODE_ABS }, { "LSR", MODE_ABS }, { "???", MODE_IMP },
+/* 5X */ { "???", MODE_IMP }, { "EOR", MODE_IDY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "EOR", MODE_ZPX }, { "LSR", MODE_ZPX }, { "???", MODE_IMP },
+         { "???", MODE_IMP }, { "EOR", MODE_ABY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "EOR", MODE_ABX }, { "LSR", MODE_ABX }, { "???", MODE_IMP },
+/* 6X */ { "RTS", MODE_IMP }, { "ADC", MODE_IDX }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "ADC", MODE_ZP }, { "ROR", MODE_ZP }, { "???", MODE_IMP },
+         { "PLA", MODE_IMP }, { "ADC", MODE_IMD }, { "ROR", MODE_IMP }, { "???", MODE_IMP }, { "JMP", MODE_IND }, { "ADC", MODE_ABS }, { "ROR", MODE_ABS }, { "???", MODE_IMP },
+/* 7X */ { "???", MODE_IMP }, { "ADC", MODE_IDY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "ADC", MODE_ZPX }, { "ROR", MODE_ZPX }, { "???", MODE_IMP },
+         { "???", MODE_IMP }, { "ADC", MODE_ABY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "ADC", MODE_ABX }, { "ROR", MODE_ABX }, { "???", MODE_IMP },
+/* 8X */ { "???", MODE_IMP }, { "STA", MODE_IDX }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "STY", MODE_ZP }, { "STA", MODE_ZP }, { "STX", MODE_ZP }, { "???", MODE_IMP },
+         { "DEY", MODE_IMP }, { "???", MODE_IMP }, { "TXA", MODE_IMP }, { "???", MODE_IMP }, { "STY", MODE_ABS }, { "STA", MODE_ABS }, { "STX", MODE_ABS }, { "???", MODE_IMP },
+/* 9X */ { "BCC", MODE_REL }, { "STA", MODE_IDY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "STY", MODE_ZPX }, { "STA", MODE_ZPX }, { "STX", MODE_ZPY }, { "???", MODE_IMP },
+         { "TYA", MODE_IMP }, { "STA", MODE_ABY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "STA", MODE_ABX }, { "???", MODE_IMP }, { "???", MODE_IMP },
+/* AX */ { "LDY", MODE_IMD }, { "LDA", MODE_IDX }, { "LDX", MODE_IMD }, { "???", MODE_IMP }, { "LDY", MODE_ZP }, { "LDA", MODE_ZP }, { "LDX", MODE_ZP }, { "???", MODE_IMP },
+         { "TAY", MODE_IMP }, { "LDA", MODE_IMD }, { "TAX", MODE_IMP }, { "???", MODE_IMP }, { "LDY", MODE_ABS }, { "LDA", MODE_ABS }, { "LDX", MODE_ABS }, { "???", MODE_IMP },
+/* BX */ { "BCS", MODE_REL }, { "LDA", MODE_IDY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "LDY", MODE_ZPX }, { "LDA", MODE_ZPX }, { "LDX", MODE_ZPY }, { "???", MODE_IMP },
+         { "???", MODE_IMP }, { "LDA", MODE_ABY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "LDY", MODE_ABX }, { "LDA", MODE_ABX }, { "LDX", MODE_ABY }, { "???", MODE_IMP },
+/* CX */ { "CPY", MODE_IMD }, { "CMP", MODE_IDX }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "CPY", MODE_ZP }, { "CMP", MODE_ZP }, { "DEC", MODE_ZP }, { "???", MODE_IMP },
+         { "INY", MODE_IMP }, { "CMP", MODE_IMD }, { "DEX", MODE_IMP }, { "???", MODE_IMP }, { "CPY", MODE_ABS }, { "CMP", MODE_ABS }, { "DEC", MODE_ABS }, { "???", MODE_IMP },
+/* DX */ { "BNE", MODE_REL }, { "CMP", MODE_IDY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "CMP", MODE_ZPX }, { "DEC", MODE_ZPX }, { "???", MODE_IMP },
+         { "???", MODE_IMP }, { "CMP", MODE_ABY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "CMP", MODE_ABX }, { "DEC", MODE_ABX }, { "???", MODE_IMP },
+/* EX */ { "CPX", MODE_IMD }, { "SBC", MODE_IDX }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "CPX", MODE_ZP }, { "SBC", MODE_ZP }, { "INC", MODE_ZP }, { "???", MODE_IMP },
+         { "INX", MODE_IMP }, { "SBC", MODE_IMD }, { "NOP", MODE_IMP }, { "???", MODE_IMP }, { "CPX", MODE_ABS }, { "SBC", MODE_ABS }, { "INC", MODE_ABS }, { "???", MODE_IMP },
+/* FX */ { "BEQ", MODE_REL }, { "SBC", MODE_IDY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "SBC", MODE_ZPX }, { "INC", MODE_ZPX }, { "???", MODE_IMP },
+         { "???", MODE_IMP }, { "SBC", MODE_ABY }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "???", MODE_IMP }, { "SBC", MODE_ABX }, { "INC", MODE_ABX }, { "???", MODE_IMP },
 };
 
-std::string NesCpu::getOpCode(const Instruction & instruction, uint16_t data)
-{
-    std::string opcode = "???";
-    GEN_OPCODE(ADC);
-    GEN_OPCODE(SBC);
-    GEN_OPCODE(CLC);
-    GEN_OPCODE(BPL);
-    GEN_OPCODE(BEQ);
-    GEN_OPCODE(BNE);
-    GEN_OPCODE(BMI);
-    GEN_OPCODE(BCC);
-    GEN_OPCODE(BCS);
-    GEN_OPCODE(CMP);
-    GEN_OPCODE(CPX);
-    GEN_OPCODE(CPY);
-    GEN_OPCODE(JSR);
-    GEN_OPCODE(ASL);
-    GEN_OPCODE(INY);
-    GEN_OPCODE(LDA);
-    GEN_OPCODE(LDX);
-    GEN_OPCODE(LDY);
-    GEN_OPCODE(STA);
-    GEN_OPCODE(STX);
-    GEN_OPCODE(STY);
-    GEN_OPCODE(TAX);
-    GEN_OPCODE(TAY);
-    GEN_OPCODE(TXA);
-    GEN_OPCODE(TYA);
-    GEN_OPCODE(JMP);
-    GEN_OPCODE(RTS);
-    GEN_OPCODE(DEC);
-    GEN_OPCODE(INC);
-    GEN_OPCODE(DEX);
-    GEN_OPCODE(DEY);
-    GEN_OPCODE(INX);
-    GEN_OPCODE(AND);
-    GEN_OPCODE(ORA);
-    GEN_OPCODE(EOR);
-    GEN_OPCODE(NOP);
-    GEN_OPCODE(LSR);
-    GEN_OPCODE(ROR);
-    GEN_OPCODE(ROL);
-    GEN_OPCODE(PHA);
-    GEN_OPCODE(PLA);
-    GEN_OPCODE(SEC);
-    GEN_OPCODE(BIT);
-
-    GEN_ADDRMODE(UND, "");
-    GEN_ADDRMODE(IMD, " #" + hexToString( static_cast<uint8_t>( data ) ) );
-    GEN_ADDRMODE(ZP,  " $" + hexToString( static_cast<uint8_t>( data ) ) );
-    GEN_ADDRMODE(ZPX, " $" + hexToString( static_cast<uint8_t>( data ) ) + std::string(", X"));
-    GEN_ADDRMODE(ZPY, " $" + hexToString( static_cast<uint8_t>( data ) ) + std::string(", Y"));
-    GEN_ADDRMODE(ABS, " $" + hexToString( data ));
-    GEN_ADDRMODE(ABX, " $" + hexToString( static_cast<uint16_t>( data ) ) + std::string(", X"));
-    GEN_ADDRMODE(ABY, " $" + hexToString( static_cast<uint16_t>( data ) ) + std::string(", Y"));
-    GEN_ADDRMODE(REL, " $" + hexToString( static_cast<uint8_t>( data ) ));
-    GEN_ADDRMODE(IND, " ($" + hexToString( data ) + std::string(")"));
-    GEN_ADDRMODE(IDX, " ($" + hexToString( static_cast<uint8_t>(data) ) + std::string(", X)"));
-    GEN_ADDRMODE(IDY, " ($" + hexToString( static_cast<uint8_t>(data) ) + std::string("), Y"));
+std::string NesCpu::getOpCode(uint8_t code, uint16_t data)
+{
+    std::string opcode = opcodes[ code ].name;
+    switch ( opcodes[ code ].mode )
+    {
+        case MODE_IMD: opcode += " #" + hexToString( static_cast<uint8_t>( data ) ); break;
+        case MODE_ZP:  opcode += " $" + hexToString( static_cast<uint8_t>( data ) ); break;
+        case MODE_ZPX: opcode += " $" + hexToString( static_cast<uint8_t>( data ) ) + std::string(", X"); break;
+        case MODE_ZPY: opcode += " $" + hexToString( static_cast<uint8_t>( data ) ) + std::string(", Y"); break;
+        case MODE_ABS: opcode += " $" + hexToString( data ); break;
+        case MODE_ABX: opcode += " $" + hexToString( static_cast<uint16_t>( data ) ) + std::string(", X"); break;
+        case MODE_ABY: opcode += " $" + hexToString( static_cast<uint16_t>( data ) ) + std::string(", Y"); break;
+        case MODE_REL: opcode += " $" + hexToString( static_cast<uint8_t>( data ) ); break;
+        case MODE_IND: opcode += " ($" + hexToString( data ) + std::string(")"); break;
+        case MODE_IDX: opcode += " ($" + hexToString( static_cast<uint8_t>(data) ) + std::string(", X)"); break;
+        case MODE_IDY: opcode += " ($" + hexToString( static_cast<uint8_t>(data) ) + std::string("), Y"); break;
+        default: break;
+    }
     return opcode;
 }
 
 bool NesCpu::executeInstruction()
 {
 #ifdef DEBUG_NES_CPU
-    uint16_t commandPc = m_cpu.pc;
+    printCpuState( m_cpu.pc );
 #endif
     uint8_t opcode = fetch();
-    if ( commands[ opcode ].opcode == &c::UND )
+    // Operand address is calculated in place by each case, so handlers can be inlined
+    switch ( opcode )
     {
-        LOGE("Unknown instruction (0x%02X) detected at [0x%04X]\n", opcode, m_cpu.pc - 1);
-        return false;
+        case 0x00: BRK(); break;
+        case 0x01: ORA( IDX() ); break;
+        case 0x05: ORA( ZP() ); break;
+        case 0x06: ASL( ZP() ); break;
+        case 0x09: ORA( IMD() ); break;
+        case 0x0A: ASL(); break;
+        case 0x0D: ORA( ABS() ); break;
+        case 0x0E: ASL( ABS() ); break;
+        case 0x10: branch( !(m_cpu.flags & N_FLAG) ); break;
+        case 0x11: ORA( IDY() ); break;
+        case 0x15: ORA( ZPX() ); break;
+        case 0x16: ASL( ZPX() ); break;
+        case 0x18: CLC(); break;
+        case 0x19: ORA( ABY() ); break;
+        case 0x1D: ORA( ABX() ); break;
+        case 0x1E: ASL( ABX() ); break;
+        case 0x20: JSR( ABS() ); break;
+        case 0x21: AND( IDX() ); break;
+        case 0x24: BIT( ZP() ); break;
+        case 0x25: AND( ZP() ); break;
+        case 0x26: ROL( ZP() ); break;
+        case 0x29: AND( IMD() ); break;
+        case 0x2A: ROL(); break;
+        case 0x2C: BIT( ABS() ); break;
+        case 0x2D: AND( ABS() ); break;
+        case 0x2E: ROL( ABS() ); break;
+        case 0x30: branch( m_cpu.flags & N_FLAG ); break;
+        case 0x31: AND( IDY() ); break;
+        case 0x35: AND( ZPX() ); break;
+        case 0x36: ROL( ZPX() ); break;
+        case 0x38: SEC(); break;
+        case 0x39: AND( ABY() ); break;
+        case 0x3D: AND( ABX() ); break;
+        case 0x3E: ROL( ABX() ); break;
+        case 0x41: EOR( IDX() ); break;
+        case 0x45: EOR( ZP() ); break;
+        case 0x46: LSR( ZP() ); break;
+        case 0x48: PHA(); break;
+        case 0x49: EOR( IMD() ); break;
+        case 0x4A: LSR(); break;
+        case 0x4C: JMP( ABS() ); break;
+        case 0x4D: EOR( ABS() ); break;
+        case 0x4E: LSR( ABS() ); break;
+        case 0x51: EOR( IDY() ); break;
+        case 0x55: EOR( ZPX() ); break;
+        case 0x56: LSR( ZPX() ); break;
+        case 0x59: EOR( ABY() ); break;
+        case 0x5D: EOR( ABX() ); break;
+        case 0x5E: LSR( ABX() ); break;
+        case 0x60: RTS(); break;
+        case 0x61: ADC( IDX() ); break;
+        case 0x65: ADC( ZP() ); break;
+        case 0x66: ROR( ZP() ); break;
+        case 0x68: PLA(); break;
+        case 0x69: ADC( IMD() ); break;
+        case 0x6A: ROR(); break;
+        case 0x6C: JMP( IND() ); break;
+        case 0x6D: ADC( ABS() ); break;
+        case 0x6E: ROR( ABS() ); break;
+        case 0x71: ADC( IDY() ); break;
+        case 0x75: ADC( ZPX() ); break;
+        case 0x76: ROR( ZPX() ); break;
+        case 0x79: ADC( ABY() ); break;
+        case 0x7D: ADC( ABX() ); break;
+        case 0x7E: ROR( ABX() ); break;
+        case 0x81: STA( IDX() ); break;
+        case 0x84: STY( ZP() ); break;
+        case 0x85: STA( ZP() ); break;
+        case 0x86: STX( ZP() ); break;
+        case 0x88: DEY(); break;
+        case 0x8A: TXA(); break;
+        case 0x8C: STY( ABS() ); break;
+        case 0x8D: STA( ABS() ); break;
+        case 0x8E: STX( ABS() ); break;
+        case 0x90: branch( !(m_cpu.flags & C_FLAG) ); break;
+        case 0x91: STA( IDY() ); break;
+        case 0x94: STY( ZPX() ); break;
+        case 0x95: STA( ZPX() ); break;
+        case 0x96: STX( ZPY() ); break;
+        case 0x98: TYA(); break;
+        case 0x99: STA( ABY() ); break;
+        case 0x9D: STA( ABX() ); break;
+        case 0xA0: LDY( IMD() ); break;
+        case 0xA1: LDA( IDX() ); break;
+        case 0xA2: LDX( IMD() ); break;
+        case 0xA4: LDY( ZP() ); break;
+        case 0xA5: LDA( ZP() ); break;
+        case 0xA6: LDX( ZP() ); break;
+        case 0xA8: TAY(); break;
+        case 0xA9: LDA( IMD() ); break;
+        case 0xAA: TAX(); break;
+        case 0xAC: LDY( ABS() ); break;
+        case 0xAD: LDA( ABS() ); break;
+        case 0xAE: LDX( ABS() ); break;
+        case 0xB0: branch( m_cpu.flags & C_FLAG ); break;
+        case 0xB1: LDA( IDY() ); break;
+        case 0xB4: LDY( ZPX() ); break;
+        case 0xB5: LDA( ZPX() ); break;
+        case 0xB6: LDX( ZPY() ); break;
+        case 0xB9: LDA( ABY() ); break;
+        case 0xBC: LDY( ABX() ); break;
+        case 0xBD: LDA( ABX() ); break;
+        case 0xBE: LDX( ABY() ); break;
+        case 0xC0: CPY( IMD() ); break;
+        case 0xC1: CMP( IDX() ); break;
+        case 0xC4: CPY( ZP() ); break;
+        case 0xC5: CMP( ZP() ); break;
+        case 0xC6: DEC( ZP() ); break;
+        case 0xC8: INY(); break;
+        case 0xC9: CMP( IMD() ); break;
+        case 0xCA: DEX(); break;
+        case 0xCC: CPY( ABS() ); break;
+        case 0xCD: CMP( ABS() ); break;
+        case 0xCE: DEC( ABS() ); break;
+        case 0xD0: branch( !(m_cpu.flags & Z_FLAG) ); break;
+        case 0xD1: CMP( IDY() ); break;
+        case 0xD5: CMP( ZPX() ); break;
+        case 0xD6: DEC( ZPX() ); break;
+        case 0xD9: CMP( ABY() ); break;
+        case 0xDD: CMP( ABX() ); break;
+        case 0xDE: DEC( ABX() ); break;
+        case 0xE0: CPX( IMD() ); break;
+        case 0xE1: SBC( IDX() ); break;
+        case 0xE4: CPX( ZP() ); break;
+        case 0xE5: SBC( ZP() ); break;
+        case 0xE6: INC( ZP() ); break;
+        case 0xE8: INX(); break;
+        case 0xE9: SBC( IMD() ); break;
+        case 0xEA: NOP(); break;
+        case 0xEC: CPX( ABS() ); break;
+        case 0xED: SBC( ABS() ); break;
+        case 0xEE: INC( ABS() ); break;
+        case 0xF0: branch( m_cpu.flags & Z_FLAG ); break;
+        case 0xF1: SBC( IDY() ); break;
+        case 0xF5: SBC( ZPX() ); break;
+        case 0xF6: INC( ZPX() ); break;
+        case 0xF9: SBC( ABY() ); break;
+        case 0xFD: SBC( ABX() ); break;
+        case 0xFE: INC( ABX() ); break;
+        default:
+            LOGE("Unknown instruction (0x%02X) detected at [0x%04X]\n", opcode, m_cpu.pc - 1);
+            return false;
     }
-    m_cpu.implied = false;
-    (this->*commands[ opcode ].addrmode)();
-#ifdef DEBUG_NES_CPU
-    printCpuState( commands[ opcode ], commandPc );
-#endif
-    (this->*commands[ opcode ].opcode)();
     return true;
 }
 
 int NesCpu::callSubroutine(uint16_t addr, int maxInstructions)
 {
     m_stopSp = m_cpu.sp;
-    m_cpu.absAddr = addr;
-    JSR();
+    JSR( addr );
     return continueSubroutine( maxInstructions );
 }
 
 int NesCpu::continueSubroutine(int maxInstructions)
 {
+#if VGM_DECODER_STATS
+    uint64_t executed = 0;
+#endif
     while ( m_stopSp != m_cpu.sp && executeInstruction( ) && maxInstructions )
     {
         if ( maxInstructions > 0 ) maxInstructions--;
+#if VGM_DECODER_STATS
+        executed++;
+#endif
     }
+    // Instruction, which reached the limit, is executed, but not counted in the loop
+    STATS_ADD( cpuInstructions, executed + ( maxInstructions == 0 ) );
     // Exit if we returned from subroutine call
     if ( m_stopSp == m_cpu.sp )
     {
@@ -431,14 +646,15 @@ int NesCpu::continueSubroutine(int maxInstructions)
     return -1;
 }
 
-void NesCpu::BPL()
+void NesCpu::branch(bool condition)
 {
-    if ( !(m_cpu.flags & N_FLAG) ) m_cpu.pc += m_cpu.relAddr;
+    uint16_t relAddr = REL();
+    if ( condition ) m_cpu.pc += relAddr;
 }
 
-void NesCpu::ADC()
+void NesCpu::ADC(uint16_t addr)
 {
-    uint8_t data = read( m_cpu.absAddr );
+    uint8_t data = read( addr );
     uint16_t temp = (uint16_t)m_cpu.a + (uint16_t)data + (uint16_t)(( m_cpu.flags & C_FLAG ) ? 1: 0);
     if ( temp > 255 ) m_cpu.flags |= C_FLAG; else m_cpu.flags &= ~C_FLAG;
     modifyFlags( temp );
@@ -449,9 +665,9 @@ void NesCpu::ADC()
     m_cpu.a = temp & 0xFF;
 }
 
-void NesCpu::SBC()
+void NesCpu::SBC(uint16_t addr)
 {
-    uint16_t data = static_cast<uint16_t>(read( m_cpu.absAddr )) ^ 0x00FF;
+    uint16_t data = static_cast<uint16_t>(read( addr )) ^ 0x00FF;
     uint16_t temp = (uint16_t)m_cpu.a + (uint16_t)data + (uint16_t)(( m_cpu.flags & C_FLAG ) ? 1: 0);
     if ( temp > 255 ) m_cpu.flags |= C_FLAG; else m_cpu.flags &= ~C_FLAG;
     modifyFlags( temp );
@@ -492,201 +708,195 @@ void NesCpu::INY()
     modifyFlags( m_cpu.y );
 }
 
-void NesCpu::LDA()
+void NesCpu::LDA(uint16_t addr)
 {
-    m_cpu.a = read( m_cpu.absAddr );
+    m_cpu.a = read( addr );
     modifyFlags( m_cpu.a );
 }
 
-void NesCpu::ASL()
+uint8_t NesCpu::shiftLeft(uint8_t data)
 {
-    uint8_t data = m_cpu.implied ? m_cpu.a : read( m_cpu.absAddr );
     m_cpu.flags &= ~(C_FLAG | Z_FLAG | N_FLAG);
     m_cpu.flags |= (data & 0x80) ? C_FLAG : 0;
     m_cpu.flags |= (data & 0x40) ? N_FLAG : 0;
     m_cpu.flags |= (data & 0x7F) ? 0 : Z_FLAG;
-    data <<= 1;
-    if ( m_cpu.implied ) m_cpu.a = data; else write( m_cpu.absAddr, data );
+    return data << 1;
 }
 
-void NesCpu::LSR()
+uint8_t NesCpu::shiftRight(uint8_t data)
 {
-    uint8_t data = m_cpu.implied ? m_cpu.a : read( m_cpu.absAddr );
     m_cpu.flags &= ~(C_FLAG | Z_FLAG | N_FLAG);
     m_cpu.flags |= (data & 0x01) ? C_FLAG : 0;
     m_cpu.flags |= (data == 1) ? Z_FLAG : 0;
-    data >>= 1;
-    if ( m_cpu.implied ) m_cpu.a = data; else write( m_cpu.absAddr, data );
+    return data >> 1;
 }
 
-void NesCpu::ROL()
+uint8_t NesCpu::rotateLeft(uint8_t data)
 {
-    uint8_t data = m_cpu.implied ? m_cpu.a : read( m_cpu.absAddr );
     uint8_t cflag = (m_cpu.flags & C_FLAG) ? 0x01 : 0x00;
     m_cpu.flags &= ~(C_FLAG | Z_FLAG | N_FLAG);
     m_cpu.flags |= (data & 0x80) ? C_FLAG : 0;
     data <<= 1;
     data |= cflag;
     modifyFlags( data );
-    if ( m_cpu.implied ) m_cpu.a = data; else write( m_cpu.absAddr, data );
+    return data;
 }
 
-void NesCpu::ROR()
+uint8_t NesCpu::rotateRight(uint8_t data)
 {
-    uint8_t data = m_cpu.implied ? m_cpu.a : read( m_cpu.absAddr );
     uint8_t cflag = (m_cpu.flags & C_FLAG) ? 0x80 : 0x00;
     m_cpu.flags &= ~(C_FLAG | Z_FLAG | N_FLAG);
     m_cpu.flags |= (data & 0x01) ? C_FLAG : 0;
     data >>= 1;
     data |= cflag;
     modifyFlags( data );
-    if ( m_cpu.implied ) m_cpu.a = data; else write( m_cpu.absAddr, data );
+    return data;
 }
 
-void NesCpu::CLC()
+void NesCpu::ASL()
 {
-    m_cpu.flags &= ~C_FLAG;
+    m_cpu.a = shiftLeft( m_cpu.a );
 }
 
-void NesCpu::PHA()
+void NesCpu::ASL(uint16_t addr)
 {
-    write( m_cpu.sp-- + 0x100, m_cpu.a );
+    write( addr, shiftLeft( read( addr ) ) );
 }
 
-void NesCpu::PLA()
+void NesCpu::LSR()
 {
-    m_cpu.a = read( ++m_cpu.sp + 0x100 );
+    m_cpu.a = shiftRight( m_cpu.a );
 }
 
-void NesCpu::JMP()
+void NesCpu::LSR(uint16_t addr)
 {
-    m_cpu.pc = m_cpu.absAddr;
+    write( addr, shiftRight( read( addr ) ) );
 }
 
-void NesCpu::JSR()
+void NesCpu::ROL()
 {
-    uint16_t addr = m_cpu.pc - 1;
-    write( m_cpu.sp-- + 0x100, addr >> 8 );
-    write( m_cpu.sp-- + 0x100, addr & 0x00FF );
-    m_cpu.pc = m_cpu.absAddr;
+    m_cpu.a = rotateLeft( m_cpu.a );
 }
 
-void NesCpu::RTS()
+void NesCpu::ROL(uint16_t addr)
 {
-    uint16_t addr = read( ++m_cpu.sp + 0x100 );
-    addr |= static_cast<uint16_t>(read( ++m_cpu.sp + 0x100 )) << 8;
-    addr++;
-    m_cpu.pc = addr;
+    write( addr, rotateLeft( read( addr ) ) );
 }
 
-void NesCpu::STA()
+void NesCpu::ROR()
 {
-    write( m_cpu.absAddr, m_cpu.a );
+    m_cpu.a = rotateRight( m_cpu.a );
 }
 
-void NesCpu::STX()
+void NesCpu::ROR(uint16_t addr)
 {
-    write( m_cpu.absAddr, m_cpu.x );
+    write( addr, rotateRight( read( addr ) ) );
 }
 
-void NesCpu::STY()
+void NesCpu::CLC()
 {
-    write( m_cpu.absAddr, m_cpu.y );
+    m_cpu.flags &= ~C_FLAG;
 }
 
-void NesCpu::LDY()
+void NesCpu::PHA()
 {
-    m_cpu.y = read( m_cpu.absAddr );
-    modifyFlags( m_cpu.y );
+    write( m_cpu.sp-- + 0x100, m_cpu.a );
 }
 
-void NesCpu::LDX()
+void NesCpu::PLA()
 {
-    m_cpu.x = read( m_cpu.absAddr );
-    modifyFlags( m_cpu.x );
+    m_cpu.a = read( ++m_cpu.sp + 0x100 );
 }
 
-void NesCpu::BEQ()
+void NesCpu::JMP(uint16_t addr)
 {
-    if ( m_cpu.flags & Z_FLAG )
-    {
-        m_cpu.pc += m_cpu.relAddr;
-    }
+    m_cpu.pc = addr;
 }
 
-void NesCpu::BNE()
+void NesCpu::JSR(uint16_t addr)
 {
-    if ( !(m_cpu.flags & Z_FLAG) )
-    {
-        m_cpu.pc += m_cpu.relAddr;
-    }
+    uint16_t retAddr = m_cpu.pc - 1;
+    write( m_cpu.sp-- + 0x100, retAddr >> 8 );
+    write( m_cpu.sp-- + 0x100, retAddr & 0x00FF );
+    m_cpu.pc = addr;
 }
 
-void NesCpu::BMI()
+void NesCpu::RTS()
 {
-    if ( m_cpu.flags & N_FLAG )
-    {
-        m_cpu.pc += m_cpu.relAddr;
-    }
+    uint16_t addr = read( ++m_cpu.sp + 0x100 );
+    addr |= static_cast<uint16_t>(read( ++m_cpu.sp + 0x100 )) << 8;
+    addr++;
+    m_cpu.pc = addr;
 }
 
-void NesCpu::BCC()
+void NesCpu::STA(uint16_t addr)
 {
-    if ( !(m_cpu.flags & C_FLAG) )
-    {
-        m_cpu.pc += m_cpu.relAddr;
-    }
+    write( addr, m_cpu.a );
 }
 
-void NesCpu::BCS()
+void NesCpu::STX(uint16_t addr)
 {
-    if ( m_cpu.flags & C_FLAG )
-    {
-        m_cpu.pc += m_cpu.relAddr;
-    }
+    write( addr, m_cpu.x );
+}
+
+void NesCpu::STY(uint16_t addr)
+{
+    write( addr, m_cpu.y );
+}
+
+void NesCpu::LDY(uint16_t addr)
+{
+    m_cpu.y = read( addr );
+    modifyFlags( m_cpu.y );
 }
 
-void NesCpu::CMP()
+void NesCpu::LDX(uint16_t addr)
 {
-    uint8_t data = read( m_cpu.absAddr );
+    m_cpu.x = read( addr );
+    modifyFlags( m_cpu.x );
+}
+
+void NesCpu::CMP(uint16_t addr)
+{
+    uint8_t data = read( addr );
     uint16_t temp = (uint16_t)m_cpu.a - (uint16_t)data;
     if ( m_cpu.a >= data ) m_cpu.flags |= C_FLAG; else m_cpu.flags &= ~C_FLAG;
     modifyFlags( temp & 0xFF );
 }
 
-void NesCpu::CPX()
+void NesCpu::CPX(uint16_t addr)
 {
-    uint8_t data = read( m_cpu.absAddr );
+    uint8_t data = read( addr );
     uint16_t temp = (uint16_t)m_cpu.x - (uint16_t)data;
     if ( m_cpu.x >= data ) m_cpu.flags |= C_FLAG; else m_cpu.flags &= ~C_FLAG;
     modifyFlags( temp & 0xFF );
 }
 
-void NesCpu::CPY()
+void NesCpu::CPY(uint16_t addr)
 {
-    uint8_t data = read( m_cpu.absAddr );
+    uint8_t data = read( addr );
     uint16_t temp = (uint16_t)m_cpu.y - (uint16_t)data;
     if ( m_cpu.y >= data ) m_cpu.flags |= C_FLAG; else m_cpu.flags &= ~C_FLAG;
     modifyFlags( temp & 0xFF );
 }
 
-void NesCpu::DEC()
+void NesCpu::DEC(uint16_t addr)
 {
-    uint8_t data = read( m_cpu.absAddr ) - 1;
-    write( m_cpu.absAddr, data );
+    uint8_t data = read( addr ) - 1;
+    write( addr, data );
     modifyFlags( data );
 }
 
-void NesCpu::INC()
+void NesCpu::INC(uint16_t addr)
 {
-    uint8_t data = read( m_cpu.absAddr ) + 1;
-    write( m_cpu.absAddr, data );
+    uint8_t data = read( addr ) + 1;
+    write( addr, data );
     modifyFlags( data );
 }
 
-void NesCpu::BIT()
+void NesCpu::BIT(uint16_t addr)
 {
-    uint8_t data = read( m_cpu.absAddr );
+    uint8_t data = read( addr );
     uint8_t result = m_cpu.a & data;
     if ( result ) m_cpu.flags &= ~Z_FLAG; else m_cpu.flags |= Z_FLAG;
     if ( data & 0x40 ) m_cpu.flags |= V_FLAG; else m_cpu.flags &= ~V_FLAG;
@@ -711,21 +921,21 @@ void NesCpu::INX()
     modifyFlags( m_cpu.x );
 }
 
-void NesCpu::AND()
+void NesCpu::AND(uint16_t addr)
 {
-    m_cpu.a &= read( m_cpu.absAddr );
+    m_cpu.a &= read( addr );
     modifyFlags( m_cpu.a );
 }
 
-void NesCpu::ORA()
+void NesCpu::ORA(uint16_t addr)
 {
-    m_cpu.a |= read( m_cpu.absAddr );
+    m_cpu.a |= read( addr );
     modifyFlags( m_cpu.a );
 }
 
-void NesCpu::EOR()
+void NesCpu::EOR(uint16_t addr)
 {
-    m_cpu.a ^= read( m_cpu.absAddr );
+    m_cpu.a ^= read( addr );
     modifyFlags( m_cpu.a );
 }
 
@@ -740,9 +950,11 @@ void NesCpu::SEC()
 
 void NesCpu::BRK()
 {
-    m_cpu.absAddr = read( 0xFFFE );
-    m_cpu.absAddr |= static_cast<uint16_t>( read( 0xFFFF) ) << 8;
-    JSR();
+    uint16_t addr = read( 0xFFFE );
+    addr |= static_cast<uint16_t>( read( 0xFFFF) ) << 8;
+    JSR( addr );
     write( m_cpu.sp-- + 0x100, m_cpu.flags );
     m_cpu.flags |= B_FLAG;
 }
+
+#endif
@@ -23,13 +23,15 @@ SOFTWARE.
 */
 
 #include "chips/nsf_cartridge.h"
+#include "vgm_config.h"
+
+#if VGM_DECODER_NES
 
 #include <malloc.h>
 #include <stdio.h>
 #include <string.h>
 
 #define CLR_VALUE 0x00
-#define BBRAM_SIZE 0x2000
 
 #define NSF_CARTRIDGE_DEBUG 1
 
@@ -64,6 +66,91 @@ void NsfCartridge::reset()
 {
 }
 
+void NsfCartridge::saveState(uint8_t *state) const
+{
+    // State buffer is not aligned, so prepare snapshot and copy it to the buffer
+    NsfCartridgeSnapshot snapshot{};
+    for (int i=0; i<APU_MAX_MEMORY_BLOCKS; i++) snapshot.mem[i] = m_mem[i];
+    for (int i=0; i<8; i++) snapshot.bank[i] = m_bank[i];
+    snapshot.bankingEnabled = m_bankingEnabled;
+    snapshot.mapper031BaseAddress = m_mapper031BaseAddress;
+    snapshot.bbRamValid = m_bbRam != nullptr;
+    if ( m_bbRam ) memcpy( snapshot.bbRam, m_bbRam, BBRAM_SIZE );
+    memcpy( state, &snapshot, sizeof(snapshot) );
+}
+
+void NsfCartridge::loadState(const uint8_t *state)
+{
+    NsfCartridgeSnapshot snapshot{};
+    memcpy( &snapshot, state, sizeof(snapshot) );
+    for (int i=0; i<APU_MAX_MEMORY_BLOCKS; i++) m_mem[i] = snapshot.mem[i];
+    for (int i=0; i<8; i++) m_bank[i] = snapshot.bank[i];
+    m_bankingEnabled = snapshot.bankingEnabled;
+    m_mapper031BaseAddress = snapshot.mapper031BaseAddress;
+    if ( snapshot.bbRamValid && allocBbRam() )
+    {
+        memcpy( m_bbRam, snapshot.bbRam, BBRAM_SIZE );
+    }
+    else if ( !snapshot.bbRamValid && m_bbRam )
+    {
+        free( m_bbRam );
+        m_bbRam = nullptr;
+    }
+    mapChanged();
+}
+
+uint64_t NsfCartridge::getStateHash(uint64_t hash) const
+{
+    hash = nesStateHash( hash, m_bank, sizeof(m_bank) );
+    hash = nesStateHash( hash, &m_bankingEnabled, sizeof(m_bankingEnabled) );
+    if ( m_bbRam ) hash = nesStateHash( hash, m_bbRam, BBRAM_SIZE );
+    return hash;
+}
+
+const uint8_t *NsfCartridge::getReadPage(uint16_t address)
+{
+    if ( address >= 0x6000 && address < 0x8000 )
+    {
+        return m_bbRam ? m_bbRam + ( address - 0x6000 ) : nullptr;
+    }
+    // Vectors at 0xFFFA-0xFFFF are not affected by banks, so the last page is not flat
+    if ( address < 0x8000 || ( m_bankingEnabled && address >= 0xFF00 ) )
+    {
+        return nullptr;
+    }
+    // Banks are 4 KiB, so the whole page is mapped to continuous address range
+    uint32_t mappedAddr = mapper031( address );
+    for (int i=0; i<APU_MAX_MEMORY_BLOCKS; i++)
+    {
+        const NesMemoryBlock &block = m_mem[i];
+        if ( block.data == nullptr )
+        {
+            break;
+        }
+        if ( mappedAddr + 0x100 <= block.addr || mappedAddr >= block.addr + block.size )
+        {
+            continue;
+        }
+        // read() uses the first block, containing the address, so the page is flat only
+        // if the first overlapping block contains the whole page
+        if ( mappedAddr >= block.addr && mappedAddr + 0x100 <= block.addr + block.size )
+        {
+            return block.data + ( mappedAddr - block.addr );
+        }
+        break;
+    }
+    return nullptr;
+}
+
+uint8_t *NsfCartridge::getWritePage(uint16_t address)
+{
+    if ( address >= 0x6000 && address < 0x8000 && m_bbRam )
+    {
+        return m_bbRam + ( address - 0x6000 );
+    }
+    return nullptr;
+}
+
 void NsfCartridge::power()
 {
 }
@@ -78,6 +165,7 @@ bool NsfCartridge::allocBbRam()
             return false;
         }
         memset( m_bbRam, CLR_VALUE, BBRAM_SIZE );
+        mapChanged();
     }
     return true;
 }
@@ -94,6 +182,7 @@ bool NsfCartridge::write(uint16_t address, uint8_t data)
     {
         m_bankingEnabled = true;
         m_bank[ address & 0x07] = data;
+        mapChanged();
         LOGI( "BANK %d [%04X] = %02X (%d) 0x%08X\n", address & 0x07, address,
                data, 0x8000 + data * 4096, 0x8000 + data * 4096 );
         return true;
@@ -106,7 +195,7 @@ bool NsfCartridge::write(uint16_t address, uint8_t data)
             return false;
         }
         m_bbRam[ address - 0x6000 ] = data;
-        LOGM("Battery backed RAM [%04X] <== %02X\n", address, data);
+        TRACEM( VGM_TRACE_MEMORY_WRITE, address, data );
         return true;
     }
     LOGE("Memory data write error (ROM) 0x%04X\n", address);
@@ -134,7 +223,7 @@ uint8_t NsfCartridge::read(uint16_t address)
             LOGE("Failed to allocate battery backed RAM 0x%04X\n", address);
             return CLR_VALUE;
         }
-        LOGM("Battery backed RAM [%04X] ==> %02X\n", address, m_bbRam[ address - 0x6000 ]);
+        TRACEM( VGM_TRACE_MEMORY_READ, address, m_bbRam[ address - 0x6000 ] );
         return m_bbRam[ address - 0x6000 ];
     }
     for (int i=0; i<APU_MAX_MEMORY_BLOCKS; i++)
@@ -148,7 +237,7 @@ uint8_t NsfCartridge::read(uint16_t address)
              mappedAddr < m_mem[i].addr + m_mem[i].size )
         {
             uint32_t addr = mappedAddr - m_mem[i].addr;
-            LOGM("[%04X] ==> %02X\n", address, m_mem[i].data[ addr ]);
+            TRACEM( VGM_TRACE_MEMORY_READ, address, m_mem[i].data[ addr ] );
             return  m_mem[i].data[ addr ];
         }
     }
@@ -192,6 +281,7 @@ void NsfCartridge::setDataBlock( uint32_t addr, const uint8_t *data, uint32_t le
     m_mem[ blockNumber ].data = data;
     m_mem[ blockNumber ].size = len;
     m_mem[ blockNumber ].addr = addr;
+    mapChanged();
     LOGI("New data block [0x%04X] (len=%d)\n", addr, len);
 }
 
@@ -213,3 +303,4 @@ uint32_t NsfCartridge::mapper031(uint16_t address)
                         (address & 0x0FFF));
 }
 
+#endif
@@ -0,0 +1,233 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "data_source.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DATA_SOURCE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define DATA_SOURCE_MMAP 0
+#endif
+
+#define DATA_SOURCE_DEBUG 1
+
+#if DATA_SOURCE_DEBUG && !defined(VGM_DECODER_LOGGER)
+#define VGM_DECODER_LOGGER DATA_SOURCE_DEBUG
+#endif
+#include "vgm_logger.h"
+
+const uint8_t *MemoryDataSource::fetch(uint32_t offset, uint32_t size)
+{
+    if ( offset >= m_size )
+    {
+        return nullptr;
+    }
+    return m_data + offset;
+}
+
+uint32_t MemoryDataSource::read(uint32_t offset, void *buffer, uint32_t size)
+{
+    if ( offset >= m_size )
+    {
+        return 0;
+    }
+    if ( size > m_size - offset )
+    {
+        size = m_size - offset;
+    }
+    memcpy( buffer, m_data + offset, size );
+    return size;
+}
+
+MappedFileDataSource::~MappedFileDataSource()
+{
+    close();
+}
+
+bool MappedFileDataSource::open(const char *name)
+{
+    close();
+#if DATA_SOURCE_MMAP
+    int fd = ::open( name, O_RDONLY );
+    if ( fd < 0 )
+    {
+        return false;
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) < 0 || st.st_size <= 0 )
+    {
+        ::close( fd );
+        return false;
+    }
+    void *mapped = mmap( nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+    if ( mapped == MAP_FAILED )
+    {
+        LOGE( "Failed to map file %s\n", name );
+        return false;
+    }
+    m_mapped = static_cast<uint8_t *>( mapped );
+    m_mappedSize = st.st_size;
+#else
+    FILE *fileptr = fopen( name, "rb" );
+    if ( fileptr == nullptr )
+    {
+        return false;
+    }
+    fseek( fileptr, 0, SEEK_END );
+    long size = ftell( fileptr );
+    rewind( fileptr );
+    m_mapped = size > 0 ? static_cast<uint8_t *>( malloc( size ) ) : nullptr;
+    if ( m_mapped == nullptr || fread( m_mapped, size, 1, fileptr ) != 1 )
+    {
+        free( m_mapped );
+        m_mapped = nullptr;
+        fclose( fileptr );
+        return false;
+    }
+    fclose( fileptr );
+    m_mappedSize = size;
+#endif
+    setData( m_mapped, m_mappedSize );
+    return true;
+}
+
+void MappedFileDataSource::close()
+{
+    if ( m_mapped )
+    {
+#if DATA_SOURCE_MMAP
+        munmap( m_mapped, m_mappedSize );
+#else
+        free( m_mapped );
+#endif
+        m_mapped = nullptr;
+        m_mappedSize = 0;
+    }
+    setData( nullptr, 0 );
+}
+
+FileDataSource::FileDataSource(uint32_t windowSize)
+    : m_windowSize( windowSize < 256 ? 256 : windowSize )
+{
+}
+
+FileDataSource::~FileDataSource()
+{
+    close();
+}
+
+bool FileDataSource::open(const char *name)
+{
+    close();
+    m_file = fopen( name, "rb" );
+    if ( m_file == nullptr )
+    {
+        return false;
+    }
+    fseek( m_file, 0, SEEK_END );
+    long size = ftell( m_file );
+    m_window = static_cast<uint8_t *>( malloc( m_windowSize ) );
+    if ( size <= 0 || m_window == nullptr )
+    {
+        close();
+        return false;
+    }
+    m_size = size;
+    return true;
+}
+
+void FileDataSource::close()
+{
+    if ( m_file )
+    {
+        fclose( m_file );
+        m_file = nullptr;
+    }
+    if ( m_window )
+    {
+        free( m_window );
+        m_window = nullptr;
+    }
+    m_size = 0;
+    m_windowOffset = 0;
+    m_windowLength = 0;
+}
+
+const uint8_t *FileDataSource::fetch(uint32_t offset, uint32_t size)
+{
+    if ( offset >= m_size || size > m_windowSize )
+    {
+        return nullptr;
+    }
+    if ( size > m_size - offset )
+    {
+        size = m_size - offset;
+    }
+    if ( offset < m_windowOffset || offset + size > m_windowOffset + m_windowLength )
+    {
+        // Read ahead the whole window, starting at requested offset
+        m_windowLength = 0;
+        if ( fseek( m_file, offset, SEEK_SET ) != 0 )
+        {
+            return nullptr;
+        }
+        m_windowOffset = offset;
+        m_windowLength = fread( m_window, 1, m_windowSize, m_file );
+        if ( m_windowLength < size )
+        {
+            return nullptr;
+        }
+    }
+    return m_window + (offset - m_windowOffset);
+}
+
+uint32_t FileDataSource::read(uint32_t offset, void *buffer, uint32_t size)
+{
+    if ( offset >= m_size )
+    {
+        return 0;
+    }
+    if ( size > m_size - offset )
+    {
+        size = m_size - offset;
+    }
+    if ( offset >= m_windowOffset && offset + size <= m_windowOffset + m_windowLength )
+    {
+        memcpy( buffer, m_window + (offset - m_windowOffset), size );
+        return size;
+    }
+    if ( fseek( m_file, offset, SEEK_SET ) != 0 )
+    {
+        return 0;
+    }
+    return fread( buffer, 1, size, m_file );
+}
@@ -22,9 +22,13 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-#include "nsf_decoder.h"
-#include "formats/nsf_format.h"
-#include "chips/nsf_cartridge.h"
+#include "formats/nsf_decoder.h"
+
+#if VGM_DECODER_NES
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
 
 #define NSF_DECODER_DEBUG 1
 
@@ -33,8 +37,17 @@ SOFTWARE.
 #endif
 #include "../vgm_logger.h"
 
-/** Vgm file are always based on 44.1kHz rate */
-#define VGM_SAMPLE_RATE 44100
+/** Track is stopped, if APU is silent during this time (in milliseconds) */
+#define NSF_SILENCE_TIMEOUT 3000
+
+/** Loops are searched in the first 10 minutes of track only to limit memory usage */
+#define NSF_LOOP_SEARCH_DURATION (10 * 60 * 1000)
+
+/** Play routine is considered an infinite loop after this number of instructions */
+#define NSF_PLAY_MAX_INSTRUCTIONS 20001
+
+/** Init routine is stopped after this number of instructions (about 10 seconds of NES cpu) */
+#define NSF_INIT_MAX_INSTRUCTIONS 6000000
 
 NsfMusicDecoder::NsfMusicDecoder(): BaseMusicDecoder()
 {
@@ -45,12 +58,33 @@ NsfMusicDecoder::~NsfMusicDecoder()
     close();
 }
 
-NsfMusicDecoder *NsfMusicDecoder::tryOpen(const uint8_t *data, int size)
+static NsfMusicDecoder *createDecoder(void *storage)
 {
-    NsfMusicDecoder *decoder = new NsfMusicDecoder();
+    return storage ? new( storage ) NsfMusicDecoder() : new NsfMusicDecoder();
+}
+
+static void destroyDecoder(NsfMusicDecoder *decoder, void *storage)
+{
+    if ( storage ) decoder->~NsfMusicDecoder(); else delete decoder;
+}
+
+NsfMusicDecoder *NsfMusicDecoder::tryOpen(const uint8_t *data, int size, void *storage)
+{
+    NsfMusicDecoder *decoder = createDecoder( storage );
     if ( !decoder->open( data, size ) )
     {
-        delete decoder;
+        destroyDecoder( decoder, storage );
+        decoder = nullptr;
+    }
+    return decoder;
+}
+
+NsfMusicDecoder *NsfMusicDecoder::tryOpen(DataSource *source, void *storage)
+{
+    NsfMusicDecoder *decoder = createDecoder( storage );
+    if ( !decoder->open( source ) )
+    {
+        destroyDecoder( decoder, storage );
         decoder = nullptr;
     }
     return decoder;
@@ -59,23 +93,61 @@ NsfMusicDecoder *NsfMusicDecoder::tryOpen(const uint8_t *data, int size)
 bool NsfMusicDecoder::open(const uint8_t * data, int size)
 {
     close();
-    if ( size < sizeof(NsfHeader) )
+    m_memorySource.setData( data, size );
+    return open( &m_memorySource );
+}
+
+bool NsfMusicDecoder::open(DataSource *source)
+{
+    if ( source != &m_memorySource )
+    {
+        close();
+    }
+    uint32_t size = source->getSize();
+    if ( size < sizeof(NsfHeader) ||
+         source->read( 0, &m_headerData, sizeof(NsfHeader) ) != sizeof(NsfHeader) )
     {
         return false;
     }
-    m_rawData = data;
-    m_size = size;
-    m_nsfHeader = reinterpret_cast<const NsfHeader *>(m_rawData);
-    m_dataPtr = m_rawData;
-    if ( m_nsfHeader->ident != 0x4D53454E )
+    if ( m_headerData.ident != 0x4D53454E )
     {
-        LOGE("%08X\n", m_nsfHeader->ident );
-        m_nsfHeader = nullptr;
+        LOGE("%08X\n", m_headerData.ident );
         return false;
     }
+    m_nsfHeader = &m_headerData;
+    const uint8_t *rom = source->getData();
+    if ( rom )
+    {
+        rom += 0x80;
+    }
+    else
+    {
+        m_romCopy = static_cast<uint8_t *>( malloc( size - 0x80 ) );
+        if ( !m_romCopy || source->read( 0x80, m_romCopy, size - 0x80 ) != size - 0x80 )
+        {
+            LOGE( "Failed to read NSF data\n" );
+            close();
+            return false;
+        }
+        rom = m_romCopy;
+    }
+    m_rom = rom;
+    m_romSize = size - 0x80;
+#if VGM_DECODER_SINGLE_CHIP
+    NsfCartridge *cartridge = new( m_cartridgeStorage ) NsfCartridge();
+    cartridge->setDataBlock( m_nsfHeader->loadAddress, m_rom, m_romSize );
+    m_nesChip.insertCartridge( cartridge, false );
+#else
     NsfCartridge *cartridge = new NsfCartridge();
-    cartridge->setDataBlock( m_nsfHeader->loadAddress, m_dataPtr + 0x80, m_size - 0x80 );
+    cartridge->setDataBlock( m_nsfHeader->loadAddress, m_rom, m_romSize );
     m_nesChip.insertCartridge( cartridge );
+#endif
+#if !VGM_DECODER_COMPACT
+    // Every track starts from the same machine state, so it is prepared once
+    setupMachine( m_nesChip );
+    m_cleanImage.resize( m_nesChip.getStateSize() );
+    m_nesChip.saveState( m_cleanImage.data() );
+#endif
     if ( !setTrack( 0 ) )
     {
         return false;
@@ -88,9 +160,22 @@ bool NsfMusicDecoder::open(const uint8_t * data, int size)
 
 void NsfMusicDecoder::close()
 {
+    stopPrefetch();
+    clearImages();
+    m_cleanImage.clear();
+#if VGM_DECODER_SINGLE_CHIP
+    NesCartridge *cartridge = m_nesChip.getCartridge();
+    m_nesChip.insertCartridge( nullptr );
+    if ( cartridge ) cartridge->~NesCartridge();
+#else
     m_nesChip.insertCartridge( nullptr );
+#endif
     m_nsfHeader = nullptr;
-    m_rawData = nullptr;
+    if ( m_romCopy )
+    {
+        free( m_romCopy );
+        m_romCopy = nullptr;
+    }
 }
 
 void NsfMusicDecoder::setVolume( uint16_t volume )
@@ -98,6 +183,16 @@ void NsfMusicDecoder::setVolume( uint16_t volume )
     m_nesChip.getApu()->setVolume( volume );
 }
 
+bool NsfMusicDecoder::setSampleFrequency( uint32_t frequency )
+{
+    stopPrefetch();
+    clearImages();
+    m_sampleFrequency = frequency;
+    m_nesChip.getApu()->setSampleFrequency( frequency );
+    resetLoopDetection();
+    return true;
+}
+
 int NsfMusicDecoder::getTrackCount()
 {
     // read nsf track count
@@ -110,7 +205,42 @@ bool NsfMusicDecoder::setTrack(int track)
     // For vgm files this is not supported
     if ( !m_nsfHeader ) return false;
 
-    m_nesChip.reset();
+    // Background thread doesn't use the images after it is stopped
+    stopPrefetch();
+    m_playRemaining = 0;
+    TrackImage *image = findImage( track );
+    if ( image )
+    {
+        m_nesChip.loadState( image->state.data() );
+    }
+    else if ( !initTrack( m_nesChip, track ) )
+    {
+        return false;
+    }
+    else if ( m_prefetch )
+    {
+        saveImage( m_nesChip, track, track );
+    }
+    resetLoopDetection();
+    if ( m_prefetch )
+    {
+        m_prefetchStop.store( false, std::memory_order_relaxed );
+        m_prefetchThread = std::thread( &NsfMusicDecoder::prefetchTracks, this, track );
+    }
+//    m_samplesPlayed = 0;
+    return true;
+}
+
+void NsfMusicDecoder::setTrackPrefetch(bool enable)
+{
+    stopPrefetch();
+    m_prefetch = enable;
+    if ( !enable ) clearImages();
+}
+
+void NsfMusicDecoder::setupMachine(NesCpu &chip)
+{
+    chip.reset();
     bool useBanks = false;
     for (int i=0; i<8; i++)
         if ( m_nsfHeader->bankSwitch[i] )
@@ -118,46 +248,285 @@ bool NsfMusicDecoder::setTrack(int track)
     if ( useBanks )
     {
         for (int i=0; i<8; i++)
-            m_nesChip.write( 0x5FF8 + i, m_nsfHeader->bankSwitch[i] );
+            chip.write( 0x5FF8 + i, m_nsfHeader->bankSwitch[i] );
     }
     // Reset NES CPU memory and state
-    NesCpuState &cpu = m_nesChip.cpuState();
-    for (uint16_t i = 0; i < 0x07FF; i++) m_nesChip.write(i, 0);
-    for (uint16_t i = 0x4000; i < 0x4013; i++) m_nesChip.write(i, 0);
-    m_nesChip.write(0x4015, 0x00);
-    m_nesChip.write(0x4015, 0x0F);
-    m_nesChip.write(0x4017, 0x40);
+    for (uint16_t i = 0; i < 0x07FF; i++) chip.write(i, 0);
+    for (uint16_t i = 0x4000; i < 0x4013; i++) chip.write(i, 0);
+    chip.write(0x4015, 0x00);
+    chip.write(0x4015, 0x0F);
+    chip.write(0x4017, 0x40);
+}
+
+bool NsfMusicDecoder::initTrack(NesCpu &chip, int track)
+{
+    if ( m_cleanImage.empty() )
+    {
+        setupMachine( chip );
+    }
+    else
+    {
+        chip.loadState( m_cleanImage.data() );
+    }
+    NesCpuState &cpu = chip.cpuState();
     // if the tune is bank switched, load the bank values from $070-$077 into $5FF8-$5FFF.
     cpu.x = 0; // ntsc
     cpu.a = track < m_nsfHeader->songIndex ? track: 0;
     cpu.sp = 0xEF;
-    if ( m_nesChip.callSubroutine( m_nsfHeader->initAddress ) < 0 )
+    int result = chip.callSubroutine( m_nsfHeader->initAddress, NSF_INIT_MAX_INSTRUCTIONS );
+    if ( result < 0 )
     {
         LOGE( "Failed to call init subroutine for NSF file\n" );
         return false;
     }
-//    m_samplesPlayed = 0;
+    if ( result == 0 )
+    {
+        LOGE( "Failed to call init subroutine, it looks infinite loop\n" );
+        return false;
+    }
     return true;
 }
 
+NsfMusicDecoder::TrackImage *NsfMusicDecoder::findImage(int track)
+{
+    for ( auto &image: m_trackImages )
+    {
+        if ( image.track == track && !image.state.empty() ) return &image;
+    }
+    return nullptr;
+}
+
+void NsfMusicDecoder::saveImage(NesCpu &chip, int track, int current)
+{
+    for ( auto &image: m_trackImages )
+    {
+        if ( image.state.empty() || image.track < current - 1 || image.track > current + 1 )
+        {
+            image.track = track;
+            image.state.resize( chip.getStateSize() );
+            chip.saveState( image.state.data() );
+            return;
+        }
+    }
+}
+
+void NsfMusicDecoder::prefetchTracks(int track)
+{
+    // Own chip and cartridge are used, so decoder can play current track meanwhile
+    NsfCartridge cartridge;
+    NesCpu chip;
+    cartridge.setDataBlock( m_nsfHeader->loadAddress, m_rom, m_romSize );
+    chip.insertCartridge( &cartridge, false );
+    chip.getApu()->setSampleFrequency( m_sampleFrequency );
+    const int tracks[] = { track + 1, track - 1 };
+    for ( int next: tracks )
+    {
+        if ( m_prefetchStop.load( std::memory_order_relaxed ) )
+        {
+            return;
+        }
+        if ( next < 0 || next >= m_nsfHeader->songIndex || findImage( next ) )
+        {
+            continue;
+        }
+        if ( initTrack( chip, next ) )
+        {
+            saveImage( chip, next, track );
+        }
+    }
+}
+
+void NsfMusicDecoder::stopPrefetch()
+{
+    m_prefetchStop.store( true, std::memory_order_relaxed );
+    if ( m_prefetchThread.joinable() )
+    {
+        m_prefetchThread.join();
+    }
+}
+
+void NsfMusicDecoder::clearImages()
+{
+    for ( auto &image: m_trackImages )
+    {
+        image.state.clear();
+        image.state.shrink_to_fit();
+    }
+}
+
 uint32_t NsfMusicDecoder::getSample()
 {
     return m_nesChip.getApu()->getSample();
 }
 
+void NsfMusicDecoder::renderBlock(uint32_t *outBuffer, int samples)
+{
+    m_nesChip.getApu()->renderBlock( outBuffer, samples );
+}
+
+void NsfMusicDecoder::skipBlock(int samples)
+{
+    m_nesChip.getApu()->skip( samples );
+}
+
+uint32_t NsfMusicDecoder::getStateSize()
+{
+    return 2 * sizeof(uint32_t) + m_nesChip.getStateSize();
+}
+
+bool NsfMusicDecoder::saveState(uint8_t *state)
+{
+    if ( !m_nsfHeader )
+    {
+        return false;
+    }
+    // Play routine may be interrupted by block budget, so it is resumed after loadState()
+    memcpy( state, &m_waitSamples, sizeof(uint32_t) );
+    memcpy( state + sizeof(uint32_t), &m_playRemaining, sizeof(uint32_t) );
+    m_nesChip.saveState( state + 2 * sizeof(uint32_t) );
+    return true;
+}
+
+bool NsfMusicDecoder::loadState(const uint8_t *state)
+{
+    if ( !m_nsfHeader )
+    {
+        return false;
+    }
+    memcpy( &m_waitSamples, state, sizeof(uint32_t) );
+    memcpy( &m_playRemaining, state + sizeof(uint32_t), sizeof(uint32_t) );
+    m_nesChip.loadState( state + 2 * sizeof(uint32_t) );
+    // Play call history is not a part of the state
+    resetLoopDetection();
+    return true;
+}
+
 int NsfMusicDecoder::decodeBlock()
 {
-    int result = m_nesChip.callSubroutine( m_nsfHeader->playAddress, 20000 );
+    bool pending = m_playRemaining != 0;
+    if ( !pending ) m_playRemaining = NSF_PLAY_MAX_INSTRUCTIONS;
+    uint32_t slice = m_blockBudget && m_blockBudget < m_playRemaining ? m_blockBudget : m_playRemaining;
+    // Subroutine calls execute one instruction more than the limit
+    int result = pending ? m_nesChip.continueSubroutine( slice - 1 )
+                         : m_nesChip.callSubroutine( m_nsfHeader->playAddress, slice - 1 );
+    if ( result == 0 )
+    {
+        m_playRemaining -= slice;
+        if ( m_playRemaining )
+        {
+            return VGM_BLOCK_PENDING;
+        }
+        LOGE( "Failed to call play subroutine, it looks infinite loop, stopping\n" );
+        return 0;
+    }
+    m_playRemaining = 0;
     if ( result < 0 )
     {
         LOGE( "Failed to call play subroutine due to CPU error, stopping\n" );
         return -1;
     }
-    if ( result == 0 )
+    m_waitSamples = (m_sampleFrequency * static_cast<uint64_t>( m_nsfHeader->ntscPlaySpeed )) / 1000000;
+    if ( m_loopDetection && !detectLoop() )
     {
-        LOGE( "Failed to call play subroutine, it looks infinite loop, stopping\n" );
         return 0;
     }
-    m_waitSamples = (VGM_SAMPLE_RATE * static_cast<uint64_t>( m_nsfHeader->ntscPlaySpeed )) / 1000000;
     return m_waitSamples;
 }
+
+bool NsfMusicDecoder::analyze(int track, uint32_t maxSamples, VgmTrackInfo &info)
+{
+    info = VgmTrackInfo{};
+    bool loopDetection = m_loopDetection;
+    uint32_t frequency = m_sampleFrequency;
+    // Track end is found by loop and silence detection, samples are counted at 44100 Hz
+    m_loopDetection = true;
+    setSampleFrequency( 44100 );
+    bool result = m_nsfHeader && setTrack( track );
+    NesApu *apu = m_nesChip.getApu();
+    apu->resetWriteStats();
+    uint64_t total = 0;
+    uint32_t peakRate = 0;
+    while ( result && total < maxSamples )
+    {
+        uint32_t writes = apu->getWriteCount();
+        int samples = decodeBlock();
+        if ( samples == VGM_BLOCK_PENDING )
+        {
+            continue;
+        }
+        if ( samples <= 0 )
+        {
+            // Silent frames before the stop are not part of the track
+            uint64_t silence = m_silentFrames ? static_cast<uint64_t>( m_silentFrames - 1 ) * m_waitSamples : 0;
+            total -= silence < total ? silence : total;
+            info.complete = samples == 0;
+            break;
+        }
+        uint32_t rate = static_cast<uint64_t>( apu->getWriteCount() - writes ) * m_sampleFrequency / samples;
+        if ( rate > peakRate ) peakRate = rate;
+        if ( m_loopLength )
+        {
+            info.loopSamples = m_loopLength;
+            info.complete = true;
+            break;
+        }
+        skipBlock( samples );
+        total += samples;
+    }
+    info.totalSamples = total < UINT32_MAX ? total : UINT32_MAX;
+    info.registerWrites = apu->getWriteCount();
+    info.peakWriteRate = peakRate;
+    info.registers[VGM_CHIP_NES_APU] = apu->getWrittenRegisters();
+    info.chips = info.registerWrites ? 1 << VGM_CHIP_NES_APU : 0;
+    m_loopDetection = loopDetection;
+    setSampleFrequency( frequency );
+    return result;
+}
+
+void NsfMusicDecoder::setLoopDetection(bool enable)
+{
+    m_loopDetection = enable;
+    resetLoopDetection();
+}
+
+void NsfMusicDecoder::resetLoopDetection()
+{
+    m_frameHashes.clear();
+    m_frame = 0;
+    m_silentFrames = 0;
+    m_loopLength = 0;
+}
+
+bool NsfMusicDecoder::detectLoop()
+{
+    if ( m_nesChip.getApu()->isSilent() )
+    {
+        m_silentFrames++;
+        if ( static_cast<uint64_t>( m_silentFrames ) * m_waitSamples >=
+             static_cast<uint64_t>( m_sampleFrequency ) * NSF_SILENCE_TIMEOUT / 1000 )
+        {
+            LOGI( "Silence is detected, stopping\n" );
+            return false;
+        }
+    }
+    else
+    {
+        m_silentFrames = 0;
+    }
+    if ( !m_loopLength && static_cast<uint64_t>( m_frame ) * m_waitSamples <
+         static_cast<uint64_t>( m_sampleFrequency ) * NSF_LOOP_SEARCH_DURATION / 1000 )
+    {
+        // Play routine is called at fixed rate, so the same state means the same sound
+        auto result = m_frameHashes.emplace( m_nesChip.getStateHash(), m_frame );
+        if ( !result.second )
+        {
+            m_loopLength = ( m_frame - result.first->second ) * m_waitSamples;
+            LOG( "Loop is detected: frames %u-%u, %u samples\n", result.first->second, m_frame, m_loopLength );
+            m_frameHashes.clear();
+        }
+    }
+    m_frame++;
+    return true;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "formats/vgm_command_stream.h"
+#include "formats/vgm_decoder.h"
+
+VgmCommandStream::VgmCommandStream(const uint8_t *data, int size)
+    : m_data( data )
+    , m_size( size )
+{
+}
+
+VgmCommandStream *VgmCommandStream::compile(const uint8_t *data, int size)
+{
+    return VgmMusicDecoder::compile( data, size );
+}
+
+void VgmCommandStream::addWrite(uint8_t chip, uint8_t reg, uint8_t value)
+{
+    m_events.push_back( VgmEvent{ 0, chip, reg, value } );
+}
+
+void VgmCommandStream::addWait(uint32_t samples)
+{
+    // Waits after the loop point must not be merged to the last event before the loop
+    if ( m_events.empty() || m_events.size() == m_loopIndex )
+    {
+        m_events.push_back( VgmEvent{ 0, VGM_EVENT_NONE, 0, 0 } );
+    }
+    m_events.back().wait += samples;
+}
+
+void VgmCommandStream::markLoop()
+{
+    m_loopIndex = m_events.size();
+}
+
+void VgmCommandStream::addDataBlock(uint32_t offset, uint32_t size)
+{
+    m_dataBlocks.push_back( VgmDataBlockInfo{ offset, size } );
+}
+
+void VgmCommandStream::end()
+{
+    m_events.push_back( VgmEvent{ 0, VGM_EVENT_END, 0, 0 } );
+    m_events.shrink_to_fit();
+}
@@ -0,0 +1,192 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "formats/vgm_data_banks.h"
+#include "data_source.h"
+
+#include <stdlib.h>
+
+#define VGM_DATA_BANKS_DEBUG 1
+
+#if VGM_DATA_BANKS_DEBUG && !defined(VGM_DECODER_LOGGER)
+#define VGM_DECODER_LOGGER VGM_DATA_BANKS_DEBUG
+#endif
+#include "../vgm_logger.h"
+
+/** Returns size of vgm command, or 0 if the command is unknown or not complete */
+static uint32_t commandSize(const uint8_t *data, uint32_t size)
+{
+    uint8_t cmd = data[0];
+    if ( cmd == 0x67 )
+    {
+        // 0x67 0x66 tt ss ss ss ss, bit 31 of the size selects the second chip
+        if ( size < 7 ) return 0;
+        uint32_t length = ( data[3] | (data[4] << 8) | (data[5] << 16) | (data[6] << 24) ) & 0x7FFFFFFF;
+        return length <= size - 7 ? 7 + length : 0;
+    }
+    if ( cmd == 0x68 ) return 12;
+    if ( cmd == 0x62 || cmd == 0x63 || ( cmd >= 0x70 && cmd <= 0x8F ) ) return 1;
+    if ( cmd >= 0x30 && cmd <= 0x3F ) return 2;
+    if ( cmd >= 0x40 && cmd <= 0x4E ) return 3;
+    if ( cmd == 0x4F || cmd == 0x50 ) return 2;
+    if ( cmd >= 0x51 && cmd <= 0x5F ) return 3;
+    if ( cmd == 0x61 ) return 3;
+    if ( cmd == 0x90 || cmd == 0x91 || cmd == 0x95 ) return 5;
+    if ( cmd == 0x92 ) return 6;
+    if ( cmd == 0x93 ) return 11;
+    if ( cmd == 0x94 ) return 2;
+    if ( cmd >= 0xA0 && cmd <= 0xBF ) return 3;
+    if ( cmd >= 0xC0 && cmd <= 0xDF ) return 4;
+    if ( cmd >= 0xE0 ) return 5;
+    return 0;
+}
+
+VgmDataBanks::~VgmDataBanks()
+{
+    clear();
+}
+
+void VgmDataBanks::clear()
+{
+    for ( VgmDataBlock &block: m_blocks )
+    {
+        if ( block.owned ) free( const_cast<uint8_t *>( block.data ) );
+    }
+    m_blocks.clear();
+}
+
+void VgmDataBanks::scan(DataSource *source, uint32_t offset)
+{
+    const uint8_t *data = source->getData();
+    uint32_t size = source->getSize();
+    if ( !data )
+    {
+        return;
+    }
+    // Data blocks are usually placed before the music, but the whole data is scanned,
+    // so blocks are known before any command, using them, is played
+    while ( offset < size && data[offset] != 0x66 )
+    {
+        uint32_t length = commandSize( data + offset, size - offset );
+        if ( !length || length > size - offset )
+        {
+            break;
+        }
+        if ( data[offset] == 0x67 )
+        {
+            add( source, data[offset + 2], offset + 7, length - 7 );
+        }
+        offset += length;
+    }
+    LOG( "Indexed %u data blocks\n", getBlockCount() );
+}
+
+void VgmDataBanks::add(DataSource *source, uint8_t type, uint32_t offset, uint32_t size)
+{
+    uint32_t bankOffset = 0;
+    for ( const VgmDataBlock &block: m_blocks )
+    {
+        if ( block.offset == offset )
+        {
+            return;
+        }
+        if ( block.type == type ) bankOffset += block.size;
+    }
+    const uint8_t *data = source->getData();
+    m_blocks.push_back( VgmDataBlock{ offset, size, bankOffset, type, data ? data + offset : nullptr, false } );
+}
+
+bool VgmDataBanks::load(DataSource *source, VgmDataBlock &block)
+{
+    if ( block.data )
+    {
+        return true;
+    }
+    uint8_t *data = static_cast<uint8_t *>( malloc( block.size ? block.size : 1 ) );
+    if ( !data || source->read( block.offset, data, block.size ) != block.size )
+    {
+        LOGE( "Failed to read data block at 0x%08X\n", block.offset );
+        free( data );
+        return false;
+    }
+    block.data = data;
+    block.owned = true;
+    return true;
+}
+
+const uint8_t *VgmDataBanks::getData(DataSource *source, uint32_t offset)
+{
+    for ( VgmDataBlock &block: m_blocks )
+    {
+        if ( block.offset == offset )
+        {
+            return load( source, block ) ? block.data : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+bool VgmDataBanks::loadBank(DataSource *source, uint8_t type)
+{
+    bool result = true;
+    for ( VgmDataBlock &block: m_blocks )
+    {
+        if ( block.type == type && !load( source, block ) ) result = false;
+    }
+    return result;
+}
+
+uint32_t VgmDataBanks::getBankSize(uint8_t type) const
+{
+    uint32_t size = 0;
+    for ( const VgmDataBlock &block: m_blocks )
+    {
+        if ( block.type == type ) size += block.size;
+    }
+    return size;
+}
+
+const VgmDataBlock *VgmDataBanks::getBlock(uint8_t type, uint32_t index) const
+{
+    for ( const VgmDataBlock &block: m_blocks )
+    {
+        if ( block.type == type && !index-- )
+        {
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+const VgmDataBlock *VgmDataBanks::findBlock(uint8_t type, uint32_t position) const
+{
+    for ( const VgmDataBlock &block: m_blocks )
+    {
+        if ( block.type == type && position >= block.bankOffset && position - block.bankOffset < block.size )
+        {
+            return &block;
+        }
+    }
+    return nullptr;
+}
@@ -22,9 +22,11 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-#include "vgm_decoder.h"
-#include "formats/vgm_format.h"
-#include "chips/nsf_cartridge.h"
+#include "formats/vgm_decoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
 
 #define VGM_DECODER_DEBUG 1
 
@@ -33,8 +35,28 @@ SOFTWARE.
 #endif
 #include "../vgm_logger.h"
 
-/** Vgm file are always based on 44.1kHz rate */
-#define VGM_SAMPLE_RATE 44100
+/** Interval of register write rate measurement in samples (1/60 second) */
+#define VGM_ANALYSIS_FRAME 735
+
+/** Maximum size of streaming data, checked for trailing waits, see GzipDataSource window */
+#define VGM_TRAILING_WAIT_LOOKUP 256
+
+/** Maximum number of samples between DAC stream writes, so 16.16 phase doesn't overflow */
+#define VGM_DAC_STREAM_MAX_PERIOD 0x7FFFFFFF
+
+/** Decoder part of the state, chips state follows it */
+typedef struct
+{
+    uint32_t dataOffset;
+    uint32_t waitSamples;
+    uint32_t samplesPlayed;
+    uint32_t waitRemainder;
+    uint32_t eventIndex;
+    uint32_t pcmPosition;
+    uint8_t loops;
+    AY38910Snapshot ay;
+    VgmDacStream dacStreams[VGM_DAC_STREAM_COUNT];
+} VgmDecoderSnapshot;
 
 VgmMusicDecoder::VgmMusicDecoder()
 {
@@ -42,52 +64,204 @@ VgmMusicDecoder::VgmMusicDecoder()
 
 VgmMusicDecoder::~VgmMusicDecoder()
 {
-    deleteChips();
+    close();
 }
 
 void VgmMusicDecoder::deleteChips()
 {
+#if VGM_DECODER_AY38910
     if ( m_msxChip )
     {
+#if !VGM_DECODER_EMBEDDED_AY38910
         delete m_msxChip;
+#endif
         m_msxChip = nullptr;
     }
+#endif
+#if VGM_DECODER_NES
     if ( m_nesChip )
     {
+#if VGM_DECODER_EMBEDDED_NES
+        NesCartridge *cartridge = m_nesChip->getCartridge();
+        m_nesChip->~NesCpu();
+        cartridge->~NesCartridge();
+#else
         delete m_nesChip;
+#endif
         m_nesChip = nullptr;
     }
+#endif
+}
+
+
+static VgmMusicDecoder *createDecoder(void *storage)
+{
+    return storage ? new( storage ) VgmMusicDecoder() : new VgmMusicDecoder();
 }
 
+static void destroyDecoder(VgmMusicDecoder *decoder, void *storage)
+{
+    if ( storage ) decoder->~VgmMusicDecoder(); else delete decoder;
+}
 
-VgmMusicDecoder *VgmMusicDecoder::tryOpen(const uint8_t *data, int size)
+VgmMusicDecoder *VgmMusicDecoder::tryOpen(const uint8_t *data, int size, bool precompile, void *storage)
 {
-    VgmMusicDecoder *decoder = new VgmMusicDecoder();
+    VgmMusicDecoder *decoder = createDecoder( storage );
+    VgmCommandStream *stream = precompile ? compile( data, size ) : nullptr;
+    if ( stream && decoder->open( stream ) )
+    {
+        decoder->m_ownStream = stream;
+        return decoder;
+    }
+    delete stream;
     if ( !decoder->open( data, size ) )
     {
-        delete decoder;
+        destroyDecoder( decoder, storage );
         decoder = nullptr;
     }
     return decoder;
 }
 
+VgmMusicDecoder *VgmMusicDecoder::tryOpen(DataSource *source, bool precompile, void *storage)
+{
+    if ( source->getData() )
+    {
+        return tryOpen( source->getData(), source->getSize(), precompile, storage );
+    }
+    VgmMusicDecoder *decoder = createDecoder( storage );
+    if ( !decoder->open( source ) )
+    {
+        destroyDecoder( decoder, storage );
+        decoder = nullptr;
+    }
+    return decoder;
+}
+
+VgmCommandStream *VgmMusicDecoder::compile(const uint8_t *data, int size)
+{
+    VgmMusicDecoder decoder;
+    if ( !decoder.open( data, size ) )
+    {
+        return nullptr;
+    }
+    VgmCommandStream *stream = new VgmCommandStream( data, size );
+    decoder.m_recorder = stream;
+    // Pass the data only once, the loop is handled by the player
+    decoder.m_loops = 1;
+    while ( decoder.m_dataOffset < decoder.m_size )
+    {
+        if ( decoder.m_loopOffset && decoder.m_dataOffset == decoder.m_loopOffset )
+        {
+            stream->markLoop();
+        }
+        decoder.m_waitSamples = 0;
+        if ( !decoder.nextCommand() || decoder.m_dacUsed )
+        {
+            break;
+        }
+        if ( decoder.m_waitSamples )
+        {
+            stream->addWait( decoder.m_waitSamples );
+        }
+    }
+    if ( decoder.m_dacUsed )
+    {
+        // DAC streams write registers between waits, so they are played from vgm commands
+        LOG( "DAC streams are used, vgm data are not compiled\n" );
+        delete stream;
+        return nullptr;
+    }
+    stream->end();
+    LOG( "Compiled %d events, loop index %d\n", stream->getEventCount(), stream->getLoopIndex() );
+    return stream;
+}
+
+bool VgmMusicDecoder::analyze(int track, uint32_t maxSamples, VgmTrackInfo &info)
+{
+    info = VgmTrackInfo{};
+    VgmMusicDecoder decoder;
+    if ( !m_header || !decoder.open( m_source ) )
+    {
+        return false;
+    }
+    decoder.m_info = &info;
+    // Pass the data only once, waits are summed in 44100 Hz samples
+    decoder.m_loops = 1;
+    uint64_t total = 0;
+    uint64_t loopStart = 0;
+    uint64_t frameEnd = VGM_ANALYSIS_FRAME;
+    uint32_t frameWrites = 0;
+    uint32_t peakWrites = 0;
+    while ( decoder.m_dataOffset < decoder.m_size && total < maxSamples )
+    {
+        if ( decoder.m_loopOffset && decoder.m_dataOffset == decoder.m_loopOffset )
+        {
+            loopStart = total;
+        }
+        uint32_t writes = info.registerWrites;
+        decoder.m_waitSamples = 0;
+        if ( !decoder.nextCommand() )
+        {
+            break;
+        }
+        // DAC streams write registers during the wait, so the wait is passed by frames
+        uint32_t wait = decoder.m_waitSamples;
+        do
+        {
+            uint32_t samples = wait;
+            if ( decoder.m_dacPlaying && samples > frameEnd - total ) samples = frameEnd - total;
+            if ( decoder.m_dacPlaying ) decoder.playDacStreams( nullptr, samples );
+            frameWrites += info.registerWrites - writes;
+            writes = info.registerWrites;
+            total += samples;
+            wait -= samples;
+            if ( total >= frameEnd )
+            {
+                if ( frameWrites > peakWrites ) peakWrites = frameWrites;
+                frameWrites = 0;
+                frameEnd = ( total / VGM_ANALYSIS_FRAME + 1 ) * VGM_ANALYSIS_FRAME;
+            }
+        } while ( wait );
+    }
+    if ( frameWrites > peakWrites ) peakWrites = frameWrites;
+    info.totalSamples = total < UINT32_MAX ? total : UINT32_MAX;
+    info.loopSamples = decoder.m_loopOffset ? info.totalSamples - loopStart : 0;
+    info.peakWriteRate = peakWrites * ( VGM_SAMPLE_RATE / VGM_ANALYSIS_FRAME );
+    info.complete = total < maxSamples;
+    return true;
+}
+
 bool VgmMusicDecoder::open(const uint8_t * data, int size)
 {
-    m_header = nullptr;
     close();
-    if ( size < sizeof(VgmHeader) )
+    m_memorySource.setData( data, size );
+    return open( &m_memorySource );
+}
+
+bool VgmMusicDecoder::open(DataSource *source)
+{
+    if ( source != &m_memorySource )
+    {
+        close();
+    }
+    m_header = nullptr;
+    m_stream = nullptr;
+    m_eventIndex = 0;
+    m_waitScanStart = 0;
+    m_waitScanEnd = 0;
+    m_source = source;
+    m_size = source->getSize();
+    if ( m_size < sizeof(VgmHeader) ||
+         source->read( 0, &m_headerData, sizeof(VgmHeader) ) != sizeof(VgmHeader) )
     {
         return false;
     }
-    m_rawData = data;
-    m_size = size;
-    m_header = reinterpret_cast<const VgmHeader *>(m_rawData);
-    m_dataPtr = m_rawData;
+    m_header = &m_headerData;
     if ( m_header->ident != 0x206D6756 )
     {
         return false;
     }
-    if ( m_header->eofOffset != size - 4 )
+    if ( m_header->eofOffset != m_size - 4 )
     {
         return false;
     }
@@ -104,13 +278,20 @@ bool VgmMusicDecoder::open(const uint8_t * data, int size)
         m_vgmDataOffset = m_header->vgmDataOffset + 0x34;
     }
 
-    m_dataPtr += m_vgmDataOffset;
+    m_dataOffset = m_vgmDataOffset;
+    m_banks.clear();
+    m_banks.scan( source, m_vgmDataOffset );
+    resetDacStreams();
+    m_pcmPosition = 0;
+    m_pcmBlock = nullptr;
     m_samplesPlayed = 0;
     m_waitSamples = 0;
+    m_waitRemainder = 0;
     if ( m_header->loopOffset )
     {
         m_loopOffset = 0x1C + m_header->loopOffset;
         m_loops = 2;
+        m_source->addCheckpoint( m_loopOffset );
     }
     else
     {
@@ -120,15 +301,37 @@ bool VgmMusicDecoder::open(const uint8_t * data, int size)
 
     if ( m_header->ay8910Clock )
     {
+#if VGM_DECODER_AY38910
+#if VGM_DECODER_EMBEDDED_AY38910
+        m_msxStorage = AY38910( m_header->ay8910Type, m_header->ay8910Flags );
+        m_msxChip = &m_msxStorage;
+#else
         m_msxChip = new AY38910( m_header->ay8910Type, m_header->ay8910Flags );
+#endif
         m_msxChip->setFrequency( m_header->ay8910Clock );
+        m_msxChip->setSampleFrequency( m_sampleFrequency );
+#else
+        LOGE( "AY-3-8910 support is not compiled in\n" );
+        return false;
+#endif
     }
     else if ( m_header->nesApuClock )
     {
+#if VGM_DECODER_NES
+#if VGM_DECODER_EMBEDDED_NES
+        m_nesChip = new( m_nesStorage ) NesCpu();
+        m_nesChip->insertCartridge( new( m_nesCartridgeStorage ) NsfCartridge(), false );
+#else
         m_nesChip = new NesCpu();
         NsfCartridge *cartridge = new NsfCartridge();
         m_nesChip->insertCartridge( cartridge );
+#endif
+        m_nesChip->getApu()->setSampleFrequency( m_sampleFrequency );
 //        m_nesChip->setFrequency( m_header->nesApuClock );
+#else
+        LOGE( "NES APU support is not compiled in\n" );
+        return false;
+#endif
     }
 
     LOG( "Rate: %d\n", m_rate );
@@ -144,19 +347,336 @@ bool VgmMusicDecoder::open(const uint8_t * data, int size)
     return true;
 }
 
+bool VgmMusicDecoder::open(const VgmCommandStream *stream)
+{
+    if ( !open( stream->getData(), stream->getSize() ) )
+    {
+        return false;
+    }
+    m_stream = stream;
+    // Data blocks are not part of the compiled events, so load them before playing
+    for ( const VgmDataBlockInfo &block: stream->getDataBlocks() )
+    {
+        setDataBlock( block.offset, block.size );
+    }
+    return true;
+}
+
 void VgmMusicDecoder::close()
 {
     m_header = nullptr;
-    m_rawData = nullptr;
+    m_source = nullptr;
     m_samplesPlayed = 0;
+    m_stream = nullptr;
+    if ( m_ownStream )
+    {
+        delete m_ownStream;
+        m_ownStream = nullptr;
+    }
     deleteChips();
+    resetDacStreams();
+    m_banks.clear();
+}
+
+void VgmMusicDecoder::writeRegister(uint8_t chip, uint8_t reg, uint8_t value)
+{
+    switch ( chip )
+    {
+#if VGM_DECODER_AY38910
+        case VGM_EVENT_AY8910:
+            if ( !m_msxChip ) return;
+            if ( m_recorder || m_info ) break;
+            m_msxChip->write( reg, value );
+            return;
+#endif
+#if VGM_DECODER_NES
+        case VGM_EVENT_NES_APU:
+            if ( !m_nesChip ) return;
+            if ( m_recorder || m_info ) break;
+            m_nesChip->getApu()->write( reg, value );
+            return;
+#endif
+        default:
+            return;
+    }
+    if ( m_info )
+    {
+        uint8_t index = chip == VGM_EVENT_AY8910 ? VGM_CHIP_AY8910 : VGM_CHIP_NES_APU;
+        m_info->chips |= 1 << index;
+        m_info->registers[index] |= 1ULL << ( reg & 0x3F );
+        m_info->registerWrites++;
+        return;
+    }
+    m_recorder->addWrite( chip, reg, value );
+}
+
+void VgmMusicDecoder::setDataBlock(uint32_t offset, uint32_t size)
+{
+#if VGM_DECODER_NES
+    if ( !m_nesChip || !m_nesChip->getCartridge() || m_info )
+    {
+        return;
+    }
+    if ( m_recorder )
+    {
+        m_recorder->addDataBlock( offset, size );
+        return;
+    }
+    // Cartridge keeps pointer to the data block, so it is copied, if the source is not resident
+    const uint8_t *data = m_banks.getData( m_source, offset );
+    if ( !data )
+    {
+        return;
+    }
+    reinterpret_cast<NsfCartridge *>(m_nesChip->getCartridge())->setDataBlock( data, size );
+#endif
+}
+
+void VgmMusicDecoder::resetDacStreams()
+{
+    for ( VgmDacStream &stream: m_dacStreams )
+    {
+        stream = VgmDacStream{};
+        stream.id = 0xFF;
+        stream.stepSize = 1;
+    }
+    m_dacUsed = false;
+    updateDacStreams();
+}
+
+void VgmMusicDecoder::updateDacStreams()
+{
+    m_dacPlaying = false;
+    for ( int i = 0; i < VGM_DAC_STREAM_COUNT; i++ )
+    {
+        VgmDacStream &stream = m_dacStreams[i];
+        uint64_t period = stream.frequency ? ( static_cast<uint64_t>( m_sampleFrequency ) << 16 ) / stream.frequency : 0;
+        if ( period > VGM_DAC_STREAM_MAX_PERIOD ) period = VGM_DAC_STREAM_MAX_PERIOD;
+        stream.period = stream.frequency && !period ? 1 : period;
+        if ( stream.playing && stream.period && stream.chip != VGM_EVENT_NONE ) m_dacPlaying = true;
+        // Blocks can be moved, when new ones are added to the registry
+        m_dacBlocks[i] = nullptr;
+    }
+}
+
+void VgmMusicDecoder::startDacStream(VgmDacStream &stream, uint32_t start, uint32_t count)
+{
+    stream.start = start;
+    if ( count == UINT32_MAX )
+    {
+        // Play till the end of the bank
+        uint32_t size = m_banks.getBankSize( stream.bank );
+        uint32_t first = start + stream.stepBase;
+        count = first < size ? ( size - first + stream.stepSize - 1 ) / stream.stepSize : 0;
+    }
+    stream.writeIndex = 0;
+    stream.writeCount = count;
+    stream.phase = 0;
+    stream.playing = count != 0;
+    if ( stream.playing && stream.chip != VGM_EVENT_NONE )
+    {
+        m_dacUsed = true;
+        if ( stream.bank >= 0x40 )
+        {
+            LOGE( "Compressed data bank 0x%02X is not supported\n", stream.bank );
+            stream.playing = false;
+        }
+        else if ( !m_recorder && !m_info && !m_banks.loadBank( m_source, stream.bank ) )
+        {
+            stream.playing = false;
+        }
+    }
+    updateDacStreams();
+}
+
+void VgmMusicDecoder::controlDacStream(const uint8_t *data)
+{
+    uint8_t cmd = data[0];
+    uint8_t id = data[1];
+    if ( cmd == 0x94 )
+    {
+        // ss : stop stream, 0xFF stops all streams
+        for ( VgmDacStream &stream: m_dacStreams )
+        {
+            if ( stream.id != 0xFF && ( id == 0xFF || stream.id == id ) ) stream.playing = false;
+        }
+        updateDacStreams();
+        return;
+    }
+    VgmDacStream *stream = nullptr;
+    for ( VgmDacStream &entry: m_dacStreams )
+    {
+        if ( entry.id == id ) stream = &entry;
+        else if ( !stream && entry.id == 0xFF && cmd == 0x90 ) stream = &entry;
+    }
+    if ( !stream )
+    {
+        LOGE( "DAC stream 0x%02X is not set up, or too many streams\n", id );
+        return;
+    }
+    switch ( cmd )
+    {
+        case 0x90: // ss tt pp cc : setup stream, chip type tt (bit 7 - second chip), port pp, command cc
+            stream->id = id;
+            stream->chip = VGM_EVENT_NONE;
+#if VGM_DECODER_AY38910
+            if ( data[2] == 0x12 && m_msxChip ) stream->chip = VGM_EVENT_AY8910;
+#endif
+#if VGM_DECODER_NES
+            if ( data[2] == 0x14 && m_nesChip ) stream->chip = VGM_EVENT_NES_APU;
+#endif
+            stream->reg = data[4];
+            break;
+        case 0x91: // ss dd ll bb : set stream data bank dd, step size ll, step base bb
+            stream->bank = data[2];
+            stream->stepSize = data[3] ? data[3] : 1;
+            stream->stepBase = data[4];
+            break;
+        case 0x92: // ss ff ff ff ff : set stream frequency
+            stream->frequency = data[2] | (data[3] << 8) | (data[4] << 16) | (data[5] << 24);
+            break;
+        case 0x93: // ss aa aa aa aa mm ll ll ll ll : start stream at bank offset aaaaaaaa,
+                   // length mode mm (bits 0-1: 0 - keep, 1 - writes, 2 - milliseconds, 3 - till
+                   // the end of bank; bit 4 - reverse, bit 7 - loop), length llllllll
+        {
+            uint32_t start = data[2] | (data[3] << 8) | (data[4] << 16) | (data[5] << 24);
+            uint32_t length = data[7] | (data[8] << 8) | (data[9] << 16) | (data[10] << 24);
+            uint32_t count = stream->writeCount;
+            switch ( data[6] & 0x03 )
+            {
+                case 1: count = length; break;
+                case 2: count = static_cast<uint64_t>( length ) * stream->frequency / 1000; break;
+                case 3: count = UINT32_MAX; break;
+                default: break;
+            }
+            stream->loop = data[6] & 0x80;
+            stream->reverse = data[6] & 0x10;
+            startDacStream( *stream, start == 0xFFFFFFFF ? stream->start : start, count );
+            return;
+        }
+        case 0x95: // ss bb bb ff : start stream with data block bbbb of the bank,
+                   // flags ff (bit 0 - loop, bit 4 - reverse)
+        {
+            const VgmDataBlock *block = m_banks.getBlock( stream->bank, data[2] | (data[3] << 8) );
+            if ( !block )
+            {
+                LOGE( "Data block %d of bank 0x%02X is not found\n", data[2] | (data[3] << 8), stream->bank );
+                stream->playing = false;
+                break;
+            }
+            stream->loop = data[4] & 0x01;
+            stream->reverse = data[4] & 0x10;
+            startDacStream( *stream, block->bankOffset, block->size / stream->stepSize );
+            return;
+        }
+        default:
+            break;
+    }
+    updateDacStreams();
+}
+
+void VgmMusicDecoder::writeDacStream(int index)
+{
+    VgmDacStream &stream = m_dacStreams[index];
+    uint32_t step = stream.reverse ? stream.writeCount - 1 - stream.writeIndex : stream.writeIndex;
+    uint32_t position = stream.start + stream.stepBase + step * stream.stepSize;
+    // Bank data are read directly from the block, which is looked up only when the stream leaves it
+    const VgmDataBlock *block = m_dacBlocks[index];
+    if ( !block || position < block->bankOffset || position - block->bankOffset >= block->size )
+    {
+        block = m_banks.findBlock( stream.bank, position );
+        m_dacBlocks[index] = block;
+    }
+    // Analysis counts the writes only, so blocks are not loaded for it
+    if ( !block || ( !block->data && !m_info ) )
+    {
+        stream.playing = false;
+        updateDacStreams();
+        return;
+    }
+    writeRegister( stream.chip, stream.reg, block->data ? block->data[ position - block->bankOffset ] : 0 );
+    if ( ++stream.writeIndex >= stream.writeCount )
+    {
+        stream.writeIndex = 0;
+        if ( !stream.loop )
+        {
+            stream.playing = false;
+            updateDacStreams();
+        }
+    }
+}
+
+void VgmMusicDecoder::playDacStreams(uint32_t *outBuffer, int samples)
+{
+    while ( samples > 0 )
+    {
+        // Writes, which are due at the current sample, are done before the sample is rendered,
+        // and chips render all samples till the next write at once
+        uint32_t span = samples;
+        for ( int i = 0; i < VGM_DAC_STREAM_COUNT; i++ )
+        {
+            VgmDacStream &stream = m_dacStreams[i];
+            if ( !stream.playing || !stream.period || stream.chip == VGM_EVENT_NONE ) continue;
+            while ( stream.playing && stream.phase < 0x10000 )
+            {
+                writeDacStream( i );
+                stream.phase += stream.period;
+            }
+            if ( stream.playing && ( stream.phase >> 16 ) < span ) span = stream.phase >> 16;
+        }
+        for ( VgmDacStream &stream: m_dacStreams )
+        {
+            if ( stream.playing && stream.period && stream.chip != VGM_EVENT_NONE ) stream.phase -= span << 16;
+        }
+        if ( outBuffer )
+        {
+            renderChips( outBuffer, span );
+            outBuffer += span;
+        }
+        else if ( !m_info )
+        {
+            skipChips( span );
+        }
+        samples -= span;
+    }
+}
+
+bool VgmMusicDecoder::nextEvent()
+{
+    const VgmEvent &event = m_stream->getEvents()[ m_eventIndex ];
+    if ( event.chip == VGM_EVENT_END )
+    {
+        STATS_ADD( commands[ VGM_STATS_COMMAND_OTHER ], 1 );
+        if ( m_stream->hasLoop() && m_loops != 1 )
+        {
+            m_eventIndex = m_stream->getLoopIndex();
+            if ( m_loops ) m_loops--;
+            return true;
+        }
+        return false;
+    }
+    writeRegister( event.chip, event.reg, event.value );
+    // Each event is register write, followed by merged wait commands
+    STATS_ADD( commands[ VGM_STATS_COMMAND_WRITE ], 1 );
+    STATS_ADD( commands[ VGM_STATS_COMMAND_WAIT ], event.wait != 0 );
+    m_waitSamples = event.wait;
+    m_eventIndex++;
+    return true;
 }
 
 
 bool VgmMusicDecoder::nextCommand()
 {
-    uint8_t cmd = *m_dataPtr;
-    LOG( "[0x%08X] command: 0x%02X", static_cast<uint32_t>(m_dataPtr - m_rawData), cmd);
+    // 12 bytes is enough for any command, including data block header and PCM RAM write
+    const uint8_t *data = m_source->fetch( m_dataOffset, 12 );
+    if ( !data )
+    {
+        LOGE( "Unexpected end of data at position 0x%08X \n", m_dataOffset );
+        return false;
+    }
+    uint8_t cmd = data[0];
+    TRACE( VGM_TRACE_VGM_COMMAND, cmd, m_dataOffset );
+    STATS_ADD( commands[ vgmStatsCommandClass( cmd ) ], 1 );
     switch ( cmd )
     {
         case 0x31: /* dd    : Set AY8910 stereo mask
@@ -165,14 +685,14 @@ bool VgmMusicDecoder::nextCommand()
                Bit 4-5: Channel C mask (00=off, 01=left, 10=right, 11=center)
                Bit 6: Chip type, 0=AY8910, 1=YM2203 SSG part
                Bit 7: Chip number, 0 or 1 */
-            LOG( " [stereo mask cmd 0x%02X]\n", m_dataPtr[1] );
-            m_dataPtr += 2;
+            LOG( "stereo mask cmd 0x%02X\n", data[1] );
+            m_dataOffset += 2;
             break;
         case 0x4F: // dd    : Game Gear PSG stereo, write dd to port 0x06
-            m_dataPtr += 2;
+            m_dataOffset += 2;
             break;
         case 0x50: // dd    : PSG (SN76489/SN76496) write value dd
-            m_dataPtr += 2;
+            m_dataOffset += 2;
             break;
         case 0x51: // aa dd : YM2413, write value dd to register aa
         case 0x52: // aa dd : YM2612 port 0, write value dd to register aa
@@ -189,64 +709,65 @@ bool VgmMusicDecoder::nextCommand()
         case 0x5D: // aa dd : YMZ280B, write value dd to register aa
         case 0x5E: // aa dd : YMF262 port 0, write value dd to register aa
         case 0x5F: // aa dd : YMF262 port 1, write value dd to register aa
-            m_dataPtr += 3;
+            m_dataOffset += 3;
             break;
         case 0x61: // nn nn : Wait n samples, n can range from 0 to 65535 (approx 1.49
                    // seconds). Longer pauses than this are represented by multiple
                    // wait commands.
-            m_waitSamples = ( m_dataPtr[1] | (m_dataPtr[2] << 8) ) + 1;
-            LOG( " [wait %d samples]", m_waitSamples);
-            m_dataPtr += 3;
+            m_waitSamples = ( data[1] | (data[2] << 8) ) + 1;
+            TRACE( VGM_TRACE_VGM_WAIT, 0, m_waitSamples );
+            m_dataOffset += 3;
             break;
         case 0x62: //       : wait 735 samples (60th of a second), a shortcut for 0x61 0xdf 0x02
             m_waitSamples = 735;
-            LOG( " [wait 735 samples]");
-            m_dataPtr += 1;
+            TRACE( VGM_TRACE_VGM_WAIT, 0, m_waitSamples );
+            m_dataOffset += 1;
             break;
         case 0x63: //       : wait 882 samples (50th of a second), a shortcut for 0x61 0x72 0x03
             m_waitSamples = 882;
-            m_dataPtr += 1;
+            TRACE( VGM_TRACE_VGM_WAIT, 0, m_waitSamples );
+            m_dataOffset += 1;
             break;
         case 0x66: //       : end of sound data
             if ( m_loopOffset && m_loops != 1  )
             {
-                m_dataPtr = m_rawData + m_loopOffset;
+                m_dataOffset = m_loopOffset;
                 if ( m_loops ) m_loops--;
             }
             else
             {
-                LOG( " [stop]\n" );
+                LOG( "stop\n" );
                 return false;
             }
             break;
         case 0x67: // ...   : data block: see below
-            // 0x67 0x66 tt ss ss ss ss
+            // 0x67 0x66 tt ss ss ss ss, bit 31 of the size selects the second chip
         {
-            LOG( " [DATA BLOCK type=0x%02X, len=0x%02X%02X%02X%02X]\n", m_dataPtr[2], m_dataPtr[6], m_dataPtr[5], m_dataPtr[4], m_dataPtr[3] );
-            uint32_t dataLength = (m_dataPtr[3] + (m_dataPtr[4] << 8) + (m_dataPtr[5] << 16) + (m_dataPtr[6] << 24));
-            if ( m_nesChip && m_nesChip->getCartridge() )
-            {
-                reinterpret_cast<NsfCartridge *>(m_nesChip->getCartridge())->setDataBlock( m_dataPtr + 7, dataLength );
-            }
-            m_dataPtr += 7 + dataLength;
+            LOG( "DATA BLOCK type=0x%02X, len=0x%02X%02X%02X%02X\n", data[2], data[6], data[5], data[4], data[3] );
+            uint32_t dataLength = (data[3] + (data[4] << 8) + (data[5] << 16) + (data[6] << 24)) & 0x7FFFFFFF;
+            m_banks.add( m_source, data[2], m_dataOffset + 7, dataLength );
+            updateDacStreams();
+            m_pcmBlock = nullptr;
+            // 0xC2: NES APU RAM write, the first 2 bytes are start address
+            if ( data[2] == 0xC2 ) setDataBlock( m_dataOffset + 7, dataLength );
+            m_dataOffset += 7 + dataLength;
             break;
         }
-        case 0x68: // ...   : PCM RAM write: see below
-            LOG( " [PCM RAM WRITE]\n" );
+        case 0x68: // 0x66 cc oo oo oo dd dd dd ss ss ss : PCM RAM write, chips with PCM RAM are not supported
+            LOG( "PCM RAM WRITE\n" );
+            m_dataOffset += 12;
             break;
         case 0xA0: // aa dd : AY8910, write value dd to register aa
-            LOG( " [write ay8910 reg [0x%02X] = 0x%02X ]", m_dataPtr[1], m_dataPtr[2]);
-            m_msxChip->write( m_dataPtr[1], m_dataPtr[2] );
-            m_dataPtr += 3;
+            writeRegister( VGM_EVENT_AY8910, data[1], data[2] );
+            m_dataOffset += 3;
             break;
         case 0xB4: // aa dd : NES APU, write value dd to register aa
                    // Note: Registers 00-1F equal NES address 4000-401F,
                    //       registers 20-3E equal NES address 4080-409E,
                    //       register 3F equals NES address 4023,
                    //       registers 40-7F equal NES address 4040-407F.
-            LOG( " [write nesAPU reg [0x%02X] = 0x%02X ]", m_dataPtr[1], m_dataPtr[2]);
-            m_nesChip->getApu()->write( m_dataPtr[1], m_dataPtr[2] );
-            m_dataPtr += 3;
+            writeRegister( VGM_EVENT_NES_APU, data[1], data[2] );
+            m_dataOffset += 3;
             break;
         case 0xB0: // aa dd : RF5C68, write value dd to register aa
         case 0xB1: // aa dd : RF5C164, write value dd to register aa
@@ -264,11 +785,11 @@ bool VgmMusicDecoder::nextCommand()
         case 0xBD: // aa dd : SAA1099, write value dd to register aa
         case 0xBE: // aa dd : ES5506, write 8-bit value dd to register aa
         case 0xBF: // aa dd : GA20, write value dd to register aa
-            m_dataPtr += 3;
+            m_dataOffset += 3;
             break;
         case 0x30: // dd    : Used for dual chip support: see below
         case 0x3F: // dd    : Used for dual chip support: see below
-            m_dataPtr += 2;
+            m_dataOffset += 2;
             break;
         case 0xC0: // bbaa dd : Sega PCM, write value dd to memory offset aabb
         case 0xC1: // bbaa dd : RF5C68, write value dd to memory offset aabb
@@ -291,19 +812,22 @@ bool VgmMusicDecoder::nextCommand()
         case 0xD4: // pp aa dd : C140 write value dd to register ppaa
         case 0xD5: // pp aa dd : ES5503 write value dd to register ppaa
         case 0xD6: // aa ddee  : ES5506 write 16-bit value ddee to register aa
-            m_dataPtr += 4;
+            m_dataOffset += 4;
             break;
         case 0xE0: // dddddddd : seek to offset dddddddd (Intel byte order) in PCM data bank
+            m_pcmPosition = data[1] | (data[2] << 8) | (data[3] << 16) | (static_cast<uint32_t>(data[4]) << 24);
+            m_dataOffset += 5;
+            break;
         case 0xE1: // aabb ddee: C352 write 16-bit value ddee to register aabb
-            m_dataPtr += 5;
+            m_dataOffset += 5;
             break;
         default:
             if ( cmd >= 0x70 && cmd <= 0x7F )
             {
-                LOG( " [wait %d samples]", (cmd & 0x0F) + 1);
                 m_waitSamples = (cmd & 0x0F) + 1;
+                TRACE( VGM_TRACE_VGM_WAIT, 0, m_waitSamples );
                 //       : wait n+1 samples, n can range from 0 to 15.
-                m_dataPtr += 1;
+                m_dataOffset += 1;
                 break;
             }
             else if ( cmd >= 0x80 && cmd <= 0x8F )
@@ -311,75 +835,336 @@ bool VgmMusicDecoder::nextCommand()
                 //       : YM2612 port 0 address 2A write from the data bank, then wait
                 //       n samples; n can range from 0 to 15. Note that the wait is n,
                 //       NOT n+1. (Note: Written to first chip instance only.)
-                m_dataPtr += 1;
+                // YM2612 is not emulated, so the byte is only looked up in the bank, as DAC streams do
+                const VgmDataBlock *block = m_pcmBlock;
+                if ( !block || m_pcmPosition < block->bankOffset || m_pcmPosition - block->bankOffset >= block->size )
+                {
+                    block = m_banks.findBlock( 0x00, m_pcmPosition );
+                    m_pcmBlock = block;
+                }
+                if ( !block )
+                {
+                    LOG( "PCM bank position 0x%08X is out of data\n", m_pcmPosition );
+                }
+                m_pcmPosition++;
+                m_waitSamples = cmd & 0x0F;
+                TRACE( VGM_TRACE_VGM_WAIT, 0, m_waitSamples );
+                STATS_ADD( commands[ VGM_STATS_COMMAND_WAIT ], m_waitSamples != 0 );
+                m_dataOffset += 1;
                 break;
             }
             else if ( cmd >= 0x90 && cmd <= 0x95 )
             {
                 //  : DAC Stream Control Write: see below
+                static const uint8_t sizes[] = { 5, 5, 6, 11, 2, 5 };
+                controlDacStream( data );
+                m_dataOffset += sizes[ cmd - 0x90 ];
                 break;
             }
             else if ( cmd >= 0x32 && cmd <= 0x3E )
             {
                 // dd          : one operand, reserved for future use
-                m_dataPtr += 2;
+                m_dataOffset += 2;
                 break;
             }
             else if ( cmd >= 0x40 && cmd <= 0x4E )
             {
                 // dd dd       : two operands, reserved for future use Note: was one operand only til v1.60
-                m_dataPtr += 3;
+                m_dataOffset += 3;
                 break;
             }
             else if ( cmd >= 0xA1 && cmd <= 0xAF)
             {
                 // aa dd : Used for dual chip support: see below
-                m_dataPtr += 3;
+                m_dataOffset += 3;
                 break;
             }
             else if ( ( cmd >= 0xC9 && cmd <= 0xCF ) || ( cmd >= 0xD7 && cmd <= 0xDF ) )
             {
                 // dd dd dd    : three operands, reserved for future use
-                m_dataPtr += 4;
+                m_dataOffset += 4;
                 break;
             }
             else if ( cmd >= 0xE2 && static_cast<uint16_t>(cmd) <= 0xFF )
             {
                 // dd dd dd dd : four operands, reserved for future use
-                m_dataPtr += 5;
+                m_dataOffset += 5;
                 break;
             }
             LOGE( "Unknown command (0x%02X) is detected at position 0x%08X \n",
-                  *m_dataPtr, static_cast<uint32_t>(m_dataPtr - m_rawData) );
+                  cmd, m_dataOffset );
             return false;
     }
-    LOG("\n");
     return true;
 }
 
 void VgmMusicDecoder::setVolume( uint16_t volume )
 {
+#if VGM_DECODER_AY38910
     if ( m_msxChip ) m_msxChip->setVolume( volume );
+#endif
+#if VGM_DECODER_NES
     if ( m_nesChip ) m_nesChip->getApu()->setVolume( volume );
+#endif
+}
+
+bool VgmMusicDecoder::setSampleFrequency( uint32_t frequency )
+{
+    m_sampleFrequency = frequency;
+    m_waitRemainder = 0;
+#if VGM_DECODER_AY38910
+    if ( m_msxChip ) m_msxChip->setSampleFrequency( frequency );
+#endif
+#if VGM_DECODER_NES
+    if ( m_nesChip ) m_nesChip->getApu()->setSampleFrequency( frequency );
+#endif
+    updateDacStreams();
+    return true;
 }
 
 uint32_t VgmMusicDecoder::getSample()
 {
+    if ( m_dacPlaying )
+    {
+        uint32_t sample;
+        renderBlock( &sample, 1 );
+        return sample;
+    }
     m_samplesPlayed++;
+#if VGM_DECODER_AY38910
     if ( m_msxChip ) return m_msxChip->getSample();
+#endif
+#if VGM_DECODER_NES
     if ( m_nesChip ) return m_nesChip->getApu()->getSample();
+#endif
     return 0;
 }
 
+void VgmMusicDecoder::renderBlock(uint32_t *outBuffer, int samples)
+{
+    m_samplesPlayed += samples;
+    if ( m_dacPlaying )
+    {
+        playDacStreams( outBuffer, samples );
+        return;
+    }
+    renderChips( outBuffer, samples );
+}
+
+void VgmMusicDecoder::renderChips(uint32_t *outBuffer, int samples)
+{
+#if VGM_DECODER_AY38910
+    if ( m_msxChip )
+    {
+        m_msxChip->renderBlock( outBuffer, samples );
+        return;
+    }
+#endif
+#if VGM_DECODER_NES
+    if ( m_nesChip )
+    {
+        m_nesChip->getApu()->renderBlock( outBuffer, samples );
+        return;
+    }
+#endif
+    memset( outBuffer, 0, samples * sizeof(uint32_t) );
+}
+
+AY38910 *VgmMusicDecoder::renderLaneBlock(int samples)
+{
+#if VGM_DECODER_AY38910
+    // DAC streams write chip registers inside the block, so it is rendered by the decoder
+    if ( m_msxChip && !m_dacPlaying )
+    {
+        m_samplesPlayed += samples;
+        return m_msxChip;
+    }
+#endif
+    return nullptr;
+}
+
+void VgmMusicDecoder::skipBlock(int samples)
+{
+    m_samplesPlayed += samples;
+    if ( m_dacPlaying )
+    {
+        playDacStreams( nullptr, samples );
+        return;
+    }
+    skipChips( samples );
+}
+
+void VgmMusicDecoder::skipChips(int samples)
+{
+#if VGM_DECODER_AY38910
+    if ( m_msxChip )
+    {
+        m_msxChip->skip( samples );
+        return;
+    }
+#endif
+#if VGM_DECODER_NES
+    if ( m_nesChip )
+    {
+        m_nesChip->getApu()->skip( samples );
+    }
+#endif
+}
+
+uint32_t VgmMusicDecoder::getStateSize()
+{
+#if VGM_DECODER_NES
+    if ( m_nesChip ) return sizeof(VgmDecoderSnapshot) + m_nesChip->getStateSize();
+#endif
+    return sizeof(VgmDecoderSnapshot);
+}
+
+bool VgmMusicDecoder::saveState(uint8_t *state)
+{
+    if ( !m_header )
+    {
+        return false;
+    }
+    VgmDecoderSnapshot snapshot{};
+    snapshot.dataOffset = m_dataOffset;
+    snapshot.waitSamples = m_waitSamples;
+    snapshot.samplesPlayed = m_samplesPlayed;
+    snapshot.waitRemainder = m_waitRemainder;
+    snapshot.eventIndex = m_eventIndex;
+    snapshot.pcmPosition = m_pcmPosition;
+    snapshot.loops = m_loops;
+    memcpy( snapshot.dacStreams, m_dacStreams, sizeof(m_dacStreams) );
+#if VGM_DECODER_AY38910
+    if ( m_msxChip ) m_msxChip->saveState( snapshot.ay );
+#endif
+    memcpy( state, &snapshot, sizeof(snapshot) );
+#if VGM_DECODER_NES
+    if ( m_nesChip ) m_nesChip->saveState( state + sizeof(VgmDecoderSnapshot) );
+#endif
+    return true;
+}
+
+bool VgmMusicDecoder::loadState(const uint8_t *state)
+{
+    if ( !m_header )
+    {
+        return false;
+    }
+    VgmDecoderSnapshot snapshot{};
+    memcpy( &snapshot, state, sizeof(snapshot) );
+    m_dataOffset = snapshot.dataOffset;
+    m_waitSamples = snapshot.waitSamples;
+    m_samplesPlayed = snapshot.samplesPlayed;
+    m_waitRemainder = snapshot.waitRemainder;
+    m_eventIndex = snapshot.eventIndex;
+    m_pcmPosition = snapshot.pcmPosition;
+    m_pcmBlock = nullptr;
+    m_loops = snapshot.loops;
+    memcpy( m_dacStreams, snapshot.dacStreams, sizeof(m_dacStreams) );
+    updateDacStreams();
+#if VGM_DECODER_AY38910
+    if ( m_msxChip ) m_msxChip->loadState( snapshot.ay );
+#endif
+#if VGM_DECODER_NES
+    if ( m_nesChip ) m_nesChip->loadState( state + sizeof(VgmDecoderSnapshot) );
+#endif
+    return true;
+}
+
+bool VgmMusicDecoder::isSilent() const
+{
+    if ( m_dacPlaying )
+    {
+        return false;
+    }
+#if VGM_DECODER_AY38910
+    if ( m_msxChip ) return m_msxChip->isSilent();
+#endif
+#if VGM_DECODER_NES
+    if ( m_nesChip ) return m_nesChip->getApu()->isSilent();
+#endif
+    return true;
+}
+
+bool VgmMusicDecoder::isTrailingWait()
+{
+    if ( m_stream )
+    {
+        // Trailing wait commands are merged to the last event
+        return m_stream->getEvents()[ m_eventIndex ].chip == VGM_EVENT_END &&
+               !( m_stream->hasLoop() && m_loops != 1 );
+    }
+    // Position of the command after the waits is remembered, so the same waits are not scanned again
+    if ( m_dataOffset >= m_waitScanStart && m_dataOffset < m_waitScanEnd )
+    {
+        return false;
+    }
+    // Resident data are scanned till the first non-wait command, while streaming source
+    // is scanned within single fetch only, so its window is not moved forward
+    uint32_t size = m_size - m_dataOffset;
+    const uint8_t *data = m_source->getData();
+    if ( data )
+    {
+        data += m_dataOffset;
+    }
+    else
+    {
+        if ( size > VGM_TRAILING_WAIT_LOOKUP ) size = VGM_TRAILING_WAIT_LOOKUP;
+        data = m_source->fetch( m_dataOffset, size );
+        if ( !data )
+        {
+            return false;
+        }
+    }
+    uint32_t offset = 0;
+    while ( offset < size )
+    {
+        uint8_t cmd = data[offset];
+        if ( cmd == 0x66 )
+        {
+            return !( m_loopOffset && m_loops != 1 );
+        }
+        if ( cmd == 0x61 ) offset += 3;
+        else if ( cmd == 0x62 || cmd == 0x63 || ( cmd >= 0x70 && cmd <= 0x7F ) ) offset += 1;
+        else break;
+    }
+    if ( offset < size )
+    {
+        m_waitScanStart = m_dataOffset;
+        m_waitScanEnd = m_dataOffset + offset;
+    }
+    return false;
+}
+
 int VgmMusicDecoder::decodeBlock()
 {
-    m_waitSamples = 0;
-    while ( !m_waitSamples )
+    uint32_t samples = 0;
+    uint32_t commands = 0;
+    while ( !samples )
     {
-        if (!nextCommand())
+        m_waitSamples = 0;
+        while ( !m_waitSamples )
+        {
+            // Position is kept between commands, so the next call continues from here
+            if ( m_blockBudget && commands++ >= m_blockBudget )
+            {
+                return VGM_BLOCK_PENDING;
+            }
+            if ( !(m_stream ? nextEvent() : nextCommand()) )
+            {
+                return 0;
+            }
+        }
+        if ( m_trimSilence && isSilent() && isTrailingWait() )
         {
+            LOGI( "Trailing silence is trimmed, stopping\n" );
             return 0;
         }
+        // Vgm wait commands are always in 44100 Hz samples, so rescale them to actual
+        // sample frequency, keeping the remainder for the next wait command
+        uint64_t wait = static_cast<uint64_t>( m_waitSamples ) * m_sampleFrequency + m_waitRemainder;
+        samples = wait / VGM_SAMPLE_RATE;
+        m_waitRemainder = wait % VGM_SAMPLE_RATE;
     }
-    return m_waitSamples;
+    return samples;
 }
@@ -0,0 +1,323 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "gzip_data_source.h"
+
+#if VGM_DECODER_ZLIB
+
+#include <zlib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GZIP_DATA_SOURCE_DEBUG 1
+
+#if GZIP_DATA_SOURCE_DEBUG && !defined(VGM_DECODER_LOGGER)
+#define VGM_DECODER_LOGGER GZIP_DATA_SOURCE_DEBUG
+#endif
+#include "vgm_logger.h"
+
+/** Number of compressed bytes to pass to inflate at once */
+#define GZIP_INPUT_CHUNK (1024)
+
+struct GzipDataSourceState
+{
+    z_stream stream;
+    /** Compressed data offset of the next input byte */
+    uint32_t inOffset;
+    /** Inflated data offset of the next output byte */
+    uint32_t outOffset;
+
+    z_stream checkpoint;
+    uint32_t checkpointInOffset;
+    uint32_t checkpointOffset;
+    bool checkpointRequested;
+    bool checkpointValid;
+
+    /** Copy of compressed data, if the source cannot fetch the whole chunk at once */
+    uint8_t input[GZIP_INPUT_CHUNK];
+};
+
+GzipDataSource::GzipDataSource(uint32_t windowSize)
+    : m_windowSize( windowSize < 256 ? 256 : windowSize )
+{
+}
+
+GzipDataSource::~GzipDataSource()
+{
+    close();
+}
+
+bool GzipDataSource::isGzip(DataSource *source)
+{
+    uint8_t signature[2];
+    return source->read( 0, signature, sizeof(signature) ) == sizeof(signature) &&
+           signature[0] == 0x1F && signature[1] == 0x8B;
+}
+
+bool GzipDataSource::open(DataSource *compressed)
+{
+    close();
+    uint32_t size = compressed->getSize();
+    uint8_t trailer[4];
+    if ( size < 18 || !isGzip( compressed ) ||
+         compressed->read( size - 4, trailer, sizeof(trailer) ) != sizeof(trailer) )
+    {
+        return false;
+    }
+    m_state = static_cast<GzipDataSourceState *>( calloc( 1, sizeof(GzipDataSourceState) ) );
+    m_window = static_cast<uint8_t *>( malloc( m_windowSize ) );
+    // 16 + MAX_WBITS allows inflate to parse gzip header and trailer
+    if ( !m_state || !m_window || inflateInit2( &m_state->stream, 16 + MAX_WBITS ) != Z_OK )
+    {
+        free( m_state );
+        m_state = nullptr;
+        close();
+        return false;
+    }
+    m_compressed = compressed;
+    // ISIZE field of gzip trailer is size of inflated data
+    m_size = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (static_cast<uint32_t>(trailer[3]) << 24);
+    return true;
+}
+
+void GzipDataSource::close()
+{
+    if ( m_state )
+    {
+        inflateEnd( &m_state->stream );
+        if ( m_state->checkpointValid )
+        {
+            inflateEnd( &m_state->checkpoint );
+        }
+        free( m_state );
+        m_state = nullptr;
+    }
+    if ( m_window )
+    {
+        free( m_window );
+        m_window = nullptr;
+    }
+    m_compressed = nullptr;
+    m_size = 0;
+    m_windowOffset = 0;
+    m_windowLength = 0;
+}
+
+void GzipDataSource::addCheckpoint(uint32_t offset)
+{
+    if ( !m_state || offset >= m_size )
+    {
+        return;
+    }
+    if ( m_state->checkpointValid )
+    {
+        if ( m_state->checkpointOffset == offset )
+        {
+            return;
+        }
+        inflateEnd( &m_state->checkpoint );
+        m_state->checkpointValid = false;
+    }
+    m_state->checkpointOffset = offset;
+    m_state->checkpointRequested = true;
+    if ( offset < m_state->outOffset )
+    {
+        // Data is already inflated beyond the checkpoint, so it will be saved after rewind
+        LOGI( "Gzip checkpoint 0x%08X is behind inflated data\n", offset );
+    }
+}
+
+bool GzipDataSource::inflateTo(uint8_t *buffer, uint32_t size)
+{
+    GzipDataSourceState &state = *m_state;
+    while ( size )
+    {
+        if ( state.checkpointRequested && state.outOffset == state.checkpointOffset )
+        {
+            if ( inflateCopy( &state.checkpoint, &state.stream ) == Z_OK )
+            {
+                state.checkpointInOffset = state.inOffset;
+                state.checkpointValid = true;
+            }
+            state.checkpointRequested = false;
+        }
+        uint32_t chunk = size;
+        // Stop exactly at requested checkpoint to save inflate state there
+        if ( state.checkpointRequested && state.outOffset < state.checkpointOffset &&
+             state.checkpointOffset - state.outOffset < chunk )
+        {
+            chunk = state.checkpointOffset - state.outOffset;
+        }
+        uint32_t inputSize = state.inOffset < m_compressed->getSize() ? m_compressed->getSize() - state.inOffset : 0;
+        if ( inputSize > GZIP_INPUT_CHUNK ) inputSize = GZIP_INPUT_CHUNK;
+        // Windowed sources may be smaller than the chunk, so the data is copied for them
+        const uint8_t *input = inputSize ? m_compressed->fetch( state.inOffset, inputSize ) : nullptr;
+        if ( !input && inputSize && m_compressed->read( state.inOffset, state.input, inputSize ) == inputSize )
+        {
+            input = state.input;
+        }
+        if ( !input )
+        {
+            LOGE( "Unexpected end of gzip data\n" );
+            return false;
+        }
+        state.stream.next_in = const_cast<Bytef *>( input );
+        state.stream.avail_in = inputSize;
+        state.stream.next_out = buffer;
+        state.stream.avail_out = chunk;
+        int result = inflate( &state.stream, Z_NO_FLUSH );
+        uint32_t consumed = state.stream.next_in - input;
+        uint32_t produced = chunk - state.stream.avail_out;
+        state.inOffset += consumed;
+        state.outOffset += produced;
+        buffer += produced;
+        size -= produced;
+        if ( result == Z_STREAM_END )
+        {
+            if ( size )
+            {
+                LOGE( "Unexpected end of gzip stream\n" );
+                return false;
+            }
+            break;
+        }
+        if ( (result != Z_OK && result != Z_BUF_ERROR) || (!consumed && !produced) )
+        {
+            LOGE( "Failed to inflate gzip data (%d)\n", result );
+            return false;
+        }
+    }
+    return true;
+}
+
+bool GzipDataSource::rewind(uint32_t offset)
+{
+    GzipDataSourceState &state = *m_state;
+    m_windowOffset = 0;
+    m_windowLength = 0;
+    inflateEnd( &state.stream );
+    if ( state.checkpointValid && state.checkpointOffset <= offset )
+    {
+        if ( inflateCopy( &state.stream, &state.checkpoint ) != Z_OK )
+        {
+            return false;
+        }
+        state.inOffset = state.checkpointInOffset;
+        state.outOffset = state.checkpointOffset;
+    }
+    else
+    {
+        memset( &state.stream, 0, sizeof(state.stream) );
+        if ( inflateInit2( &state.stream, 16 + MAX_WBITS ) != Z_OK )
+        {
+            return false;
+        }
+        state.inOffset = 0;
+        state.outOffset = 0;
+    }
+    m_windowOffset = state.outOffset;
+    return true;
+}
+
+const uint8_t *GzipDataSource::fetch(uint32_t offset, uint32_t size)
+{
+    if ( !m_state || offset >= m_size || size > m_windowSize )
+    {
+        return nullptr;
+    }
+    if ( size > m_size - offset )
+    {
+        size = m_size - offset;
+    }
+    if ( offset >= m_windowOffset && offset + size <= m_windowOffset + m_windowLength )
+    {
+        return m_window + (offset - m_windowOffset);
+    }
+    if ( offset < m_windowOffset && !rewind( offset ) )
+    {
+        return nullptr;
+    }
+    uint32_t keep = 0;
+    if ( offset < m_windowOffset + m_windowLength )
+    {
+        // Keep already inflated part of requested data
+        keep = m_windowOffset + m_windowLength - offset;
+        memmove( m_window, m_window + (offset - m_windowOffset), keep );
+    }
+    else
+    {
+        // Skip inflated data up to requested offset
+        m_windowLength = 0;
+        while ( m_state->outOffset < offset )
+        {
+            uint32_t skip = offset - m_state->outOffset;
+            if ( !inflateTo( m_window, skip < m_windowSize ? skip : m_windowSize ) )
+            {
+                m_windowLength = 0;
+                return nullptr;
+            }
+        }
+    }
+    m_windowOffset = offset;
+    m_windowLength = keep;
+    uint32_t fill = m_windowSize - keep;
+    if ( fill > m_size - m_state->outOffset )
+    {
+        fill = m_size - m_state->outOffset;
+    }
+    bool result = inflateTo( m_window + keep, fill );
+    m_windowLength = m_state->outOffset - m_windowOffset;
+    if ( !result && m_windowLength < size )
+    {
+        return nullptr;
+    }
+    return m_window;
+}
+
+uint32_t GzipDataSource::read(uint32_t offset, void *buffer, uint32_t size)
+{
+    uint8_t *out = static_cast<uint8_t *>( buffer );
+    uint32_t total = 0;
+    while ( size )
+    {
+        uint32_t chunk = size < m_windowSize ? size : m_windowSize;
+        const uint8_t *data = fetch( offset, chunk );
+        if ( !data )
+        {
+            break;
+        }
+        if ( chunk > m_size - offset )
+        {
+            chunk = m_size - offset;
+        }
+        memcpy( out, data, chunk );
+        out += chunk;
+        offset += chunk;
+        size -= chunk;
+        total += chunk;
+    }
+    return total;
+}
+
+#endif
@@ -23,8 +23,11 @@ SOFTWARE.
 */
 
 #include "vgm_file.h"
+#include "vgm_pcm_sink.h"
 #include "formats/vgm_decoder.h"
 #include "formats/nsf_decoder.h"
+#include "data_source.h"
+#include "gzip_data_source.h"
 
 #define VGM_FILE_DEBUG 1
 
@@ -33,9 +36,38 @@ SOFTWARE.
 #endif
 #include "vgm_logger.h"
 
+#include <string.h>
+#include <new>
+#include <chrono>
+
 /** Vgm file are always based on 44.1kHz rate */
 #define VGM_SAMPLE_RATE 44100
 
+/** Analysis duration limit in milliseconds, if max duration is not set */
+#define VGM_ANALYSIS_MAX_DURATION 600000
+
+/** Number of cpu instructions or commands, decoded at once, when decoding time is limited */
+#define VGM_DEADLINE_BLOCK_BUDGET 1000
+
+/** Number of samples, rendered at once when resampling is required */
+#define VGM_RENDER_BLOCK_SIZE 256
+
+/** Number of fade volume steps per second */
+#define VGM_FADE_STEP_RATE 60
+
+/** Player part of the state, decoder state follows it */
+typedef struct
+{
+    uint32_t samplesPlayed;
+    uint32_t waitSamples;
+    uint32_t position;
+    uint32_t writeCounter;
+    uint32_t sampleSum;
+    uint32_t loopEnd;
+    bool sampleSumValid;
+    uint16_t shifter;
+} VgmFileSnapshot;
+
 VgmFile::VgmFile()
     : m_readScaler( VGM_SAMPLE_RATE )
     , m_writeScaler( VGM_SAMPLE_RATE )
@@ -52,24 +84,122 @@ void VgmFile::deleteDecoder()
 {
     if ( m_decoder )
     {
+#if VGM_DECODER_SINGLE_CHIP
+        m_decoder->~BaseMusicDecoder();
+#else
         delete m_decoder;
+#endif
         m_decoder = nullptr;
     }
+    // Sources must be deleted after the decoder, which uses them
+    if ( m_gzipSource )
+    {
+        delete m_gzipSource;
+        m_gzipSource = nullptr;
+    }
+    if ( m_memorySource )
+    {
+        delete m_memorySource;
+        m_memorySource = nullptr;
+    }
+}
+
+void *VgmFile::getDecoderStorage()
+{
+#if VGM_DECODER_SINGLE_CHIP
+    return m_decoderStorage;
+#else
+    return nullptr;
+#endif
+}
+
+static bool isGzipData(const uint8_t *data, int size)
+{
+    return size >= 2 && data[0] == 0x1F && data[1] == 0x8B;
 }
 
 bool VgmFile::open(const uint8_t * data, int size)
 {
     close();
-    m_samplesPlayed = 0;
-    m_waitSamples = 0;
-    m_decoder = VgmMusicDecoder::tryOpen( data, size );
+    if ( isGzipData( data, size ) )
+    {
+        m_memorySource = new MemoryDataSource( data, size );
+        return openSource( m_memorySource );
+    }
+    m_decoder = VgmMusicDecoder::tryOpen( data, size, m_precompile, getDecoderStorage() );
+#if VGM_DECODER_NES
     if ( !m_decoder )
     {
-        m_decoder = NsfMusicDecoder::tryOpen( data, size );
+        m_decoder = NsfMusicDecoder::tryOpen( data, size, getDecoderStorage() );
     }
+#endif
+    return initDecoder();
+}
+
+bool VgmFile::open(DataSource *source)
+{
+    close();
+    return openSource( source );
+}
+
+bool VgmFile::openSource(DataSource *source)
+{
+    const uint8_t *signature = source->fetch( 0, 2 );
+    if ( signature && isGzipData( signature, source->getSize() ) )
+    {
+#if VGM_DECODER_ZLIB
+        GzipDataSource *gzipSource = new GzipDataSource();
+        m_gzipSource = gzipSource;
+        if ( !gzipSource->open( source ) )
+        {
+            LOGE( "Failed to open gzip data\n" );
+            return false;
+        }
+        source = gzipSource;
+#else
+        LOGE( "Gzip data is not supported, build with VGM_DECODER_ZLIB=1\n" );
+        return false;
+#endif
+    }
+    m_decoder = VgmMusicDecoder::tryOpen( source, m_precompile, getDecoderStorage() );
+#if VGM_DECODER_NES
+    if ( !m_decoder )
+    {
+        m_decoder = NsfMusicDecoder::tryOpen( source, getDecoderStorage() );
+    }
+#endif
+    return initDecoder();
+}
+
+bool VgmFile::open(const VgmCommandStream *stream)
+{
+    close();
+#if VGM_DECODER_SINGLE_CHIP
+    VgmMusicDecoder *decoder = new( m_decoderStorage ) VgmMusicDecoder();
+#else
+    VgmMusicDecoder *decoder = new VgmMusicDecoder();
+#endif
+    m_decoder = decoder;
+    if ( !decoder->open( stream ) )
+    {
+        deleteDecoder();
+    }
+    return initDecoder();
+}
+
+bool VgmFile::initDecoder()
+{
+    m_samplesPlayed = 0;
+    m_waitSamples = 0;
+    m_writeCounter = 0;
+    m_sampleSumValid = false;
+    resetPosition();
     if ( m_decoder )
     {
         if ( m_volume != 100 ) m_decoder->setVolume( m_volume );
+        if ( m_loopDetection ) m_decoder->setLoopDetection( true );
+        if ( m_trackPrefetch ) m_decoder->setTrackPrefetch( true );
+        setSampleFrequency( m_writeScaler );
         return true;
     }
     return false;
@@ -78,6 +208,16 @@ bool VgmFile::open(const uint8_t * data, int size)
 void VgmFile::close()
 {
     deleteDecoder();
+    resetPosition();
+    resetStats();
+}
+
+void VgmFile::resetPosition()
+{
+    m_position = 0;
+    m_clippedSamples = 0;
+    m_loopEnd = 0;
+    m_checkpoints.clear();
 }
 
 void VgmFile::setVolume( uint16_t volume )
@@ -94,13 +234,52 @@ int VgmFile::getTrackCount()
 
 bool VgmFile::setTrack(int track)
 {
+    VgmTraceScope trace( m_trace );
+    STATS_SCOPE( &m_stats );
+    // The new track is played from the start, the same way as after initDecoder()
+    m_samplesPlayed = 0;
+    m_waitSamples = 0;
+    m_writeCounter = 0;
+    m_sampleSumValid = false;
+    resetPosition();
+    m_resampler.reset();
     if ( m_decoder ) return m_decoder->setTrack( track );
     return false;
 }
 
+bool VgmFile::analyze(int track, VgmTrackInfo &info)
+{
+    if ( !m_decoder )
+    {
+        info = VgmTrackInfo{};
+        return false;
+    }
+    uint32_t duration = m_maxDuration ? m_maxDuration : VGM_ANALYSIS_MAX_DURATION;
+    bool result = m_decoder->analyze( track, static_cast<uint64_t>( duration ) * VGM_SAMPLE_RATE / 1000, info );
+    // Decoder may change chip state and sample frequency while analyzing the track
+    setSampleFrequency( m_writeScaler );
+    setTrack( track );
+    return result;
+}
+
+void VgmFile::setTrackPrefetch(bool enable)
+{
+    m_trackPrefetch = enable;
+    if ( m_decoder ) m_decoder->setTrackPrefetch( enable );
+}
+
 void VgmFile::setMaxDuration( uint32_t milliseconds )
 {
-    m_duration = static_cast<uint64_t>(milliseconds) * VGM_SAMPLE_RATE / 1000;
+    m_maxDuration = milliseconds;
+    m_duration = static_cast<uint64_t>(milliseconds) * m_readScaler / 1000;
+}
+
+void VgmFile::setLoopDetection(bool enable, uint8_t loops)
+{
+    m_loopDetection = enable;
+    m_loopCount = loops ? loops : 1;
+    m_loopEnd = 0;
+    if ( m_decoder ) m_decoder->setLoopDetection( enable );
 }
 
 typedef struct
@@ -108,99 +287,613 @@ typedef struct
     uint16_t left, right;
 } StereoChannels;
 
-void VgmFile::interpolateSample()
+void VgmFile::applyFading(uint32_t *samples, int count)
 {
-    uint32_t nextSample = m_decoder->getSample();
-    StereoChannels &source = reinterpret_cast<StereoChannels&>(nextSample);
-//    StereoChannels &dest = reinterpret_cast<StereoChannels&>(m_sampleSum);
-    if ( m_shifter )
+    for (int i = 0; i < count; i++)
     {
+        StereoChannels &source = reinterpret_cast<StereoChannels&>(samples[i]);
         source.left = static_cast<uint32_t>(source.left) * m_shifter / 1024;
         source.right = static_cast<uint32_t>(source.right) * m_shifter / 1024;
     }
+}
 
-    if ( !m_sampleSumValid ) // If no sample previously reached the mixer assign new sample
+int VgmFile::resampleBlock(const uint32_t *samples, int count, uint8_t *outBuffer)
+{
+    int decoded = 0;
+    for (int i = 0; i < count; i++)
     {
-        m_sampleSum = nextSample;
-        m_sampleSumValid = true;
+        if ( !m_sampleSumValid ) // If no sample previously reached the mixer assign new sample
+        {
+            m_sampleSum = samples[i];
+            m_sampleSumValid = true;
+        }
+        m_writeCounter += m_writeScaler;
+        if ( m_writeCounter >= m_readScaler )
+        {
+            if ( outBuffer )
+            {
+                *(reinterpret_cast<uint32_t *>(outBuffer)) = m_sampleSum;
+                outBuffer += 4;
+            }
+            decoded += 4;
+            m_writeCounter -= m_readScaler;
+            m_sampleSumValid = false;
+        }
     }
-/*    if ( (source.left >= 8192 && source.left > dest.left) ||
-         (source.left < 8192 && source.left < dest.left) )
+    return decoded;
+}
+
+int VgmFile::decodePcm(uint8_t *outBuffer, int maxSize)
+{
+    STATS_SCOPE( &m_stats );
+    if ( m_format.sampleFormat == VGM_SAMPLE_U16 && m_format.channels == 2 )
     {
-        dest.left = source.left;
+        int decoded = decode( outBuffer, maxSize );
+        if ( outBuffer && m_clipDetection )
+        {
+            STATS_TIME_BEGIN( start );
+            // Decoded samples are not changed, only full scale ones are counted
+            m_clippedSamples += vgmConvertSamples( reinterpret_cast<const uint32_t *>( outBuffer ), decoded / 4,
+                                                   outBuffer, m_format );
+            STATS_TIME_END( start, outputTime );
+        }
+        STATS_ADD( samplesEmitted, decoded / 4 );
+        return decoded;
     }
-    if ( (source.right >= 8192 && source.right > dest.right) ||
-         (source.right < 8192 && source.right < dest.right) )
+    // Decode by blocks in native format and convert them to output buffer
+    uint32_t frameSize = getFrameSize();
+    int decoded = 0;
+    while ( decoded + static_cast<int>( frameSize ) <= maxSize )
     {
-        dest.right = source.right;
-    } */
+        uint32_t block[VGM_RENDER_BLOCK_SIZE];
+        int samples = ( maxSize - decoded ) / frameSize;
+        if ( samples > VGM_RENDER_BLOCK_SIZE ) samples = VGM_RENDER_BLOCK_SIZE;
+        int size = decode( reinterpret_cast<uint8_t *>( block ), samples * 4 );
+        STATS_TIME_BEGIN( start );
+        m_clippedSamples += vgmConvertSamples( block, size / 4, outBuffer + decoded, m_format );
+        STATS_TIME_END( start, outputTime );
+        STATS_ADD( samplesEmitted, size / 4 );
+        decoded += size / 4 * frameSize;
+        if ( size < samples * 4 )
+        {
+            break;
+        }
+    }
+    return decoded;
 }
 
-int VgmFile::decodePcm(uint8_t *outBuffer, int maxSize)
+int VgmFile::decodePcm(VgmPcmSink &sink, int maxSize)
 {
+    uint32_t frameSize = getFrameSize();
     int decoded = 0;
+    while ( decoded + static_cast<int>( frameSize ) <= maxSize )
+    {
+        uint32_t size = maxSize - decoded;
+        uint8_t *data = sink.acquire( size );
+        if ( size > static_cast<uint32_t>( maxSize - decoded ) ) size = maxSize - decoded;
+        int requested = size / frameSize * frameSize;
+        if ( !data || !requested )
+        {
+            break;
+        }
+        // Decoder keeps position inside the block, so next span continues from the same sample
+        int written = decodePcm( data, requested );
+        if ( written > 0 ) sink.commit( written );
+        decoded += written;
+        if ( written < requested )
+        {
+            break;
+        }
+    }
+    return decoded;
+}
+
+static uint64_t vgmFileTime()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+void VgmFile::setDeadline(uint32_t microseconds)
+{
+    m_deadline = microseconds ? vgmFileTime() + microseconds : 0;
+    if ( m_decoder ) m_decoder->setBlockBudget( microseconds ? VGM_DEADLINE_BLOCK_BUDGET : 0 );
+}
+
+int VgmFile::decodePcm(uint8_t *outBuffer, int maxSize, uint32_t microseconds)
+{
+    // Zero time is the same as very short one, not unlimited
+    setDeadline( microseconds ? microseconds : 1 );
+    int decoded = decodePcm( outBuffer, maxSize );
+    setDeadline( 0 );
+    return decoded;
+}
+
+int VgmFile::decodePcm(VgmPcmSink &sink, int maxSize, uint32_t microseconds)
+{
+    setDeadline( microseconds ? microseconds : 1 );
+    int decoded = decodePcm( sink, maxSize );
+    setDeadline( 0 );
+    return decoded;
+}
+
+AY38910 *VgmFile::beginLaneBlock(uint32_t &samples, uint32_t minSamples)
+{
+    m_ended = false;
+    if ( !m_decoder || m_writeScaler != m_readScaler || m_sampleSumValid || m_deadline )
+    {
+        return nullptr;
+    }
+    updateCheckpoints();
+    VgmTraceScope trace( m_trace );
+    STATS_SCOPE( &m_stats );
+    bool decodeStarted = false;
+    while ( !m_waitSamples )
+    {
+        if ( !nextBlock( decodeStarted ) )
+        {
+            return nullptr;
+        }
+    }
+    if ( m_waitSamples < minSamples && m_waitSamples < samples )
+    {
+        // Commands are too frequent, decode() renders short waits faster than lane blocks
+        return nullptr;
+    }
+    if ( samples > m_waitSamples ) samples = m_waitSamples;
+    samples = limitSamples( samples );
+    if ( !samples )
+    {
+        // The track ends inside the block
+        m_waitSamples = 0;
+        nextBlock( decodeStarted );
+        return nullptr;
+    }
+    AY38910 *chip = m_decoder->renderLaneBlock( samples );
+    if ( chip )
+    {
+        STATS_ADD( samplesRendered, samples );
+        m_samplesPlayed += samples;
+        m_waitSamples -= samples;
+    }
+    return chip;
+}
+
+int VgmFile::commitLaneBlock(uint32_t *block, uint32_t samples, VgmPcmSink &sink)
+{
+    STATS_SCOPE( &m_stats );
+    STATS_TIME_BEGIN( start );
+    if ( m_shifter ) applyFading( block, samples );
+    m_position += samples;
+    uint32_t frameSize = getFrameSize();
+    int written = 0;
+    while ( samples )
+    {
+        uint32_t size = samples * frameSize;
+        uint8_t *data = sink.acquire( size );
+        uint32_t frames = size / frameSize < samples ? size / frameSize : samples;
+        if ( !data || !frames )
+        {
+            LOGE( "No space for lane block\n" );
+            break;
+        }
+        m_clippedSamples += vgmConvertSamples( block, frames, data, m_format );
+        sink.commit( frames * frameSize );
+        STATS_ADD( samplesEmitted, frames );
+        written += frames * frameSize;
+        block += frames;
+        samples -= frames;
+    }
+    STATS_TIME_END( start, outputTime );
+    return written;
+}
+
+int VgmFile::skipPcm(int maxSize)
+{
+    uint32_t frameSize = getFrameSize();
+    return decode( nullptr, maxSize / frameSize * 4 ) / 4 * frameSize;
+}
+
+bool VgmFile::getStats(VgmStats &stats) const
+{
+#if VGM_DECODER_STATS
+    stats = m_stats;
+    return true;
+#else
+    stats = VgmStats{};
+    return false;
+#endif
+}
+
+void VgmFile::resetStats()
+{
+#if VGM_DECODER_STATS
+    m_stats = VgmStats{};
+#endif
+}
+
+void VgmFile::setResampler(uint8_t quality, uint32_t chipFrequency)
+{
+    m_resamplerQuality = quality <= VGM_RESAMPLER_BEST ? quality : static_cast<uint8_t>( VGM_RESAMPLER_BEST );
+    m_chipFrequency = chipFrequency;
+    setSampleFrequency( m_writeScaler );
+}
+
+bool VgmFile::setOutputFormat(const VgmOutputFormat &format)
+{
+    if ( !vgmIsValidFormat( format ) )
+    {
+        LOGE( "Unsupported output format %d, channels %d\n", format.sampleFormat, format.channels );
+        return false;
+    }
+    m_format = format;
+    return true;
+}
+
+uint32_t VgmFile::getStateSize()
+{
+    uint32_t size = m_decoder ? m_decoder->getStateSize() : 0;
+    return size ? sizeof(VgmFileSnapshot) + m_resampler.getStateSize() + size : 0;
+}
+
+bool VgmFile::saveState(uint8_t *state)
+{
+    // Resampler state follows player state, if resampler is used
+    if ( !getStateSize() || !m_decoder->saveState( state + sizeof(VgmFileSnapshot) + m_resampler.getStateSize() ) )
+    {
+        return false;
+    }
+    if ( m_resampler.isEnabled() ) m_resampler.saveState( state + sizeof(VgmFileSnapshot) );
+    VgmFileSnapshot snapshot{};
+    snapshot.samplesPlayed = m_samplesPlayed;
+    snapshot.waitSamples = m_waitSamples;
+    snapshot.position = m_position;
+    snapshot.writeCounter = m_writeCounter;
+    snapshot.sampleSum = m_sampleSum;
+    snapshot.loopEnd = m_loopEnd;
+    snapshot.sampleSumValid = m_sampleSumValid;
+    snapshot.shifter = m_shifter;
+    memcpy( state, &snapshot, sizeof(snapshot) );
+    return true;
+}
+
+bool VgmFile::loadState(const uint8_t *state)
+{
+    if ( !getStateSize() || !m_decoder->loadState( state + sizeof(VgmFileSnapshot) + m_resampler.getStateSize() ) )
+    {
+        return false;
+    }
+    if ( m_resampler.isEnabled() ) m_resampler.loadState( state + sizeof(VgmFileSnapshot) );
+    VgmFileSnapshot snapshot;
+    memcpy( &snapshot, state, sizeof(snapshot) );
+    m_samplesPlayed = snapshot.samplesPlayed;
+    m_waitSamples = snapshot.waitSamples;
+    m_position = snapshot.position;
+    m_writeCounter = snapshot.writeCounter;
+    m_sampleSum = snapshot.sampleSum;
+    m_loopEnd = snapshot.loopEnd;
+    m_sampleSumValid = snapshot.sampleSumValid;
+    m_shifter = snapshot.shifter;
+    return true;
+}
+
+bool VgmFile::seek(uint32_t milliseconds)
+{
+    if ( !m_decoder )
+    {
+        return false;
+    }
+    uint32_t target = static_cast<uint64_t>( milliseconds ) * m_writeScaler / 1000;
+    const Checkpoint *checkpoint = nullptr;
+    for ( const Checkpoint &entry: m_checkpoints )
+    {
+        if ( entry.position > target ) break;
+        checkpoint = &entry;
+    }
+    // Restore checkpoint, if it is closer to the target than current position
+    if ( checkpoint && ( target < m_position || checkpoint->position > m_position ) )
+    {
+        if ( !loadState( checkpoint->state.data() ) )
+        {
+            return false;
+        }
+    }
+    if ( target < m_position )
+    {
+        LOGE( "Cannot seek back, no checkpoint before %u ms\n", milliseconds );
+        return false;
+    }
+    // Pass the rest by intervals, so checkpoints are added on the way
+    uint32_t interval = static_cast<uint64_t>( m_seekInterval ) * m_writeScaler / 1000;
+    if ( !interval || interval > VGM_SAMPLE_RATE * 60 ) interval = VGM_SAMPLE_RATE * 60;
+    while ( m_position < target )
+    {
+        uint32_t samples = target - m_position < interval ? target - m_position : interval;
+        if ( decode( nullptr, samples * 4 ) < static_cast<int>( samples * 4 ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void VgmFile::addCheckpoint()
+{
+    uint32_t size = getStateSize();
+    if ( !size )
+    {
+        return;
+    }
+    Checkpoint checkpoint;
+    checkpoint.position = m_position;
+    checkpoint.state.resize( size );
+    if ( saveState( checkpoint.state.data() ) )
+    {
+        m_checkpoints.push_back( std::move( checkpoint ) );
+    }
+}
+
+void VgmFile::updateCheckpoints()
+{
+    if ( m_seekInterval && ( m_checkpoints.empty() || m_position >=
+         m_checkpoints.back().position + static_cast<uint64_t>( m_seekInterval ) * m_writeScaler / 1000 ) )
+    {
+        addCheckpoint();
+    }
+}
+
+uint32_t VgmFile::getEndSample() const
+{
+    uint32_t duration = m_duration;
+    if ( m_loopEnd && ( !duration || m_loopEnd < duration ) ) duration = m_loopEnd;
+    return duration;
+}
+
+uint32_t VgmFile::limitSamples(uint32_t samples)
+{
+    m_shifter = 0;
+    uint32_t duration = getEndSample();
+    if ( !duration )
+    {
+        return samples;
+    }
+    // Blocks are cut at the end of the track, so it doesn't depend on lengths of blocks too
+    uint32_t left = m_samplesPlayed < duration ? duration - m_samplesPlayed : 0;
+    if ( samples > left ) samples = left;
+    uint32_t window = m_readScaler * 2;
+    if ( !m_fadeEffect || !samples )
+    {
+        return samples;
+    }
+    if ( left >= window )
+    {
+        // Samples before the fade are rendered at full volume
+        return left - window + 1 < samples ? left - window + 1 : samples;
+    }
+    // Steps are counted from the end of the track, so they don't depend on lengths of blocks
+    uint32_t step = m_readScaler / VGM_FADE_STEP_RATE;
+    uint32_t stepLeft = ( left - 1 ) % step + 1;
+    uint32_t stepStart = left - stepLeft + step;
+    if ( stepStart >= window ) stepStart = window - 1;
+    m_shifter = (static_cast<uint64_t>(stepStart) * VGM_SAMPLE_RATE / m_readScaler) >> 7;
+    return stepLeft < samples ? stepLeft : samples;
+}
+
+/** Decodes commands of the next block, returns false if decoding must stop */
+bool VgmFile::nextBlock(bool &decodeStarted)
+{
+    uint32_t duration = getEndSample();
+    if ( duration && m_samplesPlayed >= duration )
+    {
+        TRACE( VGM_TRACE_STOP, 0, m_samplesPlayed );
+        m_ended = true;
+        return false;
+    }
+    if ( m_deadline && decodeStarted && vgmFileTime() >= m_deadline )
+    {
+        return false;
+    }
+    decodeStarted = true;
+    STATS_TIME_BEGIN( start );
+    int result = m_decoder->decodeBlock();
+#if VGM_DECODER_STATS
+    uint64_t elapsed = vgmStatsTime() - start;
+    m_stats.decodeBlockCalls++;
+    m_stats.decodeTime += elapsed;
+    if ( elapsed > m_stats.maxDecodeTime ) m_stats.maxDecodeTime = elapsed;
+#endif
+    if ( result == VGM_BLOCK_PENDING )
+    {
+        // Budget is spent, the block is continued after deadline check
+        return true;
+    }
+    if ( result < 0 )
+    {
+        LOGE( "Failed to play melody, stopping\n" );
+        m_ended = true;
+        return false;
+    }
+    if ( result == 0 )
+    {
+        LOGI( "No more samples to play, stopping\n" );
+        m_ended = true;
+        return false;
+    }
+    m_waitSamples = result;
+    TRACE( VGM_TRACE_PCM_BLOCK, 0, m_waitSamples, m_samplesPlayed );
+    if ( m_loopDetection && !m_loopEnd && m_decoder->getLoopLength() )
+    {
+        // The rest of the first pass is already played
+        uint64_t end = m_samplesPlayed + static_cast<uint64_t>( m_decoder->getLoopLength() ) * ( m_loopCount - 1 );
+        if ( m_fadeEffect && end < m_samplesPlayed + static_cast<uint64_t>( m_readScaler ) * 2 )
+        {
+            end = m_samplesPlayed + static_cast<uint64_t>( m_readScaler ) * 2;
+        }
+        m_loopEnd = end < UINT32_MAX ? end : UINT32_MAX;
+    }
+    return true;
+}
+
+int VgmFile::decode(uint8_t *outBuffer, int maxSize)
+{
+    int decoded = 0;
+    // At least one block slice is decoded before deadline check, so each call makes progress
+    bool decodeStarted = false;
+    m_ended = true;
     if ( !m_decoder )
     {
         return 0;
     }
+    m_ended = false;
+    updateCheckpoints();
+    VgmTraceScope trace( m_trace );
+    STATS_SCOPE( &m_stats );
     while ( decoded + 4 <= maxSize )
     {
-        if ( !m_waitSamples )
+        if ( !m_waitSamples && !nextBlock( decodeStarted ) )
         {
-            m_shifter = 0;
-            if ( m_duration )
+            break;
+        }
+        while ( m_waitSamples && (decoded + 4 <= maxSize) )
+        {
+            // Each source sample produces one output sample at most, so rendering
+            // no more samples than free space in output buffer is always safe
+            uint32_t waitSamples = limitSamples( m_waitSamples );
+            if ( !waitSamples )
             {
-                if ( m_samplesPlayed >= m_duration )
+                // The track ends inside the block, nextBlock() stops decoding
+                m_waitSamples = 0;
+                break;
+            }
+            int samples = (maxSize - decoded) / 4;
+            if ( static_cast<uint32_t>(samples) > waitSamples ) samples = waitSamples;
+            if ( m_writeScaler == m_readScaler && !m_sampleSumValid )
+            {
+                STATS_TIME_BEGIN( start );
+                if ( outBuffer )
                 {
-                    LOGI("m_samplesPlayed: %d\n", m_samplesPlayed);
-                    break;
+                    // Render directly to output buffer, since no resampling is required
+                    uint32_t *block = reinterpret_cast<uint32_t *>(outBuffer);
+                    m_decoder->renderBlock( block, samples );
+                    STATS_ADD( samplesRendered, samples );
+                    if ( m_shifter ) applyFading( block, samples );
+                    outBuffer += samples * 4;
                 }
-                if ( m_fadeEffect && (m_duration - m_samplesPlayed < VGM_SAMPLE_RATE * 2) )
+                else
                 {
-                    m_shifter = (m_duration - m_samplesPlayed) >> 7;
+                    m_decoder->skipBlock( samples );
+                    STATS_ADD( samplesSkipped, samples );
                 }
+                STATS_TIME_END( start, renderTime );
+                decoded += samples * 4;
             }
-            int result = m_decoder->decodeBlock();
-            if ( result < 0 )
+            else if ( m_resampler.isEnabled() )
             {
-                LOGE( "Failed to play melody, stopping\n" );
-                break;
+                // Resampler may produce several output samples for single input one, so
+                // only input samples, required to fill output buffer, are rendered
+                uint32_t block[VGM_RENDER_BLOCK_SIZE];
+                uint32_t required = m_resampler.getInputSamples( (maxSize - decoded) / 4 );
+                samples = required < waitSamples ? required : waitSamples;
+                if ( samples > VGM_RENDER_BLOCK_SIZE ) samples = VGM_RENDER_BLOCK_SIZE;
+                STATS_TIME_BEGIN( start );
+                m_decoder->renderBlock( block, samples );
+                STATS_TIME_END( start, renderTime );
+                STATS_ADD( samplesRendered, samples );
+                STATS_TIME_BEGIN( output );
+                if ( m_shifter ) applyFading( block, samples );
+                int size = m_resampler.process( block, samples, reinterpret_cast<uint32_t *>( outBuffer ),
+                                                (maxSize - decoded) / 4 ) * 4;
+                STATS_TIME_END( output, outputTime );
+                if ( outBuffer ) outBuffer += size;
+                decoded += size;
             }
-            if ( result == 0 )
+            else
             {
-                LOGI( "No more samples to play, stopping\n" );
-                break;
-            }
-            m_waitSamples = result;
-            LOGI( "Next block %d samples [%d.%03d - %d.%03d]\n", m_waitSamples,
-                   m_samplesPlayed / VGM_SAMPLE_RATE, 1000 * (m_samplesPlayed % VGM_SAMPLE_RATE) / VGM_SAMPLE_RATE,
-                   (m_samplesPlayed + m_waitSamples) / VGM_SAMPLE_RATE,
-                   1000 * ((m_samplesPlayed + m_waitSamples) % VGM_SAMPLE_RATE) / VGM_SAMPLE_RATE );
-        }
-        while ( m_waitSamples && (decoded + 4 <= maxSize) )
-        {
-            interpolateSample();
-
-            m_writeCounter += m_writeScaler;
-            m_samplesPlayed++;
-            m_waitSamples--;
-
-            if ( m_writeCounter >= VGM_SAMPLE_RATE )
-            {
-                *(reinterpret_cast<uint32_t *>(outBuffer)) = m_sampleSum;
-                outBuffer += 4;
-                decoded += 4;
-                m_writeCounter -= VGM_SAMPLE_RATE;
-                m_sampleSumValid = false;
+                uint32_t block[VGM_RENDER_BLOCK_SIZE];
+                if ( samples > VGM_RENDER_BLOCK_SIZE ) samples = VGM_RENDER_BLOCK_SIZE;
+                STATS_TIME_BEGIN( start );
+                m_decoder->renderBlock( block, samples );
+                STATS_TIME_END( start, renderTime );
+                STATS_ADD( samplesRendered, samples );
+                STATS_TIME_BEGIN( output );
+                if ( m_shifter ) applyFading( block, samples );
+                int size = resampleBlock( block, samples, outBuffer );
+                STATS_TIME_END( output, outputTime );
+                if ( outBuffer ) outBuffer += size;
+                decoded += size;
             }
+            m_samplesPlayed += samples;
+            m_waitSamples -= samples;
         }
     }
+    m_position += decoded / 4;
     return decoded;
 }
 
 void VgmFile::setSampleFrequency( uint32_t frequency )
 {
     m_writeScaler = frequency;
+    // If decoder supports requested frequency, chips produce samples at that rate,
+    // otherwise 44100 Hz samples are decimated or filtered by resampler to requested frequency
+    uint32_t chipFrequency = frequency;
+    if ( m_resamplerQuality != VGM_RESAMPLER_OFF )
+    {
+        chipFrequency = m_chipFrequency ? m_chipFrequency : VGM_SAMPLE_RATE;
+    }
+    m_readScaler = VGM_SAMPLE_RATE;
+    if ( m_decoder && m_decoder->setSampleFrequency( chipFrequency ) )
+    {
+        m_readScaler = chipFrequency;
+    }
+    m_resampler.close();
+    if ( m_resamplerQuality != VGM_RESAMPLER_OFF && m_readScaler != m_writeScaler )
+    {
+        m_resampler.init( m_readScaler, m_writeScaler, m_resamplerQuality );
+    }
+    m_writeCounter = 0;
+    m_sampleSumValid = false;
+    resetPosition();
+    setMaxDuration( m_maxDuration );
+}
+
+int VgmFile::getMemoryUsage(VgmMemoryUsage *table, int maxEntries)
+{
+#if VGM_DECODER_NES
+    // See NsfMusicDecoder::saveState()
+    const uint32_t nsfState = sizeof(VgmFileSnapshot) + 2 * sizeof(uint32_t) + sizeof(NesCpuSnapshot) +
+                              sizeof(NsfCartridgeSnapshot);
+    // See NsfMusicDecoder::open(), the machine image doesn't include decoder part of the state
+    const uint32_t nsfImage = VGM_DECODER_COMPACT ? 0 : sizeof(NesCpuSnapshot) + sizeof(NsfCartridgeSnapshot);
+#endif
+    const VgmMemoryUsage usage[] =
+    {
+        { "VgmFile", sizeof(VgmFile), 0 },
+        { "VgmResampler (if enabled)", 0, VgmResampler::getMaxHeapSize() },
+#if VGM_DECODER_AY38910
+        { "VgmMusicDecoder (AY-3-8910)", sizeof(VgmMusicDecoder),
+          VGM_DECODER_EMBEDDED_AY38910 ? 0 : sizeof(AY38910) },
+        { "AY38910", sizeof(AY38910), 0 },
+#endif
+        { "VgmDataBanks, per vgm data block", 0, sizeof(VgmDataBlock) },
+#if VGM_DECODER_NES
+        { "VgmFile NSF checkpoint", 0, nsfState },
+        { "VgmMusicDecoder (NES APU)", sizeof(VgmMusicDecoder),
+          VGM_DECODER_EMBEDDED_NES ? 0 : sizeof(NesCpu) + NES_CPU_RAM_SIZE + sizeof(NsfCartridge) },
+        { "NsfMusicDecoder", sizeof(NsfMusicDecoder),
+          ( VGM_DECODER_SINGLE_CHIP ? 0 : NES_CPU_RAM_SIZE + sizeof(NsfCartridge) ) + BBRAM_SIZE + nsfImage },
+        { "NsfMusicDecoder track prefetch", 0, 3 * ( sizeof(NesCpuSnapshot) + sizeof(NsfCartridgeSnapshot) ) },
+        { "NesApu", sizeof(NesApu), 0 },
+        { "NesCpu", sizeof(NesCpu), VGM_DECODER_SINGLE_CHIP ? 0 : NES_CPU_RAM_SIZE },
+        { "NsfCartridge", sizeof(NsfCartridge), BBRAM_SIZE },
+#endif
+    };
+    int count = 0;
+    for ( const VgmMemoryUsage &entry: usage )
+    {
+        if ( count >= maxEntries ) break;
+        table[count++] = entry;
+    }
+    return count;
 }
 
 void VgmFile::setFading(bool enable)
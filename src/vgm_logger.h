@@ -30,8 +30,19 @@ SOFTWARE.
     1 - enable only error logging
     2 - enable error and info logging
     3 - enable error, info and memory logging
+
+    TRACE() and TRACEM() record hot path events to binary trace buffer if
+    VGM_DECODER_TRACE is 1 (see vgm_trace.h). Otherwise they are printed as
+    info and memory logs.
+
+    STATS_ADD() updates runtime statistics, attached to current thread by STATS_SCOPE(),
+    and STATS_TIME_BEGIN() / STATS_TIME_END() measure time of code block, if
+    VGM_DECODER_STATS is 1 (see vgm_stats.h). Otherwise they are compiled out.
 */
 
+#include "vgm_trace.h"
+#include "vgm_stats.h"
+
 #ifndef VGM_DECODER_LOGGER
 #define VGM_DECODER_LOGGER 0
 #endif
@@ -59,3 +70,42 @@ SOFTWARE.
 #define LOGI(...)
 #define LOGM(...)
 #endif
+
+#if VGM_DECODER_TRACE
+#define TRACE(...) vgmTrace(__VA_ARGS__)
+#define TRACEM(...) vgmTrace(__VA_ARGS__)
+#else
+#if VGM_DECODER_LOGGER > 1
+#define TRACE(...) vgmTraceLog(__VA_ARGS__)
+#else
+#define TRACE(...)
+#endif
+#if VGM_DECODER_LOGGER > 2
+#define TRACEM(...) vgmTraceLog(__VA_ARGS__)
+#else
+#define TRACEM(...)
+#endif
+#endif
+
+#if !VGM_DECODER_TRACE && VGM_DECODER_LOGGER > 1
+static inline void vgmTraceLog(uint16_t event, uint16_t arg0, uint32_t arg1 = 0, uint32_t arg2 = 0)
+{
+    char text[128];
+    VgmTraceRecord record{ 0, event, arg0, arg1, arg2 };
+    VgmTraceBuffer::formatEvent( record, text, sizeof(text) );
+    fputs( text, stderr );
+}
+#endif
+
+#if VGM_DECODER_STATS
+#define STATS_ADD(field, value) \
+    do { VgmStats *stats_ = vgmStatsCurrent(); if ( stats_ ) stats_->field += (value); } while (0)
+#define STATS_TIME_BEGIN(timer) uint64_t timer = vgmStatsTime()
+#define STATS_TIME_END(timer, field) STATS_ADD( field, vgmStatsTime() - timer )
+#define STATS_SCOPE(stats) VgmStatsScope stats_scope_( stats )
+#else
+#define STATS_ADD(field, value)
+#define STATS_TIME_BEGIN(timer)
+#define STATS_TIME_END(timer, field)
+#define STATS_SCOPE(stats)
+#endif
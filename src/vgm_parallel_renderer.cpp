@@ -0,0 +1,175 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "vgm_parallel_renderer.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define VGM_RENDERER_DEBUG 1
+
+#if VGM_RENDERER_DEBUG && !defined(VGM_DECODER_LOGGER)
+#define VGM_DECODER_LOGGER VGM_RENDERER_DEBUG
+#endif
+#include "vgm_logger.h"
+
+typedef struct
+{
+    int offset;
+    int size;
+    std::vector<uint8_t> state;
+} VgmSegment;
+
+bool VgmParallelRenderer::setup(VgmFile &file)
+{
+    file.setSampleFrequency( m_sampleFrequency );
+    file.setVolume( m_volume );
+    file.setMaxDuration( m_maxDuration );
+    file.setFading( m_fadeEffect );
+    // Segments are rendered once, so checkpoints for seek are not needed
+    file.setSeekInterval( 0 );
+    if ( !file.open( m_data, m_size ) )
+    {
+        return false;
+    }
+    return file.setTrack( m_track );
+}
+
+bool VgmParallelRenderer::open(const uint8_t *data, int size)
+{
+    m_data = data;
+    m_size = size;
+    m_track = 0;
+    return setup( m_file );
+}
+
+bool VgmParallelRenderer::setTrack(int track)
+{
+    m_track = track;
+    return m_file.setTrack( track );
+}
+
+void VgmParallelRenderer::setSampleFrequency(uint32_t frequency)
+{
+    m_sampleFrequency = frequency;
+    m_file.setSampleFrequency( frequency );
+}
+
+void VgmParallelRenderer::setVolume(uint16_t volume)
+{
+    m_volume = volume;
+    m_file.setVolume( volume );
+}
+
+void VgmParallelRenderer::setMaxDuration(uint32_t milliseconds)
+{
+    m_maxDuration = milliseconds;
+    m_file.setMaxDuration( milliseconds );
+}
+
+void VgmParallelRenderer::setFading(bool enable)
+{
+    m_fadeEffect = enable;
+    m_file.setFading( enable );
+}
+
+int VgmParallelRenderer::render(uint8_t *outBuffer, int maxSize)
+{
+    int threadCount = m_threadCount ? m_threadCount : std::thread::hardware_concurrency();
+    uint32_t stateSize = m_file.getStateSize();
+    if ( threadCount <= 1 || !stateSize )
+    {
+        return m_file.decodePcm( outBuffer, maxSize );
+    }
+    int segmentSize = static_cast<uint64_t>( m_segmentDuration ) * m_sampleFrequency / 1000 * 4;
+    if ( segmentSize < 4 ) segmentSize = 4;
+    // Pass the track without mixing, remembering state at the start of each segment
+    std::vector<VgmSegment> segments;
+    int total = 0;
+    while ( total < maxSize )
+    {
+        VgmSegment segment;
+        segment.offset = total;
+        segment.state.resize( stateSize );
+        if ( !m_file.saveState( segment.state.data() ) )
+        {
+            LOGE( "Failed to save player state\n" );
+            return 0;
+        }
+        int requested = maxSize - total < segmentSize ? maxSize - total : segmentSize;
+        int skipped = m_file.skipPcm( requested );
+        segment.size = skipped;
+        total += skipped;
+        if ( skipped )
+        {
+            segments.push_back( std::move( segment ) );
+        }
+        if ( skipped < requested )
+        {
+            break;
+        }
+    }
+    LOG( "Rendering %d segments with %d threads\n", static_cast<int>( segments.size() ), threadCount );
+    // Each thread restores the state to own file object and renders the segments.
+    // Data blocks, copied by m_file for non-resident data, are referenced by the
+    // states, so m_file must stay open until all segments are rendered.
+    std::atomic<size_t> next{ 0 };
+    std::atomic<bool> failed{ false };
+    auto worker = [&]()
+    {
+        VgmFile file;
+        if ( !setup( file ) )
+        {
+            failed = true;
+            return;
+        }
+        for ( size_t index = next++; index < segments.size(); index = next++ )
+        {
+            const VgmSegment &segment = segments[index];
+            if ( !file.loadState( segment.state.data() ) ||
+                 file.decodePcm( outBuffer + segment.offset, segment.size ) != segment.size )
+            {
+                failed = true;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for ( int i = 1; i < threadCount && static_cast<size_t>(i) < segments.size(); i++ )
+    {
+        threads.emplace_back( worker );
+    }
+    worker();
+    for ( auto &thread: threads )
+    {
+        thread.join();
+    }
+    if ( failed )
+    {
+        LOGE( "Failed to render segments in parallel\n" );
+        return 0;
+    }
+    return total;
+}
@@ -0,0 +1,299 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "vgm_pcm_cache.h"
+#include "vgm_logger.h"
+
+#include <inttypes.h>
+
+/** Name of index file in cache directory */
+#define VGM_PCM_CACHE_INDEX "index.txt"
+
+#define VGM_PCM_CACHE_HASH_SEED 0xCBF29CE484222325ULL
+#define VGM_PCM_CACHE_HASH_PRIME 0x100000001B3ULL
+
+/** Adds data to 64-bit FNV-1a hash */
+static uint64_t cacheHash(uint64_t hash, const void *data, uint32_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>( data );
+    while ( size-- ) hash = ( hash ^ *bytes++ ) * VGM_PCM_CACHE_HASH_PRIME;
+    return hash;
+}
+
+static uint64_t cacheHashWord(uint64_t hash, uint32_t word)
+{
+    uint8_t bytes[4] = { static_cast<uint8_t>( word ), static_cast<uint8_t>( word >> 8 ),
+                         static_cast<uint8_t>( word >> 16 ), static_cast<uint8_t>( word >> 24 ) };
+    return cacheHash( hash, bytes, sizeof(bytes) );
+}
+
+bool VgmPcmCache::open(const char *directory, uint64_t maxSize)
+{
+    close();
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_directory = directory;
+    if ( !m_directory.empty() && m_directory.back() != '/' && m_directory.back() != '\\' )
+    {
+        m_directory += '/';
+    }
+    m_maxSize = maxSize;
+    std::string name = m_directory + VGM_PCM_CACHE_INDEX;
+    FILE *index = fopen( name.c_str(), "r" );
+    if ( index )
+    {
+        // Index lists entries from least to most recently used
+        unsigned long long key;
+        unsigned long size;
+        while ( fscanf( index, "%llx %lu", &key, &size ) == 2 )
+        {
+            removeEntry( key );
+            addEntry( key, size );
+        }
+        fclose( index );
+    }
+    evict();
+    // Saving the index checks, that the directory is writable
+    if ( !saveIndex() )
+    {
+        LOGE( "Failed to open pcm cache in %s\n", directory );
+        m_entries.clear();
+        m_uses.clear();
+        m_size = 0;
+        m_directory.clear();
+        return false;
+    }
+    LOG( "Pcm cache: %u entries, %" PRIu64 " bytes\n", static_cast<uint32_t>( m_entries.size() ), m_size );
+    return true;
+}
+
+void VgmPcmCache::close()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( m_directory.empty() )
+    {
+        return;
+    }
+    if ( m_modified )
+    {
+        saveIndex();
+    }
+    for ( auto &temporary: m_temporary )
+    {
+        fclose( temporary.first );
+        remove( temporary.second.c_str() );
+    }
+    m_temporary.clear();
+    m_entries.clear();
+    m_uses.clear();
+    m_size = 0;
+    m_directory.clear();
+}
+
+uint64_t VgmPcmCache::makeKey(const uint8_t *data, uint32_t size, const VgmPcmCacheParams &params)
+{
+    uint64_t hash = cacheHashWord( VGM_PCM_CACHE_HASH_SEED, VGM_PCM_CACHE_VERSION );
+    hash = cacheHashWord( hash, size );
+    hash = cacheHash( hash, data, size );
+    // Parameters are added one by one, so the key doesn't depend on structure padding
+    const uint32_t words[] = { static_cast<uint32_t>( params.track ), params.sampleFrequency, params.volume,
+                               params.fading, params.loopDetection, params.loopCount, params.maxDuration,
+                               params.format.sampleFormat, params.format.channels,
+                               params.resamplerQuality, params.chipFrequency };
+    for ( uint32_t word: words )
+    {
+        hash = cacheHashWord( hash, word );
+    }
+    return hash;
+}
+
+bool VgmPcmCache::read(uint64_t key, FileDataSource &source)
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    auto entry = m_entries.find( key );
+    if ( entry == m_entries.end() )
+    {
+        return false;
+    }
+    if ( !source.open( getEntryName( key ).c_str() ) || source.getSize() != entry->second.size )
+    {
+        // The file is removed or damaged outside of the cache
+        LOGE( "Pcm cache entry %016" PRIX64 " is not valid, removing\n", key );
+        source.close();
+        removeEntry( key );
+        m_modified = true;
+        return false;
+    }
+    m_uses.splice( m_uses.end(), m_uses, entry->second.use );
+    m_modified = true;
+    return true;
+}
+
+FILE *VgmPcmCache::create(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( m_directory.empty() )
+    {
+        return nullptr;
+    }
+    // Several threads may render the same key at once, so every file has own name
+    std::string name = getEntryName( key ) + "." + std::to_string( m_temporaryCounter++ ) + ".tmp";
+    FILE *file = fopen( name.c_str(), "wb" );
+    if ( file == nullptr )
+    {
+        LOGE( "Failed to create file %s\n", name.c_str() );
+        return nullptr;
+    }
+    m_temporary[file] = name;
+    return file;
+}
+
+bool VgmPcmCache::commit(uint64_t key, FILE *file)
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    auto temporary = m_temporary.find( file );
+    if ( temporary == m_temporary.end() )
+    {
+        return false;
+    }
+    std::string name = temporary->second;
+    m_temporary.erase( temporary );
+    long size = ftell( file );
+    bool written = ferror( file ) == 0;
+    written = fclose( file ) == 0 && written;
+    if ( !written || size <= 0 || static_cast<uint64_t>( size ) > m_maxSize || m_entries.count( key ) )
+    {
+        // Entry, which doesn't fit the cache or is already added by another thread, is not stored
+        remove( name.c_str() );
+        return written && size >= 0;
+    }
+    if ( !replaceFile( name, getEntryName( key ) ) )
+    {
+        LOGE( "Failed to rename file %s\n", name.c_str() );
+        remove( name.c_str() );
+        return false;
+    }
+    addEntry( key, size );
+    evict();
+    saveIndex();
+    return true;
+}
+
+void VgmPcmCache::discard(FILE *file)
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    auto temporary = m_temporary.find( file );
+    if ( temporary == m_temporary.end() )
+    {
+        return;
+    }
+    fclose( file );
+    remove( temporary->second.c_str() );
+    m_temporary.erase( temporary );
+}
+
+uint64_t VgmPcmCache::getSize()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_size;
+}
+
+uint32_t VgmPcmCache::getCount()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_entries.size();
+}
+
+std::string VgmPcmCache::getEntryName(uint64_t key) const
+{
+    char name[24];
+    snprintf( name, sizeof(name), "%016" PRIX64 ".pcm", key );
+    return m_directory + name;
+}
+
+void VgmPcmCache::addEntry(uint64_t key, uint32_t size)
+{
+    m_uses.push_back( key );
+    m_entries[key] = Entry{ size, std::prev( m_uses.end() ) };
+    m_size += size;
+    m_modified = true;
+}
+
+void VgmPcmCache::removeEntry(uint64_t key)
+{
+    auto entry = m_entries.find( key );
+    if ( entry == m_entries.end() )
+    {
+        return;
+    }
+    m_size -= entry->second.size;
+    m_uses.erase( entry->second.use );
+    m_entries.erase( entry );
+    m_modified = true;
+}
+
+void VgmPcmCache::evict()
+{
+    while ( m_size > m_maxSize && !m_uses.empty() )
+    {
+        uint64_t key = m_uses.front();
+        // Opened sources keep reading removed file
+        remove( getEntryName( key ).c_str() );
+        removeEntry( key );
+    }
+}
+
+bool VgmPcmCache::replaceFile(const std::string &source, const std::string &target)
+{
+    if ( rename( source.c_str(), target.c_str() ) == 0 )
+    {
+        return true;
+    }
+    // Some systems don't allow to rename file to existing one
+    remove( target.c_str() );
+    return rename( source.c_str(), target.c_str() ) == 0;
+}
+
+bool VgmPcmCache::saveIndex()
+{
+    // Index is replaced at once, so it is not damaged, if the program is terminated
+    std::string name = m_directory + VGM_PCM_CACHE_INDEX;
+    std::string temporary = name + ".tmp";
+    FILE *index = fopen( temporary.c_str(), "w" );
+    if ( index == nullptr )
+    {
+        return false;
+    }
+    for ( uint64_t key: m_uses )
+    {
+        fprintf( index, "%016" PRIX64 " %u\n", key, m_entries[key].size );
+    }
+    bool written = ferror( index ) == 0;
+    if ( fclose( index ) != 0 || !written || !replaceFile( temporary, name ) )
+    {
+        remove( temporary.c_str() );
+        return false;
+    }
+    m_modified = false;
+    return true;
+}
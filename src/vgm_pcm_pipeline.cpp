@@ -0,0 +1,144 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "vgm_pcm_pipeline.h"
+
+#include <string.h>
+#include <chrono>
+
+/** Maximum size of single decodePcm() call, so consumer gets data in small portions */
+#define VGM_PCM_PRODUCER_BLOCK_SIZE 4096
+
+/** Polling interval of producer and waiting consumer, when buffer is full or empty */
+#define VGM_PCM_POLL_INTERVAL std::chrono::milliseconds( 1 )
+
+VgmPcmRingBuffer::VgmPcmRingBuffer(uint32_t size)
+{
+    uint32_t capacity = VGM_PCM_PRODUCER_BLOCK_SIZE;
+    while ( capacity < size )
+    {
+        capacity <<= 1;
+    }
+    m_data = new uint8_t[ capacity ];
+    m_capacityMask = capacity - 1;
+}
+
+VgmPcmRingBuffer::~VgmPcmRingBuffer()
+{
+    delete[] m_data;
+}
+
+uint8_t *VgmPcmRingBuffer::acquireWrite(uint32_t &size)
+{
+    uint32_t head = m_head.load( std::memory_order_relaxed );
+    uint32_t space = getCapacity() - ( head - m_tail.load( std::memory_order_acquire ) );
+    uint32_t offset = head & m_capacityMask;
+    size = getCapacity() - offset < space ? getCapacity() - offset : space;
+    return m_data + offset;
+}
+
+const uint8_t *VgmPcmRingBuffer::acquireRead(uint32_t &size)
+{
+    uint32_t tail = m_tail.load( std::memory_order_relaxed );
+    uint32_t available = m_head.load( std::memory_order_acquire ) - tail;
+    uint32_t offset = tail & m_capacityMask;
+    size = getCapacity() - offset < available ? getCapacity() - offset : available;
+    return m_data + offset;
+}
+
+uint32_t VgmPcmRingBuffer::read(uint8_t *outBuffer, uint32_t size)
+{
+    uint32_t copied = 0;
+    // Data may wrap around the end of the buffer, so it is read by two parts at most
+    while ( copied < size )
+    {
+        uint32_t length;
+        const uint8_t *data = acquireRead( length );
+        if ( !length )
+        {
+            break;
+        }
+        if ( length > size - copied ) length = size - copied;
+        memcpy( outBuffer + copied, data, length );
+        commitRead( length );
+        copied += length;
+    }
+    return copied;
+}
+
+void VgmPcmRingBuffer::clear()
+{
+    m_head.store( 0, std::memory_order_relaxed );
+    m_tail.store( 0, std::memory_order_relaxed );
+}
+
+void VgmPcmProducer::start(VgmFile *file, uint32_t prefill)
+{
+    stop();
+    m_buffer.clear();
+    m_file = file;
+    m_finished.store( false, std::memory_order_release );
+    m_stop.store( false, std::memory_order_relaxed );
+    m_thread = std::thread( &VgmPcmProducer::decode, this );
+    wait( prefill < m_buffer.getCapacity() ? prefill : m_buffer.getCapacity() );
+}
+
+void VgmPcmProducer::stop()
+{
+    m_stop.store( true, std::memory_order_relaxed );
+    if ( m_thread.joinable() )
+    {
+        m_thread.join();
+    }
+    m_finished.store( true, std::memory_order_release );
+}
+
+uint32_t VgmPcmProducer::wait(uint32_t size)
+{
+    while ( m_buffer.getAvailable() < size && !isFinished() )
+    {
+        std::this_thread::sleep_for( VGM_PCM_POLL_INTERVAL );
+    }
+    return m_buffer.getAvailable();
+}
+
+void VgmPcmProducer::decode()
+{
+    // Decoded data may wrap around the end of the buffer, decodePcm() continues
+    // from the start of the buffer then
+    int requested = VGM_PCM_PRODUCER_BLOCK_SIZE / m_file->getFrameSize() * m_file->getFrameSize();
+    while ( !m_stop.load( std::memory_order_relaxed ) )
+    {
+        if ( m_buffer.getCapacity() - m_buffer.getAvailable() < static_cast<uint32_t>( requested ) )
+        {
+            std::this_thread::sleep_for( VGM_PCM_POLL_INTERVAL );
+            continue;
+        }
+        if ( m_file->decodePcm( m_buffer, requested ) < requested )
+        {
+            break;
+        }
+    }
+    m_finished.store( true, std::memory_order_release );
+}
@@ -0,0 +1,317 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "vgm_resampler.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VGM_RESAMPLER_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VGM_RESAMPLER_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define VGM_RESAMPLER_PI 3.14159265358979323846
+
+/** SIMD kernels process 8 taps at once, so number of taps is always multiple of 8 */
+#define VGM_RESAMPLER_TAPS_ALIGN 8
+
+/** Pass band of the filter relative to Nyquist limit, and Kaiser window beta for each quality */
+static const double s_passBand[] = { 0, 0.80, 0.88, 0.92 };
+static const double s_kaiserBeta[] = { 0, 5.0, 6.5, 8.0 };
+
+/** Zero order modified Bessel function of the first kind, used by Kaiser window */
+static double bessel0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for ( int k = 1; k < 32; k++ )
+    {
+        term *= ( x / ( 2 * k ) ) * ( x / ( 2 * k ) );
+        sum += term;
+    }
+    return sum;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while ( b )
+    {
+        uint32_t rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return a;
+}
+
+static uint32_t getTapsCount(uint32_t inputFrequency, uint32_t outputFrequency, uint8_t quality)
+{
+    // Filter length is the same in output samples, so downsampling requires more input taps
+    uint64_t taps = 8 << ( quality - 1 );
+    if ( inputFrequency > outputFrequency )
+    {
+        taps = ( taps * inputFrequency + outputFrequency - 1 ) / outputFrequency;
+    }
+    taps = ( taps + VGM_RESAMPLER_TAPS_ALIGN - 1 ) / VGM_RESAMPLER_TAPS_ALIGN * VGM_RESAMPLER_TAPS_ALIGN;
+    return taps < VGM_RESAMPLER_MAX_TAPS ? taps : VGM_RESAMPLER_MAX_TAPS;
+}
+
+/** Converts filter output in Q15 to sample in internal format */
+static inline uint32_t packChannel(int32_t sum)
+{
+    int32_t value = ( sum + ( 1 << 14 ) ) >> 15;
+    if ( value > 32767 ) value = 32767;
+    if ( value < -32768 ) value = -32768;
+    return static_cast<uint32_t>( value + 32768 );
+}
+
+static uint32_t filterScalar(const int16_t *left, const int16_t *right, const int16_t *coefficients,
+                             uint32_t taps)
+{
+    int32_t sumLeft = 0;
+    int32_t sumRight = 0;
+    for ( uint32_t i = 0; i < taps; i++ )
+    {
+        sumLeft += left[i] * coefficients[i];
+        sumRight += right[i] * coefficients[i];
+    }
+    return packChannel( sumLeft ) | ( packChannel( sumRight ) << 16 );
+}
+
+#if VGM_RESAMPLER_SSE2
+static inline int32_t horizontalSum(__m128i sum)
+{
+    sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+    sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+    return _mm_cvtsi128_si32( sum );
+}
+
+static uint32_t filterSse2(const int16_t *left, const int16_t *right, const int16_t *coefficients,
+                           uint32_t taps)
+{
+    __m128i sumLeft = _mm_setzero_si128();
+    __m128i sumRight = _mm_setzero_si128();
+    for ( uint32_t i = 0; i < taps; i += 8 )
+    {
+        // History window starts at any sample, coefficients are not aligned to 16 bytes as well
+        __m128i h = _mm_loadu_si128( reinterpret_cast<const __m128i *>( coefficients + i ) );
+        sumLeft = _mm_add_epi32( sumLeft, _mm_madd_epi16( h,
+                                 _mm_loadu_si128( reinterpret_cast<const __m128i *>( left + i ) ) ) );
+        sumRight = _mm_add_epi32( sumRight, _mm_madd_epi16( h,
+                                  _mm_loadu_si128( reinterpret_cast<const __m128i *>( right + i ) ) ) );
+    }
+    return packChannel( horizontalSum( sumLeft ) ) | ( packChannel( horizontalSum( sumRight ) ) << 16 );
+}
+#endif
+
+#if VGM_RESAMPLER_NEON
+static uint32_t filterNeon(const int16_t *left, const int16_t *right, const int16_t *coefficients,
+                           uint32_t taps)
+{
+    int32x4_t sumLeft = vdupq_n_s32( 0 );
+    int32x4_t sumRight = vdupq_n_s32( 0 );
+    for ( uint32_t i = 0; i < taps; i += 8 )
+    {
+        int16x8_t h = vld1q_s16( coefficients + i );
+        int16x8_t l = vld1q_s16( left + i );
+        int16x8_t r = vld1q_s16( right + i );
+        sumLeft = vmlal_s16( sumLeft, vget_low_s16( h ), vget_low_s16( l ) );
+        sumLeft = vmlal_s16( sumLeft, vget_high_s16( h ), vget_high_s16( l ) );
+        sumRight = vmlal_s16( sumRight, vget_low_s16( h ), vget_low_s16( r ) );
+        sumRight = vmlal_s16( sumRight, vget_high_s16( h ), vget_high_s16( r ) );
+    }
+    int32x2_t pairLeft = vadd_s32( vget_low_s32( sumLeft ), vget_high_s32( sumLeft ) );
+    int32x2_t pairRight = vadd_s32( vget_low_s32( sumRight ), vget_high_s32( sumRight ) );
+    return packChannel( vget_lane_s32( vpadd_s32( pairLeft, pairLeft ), 0 ) ) |
+           ( packChannel( vget_lane_s32( vpadd_s32( pairRight, pairRight ), 0 ) ) << 16 );
+}
+#endif
+
+#if VGM_RESAMPLER_SSE2
+#define VGM_RESAMPLER_SIMD_KERNEL filterSse2
+#elif VGM_RESAMPLER_NEON
+#define VGM_RESAMPLER_SIMD_KERNEL filterNeon
+#else
+#define VGM_RESAMPLER_SIMD_KERNEL filterScalar
+#endif
+
+uint32_t (*VgmResampler::s_kernel)(const int16_t *left, const int16_t *right, const int16_t *coefficients,
+                                   uint32_t taps) = VGM_RESAMPLER_SIMD_KERNEL;
+
+void VgmResampler::enableSimd(bool enable)
+{
+    s_kernel = enable ? VGM_RESAMPLER_SIMD_KERNEL : filterScalar;
+}
+
+bool VgmResampler::init(uint32_t inputFrequency, uint32_t outputFrequency, uint8_t quality)
+{
+    close();
+    if ( quality == VGM_RESAMPLER_OFF || quality > VGM_RESAMPLER_BEST || !inputFrequency || !outputFrequency )
+    {
+        return false;
+    }
+    uint32_t divisor = gcd( inputFrequency, outputFrequency );
+    m_step = inputFrequency / divisor;
+    m_denominator = outputFrequency / divisor;
+    m_phases = m_denominator < VGM_RESAMPLER_MAX_PHASES ? m_denominator : VGM_RESAMPLER_MAX_PHASES;
+    m_taps = getTapsCount( inputFrequency, outputFrequency, quality );
+    // Cut off frequency in cycles per input sample
+    double ratio = outputFrequency < inputFrequency ? static_cast<double>( outputFrequency ) / inputFrequency : 1.0;
+    double cutoff = 0.5 * ratio * s_passBand[quality];
+    double beta = s_kaiserBeta[quality];
+    double half = m_taps / 2.0;
+    m_coefficients.resize( m_phases * m_taps );
+    std::vector<double> filter( m_taps );
+    for ( uint32_t phase = 0; phase < m_phases; phase++ )
+    {
+        // Output sample is located between samples taps / 2 - 1 and taps / 2 of the window
+        double delay = static_cast<double>( phase ) / m_phases;
+        double sum = 0;
+        for ( uint32_t i = 0; i < m_taps; i++ )
+        {
+            double t = i - half + 1 - delay;
+            double x = t / half;
+            double window = x * x < 1 ? bessel0( beta * sqrt( 1 - x * x ) ) / bessel0( beta ) : 0;
+            double arg = 2 * VGM_RESAMPLER_PI * cutoff * t;
+            double sinc = arg == 0 ? 1.0 : sin( arg ) / arg;
+            filter[i] = 2 * cutoff * sinc * window;
+            sum += filter[i];
+        }
+        // Each phase has unity gain, rounding error is added to the largest tap
+        int16_t *coefficients = &m_coefficients[ phase * m_taps ];
+        int32_t total = 0;
+        uint32_t largest = 0;
+        for ( uint32_t i = 0; i < m_taps; i++ )
+        {
+            coefficients[i] = static_cast<int16_t>( lround( filter[i] / sum * 32768 ) );
+            total += coefficients[i];
+            if ( filter[i] > filter[largest] ) largest = i;
+        }
+        coefficients[largest] += 32768 - total;
+    }
+    m_history.resize( 4 * m_taps );
+    reset();
+    return true;
+}
+
+void VgmResampler::close()
+{
+    m_coefficients.clear();
+    m_coefficients.shrink_to_fit();
+    m_history.clear();
+    m_history.shrink_to_fit();
+    m_taps = 0;
+}
+
+void VgmResampler::reset()
+{
+    // Silence is 0 in internal format, i.e. -32768 for signed samples
+    for ( int16_t &sample: m_history )
+    {
+        sample = -32768;
+    }
+    m_index = 0;
+    // First output sample requires taps / 2 + 1 input samples
+    m_position = ( m_taps / 2 + 1 ) * m_denominator;
+}
+
+uint32_t VgmResampler::getInputSamples(uint32_t outputSamples) const
+{
+    if ( !outputSamples )
+    {
+        return 0;
+    }
+    return ( m_position + static_cast<uint64_t>( outputSamples - 1 ) * m_step ) / m_denominator;
+}
+
+void VgmResampler::push(uint32_t sample)
+{
+    int16_t left = static_cast<int16_t>( ( sample & 0xFFFF ) ^ 0x8000 );
+    int16_t right = static_cast<int16_t>( ( sample >> 16 ) ^ 0x8000 );
+    m_history[ m_index ] = left;
+    m_history[ m_index + m_taps ] = left;
+    m_history[ 2 * m_taps + m_index ] = right;
+    m_history[ 3 * m_taps + m_index ] = right;
+    if ( ++m_index == m_taps ) m_index = 0;
+}
+
+int VgmResampler::process(const uint32_t *samples, int count, uint32_t *outBuffer, int maxSamples)
+{
+    int produced = 0;
+    for ( ;; )
+    {
+        if ( m_position >= m_denominator )
+        {
+            if ( !count )
+            {
+                break;
+            }
+            push( *samples++ );
+            count--;
+            m_position -= m_denominator;
+            continue;
+        }
+        if ( produced == maxSamples )
+        {
+            break;
+        }
+        if ( outBuffer )
+        {
+            uint32_t phase = m_phases == m_denominator ? m_position
+                           : static_cast<uint64_t>( m_position ) * m_phases / m_denominator;
+            const int16_t *left = &m_history[ m_index ];
+            outBuffer[produced] = s_kernel( left, left + 2 * m_taps, &m_coefficients[ phase * m_taps ], m_taps );
+        }
+        produced++;
+        m_position += m_step;
+    }
+    return produced;
+}
+
+uint32_t VgmResampler::getStateSize() const
+{
+    return m_taps ? 2 * sizeof(uint32_t) + m_history.size() * sizeof(int16_t) : 0;
+}
+
+void VgmResampler::saveState(uint8_t *state) const
+{
+    memcpy( state, &m_position, sizeof(uint32_t) );
+    memcpy( state + sizeof(uint32_t), &m_index, sizeof(uint32_t) );
+    memcpy( state + 2 * sizeof(uint32_t), m_history.data(), m_history.size() * sizeof(int16_t) );
+}
+
+void VgmResampler::loadState(const uint8_t *state)
+{
+    memcpy( &m_position, state, sizeof(uint32_t) );
+    memcpy( &m_index, state + sizeof(uint32_t), sizeof(uint32_t) );
+    memcpy( m_history.data(), state + 2 * sizeof(uint32_t), m_history.size() * sizeof(int16_t) );
+}
+
+uint32_t VgmResampler::getMaxHeapSize()
+{
+    return ( VGM_RESAMPLER_MAX_PHASES * VGM_RESAMPLER_MAX_TAPS + 4 * VGM_RESAMPLER_MAX_TAPS ) * sizeof(int16_t);
+}
@@ -0,0 +1,225 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "vgm_sample_format.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VGM_SAMPLE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VGM_SAMPLE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/** Full scale level of internal format */
+#define VGM_SAMPLE_MAX 65535
+
+/** Float samples are scaled by power of 2, so SIMD and scalar results are the same */
+#define VGM_SAMPLE_F32_SCALE (1.0f / 32768)
+
+bool vgmIsValidFormat(const VgmOutputFormat &format)
+{
+    return format.sampleFormat <= VGM_SAMPLE_F32 && ( format.channels == 1 || format.channels == 2 );
+}
+
+uint32_t vgmGetFrameSize(const VgmOutputFormat &format)
+{
+    return ( format.sampleFormat == VGM_SAMPLE_F32 ? 4 : 2 ) * format.channels;
+}
+
+/** Converts frames one by one, starting from index, returns number of full scale samples */
+static uint32_t convertScalar(const uint32_t *samples, int index, int count, uint8_t *outBuffer,
+                              const VgmOutputFormat &format)
+{
+    uint32_t clipped = 0;
+    for ( int i = index; i < count; i++ )
+    {
+        uint32_t left = samples[i] & 0xFFFF;
+        uint32_t right = samples[i] >> 16;
+        if ( format.channels == 2 )
+        {
+            clipped += ( left == VGM_SAMPLE_MAX ) + ( right == VGM_SAMPLE_MAX );
+            if ( format.sampleFormat == VGM_SAMPLE_F32 )
+            {
+                float frame[2] = { ( static_cast<int32_t>( left ) - 32768 ) * VGM_SAMPLE_F32_SCALE,
+                                   ( static_cast<int32_t>( right ) - 32768 ) * VGM_SAMPLE_F32_SCALE };
+                memcpy( outBuffer + i * 8, frame, 8 );
+            }
+            else
+            {
+                uint32_t frame = format.sampleFormat == VGM_SAMPLE_S16 ? samples[i] ^ 0x80008000 : samples[i];
+                memcpy( outBuffer + i * 4, &frame, 4 );
+            }
+            continue;
+        }
+        uint32_t mono = ( left + right ) >> 1;
+        clipped += mono == VGM_SAMPLE_MAX;
+        if ( format.sampleFormat == VGM_SAMPLE_F32 )
+        {
+            float sample = ( static_cast<int32_t>( mono ) - 32768 ) * VGM_SAMPLE_F32_SCALE;
+            memcpy( outBuffer + i * 4, &sample, 4 );
+        }
+        else
+        {
+            uint16_t sample = format.sampleFormat == VGM_SAMPLE_S16 ? mono ^ 0x8000 : mono;
+            memcpy( outBuffer + i * 2, &sample, 2 );
+        }
+    }
+    return clipped;
+}
+
+#if VGM_SAMPLE_SSE2
+/** Converts frames by groups of 4, returns number of converted frames */
+static int convertSse2(const uint32_t *samples, int count, uint8_t *outBuffer,
+                       const VgmOutputFormat &format, uint32_t &clipped)
+{
+    const __m128i fullScale = _mm_set1_epi32( -1 );
+    const __m128i lowMask = _mm_set1_epi32( 0xFFFF );
+    const __m128i signBias = _mm_set1_epi32( 32768 );
+    const __m128i signFlip = _mm_set1_epi32( 0x80008000 );
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps( VGM_SAMPLE_F32_SCALE );
+    // Each lane counts full scale samples, counters don't overflow for 65535 groups
+    __m128i clipCounter = _mm_setzero_si128();
+    int i = 0;
+    for ( ; i + 4 <= count && i < 65535 * 4; i += 4 )
+    {
+        __m128i frames = _mm_loadu_si128( reinterpret_cast<const __m128i *>( samples + i ) );
+        if ( format.channels == 2 )
+        {
+            // Subtracting -1 increments lane counter for each 16-bit sample at full scale
+            clipCounter = _mm_sub_epi16( clipCounter, _mm_cmpeq_epi16( frames, fullScale ) );
+            if ( format.sampleFormat == VGM_SAMPLE_F32 )
+            {
+                __m128i first = _mm_sub_epi32( _mm_unpacklo_epi16( frames, zero ), signBias );
+                __m128i second = _mm_sub_epi32( _mm_unpackhi_epi16( frames, zero ), signBias );
+                _mm_storeu_ps( reinterpret_cast<float *>( outBuffer + i * 8 ),
+                               _mm_mul_ps( _mm_cvtepi32_ps( first ), scale ) );
+                _mm_storeu_ps( reinterpret_cast<float *>( outBuffer + i * 8 + 16 ),
+                               _mm_mul_ps( _mm_cvtepi32_ps( second ), scale ) );
+            }
+            else
+            {
+                if ( format.sampleFormat == VGM_SAMPLE_S16 ) frames = _mm_xor_si128( frames, signFlip );
+                _mm_storeu_si128( reinterpret_cast<__m128i *>( outBuffer + i * 4 ), frames );
+            }
+            continue;
+        }
+        __m128i mono = _mm_srli_epi32( _mm_add_epi32( _mm_and_si128( frames, lowMask ),
+                                                      _mm_srli_epi32( frames, 16 ) ), 1 );
+        // Mono samples are 32-bit, so full scale 32-bit lanes are counted in pairs of 16-bit ones
+        clipCounter = _mm_sub_epi16( clipCounter, _mm_and_si128( _mm_cmpeq_epi32( mono, lowMask ), lowMask ) );
+        __m128i centered = _mm_sub_epi32( mono, signBias );
+        if ( format.sampleFormat == VGM_SAMPLE_F32 )
+        {
+            _mm_storeu_ps( reinterpret_cast<float *>( outBuffer + i * 4 ),
+                           _mm_mul_ps( _mm_cvtepi32_ps( centered ), scale ) );
+        }
+        else
+        {
+            __m128i packed = _mm_packs_epi32( centered, centered );
+            if ( format.sampleFormat == VGM_SAMPLE_U16 ) packed = _mm_xor_si128( packed, signFlip );
+            _mm_storel_epi64( reinterpret_cast<__m128i *>( outBuffer + i * 2 ), packed );
+        }
+    }
+    alignas(16) uint16_t lanes[8];
+    _mm_store_si128( reinterpret_cast<__m128i *>( lanes ), clipCounter );
+    for ( int lane = 0; lane < 8; lane++ ) clipped += lanes[lane];
+    return i;
+}
+#endif
+
+#if VGM_SAMPLE_NEON
+/** Converts frames by groups of 4, returns number of converted frames */
+static int convertNeon(const uint32_t *samples, int count, uint8_t *outBuffer,
+                       const VgmOutputFormat &format, uint32_t &clipped)
+{
+    const uint16x8_t fullScale = vdupq_n_u16( 0xFFFF );
+    const uint16x8_t signFlip = vdupq_n_u16( 0x8000 );
+    const uint32x4_t lowMask = vdupq_n_u32( 0xFFFF );
+    const int32x4_t signBias = vdupq_n_s32( 32768 );
+    // Each lane counts full scale samples, counters don't overflow for 65535 groups
+    uint16x8_t clipCounter = vdupq_n_u16( 0 );
+    int i = 0;
+    for ( ; i + 4 <= count && i < 65535 * 4; i += 4 )
+    {
+        uint32x4_t frames = vld1q_u32( samples + i );
+        if ( format.channels == 2 )
+        {
+            uint16x8_t channels = vreinterpretq_u16_u32( frames );
+            // Subtracting all ones increments lane counter for each sample at full scale
+            clipCounter = vsubq_u16( clipCounter, vceqq_u16( channels, fullScale ) );
+            if ( format.sampleFormat == VGM_SAMPLE_F32 )
+            {
+                int32x4_t first = vsubq_s32( vreinterpretq_s32_u32( vmovl_u16( vget_low_u16( channels ) ) ), signBias );
+                int32x4_t second = vsubq_s32( vreinterpretq_s32_u32( vmovl_u16( vget_high_u16( channels ) ) ), signBias );
+                vst1q_u8( outBuffer + i * 8,
+                          vreinterpretq_u8_f32( vmulq_n_f32( vcvtq_f32_s32( first ), VGM_SAMPLE_F32_SCALE ) ) );
+                vst1q_u8( outBuffer + i * 8 + 16,
+                          vreinterpretq_u8_f32( vmulq_n_f32( vcvtq_f32_s32( second ), VGM_SAMPLE_F32_SCALE ) ) );
+            }
+            else
+            {
+                if ( format.sampleFormat == VGM_SAMPLE_S16 ) channels = veorq_u16( channels, signFlip );
+                vst1q_u8( outBuffer + i * 4, vreinterpretq_u8_u16( channels ) );
+            }
+            continue;
+        }
+        uint32x4_t mono = vshrq_n_u32( vaddq_u32( vandq_u32( frames, lowMask ), vshrq_n_u32( frames, 16 ) ), 1 );
+        uint16x4_t narrow = vmovn_u32( mono );
+        uint16x4_t full = vceq_u16( narrow, vget_low_u16( fullScale ) );
+        clipCounter = vsubq_u16( clipCounter, vcombine_u16( full, vdup_n_u16( 0 ) ) );
+        if ( format.sampleFormat == VGM_SAMPLE_F32 )
+        {
+            int32x4_t centered = vsubq_s32( vreinterpretq_s32_u32( mono ), signBias );
+            vst1q_u8( outBuffer + i * 4,
+                      vreinterpretq_u8_f32( vmulq_n_f32( vcvtq_f32_s32( centered ), VGM_SAMPLE_F32_SCALE ) ) );
+        }
+        else
+        {
+            if ( format.sampleFormat == VGM_SAMPLE_S16 ) narrow = veor_u16( narrow, vget_low_u16( signFlip ) );
+            vst1_u8( outBuffer + i * 2, vreinterpret_u8_u16( narrow ) );
+        }
+    }
+    uint32x4_t sums = vpaddlq_u16( clipCounter );
+    clipped += vgetq_lane_u32( sums, 0 ) + vgetq_lane_u32( sums, 1 ) +
+               vgetq_lane_u32( sums, 2 ) + vgetq_lane_u32( sums, 3 );
+    return i;
+}
+#endif
+
+uint32_t vgmConvertSamples(const uint32_t *samples, int count, uint8_t *outBuffer,
+                           const VgmOutputFormat &format)
+{
+    uint32_t clipped = 0;
+    int index = 0;
+#if VGM_SAMPLE_SSE2
+    index = convertSse2( samples, count, outBuffer, format, clipped );
+#elif VGM_SAMPLE_NEON
+    index = convertNeon( samples, count, outBuffer, format, clipped );
+#endif
+    return clipped + convertScalar( samples, index, count, outBuffer, format );
+}
@@ -0,0 +1,260 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "vgm_stream_engine.h"
+
+#include <chrono>
+
+/** Polling interval of rendering threads, when all streams are paused or have full buffers */
+#define VGM_STREAM_POLL_INTERVAL std::chrono::milliseconds( 1 )
+
+enum
+{
+    /** Stream is not rendered, its file can be configured */
+    VGM_STREAM_IDLE = 0,
+    /** Stream is waiting for rendering thread */
+    VGM_STREAM_PLAYING = 1,
+    /** Quantum of the stream is being rendered */
+    VGM_STREAM_RENDERING = 2,
+    /** The end of the track is reached */
+    VGM_STREAM_FINISHED = 3,
+};
+
+VgmStreamEngine::VgmStreamEngine(int streams, uint32_t bufferSize, uint32_t quantum)
+    : m_quantum( quantum ? quantum : 1 )
+{
+    for ( int i = 0; i < streams; i++ )
+    {
+        m_streams.emplace_back( new Stream( bufferSize ) );
+    }
+}
+
+void VgmStreamEngine::start(int threads)
+{
+    stop();
+    if ( threads <= 0 )
+    {
+        threads = std::thread::hardware_concurrency();
+        if ( threads <= 0 ) threads = 1;
+    }
+    // Streams are shared between threads evenly, so all threads have work
+    int groupSize = m_streams.size() / threads;
+    m_groupSize = !m_lanes || groupSize < 1 ? 1 : groupSize > VGM_STREAM_LANES ? VGM_STREAM_LANES : groupSize;
+    m_stop.store( false, std::memory_order_relaxed );
+    for ( int i = 0; i < threads; i++ )
+    {
+        m_threads.emplace_back( &VgmStreamEngine::work, this );
+    }
+}
+
+void VgmStreamEngine::stop()
+{
+    m_stop.store( true, std::memory_order_relaxed );
+    for ( auto &thread: m_threads )
+    {
+        thread.join();
+    }
+    m_threads.clear();
+}
+
+void VgmStreamEngine::play(int stream)
+{
+    pause( stream );
+    m_streams[stream]->buffer.clear();
+    m_streams[stream]->state.store( VGM_STREAM_PLAYING, std::memory_order_release );
+}
+
+void VgmStreamEngine::pause(int stream)
+{
+    std::atomic<uint8_t> &state = m_streams[stream]->state;
+    for (;;)
+    {
+        uint8_t expected = VGM_STREAM_PLAYING;
+        if ( state.compare_exchange_weak( expected, VGM_STREAM_IDLE, std::memory_order_acq_rel ) ||
+             expected == VGM_STREAM_IDLE || expected == VGM_STREAM_FINISHED )
+        {
+            return;
+        }
+        if ( expected == VGM_STREAM_RENDERING )
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool VgmStreamEngine::isPlaying(int stream) const
+{
+    uint8_t state = m_streams[stream]->state.load( std::memory_order_acquire );
+    return state == VGM_STREAM_PLAYING || state == VGM_STREAM_RENDERING;
+}
+
+bool VgmStreamEngine::isFinished(int stream) const
+{
+    return m_streams[stream]->state.load( std::memory_order_acquire ) == VGM_STREAM_FINISHED;
+}
+
+void VgmStreamEngine::work()
+{
+    while ( !m_stop.load( std::memory_order_relaxed ) )
+    {
+        Stream *group[VGM_STREAM_LANES];
+        int count = 0;
+        for ( int index; count < m_groupSize && ( index = takeStream() ) >= 0; )
+        {
+            group[count++] = m_streams[index].get();
+        }
+        if ( !count )
+        {
+            std::this_thread::sleep_for( VGM_STREAM_POLL_INTERVAL );
+            continue;
+        }
+        renderGroup( group, count );
+    }
+}
+
+int VgmStreamEngine::takeStream()
+{
+    uint32_t count = m_streams.size();
+    if ( !count )
+    {
+        return -1;
+    }
+    for (;;)
+    {
+        // The stream with the least buffered data is the closest to underrun
+        uint32_t first = m_cursor.fetch_add( 1, std::memory_order_relaxed ) % count;
+        int best = -1;
+        uint32_t bestAvailable = UINT32_MAX;
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            uint32_t index = first + i < count ? first + i : first + i - count;
+            Stream &stream = *m_streams[index];
+            if ( stream.state.load( std::memory_order_acquire ) != VGM_STREAM_PLAYING )
+            {
+                continue;
+            }
+            uint32_t available = stream.buffer.getAvailable();
+            uint32_t space = stream.buffer.getCapacity() - available;
+            if ( space < stream.buffer.getCapacity() / 2 && space < m_quantum * stream.file.getFrameSize() )
+            {
+                continue;
+            }
+            if ( available < bestAvailable )
+            {
+                best = index;
+                bestAvailable = available;
+            }
+        }
+        if ( best < 0 )
+        {
+            return -1;
+        }
+        uint8_t expected = VGM_STREAM_PLAYING;
+        if ( m_streams[best]->state.compare_exchange_strong( expected, VGM_STREAM_RENDERING,
+                                                             std::memory_order_acq_rel ) )
+        {
+            return best;
+        }
+        // Another thread has taken the stream, or it is paused
+    }
+}
+
+void VgmStreamEngine::renderGroup(Stream *const *group, int count)
+{
+    uint32_t blocks[VGM_STREAM_LANES][VGM_STREAM_LANE_BLOCK];
+    // Frames of the quantum, which are not rendered yet
+    uint32_t left[VGM_STREAM_LANES];
+    // Frames of the lane block of the stream
+    uint32_t frames[VGM_STREAM_LANES];
+    bool finished[VGM_STREAM_LANES];
+#if VGM_DECODER_AY38910
+    AY38910Lanes lanes;
+#endif
+    for ( int i = 0; i < count; i++ )
+    {
+        Stream &stream = *group[i];
+        uint32_t frameSize = stream.file.getFrameSize();
+        uint32_t space = stream.buffer.getCapacity() - stream.buffer.getAvailable();
+        // Quantum is limited by free space, if the buffer is smaller than two quanta
+        left[i] = ( m_quantum * frameSize < space ? m_quantum * frameSize : space ) / frameSize;
+        finished[i] = false;
+    }
+    // Streams, which need the next lane block
+    uint32_t ready = ( 1u << count ) - 1;
+    while ( ready )
+    {
+        for ( int i = 0; i < count; i++ )
+        {
+            if ( !( ready & ( 1u << i ) ) || !left[i] )
+            {
+                continue;
+            }
+            Stream &stream = *group[i];
+            if ( m_lanes )
+            {
+                frames[i] = left[i] < VGM_STREAM_LANE_BLOCK ? left[i] : VGM_STREAM_LANE_BLOCK;
+                AY38910 *chip = stream.file.beginLaneBlock( frames[i], VGM_STREAM_LANE_MIN_WAIT );
+                if ( chip )
+                {
+#if VGM_DECODER_AY38910
+                    lanes.setLane( i, chip, blocks[i], frames[i] );
+#endif
+                    continue;
+                }
+            }
+            if ( m_lanes && stream.file.isEnded() )
+            {
+                finished[i] = true;
+            }
+            else
+            {
+                // The rest of the quantum is rendered by the decoder
+                int size = left[i] * stream.file.getFrameSize();
+                finished[i] = stream.file.decodePcm( stream.buffer, size ) < size;
+            }
+            left[i] = 0;
+        }
+        // Lanes of other streams keep rendering, while streams of filled blocks get next ones
+#if VGM_DECODER_AY38910
+        ready = lanes.render();
+#else
+        ready = 0;
+#endif
+        for ( int i = 0; i < count; i++ )
+        {
+            if ( !( ready & ( 1u << i ) ) )
+            {
+                continue;
+            }
+            Stream &stream = *group[i];
+            stream.file.commitLaneBlock( blocks[i], frames[i], stream.buffer );
+            left[i] -= frames[i];
+        }
+    }
+    for ( int i = 0; i < count; i++ )
+    {
+        m_quanta.fetch_add( 1, std::memory_order_relaxed );
+        group[i]->state.store( finished[i] ? VGM_STREAM_FINISHED : VGM_STREAM_PLAYING, std::memory_order_release );
+    }
+}
@@ -0,0 +1,122 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "vgm_trace.h"
+
+#include <stdio.h>
+#include <chrono>
+
+thread_local VgmTraceBuffer *VgmTraceBuffer::s_current = nullptr;
+
+static uint64_t getMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+VgmTraceBuffer::VgmTraceBuffer(uint32_t records)
+{
+    uint32_t capacity = 1;
+    while ( capacity < records )
+    {
+        capacity <<= 1;
+    }
+    m_records = new VgmTraceRecord[ capacity ];
+    m_capacityMask = capacity - 1;
+    m_startTime = getMicroseconds();
+}
+
+VgmTraceBuffer::~VgmTraceBuffer()
+{
+    delete[] m_records;
+}
+
+uint32_t VgmTraceBuffer::getTimestamp()
+{
+    return static_cast<uint32_t>( getMicroseconds() - m_startTime );
+}
+
+int VgmTraceBuffer::pop(VgmTraceRecord *records, int count)
+{
+    uint32_t tail = m_tail.load( std::memory_order_relaxed );
+    uint32_t available = m_head.load( std::memory_order_acquire ) - tail;
+    if ( static_cast<uint32_t>(count) > available )
+    {
+        count = available;
+    }
+    for ( int i = 0; i < count; i++ )
+    {
+        records[i] = m_records[ (tail + i) & m_capacityMask ];
+    }
+    m_tail.store( tail + count, std::memory_order_release );
+    return count;
+}
+
+VgmTraceBuffer *VgmTraceBuffer::setCurrent(VgmTraceBuffer *buffer)
+{
+    VgmTraceBuffer *prev = s_current;
+    s_current = buffer;
+    return prev;
+}
+
+int VgmTraceBuffer::format(const VgmTraceRecord &record, char *text, int size)
+{
+    uint32_t us = record.timestamp;
+    int len = snprintf( text, size, "%6u.%06u ", us / 1000000, us % 1000000 );
+    if ( len < 0 || len >= size )
+    {
+        return len;
+    }
+    return len + formatEvent( record, text + len, size - len );
+}
+
+int VgmTraceBuffer::formatEvent(const VgmTraceRecord &record, char *text, int size)
+{
+    switch ( record.event )
+    {
+        case VGM_TRACE_PCM_BLOCK:
+            return snprintf( text, size, "pcm block %u samples at %u\n", record.arg1, record.arg2 );
+        case VGM_TRACE_STOP:
+            return snprintf( text, size, "stop at %u\n", record.arg1 );
+        case VGM_TRACE_VGM_COMMAND:
+            return snprintf( text, size, "[0x%08X] command: 0x%02X\n", record.arg1, record.arg0 );
+        case VGM_TRACE_VGM_WAIT:
+            return snprintf( text, size, "wait %u samples\n", record.arg1 );
+        case VGM_TRACE_AY_WRITE:
+            return snprintf( text, size, "ay8910 reg: %d = 0x%02X\n", record.arg0, record.arg1 );
+        case VGM_TRACE_APU_WRITE:
+            return snprintf( text, size, "nes apu write 0x%02X to [%04X] reg\n", record.arg1, record.arg0 );
+        case VGM_TRACE_CPU_STEP:
+            return snprintf( text, size, "SP:%02X A:%02X X:%02X Y:%02X F:%02X [%04X] (0x%02X)\n",
+                                   record.arg2 >> 24, (record.arg2 >> 16) & 0xFF, (record.arg2 >> 8) & 0xFF,
+                                   record.arg2 & 0xFF, record.arg0 >> 8, record.arg1, record.arg0 & 0xFF );
+        case VGM_TRACE_MEMORY_READ:
+            return snprintf( text, size, "[%04X] ==> %02X\n", record.arg0, record.arg1 );
+        case VGM_TRACE_MEMORY_WRITE:
+            return snprintf( text, size, "[%04X] <== %02X\n", record.arg0, record.arg1 );
+        default:
+            return snprintf( text, size, "unknown event 0x%04X: 0x%04X 0x%08X 0x%08X\n",
+                                   record.event, record.arg0, record.arg1, record.arg2 );
+    }
+}
@@ -0,0 +1,565 @@
+/*
+MIT License
+
+Copyright (c) 2020-2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "vgm_file.h"
+#include "vgm_stream_engine.h"
+#include "chips/ay-3-8910.h"
+#include "chips/nes_cpu.h"
+#include "chips/nes_apu.h"
+#include "formats/vgm_decoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+    Benchmarks of chips, vgm parser and full decoding pipeline on synthetic inputs.
+    Every benchmark calculates checksum of produced data, and compares it with the
+    reference one, so optimization, which changes the output, is reported.
+*/
+
+#define BENCH_SAMPLE_RATE 44100
+
+/** Default duration of every benchmark in seconds of audio, reference checksums depend on it */
+#define BENCH_DEFAULT_SECONDS 60
+
+/** Number of streams, rendered at once by stream engine benchmark */
+#define BENCH_ENGINE_STREAMS 16
+
+#define BENCH_HASH_SEED 0xCBF29CE484222325ULL
+#define BENCH_HASH_PRIME 0x100000001B3ULL
+
+typedef std::vector<uint8_t> BenchData;
+
+typedef struct
+{
+    /** Number of processed units (samples or instructions) */
+    uint64_t count;
+    uint64_t checksum;
+} BenchResult;
+
+typedef struct
+{
+    const char *name;
+    /** Unit of count: "sample" for audio, or "instruction" */
+    const char *unit;
+    BenchResult (*run)(uint32_t seconds);
+    /** Checksum for BENCH_DEFAULT_SECONDS */
+    uint64_t reference;
+} Benchmark;
+
+static uint64_t hashWord(uint64_t hash, uint32_t word)
+{
+    return ( hash ^ word ) * BENCH_HASH_PRIME;
+}
+
+// ------------------------------- Synthetic inputs -------------------------------
+
+/** Builds vgm 1.71 header, data follows it at offset 0x100 */
+static BenchData vgmHeader(uint32_t ayClock, uint32_t nesClock)
+{
+    BenchData data( 0x100 );
+    auto put32 = [&data](uint32_t offset, uint32_t value) { memcpy( data.data() + offset, &value, 4 ); };
+    put32( 0x00, 0x206D6756 );
+    put32( 0x08, 0x171 );
+    put32( 0x34, 0x100 - 0x34 );
+    put32( 0x74, ayClock );
+    put32( 0x84, nesClock );
+    return data;
+}
+
+static void vgmFinish(BenchData &data)
+{
+    data.push_back( 0x66 );
+    uint32_t eof = data.size() - 4;
+    memcpy( data.data() + 4, &eof, 4 );
+}
+
+#if VGM_DECODER_AY38910
+/** Tone channels sweep their periods every frame, fixed volumes */
+static BenchData aySweepVgm(uint32_t seconds)
+{
+    BenchData data = vgmHeader( 1789772, 0 );
+    data.insert( data.end(), { 0xA0, 7, 0x38, 0xA0, 8, 15, 0xA0, 9, 12, 0xA0, 10, 10 } );
+    for ( uint32_t frame = 0; frame < seconds * 60; frame++ )
+    {
+        for ( uint8_t ch = 0; ch < 3; ch++ )
+        {
+            uint32_t period = 0x20 + ( frame * ( 3 + ch ) + ch * 200 ) % 0x600;
+            data.insert( data.end(), { 0xA0, static_cast<uint8_t>( ch * 2 ), static_cast<uint8_t>( period ),
+                                       0xA0, static_cast<uint8_t>( ch * 2 + 1 ), static_cast<uint8_t>( period >> 8 ) } );
+        }
+        data.push_back( 0x62 );
+    }
+    vgmFinish( data );
+    return data;
+}
+
+/** All channels use fast envelope with noise, envelope shape changes every 8 frames */
+static BenchData ayEnvelopeVgm(uint32_t seconds)
+{
+    BenchData data = vgmHeader( 1789772, 0 );
+    data.insert( data.end(), { 0xA0, 7, 0x00, 0xA0, 8, 0x10, 0xA0, 9, 0x10, 0xA0, 10, 0x10,
+                               0xA0, 0, 0x40, 0xA0, 2, 0x55, 0xA0, 4, 0x6A, 0xA0, 6, 0x03 } );
+    for ( uint32_t frame = 0; frame < seconds * 60; frame++ )
+    {
+        if ( frame % 8 == 0 )
+        {
+            uint8_t shapes[] = { 0x08, 0x0A, 0x0C, 0x0E };
+            data.insert( data.end(), { 0xA0, 11, static_cast<uint8_t>( 0x08 + ( frame >> 3 ) % 32 ),
+                                       0xA0, 12, 0x00, 0xA0, 13, shapes[( frame >> 3 ) % 4] } );
+        }
+        data.push_back( 0x62 );
+    }
+    vgmFinish( data );
+    return data;
+}
+
+/** Register write every sample, parser dominates */
+static BenchData ayDenseVgm(uint32_t seconds)
+{
+    BenchData data = vgmHeader( 1789772, 0 );
+    data.insert( data.end(), { 0xA0, 7, 0x38, 0xA0, 8, 15 } );
+    for ( uint32_t sample = 0; sample < seconds * BENCH_SAMPLE_RATE; sample++ )
+    {
+        data.insert( data.end(), { 0xA0, 0, static_cast<uint8_t>( sample ), 0x70 } );
+    }
+    vgmFinish( data );
+    return data;
+}
+
+#endif
+
+#if VGM_DECODER_NES
+/** NES APU register write every 4 samples to all channels in turn */
+static BenchData nesDenseVgm(uint32_t seconds)
+{
+    BenchData data = vgmHeader( 0, 1789772 );
+    data.insert( data.end(), { 0xB4, 0x15, 0x0F, 0xB4, 0x00, 0xBF, 0xB4, 0x04, 0x7F, 0xB4, 0x08, 0xFF,
+                               0xB4, 0x0C, 0x3A, 0xB4, 0x03, 0x08, 0xB4, 0x07, 0x08, 0xB4, 0x0B, 0x08,
+                               0xB4, 0x0F, 0x08 } );
+    const uint8_t regs[] = { 0x02, 0x06, 0x0A, 0x0E };
+    for ( uint32_t i = 0; i < seconds * BENCH_SAMPLE_RATE / 4; i++ )
+    {
+        uint8_t value = static_cast<uint8_t>( regs[i & 3] == 0x0E ? ( i >> 2 ) & 0x0F : 0x40 + ( i >> 2 ) );
+        data.insert( data.end(), { 0xB4, regs[i & 3], value, 0x73 } );
+    }
+    vgmFinish( data );
+    return data;
+}
+
+/** NSF with play routine, which updates APU and then burns about 5000 instructions */
+static BenchData playRoutineNsf()
+{
+    BenchData data( 0x80 );
+    const uint8_t header[] = { 'N', 'E', 'S', 'M', 0x1A, 0x01, 0x01, 0x01,
+                               0x00, 0x80, 0x00, 0x80, 0x10, 0x80 };
+    memcpy( data.data(), header, sizeof(header) );
+    uint16_t speed = 16639;
+    memcpy( data.data() + 0x6E, &speed, 2 );
+    const uint8_t code[] =
+    {
+        // init at 0x8000: enable channels
+        0xA9, 0x0F, 0x8D, 0x15, 0x40, 0x60, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA,
+        // play at 0x8010: update periods and volumes by frame counter
+        0xE6, 0x01,             // INC $01
+        0xA5, 0x01,             // LDA $01
+        0x8D, 0x02, 0x40,       // STA $4002
+        0x4A,                   // LSR A
+        0x8D, 0x06, 0x40,       // STA $4006
+        0x8D, 0x0A, 0x40,       // STA $400A
+        0x29, 0x0F,             // AND #$0F
+        0x8D, 0x0E, 0x40,       // STA $400E
+        0xA9, 0xBF,             // LDA #$BF
+        0x8D, 0x00, 0x40,       // STA $4000
+        0x8D, 0x04, 0x40,       // STA $4004
+        0x8D, 0x0C, 0x40,       // STA $400C
+        0xA9, 0x81,             // LDA #$81
+        0x8D, 0x08, 0x40,       // STA $4008
+        0xA9, 0x09,             // LDA #$09
+        0x8D, 0x0B, 0x40,       // STA $400B
+        0xA2, 0x00,             // LDX #$00
+        0xA0, 0x08,             // LDY #$08
+        0x88,                   // DEY
+        0xD0, 0xFD,             // BNE -3
+        0xCA,                   // DEX
+        0xD0, 0xF8,             // BNE -8
+        0x60,                   // RTS
+    };
+    data.insert( data.end(), code, code + sizeof(code) );
+    return data;
+}
+#endif
+
+// ---------------------------------- Benchmarks ----------------------------------
+
+#if VGM_DECODER_AY38910
+static BenchResult benchAyGetSample(uint32_t seconds)
+{
+    AY38910 chip( CHIP_TYPE_AY8910, 0 );
+    chip.setFrequency( 1789772 );
+    chip.setSampleFrequency( BENCH_SAMPLE_RATE );
+    const uint8_t regs[][2] = { { 7, 0x30 }, { 0, 0x40 }, { 2, 0x55 }, { 4, 0x6A }, { 6, 0x03 },
+                                { 8, 0x10 }, { 9, 15 }, { 10, 0x10 }, { 11, 0x20 }, { 13, 0x0E } };
+    for ( auto &reg: regs ) chip.write( reg[0], reg[1] );
+    BenchResult result{ static_cast<uint64_t>( seconds ) * BENCH_SAMPLE_RATE, BENCH_HASH_SEED };
+    for ( uint64_t i = 0; i < result.count; i++ )
+    {
+        result.checksum = hashWord( result.checksum, chip.getSample() );
+    }
+    return result;
+}
+#endif
+
+#if VGM_DECODER_NES
+static BenchResult benchNesApuGetSample(uint32_t seconds)
+{
+    NesCpu cpu;
+    NesApu *apu = cpu.getApu();
+    apu->setSampleFrequency( BENCH_SAMPLE_RATE );
+    const uint8_t regs[][2] = { { 0x15, 0x0F }, { 0x00, 0xBF }, { 0x02, 0x80 }, { 0x03, 0x08 },
+                                { 0x04, 0x4F }, { 0x06, 0x41 }, { 0x07, 0x09 }, { 0x08, 0xFF },
+                                { 0x0A, 0x70 }, { 0x0B, 0x08 }, { 0x0C, 0x3C }, { 0x0E, 0x05 }, { 0x0F, 0x08 } };
+    for ( auto &reg: regs ) apu->write( reg[0], reg[1] );
+    BenchResult result{ static_cast<uint64_t>( seconds ) * BENCH_SAMPLE_RATE, BENCH_HASH_SEED };
+    for ( uint64_t i = 0; i < result.count; i++ )
+    {
+        result.checksum = hashWord( result.checksum, apu->getSample() );
+    }
+    return result;
+}
+
+static BenchResult benchNesCpuExecute(uint32_t seconds)
+{
+    NesCpu cpu;
+    // Endless loop in RAM: copies and sums zero page bytes using indexed addressing
+    const uint8_t code[] =
+    {
+        0xA2, 0x00,             // LDX #$00
+        0xB5, 0x10,             // LDA $10,X
+        0x18,                   // CLC
+        0x69, 0x03,             // ADC #$03
+        0x9D, 0x00, 0x03,       // STA $0300,X
+        0x95, 0x10,             // STA $10,X
+        0x45, 0x00,             // EOR $00
+        0x85, 0x00,             // STA $00
+        0xE8,                   // INX
+        0xD0, 0xEF,             // BNE -17
+        0x4C, 0x00, 0x02,       // JMP $0200
+    };
+    // Cpu RAM is not initialized, so zero page is cleared to get the same result every run
+    for ( uint32_t i = 0; i < 0x100; i++ ) cpu.write( i, 0 );
+    for ( uint32_t i = 0; i < sizeof(code); i++ ) cpu.write( 0x0200 + i, code[i] );
+    cpu.cpuState().pc = 0x0200;
+    // About 1.79 MHz / 3 cycles per instruction
+    BenchResult result{ static_cast<uint64_t>( seconds ) * 600000, BENCH_HASH_SEED };
+    for ( uint64_t i = 0; i < result.count; i++ )
+    {
+        cpu.executeInstruction();
+    }
+    NesCpuState &state = cpu.cpuState();
+    result.checksum = hashWord( hashWord( result.checksum, state.a | ( state.x << 8 ) | ( state.pc << 16 ) ),
+                                cpu.read( 0x0000 ) | ( cpu.read( 0x0305 ) << 8 ) );
+    return result;
+}
+#endif
+
+#if VGM_DECODER_AY38910
+static BenchResult benchVgmParse(uint32_t seconds)
+{
+    BenchData data = ayDenseVgm( seconds );
+    VgmMusicDecoder *decoder = VgmMusicDecoder::tryOpen( data.data(), data.size() );
+    BenchResult result{ 0, BENCH_HASH_SEED };
+    if ( !decoder )
+    {
+        return result;
+    }
+    // Blocks are not rendered, so only parsing and register writes are measured
+    int samples;
+    while ( ( samples = decoder->decodeBlock() ) > 0 )
+    {
+        result.count += samples;
+        result.checksum = hashWord( result.checksum, samples );
+    }
+    delete decoder;
+    return result;
+}
+#endif
+
+static BenchResult decodeFile(const BenchData &data, uint32_t seconds, uint32_t frequency = BENCH_SAMPLE_RATE,
+                              uint8_t quality = VGM_RESAMPLER_OFF)
+{
+    VgmFile file;
+    BenchResult result{ 0, BENCH_HASH_SEED };
+    if ( !file.open( data.data(), data.size() ) )
+    {
+        return result;
+    }
+    file.setResampler( quality );
+    file.setSampleFrequency( frequency );
+    file.setMaxDuration( seconds * 1000 );
+    file.setTrack( 0 );
+    uint32_t buffer[1024];
+    for (;;)
+    {
+        int size = file.decodePcm( reinterpret_cast<uint8_t *>( buffer ), sizeof(buffer) );
+        for ( int i = 0; i < size / 4; i++ )
+        {
+            result.checksum = hashWord( result.checksum, buffer[i] );
+        }
+        result.count += size / 4;
+        if ( size < static_cast<int>( sizeof(buffer) ) )
+        {
+            break;
+        }
+    }
+    return result;
+}
+
+/** Renders the track by several streams of stream engine, checksums of streams are combined in order */
+static BenchResult engineFile(const BenchData &data, uint32_t seconds, bool lanes = true)
+{
+    VgmStreamEngine engine( BENCH_ENGINE_STREAMS );
+    engine.enableLanes( lanes );
+    BenchResult result{ 0, BENCH_HASH_SEED };
+    std::vector<uint64_t> checksums( BENCH_ENGINE_STREAMS, BENCH_HASH_SEED );
+    for ( int i = 0; i < BENCH_ENGINE_STREAMS; i++ )
+    {
+        VgmFile &file = engine.getFile( i );
+        if ( !file.open( data.data(), data.size() ) )
+        {
+            return result;
+        }
+        // Every stream renders the start of the track, so total duration is the same as for decodeFile()
+        file.setMaxDuration( seconds * 1000 / BENCH_ENGINE_STREAMS );
+        file.setTrack( 0 );
+        engine.play( i );
+    }
+    engine.start();
+    uint32_t buffer[1024];
+    for ( int playing = BENCH_ENGINE_STREAMS; playing; )
+    {
+        playing = 0;
+        for ( int i = 0; i < BENCH_ENGINE_STREAMS; i++ )
+        {
+            bool finished = engine.isFinished( i );
+            uint32_t size = engine.read( i, reinterpret_cast<uint8_t *>( buffer ), sizeof(buffer) );
+            for ( uint32_t j = 0; j < size / 4; j++ )
+            {
+                checksums[i] = hashWord( checksums[i], buffer[j] );
+            }
+            result.count += size / 4;
+            if ( size || !finished ) playing++;
+        }
+        if ( !playing ) break;
+        std::this_thread::yield();
+    }
+    engine.stop();
+    for ( uint64_t checksum: checksums )
+    {
+        result.checksum = hashWord( hashWord( result.checksum, checksum ), checksum >> 32 );
+    }
+    return result;
+}
+
+/** Analyzes the track without synthesis, count is analyzed duration in samples */
+static BenchResult analyzeFile(const BenchData &data, uint32_t seconds)
+{
+    VgmFile file;
+    BenchResult result{ 0, BENCH_HASH_SEED };
+    VgmTrackInfo info;
+    if ( !file.open( data.data(), data.size() ) )
+    {
+        return result;
+    }
+    file.setLoopDetection( true );
+    file.setMaxDuration( seconds * 1000 );
+    if ( !file.analyze( 0, info ) )
+    {
+        return result;
+    }
+    result.count = info.totalSamples;
+    const uint32_t words[] = { info.totalSamples, info.loopSamples, info.registerWrites, info.peakWriteRate,
+                               info.chips, info.complete };
+    for ( uint32_t word: words )
+    {
+        result.checksum = hashWord( result.checksum, word );
+    }
+    for ( uint64_t registers: info.registers )
+    {
+        result.checksum = hashWord( hashWord( result.checksum, registers ), registers >> 32 );
+    }
+    return result;
+}
+
+#if VGM_DECODER_AY38910
+static BenchResult benchDecodeAySweep(uint32_t seconds) { return decodeFile( aySweepVgm( seconds ), seconds ); }
+static BenchResult benchDecodeAyEnvelope(uint32_t seconds) { return decodeFile( ayEnvelopeVgm( seconds ), seconds ); }
+static BenchResult benchDecodeAyDense(uint32_t seconds) { return decodeFile( ayDenseVgm( seconds ), seconds ); }
+static BenchResult benchResampleAy48k(uint32_t seconds)
+{
+    return decodeFile( ayDenseVgm( seconds ), seconds, 48000, VGM_RESAMPLER_BEST );
+}
+static BenchResult benchAnalyzeAyDense(uint32_t seconds) { return analyzeFile( ayDenseVgm( seconds ), seconds ); }
+static BenchResult benchEngineAySweep(uint32_t seconds) { return engineFile( aySweepVgm( seconds ), seconds ); }
+static BenchResult benchEngineAyEnvelope(uint32_t seconds) { return engineFile( ayEnvelopeVgm( seconds ), seconds ); }
+static BenchResult benchEngineAyEnvelopeNoLanes(uint32_t seconds)
+{
+    return engineFile( ayEnvelopeVgm( seconds ), seconds, false );
+}
+static BenchResult benchEngineAyDense(uint32_t seconds) { return engineFile( ayDenseVgm( seconds ), seconds ); }
+#endif
+#if VGM_DECODER_NES
+static BenchResult benchDecodeNesDense(uint32_t seconds) { return decodeFile( nesDenseVgm( seconds ), seconds ); }
+static BenchResult benchDecodeNsfPlay(uint32_t seconds) { return decodeFile( playRoutineNsf(), seconds ); }
+static BenchResult benchAnalyzeNsfPlay(uint32_t seconds) { return analyzeFile( playRoutineNsf(), seconds ); }
+static BenchResult benchEngineNsfPlay(uint32_t seconds) { return engineFile( playRoutineNsf(), seconds ); }
+#endif
+
+static const Benchmark s_benchmarks[] =
+{
+#if VGM_DECODER_AY38910
+    { "ay_get_sample", "sample", benchAyGetSample, 0x2771D5D3DB35FF70ULL },
+#endif
+#if VGM_DECODER_NES
+    { "nes_apu_get_sample", "sample", benchNesApuGetSample, 0x5B32E44E050A0AA0ULL },
+    { "nes_cpu_execute", "instruction", benchNesCpuExecute, 0x03C994FCBD1A229FULL },
+#endif
+#if VGM_DECODER_AY38910
+    { "vgm_parse_dense", "sample", benchVgmParse, 0x4ED37E3DA72479D5ULL },
+    { "decode_ay_sweep", "sample", benchDecodeAySweep, 0x22015FE27F8F5A32ULL },
+    { "decode_ay_envelope", "sample", benchDecodeAyEnvelope, 0x616FCF03A30EE72CULL },
+    { "decode_ay_dense", "sample", benchDecodeAyDense, 0x90C0FAB590EED1E5ULL },
+    { "resample_ay_48k", "sample", benchResampleAy48k, 0x64515EB8D97147AAULL },
+    { "analyze_ay_dense", "sample", benchAnalyzeAyDense, 0x23C722D354725B93ULL },
+    { "engine_ay_sweep", "sample", benchEngineAySweep, 0xD92163F5C1BB8A65ULL },
+    { "engine_ay_envelope", "sample", benchEngineAyEnvelope, 0x4385423020D35865ULL },
+    { "engine_ay_env_no_lanes", "sample", benchEngineAyEnvelopeNoLanes, 0x4385423020D35865ULL },
+    { "engine_ay_dense", "sample", benchEngineAyDense, 0xF98E74DB1B6B5045ULL },
+#endif
+#if VGM_DECODER_NES
+    { "decode_nes_dense", "sample", benchDecodeNesDense, 0xB1FE36B90D22E8A4ULL },
+    { "decode_nsf_play", "sample", benchDecodeNsfPlay, 0xB7840CDB71AB08FBULL },
+    { "analyze_nsf_play", "sample", benchAnalyzeNsfPlay, 0xBF8CBE9ACF006AABULL },
+    { "engine_nsf_play", "sample", benchEngineNsfPlay, 0x558665EF293D73C5ULL },
+#endif
+};
+
+int main(int argc, char *argv[])
+{
+    uint32_t seconds = BENCH_DEFAULT_SECONDS;
+    int repeat = 3;
+    const char *jsonName = nullptr;
+    std::vector<const char *> filters;
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( !strcmp( argv[i], "--seconds" ) && i + 1 < argc ) seconds = strtoul( argv[++i], nullptr, 10 );
+        else if ( !strcmp( argv[i], "--repeat" ) && i + 1 < argc ) repeat = strtoul( argv[++i], nullptr, 10 );
+        else if ( !strcmp( argv[i], "--json" ) && i + 1 < argc ) jsonName = argv[++i];
+        else if ( argv[i][0] == '-' )
+        {
+            fprintf( stderr, "Measures performance of chips and decoders on synthetic data\n" );
+            fprintf( stderr, "Usage: vgm_bench [--seconds N] [--repeat N] [--json file] [name_filter ...]\n" );
+            return -1;
+        }
+        else filters.push_back( argv[i] );
+    }
+    if ( !seconds ) seconds = 1;
+    if ( repeat < 1 ) repeat = 1;
+    FILE *json = nullptr;
+    if ( jsonName )
+    {
+        json = fopen( jsonName, "w" );
+        if ( json == nullptr )
+        {
+            fprintf( stderr, "Failed to open file %s \n", jsonName );
+            return -1;
+        }
+        fprintf( json, "{\n  \"seconds\": %u,\n  \"repeat\": %d,\n  \"compact\": %d,\n  \"results\": [",
+                 seconds, repeat, VGM_DECODER_COMPACT );
+    }
+    printf( "%-20s %12s %10s %14s %10s %10s %16s %s\n", "benchmark", "count", "time,s", "per second",
+            "realtime", "ns/unit", "checksum", "status" );
+    int changed = 0;
+    int done = 0;
+    for ( const Benchmark &bench: s_benchmarks )
+    {
+        bool selected = filters.empty();
+        for ( const char *filter: filters ) selected = selected || strstr( bench.name, filter );
+        if ( !selected )
+        {
+            continue;
+        }
+        // The best of several runs is reported, every run must produce the same data
+        double best = 0;
+        BenchResult result{};
+        bool stable = true;
+        for ( int i = 0; i < repeat; i++ )
+        {
+            auto start = std::chrono::steady_clock::now();
+            BenchResult run = bench.run( seconds );
+            double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+            if ( i && run.checksum != result.checksum ) stable = false;
+            if ( !i || elapsed < best ) best = elapsed;
+            result = run;
+        }
+        if ( best <= 0 ) best = 1e-9;
+        double perSecond = result.count / best;
+        double nsPerUnit = result.count ? best * 1e9 / result.count : 0;
+        // Realtime factor is defined for audio benchmarks only
+        double realtime = !strcmp( bench.unit, "sample" ) ? perSecond / BENCH_SAMPLE_RATE : 0;
+        const char *status = "ok";
+        if ( !stable ) status = "UNSTABLE";
+        else if ( seconds != BENCH_DEFAULT_SECONDS || !bench.reference ) status = "unchecked";
+        else if ( result.checksum != bench.reference ) status = "CHANGED";
+        if ( strcmp( status, "ok" ) && strcmp( status, "unchecked" ) ) changed++;
+        printf( "%-20s %12llu %10.3f %14.0f %10.1f %10.2f %016llX %s\n", bench.name,
+                static_cast<unsigned long long>( result.count ), best, perSecond, realtime, nsPerUnit,
+                static_cast<unsigned long long>( result.checksum ), status );
+        if ( json )
+        {
+            fprintf( json, "%s\n    { \"name\": \"%s\", \"unit\": \"%s\", \"count\": %llu, \"seconds\": %.6f, "
+                     "\"per_second\": %.1f, \"realtime\": %.2f, \"ns_per_unit\": %.3f, "
+                     "\"checksum\": \"%016llX\", \"status\": \"%s\" }",
+                     done ? "," : "", bench.name, bench.unit, static_cast<unsigned long long>( result.count ),
+                     best, perSecond, realtime, nsPerUnit, static_cast<unsigned long long>( result.checksum ),
+                     status );
+        }
+        done++;
+    }
+    if ( json )
+    {
+        fprintf( json, "\n  ]\n}\n" );
+        fclose( json );
+    }
+    if ( changed )
+    {
+        fprintf( stderr, "Warning. %d benchmarks produced unexpected output\n", changed );
+    }
+    return changed ? 1 : 0;
+}
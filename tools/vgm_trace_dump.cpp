@@ -0,0 +1,65 @@
+/*
+MIT License
+
+Copyright (c) 2021 Aleksei Dynda
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "vgm_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[])
+{
+    if ( argc < 2 )
+    {
+        fprintf(stderr, "Prints binary trace, written by vgm2wav --trace\n");
+        fprintf(stderr, "Usage: vgmtrace trace_file\n");
+        return -1;
+    }
+    FILE *fileptr = fopen(argv[1], "rb");
+    if ( fileptr == nullptr )
+    {
+        fprintf( stderr, "Failed to open file %s \n", argv[1] );
+        return -1;
+    }
+    VgmTraceFileHeader header{};
+    if ( fread( &header, sizeof(header), 1, fileptr ) != 1 ||
+         header.ident != VGM_TRACE_FILE_IDENT || header.recordSize != sizeof(VgmTraceRecord) )
+    {
+        fprintf( stderr, "Invalid trace file %s \n", argv[1] );
+        fclose( fileptr );
+        return -1;
+    }
+    VgmTraceRecord records[256];
+    char text[128];
+    size_t count;
+    while ( (count = fread( records, sizeof(VgmTraceRecord), 256, fileptr )) > 0 )
+    {
+        for ( size_t i = 0; i < count; i++ )
+        {
+            VgmTraceBuffer::format( records[i], text, sizeof(text) );
+            fputs( text, stdout );
+        }
+    }
+    fclose( fileptr );
+    return 0;
+}